@@ -8,6 +8,7 @@
 #define MPU9250_GYRO_OUT              0x43
 #define MPU9250_TEMP_OUT              0x41
 #define MPU9250_EXT_SENS_DATA_00      0x49
+#define MPU9250_EXT_SENS_DATA_LAST    0x60
 #define MPU9250_ACCEL_CONFIG 	      0x1C
 #define MPU9250_ACCEL_FS_SEL_2G       0x00
 #define MPU9250_ACCEL_FS_SEL_4G       0x08
@@ -26,7 +27,9 @@
 #define MPU9250_ACCEL_DLPF_20         0x04
 #define MPU9250_ACCEL_DLPF_10         0x05
 #define MPU9250_ACCEL_DLPF_5          0x06
+#define MPU9250_ACCEL_FCHOICE_B       0x08  // Bypasses the accel DLPF, 1.13 kHz internal rate
 #define MPU9250_CONFIG                0x1A
+#define MPU9250_CONFIG_FIFO_MODE      0x40
 #define MPU9250_GYRO_DLPF_184         0x01
 #define MPU9250_GYRO_DLPF_92          0x02
 #define MPU9250_GYRO_DLPF_41          0x03
@@ -40,15 +43,24 @@
 #define MPU9250_INT_PULSE_50US        0x00
 #define MPU9250_INT_WOM_EN            0x40
 #define MPU9250_INT_RAW_RDY_EN        0x01
+#define MPU9250_INT_STATUS            0x3A
+#define MPU9250_INT_FIFO_OFLOW        0x10
+#define MPU9250_INT_WOM               0x40  // INT_STATUS: accel moved more than WOM_THR on some axis
+#define MPU9250_INT_RAW_RDY           0x01  // INT_STATUS: new sample in the output registers
 #define MPU9250_PWR_MGMNT_1           0x6B
+#define MPU9250_PWR_SLEEP             0x40
 #define MPU9250_PWR_CYCLE             0x20
 #define MPU9250_PWR_RESET             0x80
 #define MPU9250_CLOCK_SEL_PLL         0x01
 #define MPU9250_PWR_MGMNT_2           0x6C
 #define MPU9250_SEN_ENABLE            0x00
+#define MPU9250_DIS_ACCEL             0x38
 #define MPU9250_DIS_GYRO              0x07
 #define MPU9250_USER_CTRL             0x6A
 #define MPU9250_I2C_MST_EN            0x20
+#define MPU9250_USER_FIFO_EN          0x40
+#define MPU9250_USER_FIFO_RST         0x04
+#define MPU9250_I2C_IF_DIS            0x10  // SPI only, keeps the I2C slave interface disabled
 #define MPU9250_I2C_MST_CLK           0x0D
 #define MPU9250_I2C_MST_CTRL          0x24
 #define MPU9250_I2C_SLV0_ADDR         0x25
@@ -60,20 +72,35 @@
 #define MPU9250_MOT_DETECT_CTRL       0x69
 #define MPU9250_ACCEL_INTEL_EN        0x80
 #define MPU9250_ACCEL_INTEL_MODE      0x40
-#define MPU9250_LP_ACCEL_ODR          0x1E
-#define MPU9250_WOM_THR               0x1F
+#define MPU9250_LP_ACCEL_ODR          0x1E  // Wake-up rate in cycle mode, 0 (0.24 Hz) to 11 (500 Hz)
+#define MPU9250_WOM_THR               0x1F  // Wake-on-motion threshold, 4 mg / LSB
 #define MPU9250_WHO_AM_I              0x75
+#define MPU9250_XG_OFFSET_H           0x13  // X, Y and Z gyro offsets, big-endian
+#define MPU9250_XA_OFFSET_H           0x77  // Accel offsets, big-endian, one register apart
+#define MPU9250_YA_OFFSET_H           0x7A
+#define MPU9250_ZA_OFFSET_H           0x7D
+#define MPU9250_ACCEL_OFFSET_RESERVED 0x01  // Bit 0 of the accel offsets, must be preserved
 #define MPU9250_FIFO_EN               0x23
 #define MPU9250_FIFO_TEMP             0x80
 #define MPU9250_FIFO_GYRO             0x70
+#define MPU9250_FIFO_GYRO_X           0x40
+#define MPU9250_FIFO_GYRO_Y           0x20
+#define MPU9250_FIFO_GYRO_Z           0x10
 #define MPU9250_FIFO_ACCEL            0x08
 #define MPU9250_FIFO_MAG              0x01
 #define MPU9250_FIFO_COUNT            0x72
 #define MPU9250_FIFO_READ             0x74
+#define MPU9250_FIFO_COUNT_MASK       0x1FFF
+#define MPU9250_FIFO_SIZE             512   // Bytes of on-chip FIFO
+#define MPU9250_FIFO_FRAME_SIZE       14    // Accel (6) + temp (2) + gyro (6) bytes per FIFO frame
+#define MPU9250_FIFO_MAG_SIZE         7     // Magnetometer (6) + AK8963 ST2 (1) bytes appended by SLV0
 
 /* AK8963 registers */
 #define MPU9250_AK8963_I2C_ADDR       0x0C
+#define MPU9250_AK8963_ST1            0x02
+#define MPU9250_AK8963_ST1_DRDY       0x01  // Measurement ready
 #define MPU9250_AK8963_HXL            0x03
+#define MPU9250_AK8963_ST2            0x09
 #define MPU9250_AK8963_CNTL1          0x0A
 #define MPU9250_AK8963_PWR_DOWN       0x00
 #define MPU9250_AK8963_CNT_MEAS1      0x12
@@ -83,8 +110,15 @@
 #define MPU9250_AK8963_RESET          0x01
 #define MPU9250_AK8963_ASA            0x10
 #define MPU9250_AK8963_WHO_AM_I       0x00
+#define MPU9250_AK8963_ID             0x48
+#define MPU9250_AK8963_ST2_HOFL       0x08  // Magnetic sensor overflow
+#define MPU9250_AK8963_ST2_BITM       0x10  // 16 bit output
 
 /* I2C baudrate */
 #define MPU9250_I2C_RATE              400000 // 400 kHz
 
+/* SPI clocks, every register at 1 MHz, the sensor, interrupt and FIFO registers read at up to 20 MHz */
+#define MPU9250_SPI_RATE              1000000  // 1 MHz
+#define MPU9250_SPI_READ_RATE         20000000 // 20 MHz
+
 #endif  
\ No newline at end of file
@@ -0,0 +1,4060 @@
+#include <linux/init.h>                 // Macros used to mark up functions e.g. __init __exit
+#include <linux/module.h>               // Core header for loading LKMs into the kernel
+#include <linux/device.h>               // Header to support the kernel Driver Model
+#include <linux/kernel.h>               // Contains types, macros, functions for the kernel
+#include <linux/fs.h>                   // Header for the Linux file system support
+#include <linux/cdev.h>                 // One character device per sensor
+#include <linux/idr.h>                  // Instance numbers of the sensors
+#include <linux/of.h>                   // Instance numbers fixed by device tree aliases
+#include <linux/list.h>                 // List of probed sensors for grouped reads
+#include <linux/kref.h>                 // Open files keep the state of a removed sensor
+#include <linux/rwsem.h>                // File operations in progress hold off remove
+#include <linux/uaccess.h>              // Required for the copy to user function+
+#include <linux/regmap.h>               // Cached register map of the sensor configuration
+#include <linux/mutex.h>                // Serializes bus and per file accesses
+#include <linux/workqueue.h>            // Deferred work that drains the hardware FIFO
+#include <linux/interrupt.h>            // Data-ready threaded interrupt
+#include <linux/wait.h>                 // Wait queue for blocking reads
+#include <linux/poll.h>                 // Required for the poll file operation
+#include <linux/mm.h>                   // Required for the mmap file operation
+#include <linux/ktime.h>                // Sample timestamps
+#include <linux/math64.h>               // 64 bit divisions for the timestamp interpolation
+#include <linux/atomic.h>               // Interrupt timestamp shared with the drain path
+#include <linux/vmalloc.h>              // Memory of the shared sample ring
+#include <linux/slab.h>                 // Per open file context allocation
+#include <linux/delay.h>                // Waits for the auxiliary I2C master transfers
+#include <linux/iio/iio.h>              // IIO front-end
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include <linux/percpu.h>               // Statistics counters, one copy per CPU
+#include <linux/pm_runtime.h>           // The sensor sleeps while nobody uses it
+#include <linux/version.h>              // class_create() and vm_flags changed in 6.3 and 6.4
+#include "myMPU9250.h"                  // Required to initialize hardware sensor MPU9250
+#include "myMPU9250_uapi.h"             // Types shared with user space
+#include "myMPU9250_core.h"             // Interface with the I2C and SPI transports
+
+#define CREATE_TRACE_POINTS
+#include "myMPU9250_trace.h"            // Tracepoints of the acquisition path
+
+#define  DEVICE_NAME "i2cMPU9250"       ///< Sensor N will appear at /dev/i2cMPU9250-N using this value
+#define  CLASS_NAME  "i2c"              ///< The device class -- this is a character device driver
+#define  ALIAS_STEM  "imu"              ///< Device tree alias imuN = &sensor fixes N of that sensor
+
+#define MESSAGE_SIZE_MAX    256         ///< Kernel buffer size max
+#define MIN(a,b) ((a < b) ? (a) : (b))  ///< Macro to get the minimum between two numbers
+#define REGISTER_MAX        0x7F        ///< Highest MPU9250 register address
+#define XFER_BUCKETS        12          ///< Bus read time histogram, bucket i > 0 holds [2^(12+i), 2^(13+i)) ns
+#define RESUME_POLLS        100         ///< Data-ready checks after a wake-up, at least 50 ms
+#define MPU9250_MINORS      MPU9250_GROUP_MAX ///< Sensors handled by the driver
+#define FILTER_CHANNELS     10          ///< Channels of a record filtered by the decimator: accel, gyro, mag and temp
+#define FILTER_CHUNK        32          ///< Records converted per pass of the decimator
+
+MODULE_LICENSE("GPL");                                            ///< The license type -- this affects available functionality
+MODULE_AUTHOR("Rodrigo A. Tirapegui");                            ///< The author -- visible when you use modinfo
+MODULE_DESCRIPTION("Linux char driver for the BBB and MPU9250");  ///< The description -- see modinfo
+MODULE_VERSION("0.1");                                            ///< A version number to inform users
+
+/* Statistics counters, one copy per CPU so the acquisition path shares no cache line
+ * and takes no lock. Readers sum every copy, a sum is not a snapshot across fields.
+ */
+typedef struct
+{
+   u64                      samples;                              ///< Frames drained from the hardware FIFO
+   u64                      bytes;                                ///< Bytes returned to readers by read() and batch reads
+   u64                      busTransfers;                         ///< Sensor reads issued on the bus
+   u64                      busBytes;                             ///< Bytes returned by those reads
+   u64                      busErrors;                            ///< Sensor reads that failed
+   u64                      fifoOverflows;                        ///< Times the hardware FIFO overflowed and was reset
+   u64                      overruns;                             ///< Records lost by slow readers, every reader added
+   u64                      irqs;                                 ///< Data-ready interrupts
+   u64                      motionEvents;                         ///< Wake-on-motion events
+   u64                      resumes;                              ///< Wake-ups from runtime or system suspend that reached their first sample
+   u64                      resumeSyncs;                          ///< Of those, wake-ups that rewrote every cached register
+   u64                      resumeTime;                           ///< Time from the start of those wake-ups to their first sample [ns]
+   u64                      xferTime[XFER_BUCKETS];               ///< Sensor reads by bus time
+
+} MPU9250_Counters_t;
+
+/* One probed sensor. Every sensor has its own locks, works, interrupt and ring, so sensors
+ * on different I2C or SPI controllers are sampled in parallel and only share the bus with
+ * the sensors on the same controller.
+ */
+typedef struct
+{
+   struct device *          dev;                                  ///< Device of the sensor on its bus, I2C client or SPI device
+   const MPU9250_Bus_t *    bus;                                  ///< Transport of that bus
+   void *                   busContext;                           ///< Passed to the transport read
+   struct regmap *          regmap;                               ///< Cached register map, configuration writes go through it
+   int                      index;                                ///< Instance number, the sensor appears at /dev/i2cMPU9250-<index>
+   struct cdev *            cdev;                                 ///< Character device of the sensor, it may outlive this state
+   struct device *          charDevice;                           ///< The device-driver device struct pointer
+   struct list_head         node;                                 ///< Entry in the list of probed sensors
+   atomic_t                 numberOpens;                          ///< Counts the number of times the device is opened
+   struct kref              ref;                                  ///< Held by probe until the sensor is unbound and by every open file
+   struct rw_semaphore      removeLock;                           ///< Read by the file operations, written by remove
+   bool                     gone;                                 ///< The sensor was removed, its open files fail with -ENODEV
+
+   struct mutex             busLock;                              ///< Serializes multi-transaction accesses to the sensor
+   struct delayed_work      drainWork;                            ///< Periodic work that drains the hardware FIFO
+   unsigned char            drainBuffer[MPU9250_FIFO_SIZE];       ///< Bounce buffer for FIFO burst reads
+   MPU9250_Counters_t __percpu * counters;                        ///< Statistics counters
+   wait_queue_head_t        readQueue;                            ///< Readers sleeping until data is available
+   int                      irq;                                  ///< Data-ready interrupt line, 0 when polling
+   unsigned int             irqCount;                             ///< Data-ready interrupts since the last FIFO drain
+   unsigned long            readySeq;                             ///< Data-ready events seen in register mode
+   atomic64_t               irqTimestamp;                         ///< Time of the last data-ready interrupt [ns]
+   s64                      batchEnd;                             ///< Time of the last drained frame [ns], 0 after a FIFO reset
+   s64                      samplePeriod;                         ///< Estimated sample period [ns], tracks the sensor clock drift
+   MPU9250_Ring_t *         ring;                                 ///< Shared sample ring header, mapped by user space
+   MPU9250_Sample_t *       ringRecords;                          ///< First record of the shared sample ring
+   bool                     magPresent;                           ///< AK8963 is auto-read through SLV0 into EXT_SENS_DATA
+   u8                       fifoEnable;                           ///< Channels written to the hardware FIFO in streaming mode
+   unsigned int             frameSize;                            ///< Bytes per FIFO frame of those channels
+   int                      magScaleNano[3];                      ///< Magnetometer gauss / LSB with the fuse ROM adjustment
+   u32                      accelGainMicro[3];                    ///< Accel scale factors stored for the clients
+
+   struct mutex             womLock;                              ///< Serializes wake-on-motion transitions and sampling configuration changes
+   struct delayed_work      womWork;                              ///< Polls for motion when there is no interrupt line
+   MPU9250_Wom_t            wom;                                  ///< Wake-on-motion settings, enable is set while the sensor is in that mode
+   bool                     womResume;                            ///< A system suspend left wake-on-motion, resume enters it again
+   unsigned int             womAccelConfig2;                      ///< ACCEL_CONFIG2 of full rate sampling, restored on wake-up
+   unsigned long            motionSeq;                            ///< Motion events since probe
+   s64                      motionTimestamp;                      ///< Time of the last motion event [ns]
+   bool                     motionAwake;                          ///< The last motion event restored full rate sampling
+   u64                      resumeStart;                          ///< Start of the last wake-up until its first frame is drained [ns], 0 once measured
+   bool                     resumeSynced;                         ///< The last wake-up rewrote every cached register
+   u64                      probeTime;                            ///< Time from the start of probe to the sensor ready [ns]
+
+   struct work_struct       groupWork;                            ///< Register mode sample of a grouped read
+   MPU9250_Sample_t         groupSample;                          ///< Sample taken by that work
+   int                      groupRv;                              ///< Result of that work
+
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+   struct iio_dev *         iioDev;                               ///< IIO front-end device
+   struct iio_trigger *     iioTrigger;                           ///< IIO data-ready trigger
+   bool                     iioTriggerOn;                         ///< The data-ready trigger is in use
+#endif
+
+} MPU9250_Dev_t;
+
+/* Decimation stage of a reader, see MPU9250_IOC_SET_FILTER. It is allocated on first
+ * use and kept until the file is closed, so poll() can look at it without the file lock.
+ */
+typedef struct
+{
+   MPU9250_Filter_t         filter;                               ///< Settings, type MPU9250_FILTER_NONE when off
+   unsigned int             countdown;                            ///< Input records until the next output record
+   unsigned int             newest;                               ///< History slot of the newest input record
+   s32                      sum[FILTER_CHANNELS];                 ///< Box accumulators of the current block
+   s64                      blockStart;                           ///< Timestamp of the first record of the current block [ns]
+   u16                      flags;                                ///< Flags of the records of the current block
+   s16                      history[MPU9250_FILTER_TAPS_MAX][FILTER_CHANNELS]; ///< Last input records of the FIR
+   s64                      historyTime[MPU9250_FILTER_TAPS_MAX]; ///< Their timestamps [ns]
+   u16                      historyFlags[MPU9250_FILTER_TAPS_MAX]; ///< Their flags
+   MPU9250_Sample_t         input[FILTER_CHUNK];                  ///< Ring records of one pass
+   MPU9250_Sample_t         output[FILTER_CHUNK];                 ///< Filtered records of one read() pass
+
+} MPU9250_Decimator_t;
+
+/* Per open file context, every reader has its own cursor on the shared sample ring */
+typedef struct
+{
+   struct mutex             lock;                                 ///< Serializes calls on the same open file
+   char                     message[MESSAGE_SIZE_MAX] __aligned(8); ///< Memory for the data that is passed from/to userspace
+   u32                      cursor;                               ///< Next shared ring record to read in streaming mode
+   unsigned long            overruns;                             ///< Records lost because this reader was too slow
+   unsigned long            reportedOverruns;                     ///< Overruns already reported by a batch read
+   unsigned long            consumedSeq;                          ///< Data-ready events already read in register mode
+   bool                     mapped;                               ///< The shared sample ring is mapped by this file
+   unsigned long            motionSeen;                           ///< Motion events already read
+   MPU9250_Decimator_t *    decimator;                            ///< Decimation stage, NULL until MPU9250_IOC_SET_FILTER
+   MPU9250_Dev_t *          mpu;                                  ///< The sensor this file was opened on
+
+} MPU9250_File_t;
+
+static dev_t                g_devt;                               ///< First device number, the major is determined automatically
+static struct class *       g_MPU9250charClass  = NULL;           ///< The device-driver class struct pointer
+static DEFINE_IDR(g_minors);                                      ///< Sensors by instance number
+static DEFINE_MUTEX(g_minorsLock);                                ///< Protects g_minors
+static LIST_HEAD(g_devices);                                      ///< Probed sensors, in probe order
+static DEFINE_MUTEX(g_devicesLock);                               ///< Protects g_devices and serializes grouped reads
+
+static bool streaming = false;                                    ///< Hardware FIFO streaming mode
+module_param(streaming, bool, 0444);
+MODULE_PARM_DESC(streaming, "Stream samples through the hardware FIFO (default: false)");
+
+static unsigned int fifo_poll_ms = 10;                            ///< Hardware FIFO drain period
+module_param(fifo_poll_ms, uint, 0444);
+MODULE_PARM_DESC(fifo_poll_ms, "Hardware FIFO drain period in milliseconds (default: 10)");
+
+static unsigned int ring_frames = 1024;                           ///< Shared sample ring capacity
+module_param(ring_frames, uint, 0444);
+MODULE_PARM_DESC(ring_frames, "Shared sample ring capacity in frames, rounded up to a power of two (default: 1024)");
+
+static bool verify_writes = false;                                ///< Read back every configuration write
+module_param(verify_writes, bool, 0644);
+MODULE_PARM_DESC(verify_writes, "Read back and check every configuration register write (default: false)");
+
+static unsigned int timestamp_clock = CLOCK_MONOTONIC;            ///< Clock used for sample timestamps
+module_param(timestamp_clock, uint, 0444);
+MODULE_PARM_DESC(timestamp_clock, "Sample timestamp clock, CLOCK_MONOTONIC (1) or CLOCK_BOOTTIME (7) (default: 1)");
+
+static unsigned int wom_poll_ms = 100;                            ///< INT_STATUS polling period in wake-on-motion mode
+module_param(wom_poll_ms, uint, 0644);
+MODULE_PARM_DESC(wom_poll_ms, "Motion check period in milliseconds in wake-on-motion mode without interrupt (default: 100)");
+
+static int autosuspend_ms = 2000;                                 ///< Idle time before the sensor sleeps
+module_param(autosuspend_ms, int, 0444);
+MODULE_PARM_DESC(autosuspend_ms, "Time in milliseconds without open files before the sensor sleeps, -1 never (default: 2000)");
+
+static unsigned int irq_batch = 8;                                ///< Data-ready interrupts per FIFO drain
+module_param(irq_batch, uint, 0444);
+MODULE_PARM_DESC(irq_batch, "Data-ready interrupts per hardware FIFO drain in streaming mode (default: 8)");
+
+static bool magnetometer = true;                                  ///< Read the AK8963 through the auxiliary I2C master
+module_param(magnetometer, bool, 0444);
+MODULE_PARM_DESC(magnetometer, "Read the AK8963 magnetometer into every frame (default: true)");
+
+static char *calib[MPU9250_MINORS];                               ///< Persisted calibration of each sensor
+static int calib_count = 0;
+module_param_array(calib, charp, &calib_count, 0444);
+MODULE_PARM_DESC(calib, "Calibration of each sensor written at probe, the name of its I2C client or SPI device (e.g. 2-0068) "
+                        "then the gyro offsets x:y:z in 1000 dps counts, accel offsets x:y:z in 16 g counts and accel scale "
+                        "factors x:y:z in 1e-6 units, all separated by ':' (default: kept)");
+
+static const MPU9250_Config_t g_defaultConfig =                   ///< Sampling configuration set at probe
+{
+    .odrHz = 1000,
+    .accelRangeG = 16,
+    .gyroRangeDps = 2000,
+    .accelBandwidthHz = 184,
+    .gyroBandwidthHz = 184,
+};
+
+/* The same compatible binds under an I2C or an SPI controller node */
+const struct of_device_id g_mpu9250OfMatch[] = 
+{
+    { .compatible = "mse,myMPU9250" },
+    { }
+};
+
+MODULE_DEVICE_TABLE(of, g_mpu9250OfMatch);
+
+// The prototype functions for the character driver -- must come before the struct definition
+static int     dev_open(struct inode *, struct file *);
+static int     dev_release(struct inode *, struct file *);
+static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
+static ssize_t dev_write(struct file *, const char *, size_t, loff_t *);
+static __poll_t dev_poll(struct file *, poll_table *);
+static int     dev_mmap(struct file *, struct vm_area_struct *);
+static long    dev_ioctl(struct file *, unsigned int, unsigned long);
+static long    mpu9250Ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
+
+// The prototype functions for the MPU9250 register access and FIFO streaming
+static int     mpu9250ReadRegister(MPU9250_Dev_t *mpu, u8 subAddress, u8 *rxBuff, u16 count);
+static ssize_t mpu9250RegisterRead(struct file *filep, char __user *buffer, size_t len, loff_t *offset);
+static void    mpu9250CountersSum(MPU9250_Dev_t *mpu, MPU9250_Counters_t *sum);
+static void    mpu9250ResumeDone(MPU9250_Dev_t *mpu, u64 start, bool synced);
+static s64     mpu9250NominalPeriod(MPU9250_Dev_t *mpu);
+static ssize_t mpu9250StreamRead(struct file *filep, char __user *buffer, size_t len);
+static bool    mpu9250DataAvailable(MPU9250_File_t *ctx);
+static int     mpu9250GetConfig(MPU9250_Dev_t *mpu, MPU9250_Config_t *config);
+static int     mpu9250SetConfig(MPU9250_Dev_t *mpu, const MPU9250_Config_t *config);
+static int     mpu9250GetScale(MPU9250_Dev_t *mpu, MPU9250_Scale_t *scale);
+static void    mpu9250GetLayout(MPU9250_Dev_t *mpu, MPU9250_Layout_t *layout);
+static int     mpu9250SetLayout(MPU9250_Dev_t *mpu, const MPU9250_Layout_t *layout);
+static int     mpu9250GetCalib(MPU9250_Dev_t *mpu, MPU9250_Calib_t *calib);
+static int     mpu9250SetCalib(MPU9250_Dev_t *mpu, const MPU9250_Calib_t *calib);
+static long    mpu9250BatchRead(struct file *filep, MPU9250_Batch_t __user *argp);
+static int     mpu9250SetWom(MPU9250_Dev_t *mpu, const MPU9250_Wom_t *wom);
+static bool    mpu9250EventAvailable(MPU9250_File_t *ctx);
+static long    mpu9250ReadEvent(struct file *filep, MPU9250_Event_t __user *argp);
+static long    mpu9250GroupRead(MPU9250_Group_t __user *argp);
+static int     mpu9250GetFilter(MPU9250_File_t *ctx, MPU9250_Filter_t *filter);
+static int     mpu9250SetFilter(MPU9250_File_t *ctx, const MPU9250_Filter_t *filter);
+static int     mpu9250SetTail(MPU9250_File_t *ctx, u32 tail);
+static void    mpu9250IioTriggerPoll(MPU9250_Dev_t *mpu);
+
+/** @brief Devices are represented as file structure in the kernel. 
+ *  The file_operations structure from /linux/fs.h lists the callback functions that 
+ *  you wish to associated with your file operations using a C99 syntax structure. 
+ *  Char devices usually implement open, read, write and release calls
+ */
+static struct file_operations fops =
+{
+   .owner = THIS_MODULE,
+   .llseek = default_llseek,
+   .open = dev_open,
+   .read = dev_read,
+   .write = dev_write,
+   .poll = dev_poll,
+   .mmap = dev_mmap,
+   .unlocked_ioctl = dev_ioctl,
+   .release = dev_release,
+};
+
+/** @brief The LKM initialization function
+ *  The static keyword restricts the visibility of the function to within this C file. 
+ *  The __init macro means that for a built-in driver (not a LKM) the function is only 
+ *  used at initialization time and that it can be discarded and its memory freed up 
+ *  after that point. Device numbers and the class are shared by every sensor, each
+ *  probed sensor then adds its own character device, see mpu9250CharStart().
+ *  @return returns 0 if successful
+ */
+static int __init i2cMPU9250char_init(void)
+{
+   int rv;
+
+   pr_info(KERN_INFO "From Char Init: Initializing the i2cMPU9250Char LKM\n");
+
+   /* Try to dynamically allocate a major number for the devices -- more difficult but worth it */
+   rv = alloc_chrdev_region(&g_devt, 0, MPU9250_MINORS, DEVICE_NAME);
+   
+   if (rv < 0)
+   {
+      pr_info(KERN_ALERT "From Char Init: Failed to register a major number\n");
+      return rv;
+   }
+
+   pr_info(KERN_INFO "From Char Init: Registered correctly with major number %d\n", MAJOR(g_devt));
+
+   // Register the device class
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+   g_MPU9250charClass = class_create(CLASS_NAME);
+#else
+   g_MPU9250charClass = class_create(THIS_MODULE, CLASS_NAME);
+#endif
+
+   if (IS_ERR(g_MPU9250charClass))
+   {  // Check for error and clean up if there is
+      unregister_chrdev_region(g_devt, MPU9250_MINORS);
+      pr_info(KERN_ALERT "From Char Init: Failed to register device class\n");
+      
+      /* Correct way to return an error on a pointer */
+      return PTR_ERR(g_MPU9250charClass);                    
+   }
+
+   pr_info(KERN_INFO "From Char Init: Device class registered correctly\n");
+
+   /* Every sensor in the device tree is probed from here, on either bus */
+   rv = mpu9250I2cRegister();
+
+   if (0 != rv)
+   {
+      pr_info(KERN_ALERT "From Char Init: Failed to register the I2C driver\n");
+      goto err_class;
+   }
+
+   rv = mpu9250SpiRegister();
+
+   if (0 != rv)
+   {
+      pr_info(KERN_ALERT "From Char Init: Failed to register the SPI driver\n");
+      goto err_i2c;
+   }
+
+   return 0;
+
+err_i2c:
+   mpu9250I2cUnregister();
+err_class:
+   class_destroy(g_MPU9250charClass);
+   unregister_chrdev_region(g_devt, MPU9250_MINORS);
+
+   return rv;
+}
+
+/** @brief The LKM cleanup function
+ *  Similar to the initialization function, it is static. 
+ *  The __exit macro notifies that if this code is used for a built-in driver 
+ *  (not a LKM) that this function is not required.
+ */
+static void __exit i2cMPU9250char_exit(void)
+{
+   /* Remove every sensor */
+   mpu9250SpiUnregister();
+   mpu9250I2cUnregister();
+
+   /* Remove the device class */ 
+   class_destroy(g_MPU9250charClass);                             
+   
+   /* Unregister the major number */
+   unregister_chrdev_region(g_devt, MPU9250_MINORS);             
+   
+   pr_info(KERN_INFO "From Char Exit: Goodbye from the LKM!\n");
+}
+
+/** @brief Frees the sensor state once probe and the last open file let it go */
+static void mpu9250Free(struct kref *ref)
+{
+   MPU9250_Dev_t *mpu = container_of(ref, MPU9250_Dev_t, ref);
+
+   free_percpu(mpu->counters);
+   kfree(mpu);
+}
+static void mpu9250Put(void *data)
+{
+   MPU9250_Dev_t *mpu = data;
+
+   kref_put(&mpu->ref, mpu9250Free);
+}
+
+/** @brief Starts a file operation, fails once the sensor is removed
+ *  The sensor stays bound until mpu9250FileEnd, remove waits for the operations in progress.
+ *  @param mpu The sensor of the open file
+ *  @return 0 on success or -ENODEV
+ */
+static int mpu9250FileBegin(MPU9250_Dev_t *mpu)
+{
+   down_read(&mpu->removeLock);
+
+   if (mpu->gone)
+   {
+      up_read(&mpu->removeLock);
+      return -ENODEV;
+   }
+
+   return 0;
+}
+static void mpu9250FileEnd(MPU9250_Dev_t *mpu)
+{
+   up_read(&mpu->removeLock);
+}
+
+/** @brief Creates the character device of one sensor, /dev/i2cMPU9250-<index>
+ *  Sensors are probed asynchronously, in no fixed order. A sensor with a device tree
+ *  alias imuN always gets instance N, the others get the lowest number above every alias,
+ *  which is only stable when there is a single one of them.
+ *  @param mpu The sensor
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250CharStart(MPU9250_Dev_t *mpu)
+{
+   int alias = of_alias_get_id(mpu->dev->of_node, ALIAS_STEM);
+   dev_t devt;
+   int rv;
+
+   mutex_lock(&g_minorsLock);
+
+   mpu->index = -ENOSPC;
+
+   if ((0 <= alias) && (MPU9250_MINORS > alias))
+   {
+      mpu->index = idr_alloc(&g_minors, mpu, alias, alias + 1, GFP_KERNEL);
+
+      if (0 > mpu->index)
+         dev_warn(mpu->dev, "From Probe: Instance number %d of alias %s%d is taken.\n", alias, ALIAS_STEM, alias);
+   }
+
+   if (0 > mpu->index)
+      mpu->index = idr_alloc(&g_minors, mpu, max(of_alias_get_highest_id(ALIAS_STEM) + 1, 0), MPU9250_MINORS, GFP_KERNEL);
+
+   mutex_unlock(&g_minorsLock);
+
+   if (0 > mpu->index)
+      return mpu->index;
+
+   devt = MKDEV(MAJOR(g_devt), mpu->index);
+
+   /* Allocated on its own, the files still open release it after the sensor state */
+   mpu->cdev = cdev_alloc();
+
+   if (NULL == mpu->cdev)
+   {
+      rv = -ENOMEM;
+      goto err_minor;
+   }
+
+   mpu->cdev->ops = &fops;
+   mpu->cdev->owner = THIS_MODULE;
+
+   rv = cdev_add(mpu->cdev, devt, 1);
+
+   if (0 != rv)
+      goto err_cdev;
+
+   /* Register the device driver, under the bus device so udev sees the bus and address */
+   mpu->charDevice = device_create(g_MPU9250charClass, mpu->dev, devt, mpu, DEVICE_NAME "-%d", mpu->index);
+   
+   if (IS_ERR(mpu->charDevice))
+   {
+      rv = PTR_ERR(mpu->charDevice);
+      goto err_cdev;
+   }
+
+   return 0;
+
+err_cdev:
+   cdev_del(mpu->cdev);
+err_minor:
+   mutex_lock(&g_minorsLock);
+   idr_remove(&g_minors, mpu->index);
+   mutex_unlock(&g_minorsLock);
+
+   return rv;
+}
+static void mpu9250CharStop(MPU9250_Dev_t *mpu)
+{
+   device_destroy(g_MPU9250charClass, MKDEV(MAJOR(g_devt), mpu->index));
+   cdev_del(mpu->cdev);
+
+   /* Opens still in progress find nothing from here on */
+   mutex_lock(&g_minorsLock);
+   idr_remove(&g_minors, mpu->index);
+   mutex_unlock(&g_minorsLock);
+}
+
+/** @brief The device open function that is called each time the device is opened
+ *  A sleeping sensor is woken up first, so the first read already returns a new sample.
+ *  The file holds a reference to the sensor state until it is released, also when the
+ *  sensor is removed before that.
+ *  @param inodep A pointer to an inode object (defined in linux/fs.h)
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ */
+static int dev_open(struct inode *inodep, struct file *filep)
+{
+   MPU9250_Dev_t *mpu;
+   MPU9250_File_t *ctx;
+   int rv;
+
+   mutex_lock(&g_minorsLock);
+   mpu = idr_find(&g_minors, iminor(inodep));
+
+   if (NULL != mpu)
+      kref_get(&mpu->ref);
+
+   mutex_unlock(&g_minorsLock);
+
+   if (NULL == mpu)
+      return -ENODEV;
+
+   /* Allocate the per open file context */
+   ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+
+   if (NULL == ctx)
+   {
+      rv = -ENOMEM;
+      goto err_put;
+   }
+
+   rv = mpu9250FileBegin(mpu);
+
+   if (0 != rv)
+      goto err_free;
+
+   /* Every open file keeps the sensor awake, the first one wakes it up */
+   rv = pm_runtime_get_sync(mpu->dev);
+
+   if (0 > rv)
+   {
+      pm_runtime_put_noidle(mpu->dev);
+      mpu9250FileEnd(mpu);
+      goto err_free;
+   }
+
+   mutex_init(&ctx->lock);
+   ctx->mpu = mpu;
+
+   /* New readers start at the newest sample, older ones belong to other readers */
+   ctx->consumedSeq = mpu->readySeq;
+   ctx->motionSeen = READ_ONCE(mpu->motionSeq);
+
+   if (NULL != mpu->ring)
+      ctx->cursor = READ_ONCE(mpu->ring->head);
+
+   filep->private_data = ctx;
+
+   atomic_inc(&mpu->numberOpens);
+
+   mpu9250FileEnd(mpu);
+
+   return 0;
+
+err_free:
+   kfree(ctx);
+err_put:
+   mpu9250Put(mpu);
+
+   return rv;
+}
+
+/** @brief This function is called whenever device is being read from user space 
+ *         i.e. data is being sent from the device to the user. 
+ *  In this case is uses the copy_to_user() function to send the buffer string to 
+ *  the user and captures any errors.
+ *  The file position is the register address, the registers are read with a single
+ *  repeated-start transaction so pread(fd, buf, 14, MPU9250_ACCEL_OUT) returns a whole
+ *  accel, temperature and gyro frame in one syscall.
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @param buffer The pointer to the buffer to which this function writes the data
+ *  @param len The length of the b
+ *  @param offset The offset if required
+ */
+static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset)
+{
+   MPU9250_File_t *ctx = filep->private_data;
+   MPU9250_Dev_t *mpu = ctx->mpu;
+   u64 start = ktime_get_ns();
+   ssize_t rv;
+
+   rv = mpu9250FileBegin(mpu);
+
+   if (0 != rv)
+      return rv;
+
+   /* In streaming mode complete frames come from the shared sample ring, at this reader cursor */
+   if (streaming)
+      rv = mpu9250StreamRead(filep, buffer, len);
+   else
+      rv = mpu9250RegisterRead(filep, buffer, len, offset);
+
+   if (0 < rv)
+      this_cpu_add(mpu->counters->bytes, rv);
+
+   mpu9250FileEnd(mpu);
+
+   trace_mpu9250_read(streaming ? MPU9250_TRACE_STREAM : MPU9250_TRACE_REGISTER, len, rv, ktime_get_ns() - start);
+
+   return rv;
+}
+
+/** @brief This function is called whenever the device is being written to from user space 
+ *         i.e. data is sent to the device from the user. 
+ *  The data is copied to the message[] array in this LKM using the sprintf() 
+ *  function along with the length of the string.
+ *  A single byte only selects the register to read next (the file position) and
+ *  causes no bus traffic, longer messages are a register address followed by data.
+ *  @param filep A pointer to a file object
+ *  @param buffer The buffer to that contains the string to write to the device
+ *  @param len The length of the array of data that is being passed in the const char buffer
+ *  @param offset The offset if required
+ */
+static ssize_t dev_write(struct file *filep, const char *buffer, size_t len, loff_t *offset)
+{
+   MPU9250_File_t *ctx = filep->private_data;
+   MPU9250_Dev_t *mpu = ctx->mpu;
+   int rv;
+   int errCnt = 0;
+   int sizeOfMessage;
+
+   /* Set size of message to write */
+   sizeOfMessage = MIN(sizeof(ctx->message), len);
+
+   if (0 == sizeOfMessage)
+      return 0;
+
+   rv = mpu9250FileBegin(mpu);
+
+   if (0 != rv)
+      return rv;
+
+   if (mutex_lock_interruptible(&ctx->lock))
+   {
+      mpu9250FileEnd(mpu);
+      return -ERESTARTSYS;
+   }
+
+   /* Copy message from user to kernel space */
+   errCnt = copy_from_user(ctx->message, buffer, sizeOfMessage);
+   
+   if(0 != errCnt)
+   {
+      /* Failed -- return a bad address message (i.e. -14) */
+      rv = -EFAULT;
+      goto out;
+   }
+
+   /* Select the register address for the next read */
+   if (1 == sizeOfMessage)
+   {
+      *offset = (unsigned char)ctx->message[0];
+
+      rv = 1;
+      goto out;
+   }
+
+   if (REGISTER_MAX < (unsigned char)ctx->message[0])
+   {
+      rv = -EINVAL;
+      goto out;
+   }
+
+   /* Write data to device through the register map so the cache stays coherent */
+   mutex_lock(&mpu->busLock);
+   rv = regmap_bulk_write(mpu->regmap, (unsigned char)ctx->message[0], &ctx->message[1], sizeOfMessage - 1);
+   mutex_unlock(&mpu->busLock);
+
+   if (0 == rv)
+      rv = sizeOfMessage;
+
+out:
+   mutex_unlock(&ctx->lock);
+   mpu9250FileEnd(mpu);
+
+   return rv;
+}
+
+/** @brief This function is called whenever the device is polled from user space 
+ *  Data is readable when the shared ring has records this reader has not read (streaming mode) or
+ *  when a new data-ready interrupt arrived (register mode). Files that mapped the ring move their
+ *  cursor with MPU9250_IOC_SET_TAIL, poll() itself changes nothing. Writes never block. A motion
+ *  event this file did not read is reported as priority data. A removed sensor reports
+ *  an error and a hang up.
+ *  @param filep A pointer to a file object
+ *  @param wait The poll table used to register on the read wait queue
+ */
+static __poll_t dev_poll(struct file *filep, poll_table *wait)
+{
+   MPU9250_File_t *ctx = filep->private_data;
+   MPU9250_Dev_t *mpu = ctx->mpu;
+   __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+   poll_wait(filep, &mpu->readQueue, wait);
+
+   if (0 != mpu9250FileBegin(mpu))
+      return EPOLLERR | EPOLLHUP;
+
+   if (mpu9250DataAvailable(ctx))
+      mask |= EPOLLIN | EPOLLRDNORM;
+
+   if (mpu9250EventAvailable(ctx))
+      mask |= EPOLLPRI;
+
+   mpu9250FileEnd(mpu);
+
+   return mask;
+}
+
+/** @brief This function is called whenever the device is mapped from user space 
+ *  It maps the shared sample ring read-only, see MPU9250_Ring_t for the layout and
+ *  the lock-free reading protocol. Only available in streaming mode.
+ *  @param filep A pointer to a file object
+ *  @param vma The user virtual memory area to map the ring into
+ */
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+   MPU9250_File_t *ctx = filep->private_data;
+   MPU9250_Dev_t *mpu = ctx->mpu;
+   int rv;
+
+   /* Readers never write, the producer is the only writer */
+   if (vma->vm_flags & VM_WRITE)
+      return -EPERM;
+
+   rv = mpu9250FileBegin(mpu);
+
+   if (0 != rv)
+      return rv;
+
+   /* The mapped pages outlive remove, the ring just stops moving */
+   if (NULL == mpu->ring)
+   {
+      rv = -ENODEV;
+   }
+   else
+   {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+      vm_flags_clear(vma, VM_MAYWRITE);
+#else
+      vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+      rv = remap_vmalloc_range(vma, mpu->ring, vma->vm_pgoff);
+
+      if (0 == rv)
+         ctx->mapped = true;
+   }
+
+   mpu9250FileEnd(mpu);
+
+   return rv;
+}
+
+/** @brief This function is called whenever user space issues an ioctl on the device 
+ *  See myMPU9250_uapi.h for the commands. The configuration is read from the register
+ *  cache, so querying it costs no bus traffic.
+ *  @param filep A pointer to a file object
+ *  @param cmd The ioctl command
+ *  @param arg The user space argument of the command
+ */
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+   MPU9250_File_t *ctx = filep->private_data;
+   long rv;
+
+   rv = mpu9250FileBegin(ctx->mpu);
+
+   if (0 != rv)
+      return rv;
+
+   rv = mpu9250Ioctl(filep, cmd, arg);
+
+   mpu9250FileEnd(ctx->mpu);
+
+   return rv;
+}
+static long mpu9250Ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+   void __user *argp = (void __user *)arg;
+   MPU9250_Config_t config;
+   MPU9250_Scale_t scale;
+   MPU9250_Layout_t layout;
+   MPU9250_Calib_t calib;
+   MPU9250_Stats_t stats;
+   MPU9250_Wom_t wom;
+   MPU9250_Filter_t filter;
+   MPU9250_Counters_t counters;
+   MPU9250_File_t *ctx = filep->private_data;
+   MPU9250_Dev_t *mpu = ctx->mpu;
+   u32 head, tail;
+   u64 start;
+   long rv;
+
+   switch (cmd)
+   {
+      case MPU9250_IOC_GET_VERSION:
+         return put_user((u32)MPU9250_UAPI_VERSION, (u32 __user *)argp);
+
+      case MPU9250_IOC_GET_CONFIG:
+         rv = mpu9250GetConfig(mpu, &config);
+
+         if (0 != rv)
+            return rv;
+
+         return copy_to_user(argp, &config, sizeof(config)) ? -EFAULT : 0;
+
+      case MPU9250_IOC_SET_CONFIG:
+         /* Changing the configuration affects every reader */
+         if (!(filep->f_mode & FMODE_WRITE))
+            return -EBADF;
+
+         if (copy_from_user(&config, argp, sizeof(config)))
+            return -EFAULT;
+
+         /* Nothing is sampled in wake-on-motion mode */
+         mutex_lock(&mpu->womLock);
+         rv = mpu->wom.enable ? -EBUSY : mpu9250SetConfig(mpu, &config);
+         mutex_unlock(&mpu->womLock);
+
+         return rv;
+
+      case MPU9250_IOC_GET_SCALE:
+         rv = mpu9250GetScale(mpu, &scale);
+
+         if (0 != rv)
+            return rv;
+
+         return copy_to_user(argp, &scale, sizeof(scale)) ? -EFAULT : 0;
+
+      case MPU9250_IOC_READ_BATCH:
+         start = ktime_get_ns();
+         rv = mpu9250BatchRead(filep, argp);
+         trace_mpu9250_read(MPU9250_TRACE_BATCH, sizeof(MPU9250_Batch_t), rv, ktime_get_ns() - start);
+
+         return rv;
+
+      case MPU9250_IOC_GET_LAYOUT:
+         mpu9250GetLayout(mpu, &layout);
+
+         return copy_to_user(argp, &layout, sizeof(layout)) ? -EFAULT : 0;
+
+      case MPU9250_IOC_SET_LAYOUT:
+         /* Changing the layout affects every reader */
+         if (!(filep->f_mode & FMODE_WRITE))
+            return -EBADF;
+
+         if (copy_from_user(&layout, argp, sizeof(layout)))
+            return -EFAULT;
+
+         mutex_lock(&mpu->womLock);
+         rv = mpu->wom.enable ? -EBUSY : mpu9250SetLayout(mpu, &layout);
+         mutex_unlock(&mpu->womLock);
+
+         return rv;
+
+      case MPU9250_IOC_GET_CALIB:
+         rv = mpu9250GetCalib(mpu, &calib);
+
+         if (0 != rv)
+            return rv;
+
+         return copy_to_user(argp, &calib, sizeof(calib)) ? -EFAULT : 0;
+
+      case MPU9250_IOC_SET_CALIB:
+         /* The offsets apply to every reader */
+         if (!(filep->f_mode & FMODE_WRITE))
+            return -EBADF;
+
+         if (copy_from_user(&calib, argp, sizeof(calib)))
+            return -EFAULT;
+
+         return mpu9250SetCalib(mpu, &calib);
+
+      case MPU9250_IOC_GET_STATS:
+         mpu9250CountersSum(mpu, &counters);
+         memset(&stats, 0, sizeof(stats));
+         stats.busTransfers = counters.busTransfers;
+         stats.busBytes = counters.busBytes;
+         stats.samples = counters.samples;
+         stats.fifoOverflows = counters.fifoOverflows;
+
+         /* Records already overwritten count as lost, even before the reader moves its cursor */
+         mutex_lock(&ctx->lock);
+         stats.overruns = ctx->overruns;
+
+         if (streaming && (NULL != mpu->ring))
+         {
+            head = smp_load_acquire(&mpu->ring->head);
+
+            if (head - ctx->cursor > mpu->ring->capacity)
+               stats.overruns += head - ctx->cursor - mpu->ring->capacity;
+         }
+
+         mutex_unlock(&ctx->lock);
+
+         return copy_to_user(argp, &stats, sizeof(stats)) ? -EFAULT : 0;
+
+      case MPU9250_IOC_GET_WOM:
+         mutex_lock(&mpu->womLock);
+         wom = mpu->wom;
+         mutex_unlock(&mpu->womLock);
+
+         return copy_to_user(argp, &wom, sizeof(wom)) ? -EFAULT : 0;
+
+      case MPU9250_IOC_SET_WOM:
+         /* The sensor mode affects every reader */
+         if (!(filep->f_mode & FMODE_WRITE))
+            return -EBADF;
+
+         if (copy_from_user(&wom, argp, sizeof(wom)))
+            return -EFAULT;
+
+         return mpu9250SetWom(mpu, &wom);
+
+      case MPU9250_IOC_READ_EVENT:
+         return mpu9250ReadEvent(filep, argp);
+
+      case MPU9250_IOC_READ_GROUP:
+         return mpu9250GroupRead(argp);
+
+      case MPU9250_IOC_GET_FILTER:
+         rv = mpu9250GetFilter(ctx, &filter);
+
+         if (0 != rv)
+            return rv;
+
+         return copy_to_user(argp, &filter, sizeof(filter)) ? -EFAULT : 0;
+
+      case MPU9250_IOC_SET_FILTER:
+         /* Only this reader is affected, a read-only file may set it */
+         if (copy_from_user(&filter, argp, sizeof(filter)))
+            return -EFAULT;
+
+         return mpu9250SetFilter(ctx, &filter);
+
+      case MPU9250_IOC_SET_TAIL:
+         if (get_user(tail, (u32 __user *)argp))
+            return -EFAULT;
+
+         return mpu9250SetTail(ctx, tail);
+
+      default:
+         return -ENOTTY;
+   }
+}
+
+/** @brief The device release function that is called whenever the device is closed/released 
+ *         by the userspace program.
+ *  @param inodep A pointer to an inode object (defined in linux/fs.h)
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ */
+static int dev_release(struct inode *inodep, struct file *filep)
+{
+    MPU9250_File_t *ctx = filep->private_data;
+    MPU9250_Dev_t *mpu = ctx->mpu;
+
+    /* Free the per open file context, its overruns are already in the statistics */
+    kfree(ctx->decimator);
+    kfree(ctx);
+
+    /* The last close starts the autosuspend delay, remove already dropped the references of a removed sensor */
+    if (0 == mpu9250FileBegin(mpu))
+    {
+        pm_runtime_mark_last_busy(mpu->dev);
+        pm_runtime_put_autosuspend(mpu->dev);
+
+        atomic_dec(&mpu->numberOpens);
+
+        mpu9250FileEnd(mpu);
+    }
+
+    /* The last reference frees the sensor state */
+    mpu9250Put(mpu);
+
+    return 0;
+}
+
+/*****************************************************************************************/
+/** @brief Reads consecutive registers in a single bus transaction
+ *  The transport sends the register address and reads the data without releasing the
+ *  bus, a repeated start on I2C and one chip select on SPI.
+ *  @param mpu The sensor
+ *  @param subAddress The first register to read
+ *  @param rxBuff The buffer to store the registers values
+ *  @param count Number of registers to read
+ *  @return Number of bytes read or a negative error code
+ */
+static int mpu9250ReadRegister(MPU9250_Dev_t *mpu, u8 subAddress, u8 *rxBuff, u16 count)
+{
+    int rv;
+    u64 start, duration;
+
+    start = ktime_get_ns();
+    rv = mpu->bus->read(mpu->busContext, subAddress, rxBuff, count);
+    duration = ktime_get_ns() - start;
+
+    trace_mpu9250_bus_read(subAddress, count, rv, duration);
+
+    /* First bucket below 8 us, then one per doubling */
+    duration >>= 13;
+    this_cpu_inc(mpu->counters->xferTime[(0 == duration) ? 0 : MIN(fls64(duration), XFER_BUCKETS - 1)]);
+    this_cpu_inc(mpu->counters->busTransfers);
+
+    if(0 == rv)
+    {
+        this_cpu_add(mpu->counters->busBytes, count);
+        return count;
+    }
+
+    this_cpu_inc(mpu->counters->busErrors);
+
+    return rv;
+}
+static bool mpu9250VolatileRegister(struct device *dev, unsigned int reg)
+{
+    /* Registers changed by the sensor itself are never served from the cache */
+    switch(reg)
+    {
+        case MPU9250_INT_STATUS:
+        case MPU9250_ACCEL_OUT ... MPU9250_EXT_SENS_DATA_LAST:
+        case MPU9250_USER_CTRL:
+        case MPU9250_FIFO_COUNT:
+        case MPU9250_FIFO_COUNT + 1:
+        case MPU9250_FIFO_READ:
+            return true;
+        default:
+            return false;
+    }
+}
+static bool mpu9250PreciousRegister(struct device *dev, unsigned int reg)
+{
+    /* Reading these registers has side effects */
+    return (MPU9250_INT_STATUS == reg) || (MPU9250_FIFO_READ == reg);
+}
+
+/* On SPI the register map sets MPU9250_I2C_READ_FLAG in the address of every read */
+const struct regmap_config g_mpu9250RegmapConfig =
+{
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = REGISTER_MAX,
+    .volatile_reg = mpu9250VolatileRegister,
+    .precious_reg = mpu9250PreciousRegister,
+    .cache_type = REGCACHE_RBTREE,
+};
+
+static int mpu9250SendRegister(MPU9250_Dev_t *mpu, u8 subAddress, u8 data)
+{
+    /* Write register without reading it back, used for self-clearing bits */
+    return regmap_write(mpu->regmap, subAddress, data);
+}
+
+/** @brief Writes consecutive configuration registers in a single I2C transaction
+ *  Values are kept in the register cache, so reading them back costs no bus traffic.
+ *  The hardware is only read back when the verify_writes parameter is set.
+ *  @param mpu The sensor
+ *  @param subAddress The first register to write
+ *  @param data The registers values
+ *  @param count Number of registers to write
+ *  @return 1 on success or -1 on error
+ */
+static int mpu9250WriteRegisters(MPU9250_Dev_t *mpu, u8 subAddress, const u8 *data, u8 count)
+{
+    u8 rx[REGISTER_MAX + 1];
+
+    /* Write registers */
+    if(0 != regmap_bulk_write(mpu->regmap, subAddress, data, count))
+        return -1;
+
+    if(verify_writes)
+    {
+        /* Read back the registers from the sensor, bypassing the cache */
+        if(count != mpu9250ReadRegister(mpu, subAddress, rx, count))
+            return -1;
+
+        /* Check the read back registers against the written registers */
+        if(0 != memcmp(data, rx, count))
+            return -1;
+    }
+
+    return 1;
+}
+static int mpu9250WriteRegister(MPU9250_Dev_t *mpu, u8 subAddress, u8 data)
+{
+    return mpu9250WriteRegisters(mpu, subAddress, &data, 1);
+}
+static int mpu9250WhoAmI(MPU9250_Dev_t *mpu)
+{
+    u8 rx;
+
+	/* Read the WHO AM I register */
+	if (0 > mpu9250ReadRegister(mpu, MPU9250_WHO_AM_I, &rx, 1)) 
+    {
+		return -1;
+	}
+	
+    /* Return the register value */
+	return rx;
+}
+
+/*****************************************************************************************/
+/** @brief Sleeps until the auxiliary I2C master ran the SLV0 transaction
+ *  The master runs once per sample cycle, two sample periods cover a cycle already
+ *  started. At the default 1 kHz this is 2 ms instead of a fixed 10 ms per access.
+ *  @param mpu The sensor
+ */
+static void mpu9250AuxWait(MPU9250_Dev_t *mpu)
+{
+    unsigned long us = 2 * div_s64(mpu9250NominalPeriod(mpu), NSEC_PER_USEC);
+
+    usleep_range(us, us + us / 2);
+}
+
+/** @brief Writes one AK8963 register through the MPU9250 auxiliary I2C master
+ *  SLV0 performs the write on the next sample cycle, so the caller is put to sleep
+ *  until it is done.
+ *  @param mpu The sensor
+ *  @param subAddress The AK8963 register to write
+ *  @param data The register value
+ *  @return 1 on success or -1 on error
+ */
+static int mpu9250WriteAK8963Register(MPU9250_Dev_t *mpu, u8 subAddress, u8 data)
+{
+    const u8 slv0[3] = { MPU9250_AK8963_I2C_ADDR, subAddress, MPU9250_I2C_SLV0_EN | 1 };
+
+    /* Data first, so SLV0 never writes a stale value */
+    if((0 > mpu9250WriteRegister(mpu, MPU9250_I2C_SLV0_DO, data)) ||
+       (0 > mpu9250WriteRegisters(mpu, MPU9250_I2C_SLV0_ADDR, slv0, sizeof(slv0))))
+        return -1;
+
+    mpu9250AuxWait(mpu);
+
+    return 1;
+}
+
+/** @brief Reads consecutive AK8963 registers through the MPU9250 auxiliary I2C master
+ *  SLV0 is left reading them on every sample cycle into EXT_SENS_DATA_00 onwards.
+ *  @param mpu The sensor
+ *  @param subAddress The first AK8963 register to read
+ *  @param rxBuff The buffer to store the registers values
+ *  @param count Number of registers to read, up to 15
+ *  @return Number of bytes read or a negative error code
+ */
+static int mpu9250ReadAK8963Registers(MPU9250_Dev_t *mpu, u8 subAddress, u8 *rxBuff, u8 count)
+{
+    const u8 slv0[3] = { MPU9250_AK8963_I2C_ADDR | MPU9250_I2C_READ_FLAG, subAddress, MPU9250_I2C_SLV0_EN | count };
+
+    if(0 > mpu9250WriteRegisters(mpu, MPU9250_I2C_SLV0_ADDR, slv0, sizeof(slv0)))
+        return -EIO;
+
+    mpu9250AuxWait(mpu);
+
+    return mpu9250ReadRegister(mpu, MPU9250_EXT_SENS_DATA_00, rxBuff, count);
+}
+
+/** @brief Configures the AK8963 for 100 Hz continuous measurement
+ *  The sensitivity adjustment values are read from the fuse ROM and folded into the
+ *  magnetometer scales. SLV0 is then left reading HXL to ST2 on every sample cycle,
+ *  so a burst from MPU9250_ACCEL_OUT, or a FIFO frame with MPU9250_FIFO_MAG, holds
+ *  all nine axes and the second polling path for the magnetometer goes away.
+ *  @param mpu The sensor
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250MagStart(MPU9250_Dev_t *mpu)
+{
+    u8 rx[MPU9250_FIFO_MAG_SIZE];
+    int rv = -EIO;
+    int i;
+
+    /* Soft reset, then check the AK8963 answers behind the auxiliary master */
+    if((0 > mpu9250WriteAK8963Register(mpu, MPU9250_AK8963_CNTL2, MPU9250_AK8963_RESET)) ||
+       (1 != mpu9250ReadAK8963Registers(mpu, MPU9250_AK8963_WHO_AM_I, rx, 1)))
+        goto err;
+
+    if(MPU9250_AK8963_ID != rx[0])
+    {
+        rv = -ENODEV;
+        goto err;
+    }
+
+    /* The fuse ROM is only readable from its own mode, entered from power down */
+    if((0 > mpu9250WriteAK8963Register(mpu, MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN)) ||
+       (0 > mpu9250WriteAK8963Register(mpu, MPU9250_AK8963_CNTL1, MPU9250_AK8963_FUSE_ROM)) ||
+       (3 != mpu9250ReadAK8963Registers(mpu, MPU9250_AK8963_ASA, rx, 3)))
+        goto err;
+
+    /* 4912 uT full scale over 32760 LSB is 1499389 ngauss / LSB, adjusted by (ASA + 128) / 256 */
+    for(i = 0; i < 3; i++)
+        mpu->magScaleNano[i] = (1499389 * (rx[i] + 128)) >> 8;
+
+    /* 16 bit output, 100 Hz continuous measurement */
+    if((0 > mpu9250WriteAK8963Register(mpu, MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN)) ||
+       (0 > mpu9250WriteAK8963Register(mpu, MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS2)))
+        goto err;
+
+    /* Leave SLV0 reading the measurement, ST2 included because reading it unlatches the next one */
+    if(MPU9250_FIFO_MAG_SIZE != mpu9250ReadAK8963Registers(mpu, MPU9250_AK8963_HXL, rx, MPU9250_FIFO_MAG_SIZE))
+        goto err;
+
+    mpu->magPresent = true;
+
+    return 0;
+
+err:
+    /* Do not leave SLV0 polling a missing slave */
+    mpu9250SendRegister(mpu, MPU9250_I2C_SLV0_CTRL, 0x00);
+
+    return rv;
+}
+static void mpu9250MagSuspend(MPU9250_Dev_t *mpu)
+{
+    /* Power down the AK8963, then stop SLV0 from repeating the write */
+    mpu9250WriteAK8963Register(mpu, MPU9250_AK8963_CNTL1, MPU9250_AK8963_PWR_DOWN);
+    mpu9250SendRegister(mpu, MPU9250_I2C_SLV0_CTRL, 0x00);
+}
+
+/** @brief Restarts the measurement stopped by mpu9250MagSuspend()
+ *  The fuse ROM adjustment is kept, only the mode and the SLV0 read are restored.
+ *  @param mpu The sensor
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250MagResume(MPU9250_Dev_t *mpu)
+{
+    u8 rx[MPU9250_FIFO_MAG_SIZE];
+
+    if((0 > mpu9250WriteAK8963Register(mpu, MPU9250_AK8963_CNTL1, MPU9250_AK8963_CNT_MEAS2)) ||
+       (MPU9250_FIFO_MAG_SIZE != mpu9250ReadAK8963Registers(mpu, MPU9250_AK8963_HXL, rx, MPU9250_FIFO_MAG_SIZE)))
+        return -EIO;
+
+    return 0;
+}
+static void mpu9250MagStop(MPU9250_Dev_t *mpu)
+{
+    mpu9250MagSuspend(mpu);
+
+    mpu->magPresent = false;
+}
+
+/*****************************************************************************************/
+static int mpu9250FifoReset(MPU9250_Dev_t *mpu)
+{
+    int rv;
+
+    /* Stop FIFO writes and flush the FIFO, the reset bit clears itself */
+    rv = mpu9250SendRegister(mpu, MPU9250_USER_CTRL, mpu->bus->userCtrl | MPU9250_I2C_MST_EN | MPU9250_USER_FIFO_RST);
+
+    if(0 == rv)
+    {
+        /* Restart FIFO writes, the first frame will be aligned to offset 0 */
+        rv = mpu9250SendRegister(mpu, MPU9250_USER_CTRL, mpu->bus->userCtrl | MPU9250_I2C_MST_EN | MPU9250_USER_FIFO_EN);
+    }
+
+    /* Frames lost, the next batch can not be chained to the previous one */
+    mpu->batchEnd = 0;
+
+    return rv;
+}
+static s64 mpu9250Timestamp(void)
+{
+    if(CLOCK_BOOTTIME == timestamp_clock)
+        return ktime_to_ns(ktime_get_boottime());
+
+    return ktime_get_ns();
+}
+static s64 mpu9250NominalPeriod(MPU9250_Dev_t *mpu)
+{
+    unsigned int smpdiv = 0;
+
+    /* Internal sample rate is 1 kHz with the DLPF enabled, SMPDIV comes from the cache */
+    regmap_read(mpu->regmap, MPU9250_SMPDIV, &smpdiv);
+
+    return (s64)NSEC_PER_MSEC * (1 + smpdiv);
+}
+
+/** @brief Estimates the timestamp of the last frame of a FIFO batch
+ *  With the data-ready interrupt the newest frame is the one that raised the last
+ *  interrupt, whose time was captured in the top half. When polling, it is taken
+ *  half a period before FIFO_COUNT was read. The time between consecutive batches
+ *  measures the sensor clock against the host clock, the sample period estimate is
+ *  smoothed with it so interpolated timestamps follow the sensor drift.
+ *  @param mpu The sensor
+ *  @param frames Number of frames in the batch
+ *  @return Timestamp of the last frame [ns]
+ */
+static s64 mpu9250BatchEnd(MPU9250_Dev_t *mpu, unsigned int frames)
+{
+    s64 nominal = mpu9250NominalPeriod(mpu);
+    s64 end;
+    s64 measured;
+
+    if(0 == mpu->samplePeriod)
+        mpu->samplePeriod = nominal;
+
+    if(0 < mpu->irq)
+        end = atomic64_read(&mpu->irqTimestamp);
+    else
+        end = mpu9250Timestamp() - (mpu->samplePeriod >> 1);
+
+    if(0 != mpu->batchEnd)
+    {
+        measured = div_s64(end - mpu->batchEnd, frames);
+
+        /* Missed interrupts or scheduling hiccups are not drift, ignore outliers */
+        if((measured > nominal - (nominal >> 3)) && (measured < nominal + (nominal >> 3)))
+            mpu->samplePeriod += (measured - mpu->samplePeriod) >> 4;
+
+        /* Keep timestamps strictly increasing across batches */
+        if(end - (s64)(frames - 1) * mpu->samplePeriod <= mpu->batchEnd)
+            end = mpu->batchEnd + (s64)frames * mpu->samplePeriod;
+    }
+
+    mpu->batchEnd = end;
+
+    return end;
+}
+
+/** @brief Bytes per frame of a FIFO channel set, channels follow the register order */
+static unsigned int mpu9250FrameSize(unsigned int fifoEnable)
+{
+    return ((fifoEnable & MPU9250_FIFO_ACCEL)  ? 6 : 0) +
+           ((fifoEnable & MPU9250_FIFO_TEMP)   ? 2 : 0) +
+           ((fifoEnable & MPU9250_FIFO_GYRO_X) ? 2 : 0) +
+           ((fifoEnable & MPU9250_FIFO_GYRO_Y) ? 2 : 0) +
+           ((fifoEnable & MPU9250_FIFO_GYRO_Z) ? 2 : 0) +
+           ((fifoEnable & MPU9250_FIFO_MAG)    ? MPU9250_FIFO_MAG_SIZE : 0);
+}
+static void mpu9250FrameDecode(const u8 *frame, unsigned int fifoEnable, MPU9250_Sample_t *rec)
+{
+    memset(rec->accel, 0, sizeof(rec->accel));
+    memset(rec->gyro, 0, sizeof(rec->gyro));
+    memset(rec->mag, 0, sizeof(rec->mag));
+    rec->temp  = 0;
+    rec->flags = 0;
+
+    if(fifoEnable & MPU9250_FIFO_ACCEL)
+    {
+        rec->accel[0] = (s16)((frame[0] << 8) | frame[1]);
+        rec->accel[1] = (s16)((frame[2] << 8) | frame[3]);
+        rec->accel[2] = (s16)((frame[4] << 8) | frame[5]);
+        frame += 6;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_TEMP)
+    {
+        rec->temp = (s16)((frame[0] << 8) | frame[1]);
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_GYRO_X)
+    {
+        rec->gyro[0] = (s16)((frame[0] << 8) | frame[1]);
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_GYRO_Y)
+    {
+        rec->gyro[1] = (s16)((frame[0] << 8) | frame[1]);
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_GYRO_Z)
+    {
+        rec->gyro[2] = (s16)((frame[0] << 8) | frame[1]);
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_MAG)
+    {
+        /* The AK8963 is little-endian, ST2 follows the measurement */
+        rec->mag[0] = (s16)((frame[1] << 8) | frame[0]);
+        rec->mag[1] = (s16)((frame[3] << 8) | frame[2]);
+        rec->mag[2] = (s16)((frame[5] << 8) | frame[4]);
+        rec->flags  = MPU9250_SAMPLE_MAG;
+
+        if(frame[6] & MPU9250_AK8963_ST2_HOFL)
+            rec->flags |= MPU9250_SAMPLE_MAG_OVERFLOW;
+    }
+}
+static void mpu9250FrameEncode(const MPU9250_Sample_t *rec, unsigned int fifoEnable, u8 *frame)
+{
+    if(fifoEnable & MPU9250_FIFO_ACCEL)
+    {
+        frame[0] = rec->accel[0] >> 8;  frame[1] = rec->accel[0];
+        frame[2] = rec->accel[1] >> 8;  frame[3] = rec->accel[1];
+        frame[4] = rec->accel[2] >> 8;  frame[5] = rec->accel[2];
+        frame += 6;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_TEMP)
+    {
+        frame[0] = rec->temp >> 8;      frame[1] = rec->temp;
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_GYRO_X)
+    {
+        frame[0] = rec->gyro[0] >> 8;   frame[1] = rec->gyro[0];
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_GYRO_Y)
+    {
+        frame[0] = rec->gyro[1] >> 8;   frame[1] = rec->gyro[1];
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_GYRO_Z)
+    {
+        frame[0] = rec->gyro[2] >> 8;   frame[1] = rec->gyro[2];
+        frame += 2;
+    }
+
+    if(fifoEnable & MPU9250_FIFO_MAG)
+    {
+        frame[0] = rec->mag[0];         frame[1] = rec->mag[0] >> 8;
+        frame[2] = rec->mag[1];         frame[3] = rec->mag[1] >> 8;
+        frame[4] = rec->mag[2];         frame[5] = rec->mag[2] >> 8;
+        frame[6] = MPU9250_AK8963_ST2_BITM | ((rec->flags & MPU9250_SAMPLE_MAG_OVERFLOW) ? MPU9250_AK8963_ST2_HOFL : 0);
+    }
+}
+
+static void mpu9250SharedRingPush(MPU9250_Dev_t *mpu, const unsigned char *frames, unsigned int count, s64 timestamp, s64 period)
+{
+    MPU9250_Sample_t *rec;
+    u32 head = mpu->ring->head;
+    u32 mask = mpu->ring->capacity - 1;
+    unsigned int i;
+
+    /* Claim the records before overwriting them so readers can detect it */
+    WRITE_ONCE(mpu->ring->reserve, head + count);
+    smp_wmb();
+
+    for(i = 0; i < count; i++, frames += mpu->frameSize)
+    {
+        rec = &mpu->ringRecords[(head + i) & mask];
+
+        rec->timestamp = timestamp + i * period;
+        mpu9250FrameDecode(frames, mpu->fifoEnable, rec);
+    }
+
+    /* Publish the records */
+    smp_wmb();
+    WRITE_ONCE(mpu->ring->head, head + count);
+}
+static int mpu9250SharedRingAlloc(MPU9250_Dev_t *mpu)
+{
+    u32 capacity = roundup_pow_of_two(ring_frames);
+    u32 dataOffset = PAGE_SIZE;
+    u32 mapSize = PAGE_ALIGN(dataOffset + capacity * sizeof(MPU9250_Sample_t));
+
+    /* Zeroed memory that can be mapped to user space */
+    mpu->ring = vmalloc_user(mapSize);
+
+    if(NULL == mpu->ring)
+        return -ENOMEM;
+
+    mpu->ring->magic      = MPU9250_RING_MAGIC;
+    mpu->ring->version    = MPU9250_RING_VERSION;
+    mpu->ring->mapSize    = mapSize;
+    mpu->ring->dataOffset = dataOffset;
+    mpu->ring->recordSize = sizeof(MPU9250_Sample_t);
+    mpu->ring->capacity   = capacity;
+
+    mpu->ringRecords = (MPU9250_Sample_t *)((char *)mpu->ring + dataOffset);
+
+    return 0;
+}
+
+/** @brief Moves every complete frame from the MPU9250 hardware FIFO into the shared sample ring
+ *  Frames are read in bursts as large as the hardware FIFO, so the whole FIFO
+ *  content costs a few I2C transactions instead of two per sample.
+ *  @param mpu The sensor
+ *  @return Number of frames drained or a negative error code
+ */
+static int mpu9250FifoDrain(MPU9250_Dev_t *mpu)
+{
+    int rv;
+    unsigned char rx[2];
+    unsigned int frames;
+    unsigned int burst;
+    unsigned int total = 0;
+    s64 timestamp;
+    u64 start = ktime_get_ns();
+
+    mutex_lock(&mpu->busLock);
+
+    /* An overflow loses frame alignment, so the FIFO is flushed and restarted */
+    rv = mpu9250ReadRegister(mpu, MPU9250_INT_STATUS, rx, 1);
+
+    if((0 < rv) && (rx[0] & MPU9250_INT_FIFO_OFLOW))
+    {
+        this_cpu_inc(mpu->counters->fifoOverflows);
+        trace_mpu9250_fifo_overflow(mpu->batchEnd);
+        rv = mpu9250FifoReset(mpu);
+        goto out;
+    }
+
+    /* Read how many bytes are waiting */
+    if(0 < rv)
+    {
+        rv = mpu9250ReadRegister(mpu, MPU9250_FIFO_COUNT, rx, 2);
+    }
+
+    if(0 >= rv)
+        goto out;
+
+    frames = (((rx[0] << 8) | rx[1]) & MPU9250_FIFO_COUNT_MASK) / mpu->frameSize;
+
+    if(0 == frames)
+        goto out;
+
+    /* Interpolate per frame timestamps backwards from the newest frame */
+    timestamp = mpu9250BatchEnd(mpu, frames) - (s64)(frames - 1) * mpu->samplePeriod;
+
+    while(0 < frames)
+    {
+        burst = MIN(frames, sizeof(mpu->drainBuffer) / mpu->frameSize);
+
+        rv = mpu9250ReadRegister(mpu, MPU9250_FIFO_READ, mpu->drainBuffer, burst * mpu->frameSize);
+
+        if(0 >= rv)
+            break;
+
+        mpu9250SharedRingPush(mpu, mpu->drainBuffer, burst, timestamp, mpu->samplePeriod);
+
+        timestamp += (s64)burst * mpu->samplePeriod;
+        frames -= burst;
+        total += burst;
+    }
+
+    /* First frame after a wake-up */
+    if((0 < total) && (0 != mpu->resumeStart))
+    {
+        mpu9250ResumeDone(mpu, mpu->resumeStart, mpu->resumeSynced);
+        WRITE_ONCE(mpu->resumeStart, 0);
+    }
+
+out:
+    mutex_unlock(&mpu->busLock);
+
+    this_cpu_add(mpu->counters->samples, total);
+    trace_mpu9250_fifo_drain(total, rv, ktime_get_ns() - start);
+
+    return (0 > rv) ? rv : total;
+}
+static void mpu9250DrainWork(struct work_struct *work)
+{
+    MPU9250_Dev_t *mpu = container_of(to_delayed_work(work), MPU9250_Dev_t, drainWork);
+    if(0 > mpu9250FifoDrain(mpu))
+    {
+        pr_info_ratelimited("From Drain: Read hardware FIFO fail.\n");
+    }
+
+    wake_up_interruptible(&mpu->readQueue);
+
+    schedule_delayed_work(&mpu->drainWork, msecs_to_jiffies(fifo_poll_ms));
+}
+static int mpu9250StreamStart(MPU9250_Dev_t *mpu)
+{
+    int rv;
+
+    /* Allocate the sample ring shared by all readers */
+    rv = mpu9250SharedRingAlloc(mpu);
+
+    if(0 != rv)
+        return rv;
+
+    /* Select accel, temperature, gyro and SLV0 magnetometer samples to be written to the FIFO */
+    mpu->fifoEnable = MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO | (mpu->magPresent ? MPU9250_FIFO_MAG : 0);
+    mpu->frameSize = mpu9250FrameSize(mpu->fifoEnable);
+
+    if ((0 > mpu9250WriteRegister(mpu, MPU9250_FIFO_EN, mpu->fifoEnable)) ||
+        (0 > mpu9250FifoReset(mpu)))
+    {
+        vfree(mpu->ring);
+        mpu->ring = NULL;
+        return -EIO;
+    }
+
+    /* The work is only scheduled when there is no data-ready interrupt */
+    INIT_DELAYED_WORK(&mpu->drainWork, mpu9250DrainWork);
+
+    return 0;
+}
+static void mpu9250StreamStop(MPU9250_Dev_t *mpu)
+{
+    cancel_delayed_work_sync(&mpu->drainWork);
+
+    /* Stop FIFO writes */
+    mpu9250SendRegister(mpu, MPU9250_FIFO_EN, 0x00);
+    mpu9250SendRegister(mpu, MPU9250_USER_CTRL, mpu->bus->userCtrl | MPU9250_I2C_MST_EN);
+
+    /* Pages stay alive until the last user mapping goes away */
+    vfree(mpu->ring);
+    mpu->ring = NULL;
+}
+
+/*****************************************************************************************/
+
+/* Full scale to SI units per count, indexed by the FS_SEL field of ACCEL_CONFIG and GYRO_CONFIG */
+static const int g_accelRangeG[]    = { 2, 4, 8, 16 };
+static const int g_gyroRangeDps[]   = { 250, 500, 1000, 2000 };
+static const int g_accelScaleNano[] = { 598550, 1197101, 2394202, 4788403 };      ///< (m/s2) / LSB for 2, 4, 8 and 16 G
+static const int g_gyroScaleNano[]  = { 133158, 266316, 532632, 1065264 };        ///< (rad/s) / LSB for 250, 500, 1000 and 2000 DPS
+
+/* DLPF bandwidth indexed by the DLPF_CFG field of CONFIG and ACCEL_CONFIG2, 0 is not supported */
+static const int g_dlpfHz[]         = { 0, 184, 92, 41, 20, 10, 5, 0 };
+
+static int mpu9250TableIndex(const int *table, int size, u32 value)
+{
+    int i;
+
+    for(i = 0; i < size; i++)
+    {
+        if((0 != table[i]) && (value == table[i]))
+            return i;
+    }
+
+    return -EINVAL;
+}
+
+/** @brief Reads the sampling configuration from the register cache
+ *  @param mpu The sensor
+ *  @param config The configuration in physical units
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250GetConfig(MPU9250_Dev_t *mpu, MPU9250_Config_t *config)
+{
+    int rv;
+    u8 regs[5];
+
+    /* SMPDIV, CONFIG, GYRO_CONFIG, ACCEL_CONFIG and ACCEL_CONFIG2 are consecutive and cached */
+    rv = regmap_bulk_read(mpu->regmap, MPU9250_SMPDIV, regs, sizeof(regs));
+
+    if(0 != rv)
+        return rv;
+
+    config->odrHz            = 1000 / (1 + regs[0]);
+    config->gyroBandwidthHz  = g_dlpfHz[regs[1] & 0x07];
+    config->gyroRangeDps     = g_gyroRangeDps[(regs[2] >> 3) & 0x03];
+    config->accelRangeG      = g_accelRangeG[(regs[3] >> 3) & 0x03];
+    config->accelBandwidthHz = g_dlpfHz[regs[4] & 0x07];
+
+    return 0;
+}
+
+/** @brief Writes the sampling configuration in a single bulk transaction
+ *  In streaming mode the hardware FIFO is flushed so every queued frame matches the
+ *  new configuration, and the timestamp model restarts from the new sample period.
+ *  @param mpu The sensor
+ *  @param config The configuration in physical units
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SetConfig(MPU9250_Dev_t *mpu, const MPU9250_Config_t *config)
+{
+    int rv;
+    int accelRange = mpu9250TableIndex(g_accelRangeG, ARRAY_SIZE(g_accelRangeG), config->accelRangeG);
+    int gyroRange = mpu9250TableIndex(g_gyroRangeDps, ARRAY_SIZE(g_gyroRangeDps), config->gyroRangeDps);
+    int accelDlpf = mpu9250TableIndex(g_dlpfHz, ARRAY_SIZE(g_dlpfHz), config->accelBandwidthHz);
+    int gyroDlpf = mpu9250TableIndex(g_dlpfHz, ARRAY_SIZE(g_dlpfHz), config->gyroBandwidthHz);
+    u8 regs[5];
+
+    if((0 > accelRange) || (0 > gyroRange) || (0 > accelDlpf) || (0 > gyroDlpf) ||
+       (0 == config->odrHz) || (1000 < config->odrHz))
+    {
+        return -EINVAL;
+    }
+
+    regs[0] = MIN(DIV_ROUND_CLOSEST(1000, config->odrHz) - 1, 255);                     // Sample rate divider
+    regs[1] = gyroDlpf | (streaming ? MPU9250_CONFIG_FIFO_MODE : 0);                    // Gyro bandwidth, a full FIFO stops instead of overwriting
+    regs[2] = gyroRange << 3;                                                           // Gyro range
+    regs[3] = accelRange << 3;                                                          // Accel range
+    regs[4] = accelDlpf;                                                                // Accel bandwidth
+
+    mutex_lock(&mpu->busLock);
+
+    rv = mpu9250WriteRegisters(mpu, MPU9250_SMPDIV, regs, sizeof(regs));
+
+    /* Frames queued with the previous configuration are discarded */
+    if((0 < rv) && (NULL != mpu->ring))
+        mpu9250FifoReset(mpu);
+
+    mpu->samplePeriod = 0;
+    mpu->batchEnd = 0;
+
+    mutex_unlock(&mpu->busLock);
+
+    return (0 > rv) ? -EIO : 0;
+}
+static int mpu9250GetScale(MPU9250_Dev_t *mpu, MPU9250_Scale_t *scale)
+{
+    int rv;
+    unsigned int accel;
+    unsigned int gyro;
+
+    /* Full scales come from the register cache */
+    rv = regmap_read(mpu->regmap, MPU9250_ACCEL_CONFIG, &accel);
+
+    if(0 == rv)
+        rv = regmap_read(mpu->regmap, MPU9250_GYRO_CONFIG, &gyro);
+
+    if(0 != rv)
+        return rv;
+
+    scale->accelNano            = g_accelScaleNano[(accel >> 3) & 0x03];
+    scale->gyroNano             = g_gyroScaleNano[(gyro >> 3) & 0x03];
+    scale->tempSensitivityMilli = 333870;
+    scale->tempOffsetMilli      = 21000;
+
+    /* 1 ngauss is 0.1 pT */
+    scale->magPico[0]           = mpu->magPresent ? mpu->magScaleNano[0] / 10 : 0;
+    scale->magPico[1]           = mpu->magPresent ? mpu->magScaleNano[1] / 10 : 0;
+    scale->magPico[2]           = mpu->magPresent ? mpu->magScaleNano[2] / 10 : 0;
+
+    return 0;
+}
+static void mpu9250GetLayout(MPU9250_Dev_t *mpu, MPU9250_Layout_t *layout)
+{
+    /* Without streaming, the layout of a burst read from ACCEL_OUT */
+    if(NULL == mpu->ring)
+        layout->fifoEnable = MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO | (mpu->magPresent ? MPU9250_FIFO_MAG : 0);
+    else
+        layout->fifoEnable = READ_ONCE(mpu->fifoEnable);
+
+    layout->frameSize = mpu9250FrameSize(layout->fifoEnable);
+}
+
+/** @brief Selects the channels written to the hardware FIFO in streaming mode
+ *  Smaller frames let the FIFO hold more samples and cut the bus time per sample.
+ *  The FIFO is flushed, frames already in the shared ring keep their values and
+ *  read() returns them in the new layout.
+ *  @param mpu The sensor
+ *  @param layout The channels, fifoEnable is a set of MPU9250_FIFO_* bits
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SetLayout(MPU9250_Dev_t *mpu, const MPU9250_Layout_t *layout)
+{
+    u32 supported = MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO | (mpu->magPresent ? MPU9250_FIFO_MAG : 0);
+    int rv;
+
+    if(NULL == mpu->ring)
+        return -EINVAL;
+
+    if((0 == layout->fifoEnable) || (layout->fifoEnable & ~supported))
+        return -EINVAL;
+
+    mutex_lock(&mpu->busLock);
+
+    /* The drain path decodes under the bus lock, so it never sees a half updated layout */
+    rv = mpu9250WriteRegister(mpu, MPU9250_FIFO_EN, layout->fifoEnable);
+
+    if(0 < rv)
+        rv = mpu9250FifoReset(mpu);
+
+    if(0 == rv)
+    {
+        WRITE_ONCE(mpu->fifoEnable, layout->fifoEnable);
+        WRITE_ONCE(mpu->frameSize, mpu9250FrameSize(layout->fifoEnable));
+    }
+
+    mutex_unlock(&mpu->busLock);
+
+    return (0 > rv) ? -EIO : 0;
+}
+
+/** @brief Reads the offset registers from the register cache and the stored accel scale factors
+ *  @param mpu The sensor
+ *  @param calib The calibration
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250GetCalib(MPU9250_Dev_t *mpu, MPU9250_Calib_t *calib)
+{
+    int rv;
+    int i;
+    u8 gyro[6];
+    u8 accel[MPU9250_ZA_OFFSET_H + 2 - MPU9250_XA_OFFSET_H];
+
+    /* Gyro offsets are consecutive, accel offsets are three registers apart */
+    rv = regmap_bulk_read(mpu->regmap, MPU9250_XG_OFFSET_H, gyro, sizeof(gyro));
+
+    if(0 == rv)
+        rv = regmap_bulk_read(mpu->regmap, MPU9250_XA_OFFSET_H, accel, sizeof(accel));
+
+    if(0 != rv)
+        return rv;
+
+    for(i = 0; i < 3; i++)
+    {
+        calib->gyroOffset[i]     = (s16)((gyro[2 * i] << 8) | gyro[2 * i + 1]);
+        calib->accelOffset[i]    = (s16)((accel[3 * i] << 8) | accel[3 * i + 1]);
+        calib->accelGainMicro[i] = READ_ONCE(mpu->accelGainMicro[i]);
+    }
+
+    return 0;
+}
+
+/** @brief Writes the offset registers and stores the accel scale factors
+ *  From then on every sample comes out of the sensor corrected, in every mode.
+ *  @param mpu The sensor
+ *  @param calib The calibration, bit 0 of the accel offsets is ignored
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SetCalib(MPU9250_Dev_t *mpu, const MPU9250_Calib_t *calib)
+{
+    static const u8 accelRegister[3] = { MPU9250_XA_OFFSET_H, MPU9250_YA_OFFSET_H, MPU9250_ZA_OFFSET_H };
+    unsigned int low;
+    u8 regs[6];
+    int rv;
+    int i;
+
+    for(i = 0; i < 3; i++)
+    {
+        if(0 == calib->accelGainMicro[i])
+            return -EINVAL;
+
+        regs[2 * i]     = (u16)calib->gyroOffset[i] >> 8;
+        regs[2 * i + 1] = (u16)calib->gyroOffset[i] & 0xFF;
+    }
+
+    mutex_lock(&mpu->busLock);
+
+    rv = mpu9250WriteRegisters(mpu, MPU9250_XG_OFFSET_H, regs, sizeof(regs));
+
+    for(i = 0; (0 < rv) && (i < 3); i++)
+    {
+        /* Bit 0 keeps the value set at the factory */
+        if(0 != regmap_read(mpu->regmap, accelRegister[i] + 1, &low))
+        {
+            rv = -1;
+            break;
+        }
+
+        regs[0] = (u16)calib->accelOffset[i] >> 8;
+        regs[1] = ((u16)calib->accelOffset[i] & 0xFF & ~MPU9250_ACCEL_OFFSET_RESERVED) | (low & MPU9250_ACCEL_OFFSET_RESERVED);
+
+        rv = mpu9250WriteRegisters(mpu, accelRegister[i], regs, 2);
+    }
+
+    if(0 < rv)
+    {
+        for(i = 0; i < 3; i++)
+            WRITE_ONCE(mpu->accelGainMicro[i], calib->accelGainMicro[i]);
+    }
+
+    mutex_unlock(&mpu->busLock);
+
+    return (0 > rv) ? -EIO : 0;
+}
+
+/** @brief Applies the calibration module parameter entry of this sensor
+ *  Entries are keyed by the name of the bus device, which does not depend on the probe
+ *  order. A sensor without an entry keeps the values it holds.
+ *  @param mpu The sensor
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250LoadCalib(MPU9250_Dev_t *mpu)
+{
+    const char *name = dev_name(mpu->dev);
+    size_t length = strlen(name);
+    MPU9250_Calib_t saved;
+    const char *values;
+    int used = 0;
+    int i;
+
+    for(i = 0; i < calib_count; i++)
+    {
+        if((0 == strncmp(calib[i], name, length)) && (':' == calib[i][length]))
+            break;
+    }
+
+    if(i == calib_count)
+        return 0;
+
+    values = &calib[i][length + 1];
+
+    if((9 != sscanf(values, "%hd:%hd:%hd:%hd:%hd:%hd:%u:%u:%u%n",
+                    &saved.gyroOffset[0], &saved.gyroOffset[1], &saved.gyroOffset[2],
+                    &saved.accelOffset[0], &saved.accelOffset[1], &saved.accelOffset[2],
+                    &saved.accelGainMicro[0], &saved.accelGainMicro[1], &saved.accelGainMicro[2], &used)) ||
+       ('\0' != values[used]))
+    {
+        dev_err(mpu->dev, "From Probe: Calibration entry %s is malformed.\n", calib[i]);
+        return -EINVAL;
+    }
+
+    return mpu9250SetCalib(mpu, &saved);
+}
+
+/*****************************************************************************************/
+static u32 mpu9250ReaderBegin(MPU9250_File_t *ctx, u32 count)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    u32 capacity = mpu->ring->capacity;
+    u32 head = smp_load_acquire(&mpu->ring->head);
+
+    /* Skip what the producer already overwrote */
+    if(head - ctx->cursor > capacity)
+    {
+        trace_mpu9250_overrun(ctx->cursor, head - ctx->cursor - capacity);
+        this_cpu_add(mpu->counters->overruns, head - ctx->cursor - capacity);
+        ctx->overruns += head - ctx->cursor - capacity;
+        ctx->cursor = head - capacity;
+    }
+
+    return MIN(count, head - ctx->cursor);
+}
+static u32 mpu9250ReaderEnd(MPU9250_File_t *ctx, u32 count)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    u32 capacity = mpu->ring->capacity;
+    u32 lost;
+
+    /* The leading copies the producer overwrote meanwhile are lost */
+    smp_rmb();
+    lost = READ_ONCE(mpu->ring->reserve) - ctx->cursor;
+    lost = (lost > capacity) ? MIN(lost - capacity, count) : 0;
+
+    if(0 < lost)
+    {
+        trace_mpu9250_overrun(ctx->cursor, lost);
+        this_cpu_add(mpu->counters->overruns, lost);
+        ctx->overruns += lost;
+    }
+
+    ctx->cursor += count;
+
+    return lost;
+}
+
+/** @brief Copies the records a reader has not seen yet as FIFO frames
+ *  Readers only move their own cursor, so any number of them share one acquisition
+ *  stream without extra I2C traffic. A reader that falls more than the ring capacity
+ *  behind loses the oldest records, they are added to its overrun counter.
+ *  @param ctx The reader context
+ *  @param frames The buffer to store frames in the FIFO layout
+ *  @param fifoEnable The channels of the FIFO layout
+ *  @param count Maximum number of frames to copy
+ *  @return Number of frames copied
+ */
+static unsigned int mpu9250SharedRingCopy(MPU9250_File_t *ctx, u8 *frames, unsigned int fifoEnable, unsigned int count)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    unsigned int frameSize = mpu9250FrameSize(fifoEnable);
+    u8 *frame = frames;
+    u32 mask = mpu->ring->capacity - 1;
+    u32 lost;
+    unsigned int i;
+
+    count = mpu9250ReaderBegin(ctx, count);
+
+    for(i = 0; i < count; i++, frame += frameSize)
+    {
+        mpu9250FrameEncode(&mpu->ringRecords[(ctx->cursor + i) & mask], fifoEnable, frame);
+    }
+
+    lost = mpu9250ReaderEnd(ctx, count);
+
+    if(0 < lost)
+        memmove(frames, frames + lost * frameSize, (count - lost) * frameSize);
+
+    return count - lost;
+}
+
+/** @brief Copies the records a reader has not seen yet as typed samples
+ *  Same cursor and overrun accounting as mpu9250SharedRingCopy().
+ */
+static unsigned int mpu9250SharedRingCopyRecords(MPU9250_File_t *ctx, MPU9250_Sample_t *records, unsigned int count)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    u32 mask = mpu->ring->capacity - 1;
+    u32 lost;
+    unsigned int i;
+
+    count = mpu9250ReaderBegin(ctx, count);
+
+    for(i = 0; i < count; i++)
+        records[i] = mpu->ringRecords[(ctx->cursor + i) & mask];
+
+    lost = mpu9250ReaderEnd(ctx, count);
+
+    if(0 < lost)
+        memmove(records, records + lost, (count - lost) * sizeof(*records));
+
+    return count - lost;
+}
+
+/*****************************************************************************************/
+static bool mpu9250DecimatorActive(MPU9250_File_t *ctx)
+{
+    MPU9250_Decimator_t *dec = smp_load_acquire(&ctx->decimator);
+
+    return (NULL != dec) && (MPU9250_FILTER_NONE != READ_ONCE(dec->filter.type));
+}
+static void mpu9250DecimatorReset(MPU9250_Decimator_t *dec)
+{
+    /* The first output waits for a full block, or for a full FIR history */
+    if(MPU9250_FILTER_FIR == dec->filter.type)
+        dec->countdown = dec->filter.taps;
+    else
+        dec->countdown = dec->filter.decimation;
+
+    memset(dec->sum, 0, sizeof(dec->sum));
+    dec->flags = 0;
+}
+
+static void mpu9250SampleChannels(const MPU9250_Sample_t *rec, s16 *ch)
+{
+    memcpy(&ch[0], rec->accel, sizeof(rec->accel));
+    memcpy(&ch[3], rec->gyro, sizeof(rec->gyro));
+    memcpy(&ch[6], rec->mag, sizeof(rec->mag));
+    ch[9] = rec->temp;
+}
+
+static void mpu9250SampleFromChannels(MPU9250_Sample_t *rec, const s16 *ch)
+{
+    memcpy(rec->accel, &ch[0], sizeof(rec->accel));
+    memcpy(rec->gyro, &ch[3], sizeof(rec->gyro));
+    memcpy(rec->mag, &ch[6], sizeof(rec->mag));
+    rec->temp = ch[9];
+    rec->reserved = 0;
+}
+
+/** @brief Feeds one ring record to the decimation stage of a reader
+ *  The box filter only adds the record to the block accumulators. The FIR keeps the
+ *  last taps records and is evaluated once every decimation records, so its cost is
+ *  taps multiply-accumulates per channel and output record.
+ *  @param dec The decimation stage
+ *  @param rec The ring record
+ *  @param out The output record, written when the function returns true
+ *  @return true when an output record is complete
+ */
+static bool mpu9250DecimatorPush(MPU9250_Decimator_t *dec, const MPU9250_Sample_t *rec, MPU9250_Sample_t *out)
+{
+    const u32 mask = MPU9250_FILTER_TAPS_MAX - 1;
+    s16 ch[FILTER_CHANNELS];
+    s64 acc[FILTER_CHANNELS];
+    const s16 *x;
+    unsigned int slot;
+    unsigned int k;
+    unsigned int i;
+    u16 flags = 0;
+
+    mpu9250SampleChannels(rec, ch);
+
+    if(MPU9250_FILTER_BOX == dec->filter.type)
+    {
+        if(dec->countdown == dec->filter.decimation)
+            dec->blockStart = rec->timestamp;
+
+        for(i = 0; i < FILTER_CHANNELS; i++)
+            dec->sum[i] += ch[i];
+
+        dec->flags |= rec->flags;
+
+        if(0 != --dec->countdown)
+            return false;
+
+        for(i = 0; i < FILTER_CHANNELS; i++)
+            ch[i] = DIV_ROUND_CLOSEST(dec->sum[i], (s32)dec->filter.decimation);
+
+        out->timestamp = dec->blockStart + (rec->timestamp - dec->blockStart) / 2;
+        out->flags = dec->flags;
+        mpu9250SampleFromChannels(out, ch);
+
+        memset(dec->sum, 0, sizeof(dec->sum));
+        dec->flags = 0;
+        dec->countdown = dec->filter.decimation;
+
+        return true;
+    }
+
+    /* FIR, the history is a ring of MPU9250_FILTER_TAPS_MAX records */
+    dec->newest = (dec->newest + 1) & mask;
+    memcpy(dec->history[dec->newest], ch, sizeof(ch));
+    dec->historyTime[dec->newest] = rec->timestamp;
+    dec->historyFlags[dec->newest] = rec->flags;
+
+    if(0 != --dec->countdown)
+        return false;
+
+    dec->countdown = dec->filter.decimation;
+
+    memset(acc, 0, sizeof(acc));
+
+    for(k = 0; k < dec->filter.taps; k++)
+    {
+        slot = (dec->newest - k) & mask;
+        x = dec->history[slot];
+
+        for(i = 0; i < FILTER_CHANNELS; i++)
+            acc[i] += (s32)dec->filter.coeff[k] * x[i];
+
+        flags |= dec->historyFlags[slot];
+    }
+
+    /* Q15 back to counts, rounded and saturated */
+    for(i = 0; i < FILTER_CHANNELS; i++)
+        ch[i] = clamp_t(s64, (acc[i] + (1 << 14)) >> 15, S16_MIN, S16_MAX);
+
+    out->timestamp = dec->historyTime[(dec->newest - (dec->filter.taps - 1) / 2) & mask];
+    out->flags = flags;
+    mpu9250SampleFromChannels(out, ch);
+
+    return true;
+}
+
+/** @brief Copies filtered records a reader has not seen yet
+ *  Ring records go through the decimation stage in passes of FILTER_CHUNK, never more
+ *  than the ones that complete count output records, so the cursor stays on the first
+ *  record not fed to the filter. Records lost to an overrun restart the filter.
+ *  @param ctx The reader context, with an active decimation stage
+ *  @param records The buffer to store the output records
+ *  @param count Maximum number of output records
+ *  @return Number of output records stored
+ */
+static unsigned int mpu9250DecimatorCopy(MPU9250_File_t *ctx, MPU9250_Sample_t *records, unsigned int count)
+{
+    MPU9250_Decimator_t *dec = ctx->decimator;
+    unsigned long overruns;
+    unsigned int stored = 0;
+    unsigned int n;
+    unsigned int i;
+    u64 limit;
+
+    while(stored < count)
+    {
+        /* Input records that complete at most the remaining output records */
+        limit = dec->countdown + (u64)(count - stored - 1) * dec->filter.decimation;
+        n = MIN(limit, (u64)FILTER_CHUNK);
+
+        overruns = ctx->overruns;
+        n = mpu9250SharedRingCopyRecords(ctx, dec->input, n);
+
+        if(0 == n)
+            break;
+
+        if(overruns != ctx->overruns)
+            mpu9250DecimatorReset(dec);
+
+        for(i = 0; i < n; i++)
+        {
+            if(mpu9250DecimatorPush(dec, &dec->input[i], &records[stored]))
+                stored++;
+        }
+    }
+
+    return stored;
+}
+
+/** @brief Reads the decimation stage of a reader
+ *  @param ctx The reader context
+ *  @param filter The settings and the output rate at the current ODR
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250GetFilter(MPU9250_File_t *ctx, MPU9250_Filter_t *filter)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    unsigned int smpdiv;
+    int rv;
+
+    rv = regmap_read(mpu->regmap, MPU9250_SMPDIV, &smpdiv);
+
+    if(0 != rv)
+        return rv;
+
+    mutex_lock(&ctx->lock);
+
+    if(NULL != ctx->decimator)
+    {
+        *filter = ctx->decimator->filter;
+    }
+    else
+    {
+        memset(filter, 0, sizeof(*filter));
+        filter->decimation = 1;
+    }
+
+    mutex_unlock(&ctx->lock);
+
+    filter->rateMilliHz = DIV_ROUND_CLOSEST(1000000, (1 + smpdiv) * filter->decimation);
+
+    return 0;
+}
+
+/** @brief Sets the decimation stage of a reader, in streaming mode
+ *  The filter starts empty from the next unread record.
+ *  @param ctx The reader context
+ *  @param filter The settings
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SetFilter(MPU9250_File_t *ctx, const MPU9250_Filter_t *filter)
+{
+    MPU9250_Decimator_t *dec;
+
+    if(NULL == ctx->mpu->ring)
+        return -ENODEV;
+
+    if((MPU9250_FILTER_FIR < filter->type) ||
+       (1 > filter->decimation) || (MPU9250_FILTER_DECIMATION_MAX < filter->decimation) ||
+       ((MPU9250_FILTER_FIR == filter->type) && ((1 > filter->taps) || (MPU9250_FILTER_TAPS_MAX < filter->taps))))
+    {
+        return -EINVAL;
+    }
+
+    /* The records of one output must fit in the ring, or the reader would never catch up */
+    if((ctx->mpu->ring->capacity < filter->decimation) ||
+       ((MPU9250_FILTER_FIR == filter->type) && (ctx->mpu->ring->capacity < filter->taps)))
+    {
+        return -EINVAL;
+    }
+
+    if(mutex_lock_interruptible(&ctx->lock))
+        return -ERESTARTSYS;
+
+    dec = ctx->decimator;
+
+    if(NULL == dec)
+    {
+        dec = kzalloc(sizeof(*dec), GFP_KERNEL);
+
+        if(NULL == dec)
+        {
+            mutex_unlock(&ctx->lock);
+            return -ENOMEM;
+        }
+    }
+
+    dec->filter = *filter;
+    dec->filter.rateMilliHz = 0;
+
+    if(MPU9250_FILTER_FIR != filter->type)
+    {
+        dec->filter.taps = 0;
+        memset(dec->filter.coeff, 0, sizeof(dec->filter.coeff));
+    }
+
+    mpu9250DecimatorReset(dec);
+
+    /* Published once, poll() reads it without the file lock */
+    if(NULL == ctx->decimator)
+        smp_store_release(&ctx->decimator, dec);
+
+    mutex_unlock(&ctx->lock);
+
+    return 0;
+}
+
+/** @brief Moves the cursor of a reader that consumes the mapped ring by itself
+ *  @param ctx The reader
+ *  @param tail Next record the reader will copy, at most the ring head
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SetTail(MPU9250_File_t *ctx, u32 tail)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+
+    if(!ctx->mapped)
+        return -EINVAL;
+
+    /* Records not published yet cannot be consumed */
+    if((s32)(tail - smp_load_acquire(&mpu->ring->head)) > 0)
+        return -EINVAL;
+
+    if(mutex_lock_interruptible(&ctx->lock))
+        return -ERESTARTSYS;
+
+    WRITE_ONCE(ctx->cursor, tail);
+
+    mutex_unlock(&ctx->lock);
+
+    return 0;
+}
+static int mpu9250WaitData(struct file *filep)
+{
+    MPU9250_File_t *ctx = filep->private_data;
+    MPU9250_Dev_t *mpu = ctx->mpu;
+
+    /* Sleep until the drain path publishes a record */
+    if(mpu9250DataAvailable(ctx))
+        return 0;
+
+    if(filep->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+    if(wait_event_interruptible(mpu->readQueue, mpu9250DataAvailable(ctx)))
+        return -ERESTARTSYS;
+
+    return READ_ONCE(mpu->gone) ? -ENODEV : 0;
+}
+
+/** @brief Fills a user array with typed samples in streaming mode
+ *  Blocks until at least one sample is available unless the file is O_NONBLOCK.
+ *  @param filep A pointer to the file object being read
+ *  @param argp The user space MPU9250_Batch_t
+ *  @return 0 on success or a negative error code
+ */
+static long mpu9250BatchRead(struct file *filep, MPU9250_Batch_t __user *argp)
+{
+    MPU9250_File_t *ctx = filep->private_data;
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    MPU9250_Batch_t batch;
+    MPU9250_Sample_t __user *samples;
+    unsigned int stored = 0;
+    unsigned int n;
+    int rv = 0;
+
+    if(NULL == mpu->ring)
+        return -ENODEV;
+
+    if(copy_from_user(&batch, argp, sizeof(batch)))
+        return -EFAULT;
+
+    if(0 == batch.count)
+        return -EINVAL;
+
+    samples = u64_to_user_ptr(batch.samples);
+
+    do
+    {
+        rv = mpu9250WaitData(filep);
+
+        if(0 != rv)
+            return rv;
+
+        if(mutex_lock_interruptible(&ctx->lock))
+            return -ERESTARTSYS;
+
+        /* Copy records in chunks as large as the per file buffer */
+        while(stored < batch.count)
+        {
+            n = MIN(batch.count - stored, sizeof(ctx->message) / sizeof(MPU9250_Sample_t));
+
+            if(mpu9250DecimatorActive(ctx))
+                n = mpu9250DecimatorCopy(ctx, (MPU9250_Sample_t *)ctx->message, n);
+            else
+                n = mpu9250SharedRingCopyRecords(ctx, (MPU9250_Sample_t *)ctx->message, n);
+
+            if(0 == n)
+                break;
+
+            if(copy_to_user(samples + stored, ctx->message, n * sizeof(MPU9250_Sample_t)))
+            {
+                rv = -EFAULT;
+                break;
+            }
+
+            stored += n;
+        }
+
+        batch.overruns = ctx->overruns - ctx->reportedOverruns;
+        ctx->reportedOverruns = ctx->overruns;
+
+        mutex_unlock(&ctx->lock);
+
+    /* Every record seen was overwritten while copying, wait for new ones */
+    } while((0 == rv) && (0 == stored));
+
+    if(0 != rv)
+        return rv;
+
+    batch.count = stored;
+    this_cpu_add(mpu->counters->bytes, stored * sizeof(MPU9250_Sample_t));
+
+    return copy_to_user(argp, &batch, sizeof(batch)) ? -EFAULT : 0;
+}
+
+/** @brief Reads complete frames from the shared sample ring in streaming mode
+ *  Blocks until at least one frame is available unless the file is O_NONBLOCK.
+ *  @param filep A pointer to the file object being read
+ *  @param buffer The pointer to the user buffer, it must hold at least one frame
+ *  @param len The length of the user buffer
+ *  @return Number of bytes copied, always a multiple of the frame size of MPU9250_IOC_GET_LAYOUT
+ */
+static ssize_t mpu9250StreamRead(struct file *filep, char __user *buffer, size_t len)
+{
+    MPU9250_File_t *ctx = filep->private_data;
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    unsigned int fifoEnable = READ_ONCE(mpu->fifoEnable);
+    unsigned int frameSize = mpu9250FrameSize(fifoEnable);
+    unsigned int frames;
+    unsigned int i;
+    ssize_t total = 0;
+
+    /* One layout for the whole call, even if it is changed meanwhile */
+    if(frameSize > len)
+        return -EINVAL;
+
+    do
+    {
+        total = mpu9250WaitData(filep);
+
+        if(0 != total)
+            return total;
+
+        if(mutex_lock_interruptible(&ctx->lock))
+            return -ERESTARTSYS;
+
+        /* Convert records in chunks as large as the per file buffer */
+        while(frameSize <= len - total)
+        {
+            frames = MIN((len - total) / frameSize, sizeof(ctx->message) / frameSize);
+
+            if(mpu9250DecimatorActive(ctx))
+            {
+                /* Filtered records are encoded as frames of the same layout */
+                frames = mpu9250DecimatorCopy(ctx, ctx->decimator->output, MIN(frames, FILTER_CHUNK));
+
+                for(i = 0; i < frames; i++)
+                    mpu9250FrameEncode(&ctx->decimator->output[i], fifoEnable, (u8 *)ctx->message + i * frameSize);
+            }
+            else
+            {
+                frames = mpu9250SharedRingCopy(ctx, (u8 *)ctx->message, fifoEnable, frames);
+            }
+
+            if(0 == frames)
+                break;
+
+            if(0 != copy_to_user(buffer + total, ctx->message, frames * frameSize))
+            {
+                total = total ? total : -EFAULT;
+                break;
+            }
+
+            total += frames * frameSize;
+        }
+
+        mutex_unlock(&ctx->lock);
+
+    /* Every record seen was overwritten while copying, wait for new ones */
+    } while(0 == total);
+
+    return total;
+}
+static bool mpu9250DataAvailable(MPU9250_File_t *ctx)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+
+    /* Sleepers wake up once the sensor is removed and find it gone, the ring is freed after that */
+    if(READ_ONCE(mpu->gone) || (streaming && (NULL == mpu->ring)))
+        return true;
+
+    /* A filtered reader waits for the records that complete its next output */
+    if(streaming && mpu9250DecimatorActive(ctx))
+        return READ_ONCE(mpu->ring->head) - READ_ONCE(ctx->cursor) >= READ_ONCE(ctx->decimator->countdown);
+
+    if(streaming)
+        return READ_ONCE(mpu->ring->head) != ctx->cursor;
+
+    /* Without an interrupt line a register read is always possible */
+    return (0 >= mpu->irq) || (mpu->readySeq != ctx->consumedSeq);
+}
+/** @brief Reads registers starting at the file position, in register mode */
+static ssize_t mpu9250RegisterRead(struct file *filep, char __user *buffer, size_t len, loff_t *offset)
+{
+   MPU9250_File_t *ctx = filep->private_data;
+   MPU9250_Dev_t *mpu = ctx->mpu;
+   int rv;
+   int errCnt = 0;
+
+   if ((0 > *offset) || (REGISTER_MAX < *offset))
+      return -EINVAL;
+
+   /* With a data-ready interrupt wait for a sample newer than the last one read */
+   if (!mpu9250DataAvailable(ctx))
+   {
+      if (filep->f_flags & O_NONBLOCK)
+         return -EAGAIN;
+
+      if (wait_event_interruptible(mpu->readQueue, mpu9250DataAvailable(ctx)))
+         return -ERESTARTSYS;
+
+      if (READ_ONCE(mpu->gone))
+         return -ENODEV;
+   }
+
+   if (mutex_lock_interruptible(&ctx->lock))
+      return -ERESTARTSYS;
+
+   ctx->consumedSeq = mpu->readySeq;
+
+   /* Read data from MPU9250 starting at the register selected by the file position */
+   mutex_lock(&mpu->busLock);
+   rv = mpu9250ReadRegister(mpu, (u8)*offset, (u8 *)ctx->message, MIN(sizeof(ctx->message), len));
+   mutex_unlock(&mpu->busLock);
+
+   if(0 < rv)
+   {
+       /* Copy_to_user has the format ( *to, *from, size) and returns 0 on success */
+       errCnt = copy_to_user(buffer, ctx->message, rv);
+
+       if (0 != errCnt)
+       {
+          /* Failed -- return a bad address message (i.e. -14) */
+          rv = -EFAULT;
+       }
+   }
+
+   mutex_unlock(&ctx->lock);
+
+   return rv;
+}
+
+/*****************************************************************************************/
+/** @brief Finds the ring record nearest to a time without moving any reader cursor
+ *  Records are in time order, a binary search over the ones the producer did not
+ *  overwrite finds it. The copy is checked against the reserve counter, like a reader
+ *  of the mapped ring does.
+ *  @param mpu The sensor
+ *  @param timestamp The reference time [ns]
+ *  @param rec The record found
+ *  @return 0 on success, -EAGAIN when the ring is empty or the record was overwritten
+ */
+static int mpu9250SharedRingFind(MPU9250_Dev_t *mpu, s64 timestamp, MPU9250_Sample_t *rec)
+{
+    u32 capacity = mpu->ring->capacity;
+    u32 mask = capacity - 1;
+    u32 head = smp_load_acquire(&mpu->ring->head);
+    u32 count = MIN(head, capacity);
+    u32 base = head - count;
+    u32 lo = 0;
+    u32 hi = count - 1;
+    u32 mid;
+
+    if(0 == count)
+        return -EAGAIN;
+
+    /* Last record not after the reference, the oldest one if they all are */
+    while(lo < hi)
+    {
+        mid = (lo + hi + 1) >> 1;
+
+        if(READ_ONCE(mpu->ringRecords[(base + mid) & mask].timestamp) <= timestamp)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    /* Or the next one, whichever is nearer */
+    if((lo + 1 < count) &&
+       (mpu->ringRecords[(base + lo + 1) & mask].timestamp - timestamp < timestamp - mpu->ringRecords[(base + lo) & mask].timestamp))
+        lo++;
+
+    *rec = mpu->ringRecords[(base + lo) & mask];
+
+    smp_rmb();
+
+    if(READ_ONCE(mpu->ring->reserve) - (base + lo) > capacity)
+        return -EAGAIN;
+
+    return 0;
+}
+static void mpu9250GroupWork(struct work_struct *work)
+{
+    MPU9250_Dev_t *mpu = container_of(work, MPU9250_Dev_t, groupWork);
+    unsigned int fifoEnable = MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO | (mpu->magPresent ? MPU9250_FIFO_MAG : 0);
+    u8 frame[MPU9250_FIFO_FRAME_SIZE + MPU9250_FIFO_MAG_SIZE];
+    s64 start = mpu9250Timestamp();
+    int rv;
+
+    /* One burst from ACCEL_OUT, in the FIFO frame layout */
+    mutex_lock(&mpu->busLock);
+    rv = mpu9250ReadRegister(mpu, MPU9250_ACCEL_OUT, frame, mpu9250FrameSize(fifoEnable));
+    mutex_unlock(&mpu->busLock);
+
+    if(0 < rv)
+    {
+        mpu9250FrameDecode(frame, fifoEnable, &mpu->groupSample);
+
+        /* The registers were latched during the transfer */
+        mpu->groupSample.timestamp = start + ((mpu9250Timestamp() - start) >> 1);
+    }
+
+    mpu->groupRv = (0 > rv) ? rv : 0;
+}
+static bool mpu9250GroupMember(MPU9250_Dev_t *mpu)
+{
+    /* Nothing is sampled in wake-on-motion mode, nor streamed while the sensor sleeps */
+    return !READ_ONCE(mpu->wom.enable) && (!streaming || pm_runtime_active(mpu->dev));
+}
+
+/** @brief Returns one time-aligned sample of every probed sensor
+ *  In streaming mode the records nearest to a common time are picked from every ring,
+ *  so the alignment is as good as the interpolated timestamps and costs no bus traffic.
+ *  In register mode every sensor is read by its own work on the unbound workqueue, the
+ *  reads on different I2C controllers overlap and the samples are taken within one
+ *  transfer time of each other.
+ *  @param argp The user space MPU9250_Group_t
+ *  @return 0 on success or a negative error code
+ */
+static long mpu9250GroupRead(MPU9250_Group_t __user *argp)
+{
+    MPU9250_Group_t group;
+    MPU9250_Dev_t *mpu;
+    unsigned long queued = 0;
+    u32 head;
+
+    memset(&group, 0, sizeof(group));
+
+    if(get_user(group.timestamp, &argp->timestamp))
+        return -EFAULT;
+
+    mutex_lock(&g_devicesLock);
+
+    if(streaming)
+    {
+        /* The newest time every sensor already reached */
+        if(0 == group.timestamp)
+        {
+            group.timestamp = S64_MAX;
+
+            list_for_each_entry(mpu, &g_devices, node)
+            {
+                head = smp_load_acquire(&mpu->ring->head);
+
+                if(mpu9250GroupMember(mpu) && (0 != head))
+                    group.timestamp = min(group.timestamp, READ_ONCE(mpu->ringRecords[(head - 1) & (mpu->ring->capacity - 1)].timestamp));
+            }
+
+            /* No sensor has a record yet */
+            if(S64_MAX == group.timestamp)
+                group.timestamp = 0;
+        }
+
+        list_for_each_entry(mpu, &g_devices, node)
+        {
+            if(mpu9250GroupMember(mpu) && (0 == mpu9250SharedRingFind(mpu, group.timestamp, &group.samples[group.count])))
+                group.index[group.count++] = mpu->index;
+        }
+    }
+    else
+    {
+        group.timestamp = mpu9250Timestamp();
+
+        /* Start every read before waiting for any */
+        list_for_each_entry(mpu, &g_devices, node)
+        {
+            if(!mpu9250GroupMember(mpu))
+                continue;
+
+            /* Sensors nobody has open are asleep */
+            if(0 > pm_runtime_get_sync(mpu->dev))
+            {
+                pm_runtime_put_noidle(mpu->dev);
+                continue;
+            }
+
+            __set_bit(mpu->index, &queued);
+            queue_work(system_unbound_wq, &mpu->groupWork);
+        }
+
+        list_for_each_entry(mpu, &g_devices, node)
+        {
+            if(!test_bit(mpu->index, &queued))
+                continue;
+
+            flush_work(&mpu->groupWork);
+
+            if(0 == mpu->groupRv)
+            {
+                group.samples[group.count] = mpu->groupSample;
+                group.index[group.count++] = mpu->index;
+            }
+
+            pm_runtime_mark_last_busy(mpu->dev);
+            pm_runtime_put_autosuspend(mpu->dev);
+        }
+    }
+
+    mutex_unlock(&g_devicesLock);
+
+    return copy_to_user(argp, &group, sizeof(group)) ? -EFAULT : 0;
+}
+
+/*****************************************************************************************/
+/* Low-power accelerometer rates indexed by LP_ACCEL_ODR [1e-3 Hz] */
+static const u32 g_lpOdrMilliHz[] = { 240, 490, 980, 1950, 3910, 7810, 15630, 31250, 62500, 125000, 250000, 500000 };
+
+static unsigned int mpu9250LpOdrIndex(u32 milliHz)
+{
+    unsigned int i;
+
+    /* Rates double from one to the next, round to the nearest */
+    for(i = 1; i < ARRAY_SIZE(g_lpOdrMilliHz); i++)
+    {
+        if(milliHz < (g_lpOdrMilliHz[i - 1] + g_lpOdrMilliHz[i]) / 2)
+            break;
+    }
+
+    return i - 1;
+}
+
+/** @brief Returns the sensor to full rate sampling
+ *  Undoes mpu9250WomEnter(): cycle mode, the motion comparator and the gyro are
+ *  turned off in the reverse order, the magnetometer measurement restarts and, in
+ *  streaming mode, the FIFO restarts empty with a new timestamp model. Called with
+ *  mpu->womLock held.
+ *  @param mpu The sensor
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250WomExit(MPU9250_Dev_t *mpu)
+{
+    const u8 sequence[][2] =
+    {
+        { MPU9250_PWR_MGMNT_1,     MPU9250_CLOCK_SEL_PLL },
+        { MPU9250_MOT_DETECT_CTRL, 0x00 },
+        { MPU9250_INT_ENABLE,      (0 < mpu->irq) ? MPU9250_INT_RAW_RDY_EN : MPU9250_INT_DISABLE },
+        { MPU9250_ACCEL_CONFIG2,   mpu->womAccelConfig2 },
+        { MPU9250_PWR_MGMNT_2,     MPU9250_SEN_ENABLE },
+    };
+    unsigned int i;
+    int rv = 0;
+
+    mutex_lock(&mpu->busLock);
+
+    for(i = 0; (0 == rv) && (i < ARRAY_SIZE(sequence)); i++)
+    {
+        if(0 > mpu9250WriteRegister(mpu, sequence[i][0], sequence[i][1]))
+            rv = -EIO;
+    }
+
+    if((0 == rv) && mpu->magPresent)
+        rv = mpu9250MagResume(mpu);
+
+    if((0 == rv) && (NULL != mpu->ring))
+    {
+        if((0 > mpu9250WriteRegister(mpu, MPU9250_FIFO_EN, mpu->fifoEnable)) ||
+           (0 != mpu9250FifoReset(mpu)))
+            rv = -EIO;
+
+        mpu->samplePeriod = 0;
+    }
+
+    mutex_unlock(&mpu->busLock);
+
+    WRITE_ONCE(mpu->wom.enable, 0);
+
+    /* Without interrupt the hardware FIFO is drained periodically again */
+    if((NULL != mpu->ring) && (0 >= mpu->irq))
+        schedule_delayed_work(&mpu->drainWork, msecs_to_jiffies(fifo_poll_ms));
+
+    return rv;
+}
+
+/** @brief Puts the sensor in wake-on-motion mode
+ *  Follows the low-power accelerometer sequence of the MPU9250: gyro off, accel DLPF
+ *  bypassed, motion interrupt only, comparator against the previous sample, then cycle
+ *  mode at the low-power rate. The magnetometer is powered down and FIFO writes stop,
+ *  so between wake-ups the bus and the CPU stay idle. Called with mpu->womLock held.
+ *  @param mpu The sensor
+ *  @param wom The threshold and low-power rate
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250WomEnter(MPU9250_Dev_t *mpu, const MPU9250_Wom_t *wom)
+{
+    const u8 sequence[][2] =
+    {
+        { MPU9250_FIFO_EN,         0x00 },
+        { MPU9250_PWR_MGMNT_2,     MPU9250_DIS_GYRO },
+        { MPU9250_ACCEL_CONFIG2,   MPU9250_ACCEL_FCHOICE_B | MPU9250_ACCEL_DLPF_184 },
+        { MPU9250_INT_ENABLE,      MPU9250_INT_WOM_EN },
+        { MPU9250_MOT_DETECT_CTRL, MPU9250_ACCEL_INTEL_EN | MPU9250_ACCEL_INTEL_MODE },
+        { MPU9250_LP_ACCEL_ODR,    mpu9250LpOdrIndex(wom->lpOdrMilliHz) },
+        { MPU9250_WOM_THR,         wom->thresholdMg >> 2 },
+        { MPU9250_PWR_MGMNT_1,     MPU9250_CLOCK_SEL_PLL | MPU9250_PWR_CYCLE },
+    };
+    unsigned int i;
+    u8 status;
+    int rv;
+
+    /* The drain stops before the FIFO does, an interrupt driven drain then finds it empty */
+    if(NULL != mpu->ring)
+        cancel_delayed_work_sync(&mpu->drainWork);
+
+    mutex_lock(&mpu->busLock);
+
+    rv = regmap_read(mpu->regmap, MPU9250_ACCEL_CONFIG2, &mpu->womAccelConfig2);
+
+    if((0 == rv) && mpu->magPresent)
+        mpu9250MagSuspend(mpu);
+
+    for(i = 0; (0 == rv) && (i < ARRAY_SIZE(sequence)); i++)
+    {
+        if(0 > mpu9250WriteRegister(mpu, sequence[i][0], sequence[i][1]))
+            rv = -EIO;
+    }
+
+    /* Drop a motion flag latched before the comparator had a reference */
+    if(0 == rv)
+        mpu9250ReadRegister(mpu, MPU9250_INT_STATUS, &status, 1);
+
+    mutex_unlock(&mpu->busLock);
+
+    if(0 != rv)
+    {
+        mpu9250WomExit(mpu);
+        return rv;
+    }
+
+    WRITE_ONCE(mpu->wom.enable, 1);
+
+    /* Without interrupt INT_STATUS is polled, one register read per period */
+    if(0 >= mpu->irq)
+        schedule_delayed_work(&mpu->womWork, msecs_to_jiffies(wom_poll_ms));
+
+    return 0;
+}
+
+/** @brief Enters or leaves wake-on-motion mode, or changes its settings while in it
+ *  @param mpu The sensor
+ *  @param wom The settings
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SetWom(MPU9250_Dev_t *mpu, const MPU9250_Wom_t *wom)
+{
+    u8 regs[2];
+    int rv = 0;
+
+    if((1 < wom->enable) || (1 < wom->autoWake) ||
+       (4 > wom->thresholdMg) || (1020 < wom->thresholdMg) ||
+       (MPU9250_WOM_ODR_MIN > wom->lpOdrMilliHz) || (MPU9250_WOM_ODR_MAX < wom->lpOdrMilliHz))
+    {
+        return -EINVAL;
+    }
+
+    mutex_lock(&mpu->womLock);
+
+    if(wom->enable && mpu->wom.enable)
+    {
+        /* LP_ACCEL_ODR and WOM_THR are consecutive */
+        regs[0] = mpu9250LpOdrIndex(wom->lpOdrMilliHz);
+        regs[1] = wom->thresholdMg >> 2;
+
+        mutex_lock(&mpu->busLock);
+        rv = (0 > mpu9250WriteRegisters(mpu, MPU9250_LP_ACCEL_ODR, regs, sizeof(regs))) ? -EIO : 0;
+        mutex_unlock(&mpu->busLock);
+    }
+    else if(wom->enable)
+    {
+        rv = mpu9250WomEnter(mpu, wom);
+    }
+    else if(mpu->wom.enable)
+    {
+        rv = mpu9250WomExit(mpu);
+    }
+
+    if(0 == rv)
+    {
+        /* Report what the sensor actually does */
+        mpu->wom.thresholdMg = wom->thresholdMg & ~3;
+        mpu->wom.lpOdrMilliHz = g_lpOdrMilliHz[mpu9250LpOdrIndex(wom->lpOdrMilliHz)];
+        mpu->wom.autoWake = wom->autoWake;
+    }
+
+    mutex_unlock(&mpu->womLock);
+
+    return rv;
+}
+
+/** @brief Delivers a motion event when the sensor flagged one
+ *  Called from the interrupt thread, or from the polling work without interrupt.
+ *  With autoWake the sensor is back at full rate before readers are woken.
+ *  @param mpu The sensor
+ *  @param timestamp Time the motion was noticed [ns]
+ */
+static void mpu9250WomCheck(MPU9250_Dev_t *mpu, s64 timestamp)
+{
+    u8 status;
+    int rv;
+
+    mutex_lock(&mpu->womLock);
+
+    if(!mpu->wom.enable)
+        goto out;
+
+    mutex_lock(&mpu->busLock);
+    rv = mpu9250ReadRegister(mpu, MPU9250_INT_STATUS, &status, 1);
+    mutex_unlock(&mpu->busLock);
+
+    if((0 < rv) && (status & MPU9250_INT_WOM))
+    {
+        mpu->motionTimestamp = timestamp;
+        mpu->motionAwake = mpu->wom.autoWake && (0 == mpu9250WomExit(mpu));
+        WRITE_ONCE(mpu->motionSeq, mpu->motionSeq + 1);
+
+        this_cpu_inc(mpu->counters->motionEvents);
+        trace_mpu9250_motion(timestamp, mpu->motionAwake);
+
+        wake_up_interruptible(&mpu->readQueue);
+    }
+
+    if(mpu->wom.enable && (0 >= mpu->irq))
+        schedule_delayed_work(&mpu->womWork, msecs_to_jiffies(wom_poll_ms));
+
+out:
+    mutex_unlock(&mpu->womLock);
+}
+static void mpu9250WomWork(struct work_struct *work)
+{
+    MPU9250_Dev_t *mpu = container_of(to_delayed_work(work), MPU9250_Dev_t, womWork);
+    mpu9250WomCheck(mpu, mpu9250Timestamp());
+}
+static void mpu9250WomStop(MPU9250_Dev_t *mpu)
+{
+    mutex_lock(&mpu->womLock);
+
+    if(mpu->wom.enable)
+        mpu9250WomExit(mpu);
+
+    mutex_unlock(&mpu->womLock);
+
+    /* A pending check finds the mode off and does not come back */
+    cancel_delayed_work_sync(&mpu->womWork);
+}
+static bool mpu9250EventAvailable(MPU9250_File_t *ctx)
+{
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    return READ_ONCE(mpu->gone) || (READ_ONCE(mpu->motionSeq) != READ_ONCE(ctx->motionSeen));
+}
+
+/** @brief Returns the newest motion event this file did not read yet
+ *  Blocks until there is one unless the file is O_NONBLOCK.
+ *  @param filep A pointer to the file object
+ *  @param argp The user space MPU9250_Event_t
+ *  @return 0 on success or a negative error code
+ */
+static long mpu9250ReadEvent(struct file *filep, MPU9250_Event_t __user *argp)
+{
+    MPU9250_File_t *ctx = filep->private_data;
+    MPU9250_Dev_t *mpu = ctx->mpu;
+    MPU9250_Event_t event;
+    unsigned long seq;
+
+    if(!mpu9250EventAvailable(ctx))
+    {
+        if(filep->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        if(wait_event_interruptible(mpu->readQueue, mpu9250EventAvailable(ctx)))
+            return -ERESTARTSYS;
+
+        if(READ_ONCE(mpu->gone))
+            return -ENODEV;
+    }
+
+    memset(&event, 0, sizeof(event));
+
+    mutex_lock(&mpu->womLock);
+    seq = mpu->motionSeq;
+    event.timestamp = mpu->motionTimestamp;
+    event.awake = mpu->motionAwake;
+    mutex_unlock(&mpu->womLock);
+
+    mutex_lock(&ctx->lock);
+    event.seq = seq;
+    event.missed = (seq != ctx->motionSeen) ? seq - ctx->motionSeen - 1 : 0;
+    WRITE_ONCE(ctx->motionSeen, seq);
+    mutex_unlock(&ctx->lock);
+
+    return copy_to_user(argp, &event, sizeof(event)) ? -EFAULT : 0;
+}
+
+/*****************************************************************************************/
+static void mpu9250ResumeDone(MPU9250_Dev_t *mpu, u64 start, bool synced)
+{
+    u64 latency = ktime_get_ns() - start;
+
+    this_cpu_inc(mpu->counters->resumes);
+    this_cpu_add(mpu->counters->resumeTime, latency);
+
+    if(synced)
+        this_cpu_inc(mpu->counters->resumeSyncs);
+
+    trace_mpu9250_resume(latency, synced);
+}
+
+/** @brief Waits for the first sample after a wake-up, in register mode
+ *  Until then the output registers hold the values from before the sleep.
+ *  @param mpu The sensor
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250WaitSample(MPU9250_Dev_t *mpu)
+{
+    unsigned int i;
+    u8 status;
+
+    for(i = 0; i < RESUME_POLLS; i++)
+    {
+        mutex_lock(&mpu->busLock);
+        status = 0;
+        mpu9250ReadRegister(mpu, MPU9250_INT_STATUS, &status, 1);
+        mutex_unlock(&mpu->busLock);
+
+        if(status & MPU9250_INT_RAW_RDY)
+            return 0;
+
+        usleep_range(500, 1000);
+    }
+
+    return -ETIMEDOUT;
+}
+
+/** @brief Restores the sensor after a runtime or system suspend
+ *  The register cache is the shadow of the whole configuration. A sensor that only
+ *  slept kept its registers, then the two power registers are the only ones to write.
+ *  After a power loss every cached register is rewritten by regcache_sync(), which
+ *  joins consecutive registers in one transaction. The time to the first sample is
+ *  measured, see mpu9250ResumeDone(). Wake-on-motion left by a system suspend is entered
+ *  again instead, with the same settings.
+ *  @param dev The device of the sensor on its bus
+ *  @return 0 on success or a negative error code
+ */
+static int __maybe_unused mpu9250RuntimeResume(struct device *dev)
+{
+    MPU9250_Dev_t *mpu = dev_get_drvdata(dev);
+    u64 start = ktime_get_ns();
+    bool synced = false;
+    u8 regs[2];
+    u8 status;
+    int rv;
+
+    mutex_lock(&mpu->busLock);
+
+    regcache_cache_only(mpu->regmap, false);
+
+    /* The reset value of PWR_MGMT_1 has SLEEP clear, so a set bit means the registers survived */
+    rv = mpu9250ReadRegister(mpu, MPU9250_PWR_MGMNT_1, regs, 1);
+
+    if((0 < rv) && (regs[0] & MPU9250_PWR_SLEEP))
+    {
+        /* Drop the data-ready flag of the last sample before the sleep */
+        mpu9250ReadRegister(mpu, MPU9250_INT_STATUS, &status, 1);
+
+        /* PWR_MGMT_1 and PWR_MGMT_2 are consecutive, wake up in one transaction */
+        rv = regmap_bulk_read(mpu->regmap, MPU9250_PWR_MGMNT_1, regs, sizeof(regs));
+
+        if(0 == rv)
+            rv = regmap_bulk_write(mpu->regmap, MPU9250_PWR_MGMNT_1, regs, sizeof(regs));
+    }
+    else
+    {
+        regcache_mark_dirty(mpu->regmap);
+        rv = regcache_sync(mpu->regmap);
+        synced = true;
+
+        mpu9250ReadRegister(mpu, MPU9250_INT_STATUS, &status, 1);
+    }
+
+    /* USER_CTRL is not cached, in streaming mode the FIFO restarts empty */
+    if(0 == rv)
+        rv = (NULL != mpu->ring) ? mpu9250FifoReset(mpu) : mpu9250SendRegister(mpu, MPU9250_USER_CTRL, mpu->bus->userCtrl | MPU9250_I2C_MST_EN);
+
+    if((0 == rv) && mpu->magPresent)
+        rv = mpu9250MagResume(mpu);
+
+    mpu->samplePeriod = 0;
+
+    mutex_unlock(&mpu->busLock);
+
+    if(0 < mpu->irq)
+        enable_irq(mpu->irq);
+
+    if(0 != rv)
+        return rv;
+
+    /* The files that armed wake-on-motion keep waiting for motion, nothing is sampled until then */
+    if(mpu->womResume)
+    {
+        mpu->womResume = false;
+
+        mutex_lock(&mpu->womLock);
+        rv = mpu9250WomEnter(mpu, &mpu->wom);
+        mutex_unlock(&mpu->womLock);
+
+        if(0 != rv)
+            dev_warn(mpu->dev, "From Resume: Wake-on-motion restore fail, sampling at full rate.\n");
+
+        return 0;
+    }
+
+    if(NULL != mpu->ring)
+    {
+        /* The first drained frame closes the measurement */
+        mpu->resumeSynced = synced;
+        WRITE_ONCE(mpu->resumeStart, start);
+
+        if(0 >= mpu->irq)
+            schedule_delayed_work(&mpu->drainWork, msecs_to_jiffies(fifo_poll_ms));
+    }
+    else if(0 == mpu9250WaitSample(mpu))
+    {
+        mpu9250ResumeDone(mpu, start, synced);
+    }
+
+    return 0;
+}
+
+/** @brief Puts the sensor to sleep after autosuspend_ms without users, or on system suspend
+ *  Wake-on-motion is left first, so the register cache holds the full rate configuration.
+ *  With files open this is a system suspend, and resume enters wake-on-motion again.
+ *  The sleep writes bypass the cache and, until resume, configuration writes only
+ *  update the cache.
+ *  @param dev The device of the sensor on its bus
+ *  @return 0 on success or a negative error code
+ */
+static int __maybe_unused mpu9250RuntimeSuspend(struct device *dev)
+{
+    MPU9250_Dev_t *mpu = dev_get_drvdata(dev);
+    const u8 sleep[2] = { MPU9250_CLOCK_SEL_PLL | MPU9250_PWR_SLEEP, MPU9250_DIS_ACCEL | MPU9250_DIS_GYRO };
+    int rv;
+
+    /* Open files hold the sensor awake, only a system suspend gets here with one */
+    mpu->womResume = READ_ONCE(mpu->wom.enable) && (0 < atomic_read(&mpu->numberOpens));
+
+    mpu9250WomStop(mpu);
+
+    /* No drain or interrupt thread may run on a sleeping sensor */
+    if(0 < mpu->irq)
+        disable_irq(mpu->irq);
+
+    if(NULL != mpu->ring)
+        cancel_delayed_work_sync(&mpu->drainWork);
+
+    mutex_lock(&mpu->busLock);
+
+    if(mpu->magPresent)
+        mpu9250MagSuspend(mpu);
+
+    regcache_cache_bypass(mpu->regmap, true);
+    rv = regmap_bulk_write(mpu->regmap, MPU9250_PWR_MGMNT_1, sleep, sizeof(sleep));
+    regcache_cache_bypass(mpu->regmap, false);
+
+    if(0 == rv)
+        regcache_cache_only(mpu->regmap, true);
+
+    mutex_unlock(&mpu->busLock);
+
+    if(0 != rv)
+    {
+        /* Stay up, the PM core retries later */
+        mpu9250RuntimeResume(dev);
+        return -EBUSY;
+    }
+
+    return 0;
+}
+
+/* Runtime PM, and system sleep through the same callbacks */
+const struct dev_pm_ops g_mpu9250PmOps =
+{
+    SET_SYSTEM_SLEEP_PM_OPS(pm_runtime_force_suspend, pm_runtime_force_resume)
+    SET_RUNTIME_PM_OPS(mpu9250RuntimeSuspend, mpu9250RuntimeResume, NULL)
+};
+
+/*****************************************************************************************/
+static irqreturn_t mpu9250IrqHandler(int irq, void *devId)
+{
+    MPU9250_Dev_t *mpu = devId;
+    s64 timestamp = mpu9250Timestamp();
+
+    /* Timestamp as close to the sample as possible */
+    atomic64_set(&mpu->irqTimestamp, timestamp);
+
+    this_cpu_inc(mpu->counters->irqs);
+    trace_mpu9250_irq(timestamp);
+
+    /* Wake-on-motion: the motion interrupt is the only one enabled, INT_STATUS is read in the thread */
+    if(READ_ONCE(mpu->wom.enable))
+        return IRQ_WAKE_THREAD;
+
+    /* Feed the IIO data-ready trigger */
+    mpu9250IioTriggerPoll(mpu);
+
+    /* Register mode: just signal readers that a new sample is in the output registers */
+    if(!streaming)
+    {
+        mpu->readySeq++;
+        wake_up_interruptible(&mpu->readQueue);
+
+        return IRQ_HANDLED;
+    }
+
+    /* Streaming mode: batch data-ready events so each drain moves several frames */
+    if(++mpu->irqCount < irq_batch)
+        return IRQ_HANDLED;
+
+    mpu->irqCount = 0;
+
+    return IRQ_WAKE_THREAD;
+}
+static irqreturn_t mpu9250IrqThread(int irq, void *devId)
+{
+    MPU9250_Dev_t *mpu = devId;
+
+    if(READ_ONCE(mpu->wom.enable))
+    {
+        mpu9250WomCheck(mpu, atomic64_read(&mpu->irqTimestamp));
+        return IRQ_HANDLED;
+    }
+
+    if(0 > mpu9250FifoDrain(mpu))
+    {
+        pr_info_ratelimited("From IRQ: Read hardware FIFO fail.\n");
+    }
+
+    wake_up_interruptible(&mpu->readQueue);
+
+    return IRQ_HANDLED;
+}
+static int mpu9250IrqStart(MPU9250_Dev_t *mpu, int irq)
+{
+    int rv;
+
+    rv = request_threaded_irq(irq, mpu9250IrqHandler, mpu9250IrqThread, 0, dev_name(mpu->dev), mpu);
+
+    if(0 != rv)
+        return rv;
+
+    /* Active high, push-pull, 50 us pulse on every new sample */
+    if ((0 > mpu9250WriteRegister(mpu, MPU9250_INT_PIN_CFG, MPU9250_INT_PULSE_50US)) ||
+        (0 > mpu9250WriteRegister(mpu, MPU9250_INT_ENABLE, MPU9250_INT_RAW_RDY_EN)))
+    {
+        free_irq(irq, mpu);
+        return -EIO;
+    }
+
+    return 0;
+}
+static void mpu9250IrqStop(MPU9250_Dev_t *mpu)
+{
+    mpu9250SendRegister(mpu, MPU9250_INT_ENABLE, MPU9250_INT_DISABLE);
+
+    free_irq(mpu->irq, mpu);
+}
+
+/*****************************************************************************************/
+/** @brief Adds the counters of every CPU */
+static void mpu9250CountersSum(MPU9250_Dev_t *mpu, MPU9250_Counters_t *sum)
+{
+    const u64 *counters;
+    u64 *total = (u64 *)sum;
+    unsigned int i;
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+
+    /* Every field is a u64 counter */
+    for_each_possible_cpu(cpu)
+    {
+        counters = (const u64 *)per_cpu_ptr(mpu->counters, cpu);
+
+        for(i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+            total[i] += counters[i];
+    }
+}
+
+#define MPU9250_COUNTER_ATTR(_name, _field)                                       \
+static ssize_t _name##_show(struct device *dev, struct device_attribute *attr, char *buf) \
+{                                                                                 \
+    MPU9250_Dev_t *mpu = dev_get_drvdata(dev);                                    \
+    MPU9250_Counters_t sum;                                                       \
+                                                                                  \
+    mpu9250CountersSum(mpu, &sum);                                                \
+    return sprintf(buf, "%llu\n", sum._field);                                    \
+}                                                                                 \
+static DEVICE_ATTR_RO(_name)
+
+MPU9250_COUNTER_ATTR(samples, samples);
+MPU9250_COUNTER_ATTR(bytes, bytes);
+MPU9250_COUNTER_ATTR(bus_transfers, busTransfers);
+MPU9250_COUNTER_ATTR(bus_bytes, busBytes);
+MPU9250_COUNTER_ATTR(bus_errors, busErrors);
+MPU9250_COUNTER_ATTR(fifo_overflows, fifoOverflows);
+MPU9250_COUNTER_ATTR(overruns, overruns);
+MPU9250_COUNTER_ATTR(irqs, irqs);
+MPU9250_COUNTER_ATTR(motion_events, motionEvents);
+MPU9250_COUNTER_ATTR(resumes, resumes);
+MPU9250_COUNTER_ATTR(resume_syncs, resumeSyncs);
+MPU9250_COUNTER_ATTR(resume_time, resumeTime);
+
+/** @brief Sensor reads by bus time, one "lower bound [ns] count" line per bucket */
+static ssize_t xfer_time_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    MPU9250_Dev_t *mpu = dev_get_drvdata(dev);
+    MPU9250_Counters_t sum;
+    ssize_t len = 0;
+    unsigned int i;
+
+    mpu9250CountersSum(mpu, &sum);
+
+    for(i = 0; i < XFER_BUCKETS; i++)
+        len += sprintf(buf + len, "%llu %llu\n", (0 == i) ? 0ULL : 1ULL << (12 + i), sum.xferTime[i]);
+
+    return len;
+}
+static DEVICE_ATTR_RO(xfer_time);
+
+/** @brief Time from the start of probe to the sensor ready [ns] */
+static ssize_t probe_time_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    MPU9250_Dev_t *mpu = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%llu\n", mpu->probeTime);
+}
+static DEVICE_ATTR_RO(probe_time);
+
+static struct attribute *g_statsAttrs[] =
+{
+    &dev_attr_samples.attr,
+    &dev_attr_bytes.attr,
+    &dev_attr_bus_transfers.attr,
+    &dev_attr_bus_bytes.attr,
+    &dev_attr_bus_errors.attr,
+    &dev_attr_fifo_overflows.attr,
+    &dev_attr_overruns.attr,
+    &dev_attr_irqs.attr,
+    &dev_attr_motion_events.attr,
+    &dev_attr_resumes.attr,
+    &dev_attr_resume_syncs.attr,
+    &dev_attr_resume_time.attr,
+    &dev_attr_xfer_time.attr,
+    &dev_attr_probe_time.attr,
+    NULL,
+};
+
+/* Under the bus device, e.g. /sys/bus/i2c/devices/1-0068/statistics or /sys/bus/spi/devices/spi1.0/statistics */
+static const struct attribute_group g_statsGroup =
+{
+    .name = "statistics",
+    .attrs = g_statsAttrs,
+};
+
+/*****************************************************************************************/
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+
+#define MPU9250_IIO_CHANNEL(_type, _axis, _address, _index)                       \
+{                                                                                 \
+    .type = _type,                                                                \
+    .modified = 1,                                                                \
+    .channel2 = _axis,                                                            \
+    .address = _address,                                                          \
+    .info_mask_separate = BIT(IIO_CHAN_INFO_RAW),                                 \
+    .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),                         \
+    .info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),                      \
+    .scan_index = _index,                                                         \
+    .scan_type = { .sign = 's', .realbits = 16, .storagebits = 16, .endianness = IIO_BE }, \
+}
+
+/* The AK8963 is little-endian and every axis has its own fuse ROM adjustment */
+#define MPU9250_IIO_MAGN_CHANNEL(_axis, _address, _index)                         \
+{                                                                                 \
+    .type = IIO_MAGN,                                                             \
+    .modified = 1,                                                                \
+    .channel2 = _axis,                                                            \
+    .address = _address,                                                          \
+    .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE),      \
+    .info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),                      \
+    .scan_index = _index,                                                         \
+    .scan_type = { .sign = 's', .realbits = 16, .storagebits = 16, .endianness = IIO_LE }, \
+}
+
+/* Scan indexes follow the register order, so one ACCEL_OUT burst is a whole scan */
+#define MPU9250_IIO_IMU_CHANNELS                                                  \
+    MPU9250_IIO_CHANNEL(IIO_ACCEL,    IIO_MOD_X, MPU9250_ACCEL_OUT,     0),       \
+    MPU9250_IIO_CHANNEL(IIO_ACCEL,    IIO_MOD_Y, MPU9250_ACCEL_OUT + 2, 1),       \
+    MPU9250_IIO_CHANNEL(IIO_ACCEL,    IIO_MOD_Z, MPU9250_ACCEL_OUT + 4, 2),       \
+    {                                                                             \
+        .type = IIO_TEMP,                                                         \
+        .address = MPU9250_TEMP_OUT,                                              \
+        .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE) | BIT(IIO_CHAN_INFO_OFFSET), \
+        .info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),                  \
+        .scan_index = 3,                                                          \
+        .scan_type = { .sign = 's', .realbits = 16, .storagebits = 16, .endianness = IIO_BE }, \
+    },                                                                            \
+    MPU9250_IIO_CHANNEL(IIO_ANGL_VEL, IIO_MOD_X, MPU9250_GYRO_OUT,      4),       \
+    MPU9250_IIO_CHANNEL(IIO_ANGL_VEL, IIO_MOD_Y, MPU9250_GYRO_OUT + 2,  5),       \
+    MPU9250_IIO_CHANNEL(IIO_ANGL_VEL, IIO_MOD_Z, MPU9250_GYRO_OUT + 4,  6)
+
+static const struct iio_chan_spec g_iioChannels[] =
+{
+    MPU9250_IIO_IMU_CHANNELS,
+    IIO_CHAN_SOFT_TIMESTAMP(7),
+};
+
+/* With the AK8963 the EXT_SENS_DATA registers follow GYRO_OUT, still one burst */
+static const struct iio_chan_spec g_iioMagChannels[] =
+{
+    MPU9250_IIO_IMU_CHANNELS,
+    MPU9250_IIO_MAGN_CHANNEL(IIO_MOD_X, MPU9250_EXT_SENS_DATA_00,     7),
+    MPU9250_IIO_MAGN_CHANNEL(IIO_MOD_Y, MPU9250_EXT_SENS_DATA_00 + 2, 8),
+    MPU9250_IIO_MAGN_CHANNEL(IIO_MOD_Z, MPU9250_EXT_SENS_DATA_00 + 4, 9),
+    IIO_CHAN_SOFT_TIMESTAMP(10),
+};
+
+/* Every scan reads all channels, the IIO core demuxes the ones enabled by the user */
+static const unsigned long g_iioScanMasks[] = { GENMASK(6, 0), 0 };
+static const unsigned long g_iioMagScanMasks[] = { GENMASK(9, 0), 0 };
+
+static int mpu9250IioReadRaw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan, int *val, int *val2, long mask)
+{
+    MPU9250_Dev_t *mpu = iio_device_get_drvdata(indio_dev);
+    int rv;
+    unsigned int reg;
+    u8 rx[2];
+
+    switch(mask)
+    {
+        case IIO_CHAN_INFO_RAW:
+            rv = iio_device_claim_direct_mode(indio_dev);
+
+            if(0 != rv)
+                return rv;
+
+            rv = pm_runtime_get_sync(mpu->dev);
+
+            if(0 <= rv)
+            {
+                mutex_lock(&mpu->busLock);
+                rv = mpu9250ReadRegister(mpu, chan->address, rx, 2);
+                mutex_unlock(&mpu->busLock);
+
+                pm_runtime_mark_last_busy(mpu->dev);
+                pm_runtime_put_autosuspend(mpu->dev);
+            }
+            else
+            {
+                pm_runtime_put_noidle(mpu->dev);
+            }
+
+            iio_device_release_direct_mode(indio_dev);
+
+            if(0 > rv)
+                return rv;
+
+            if(IIO_MAGN == chan->type)
+                *val = (s16)((rx[1] << 8) | rx[0]);
+            else
+                *val = (s16)((rx[0] << 8) | rx[1]);
+
+            return IIO_VAL_INT;
+
+        case IIO_CHAN_INFO_SCALE:
+            if(IIO_TEMP == chan->type)
+            {
+                /* 333.87 LSB / C */
+                *val = 2;
+                *val2 = 995178;
+                return IIO_VAL_INT_PLUS_MICRO;
+            }
+
+            if(IIO_MAGN == chan->type)
+            {
+                /* Gauss / LSB, x, y and z follow each other from EXT_SENS_DATA_00 */
+                *val = 0;
+                *val2 = mpu->magScaleNano[(chan->address - MPU9250_EXT_SENS_DATA_00) >> 1];
+                return IIO_VAL_INT_PLUS_NANO;
+            }
+
+            /* Full scale comes from the register cache, no bus traffic */
+            rv = regmap_read(mpu->regmap, (IIO_ACCEL == chan->type) ? MPU9250_ACCEL_CONFIG : MPU9250_GYRO_CONFIG, &reg);
+
+            if(0 != rv)
+                return rv;
+
+            *val = 0;
+            *val2 = (IIO_ACCEL == chan->type) ? g_accelScaleNano[(reg >> 3) & 0x03] : g_gyroScaleNano[(reg >> 3) & 0x03];
+            return IIO_VAL_INT_PLUS_NANO;
+
+        case IIO_CHAN_INFO_OFFSET:
+            /* 21 C at 0 LSB */
+            *val = 7011;
+            *val2 = 270000;
+            return IIO_VAL_INT_PLUS_MICRO;
+
+        case IIO_CHAN_INFO_SAMP_FREQ:
+            rv = regmap_read(mpu->regmap, MPU9250_SMPDIV, &reg);
+
+            if(0 != rv)
+                return rv;
+
+            /* Internal sample rate is 1 kHz with the DLPF enabled */
+            *val = 1000 / (1 + reg);
+            return IIO_VAL_INT;
+
+        default:
+            return -EINVAL;
+    }
+}
+
+static const struct iio_info g_iioInfo =
+{
+    .read_raw = mpu9250IioReadRaw,
+};
+
+/* An enabled buffer keeps the sensor awake like an open file */
+static int mpu9250IioPreenable(struct iio_dev *indio_dev)
+{
+    MPU9250_Dev_t *mpu = iio_device_get_drvdata(indio_dev);
+    int rv = pm_runtime_get_sync(mpu->dev);
+
+    if(0 > rv)
+    {
+        pm_runtime_put_noidle(mpu->dev);
+        return rv;
+    }
+
+    return 0;
+}
+static int mpu9250IioPostdisable(struct iio_dev *indio_dev)
+{
+    MPU9250_Dev_t *mpu = iio_device_get_drvdata(indio_dev);
+    pm_runtime_mark_last_busy(mpu->dev);
+    pm_runtime_put_autosuspend(mpu->dev);
+
+    return 0;
+}
+
+static const struct iio_buffer_setup_ops g_iioBufferOps =
+{
+    .preenable = mpu9250IioPreenable,
+    .postdisable = mpu9250IioPostdisable,
+};
+
+/** @brief Pushes one scan to the IIO buffer on every trigger
+ *  The whole accel, temperature, gyro and magnetometer frame is one burst read, the timestamp
+ *  is taken by iio_pollfunc_store_time() when the trigger fires.
+ */
+static irqreturn_t mpu9250IioTriggerHandler(int irq, void *p)
+{
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    MPU9250_Dev_t *mpu = iio_device_get_drvdata(indio_dev);
+    u8 scan[32] __aligned(8);           // Up to 20 bytes of channels, AK8963 ST2 or padding and 8 bytes of timestamp
+    int rv;
+
+    /* The burst fills 14 or 21 bytes, the padding before the timestamp must not leak the stack */
+    memset(scan, 0, sizeof(scan));
+
+    mutex_lock(&mpu->busLock);
+    rv = mpu9250ReadRegister(mpu, MPU9250_ACCEL_OUT, scan,
+                             MPU9250_FIFO_FRAME_SIZE + (mpu->magPresent ? MPU9250_FIFO_MAG_SIZE : 0));
+    mutex_unlock(&mpu->busLock);
+
+    if(0 < rv)
+    {
+        iio_push_to_buffers_with_timestamp(indio_dev, scan, pf->timestamp);
+    }
+
+    iio_trigger_notify_done(indio_dev->trig);
+
+    return IRQ_HANDLED;
+}
+static int mpu9250IioSetTriggerState(struct iio_trigger *trig, bool state)
+{
+    MPU9250_Dev_t *mpu = iio_trigger_get_drvdata(trig);
+
+    WRITE_ONCE(mpu->iioTriggerOn, state);
+
+    return 0;
+}
+
+static const struct iio_trigger_ops g_iioTriggerOps =
+{
+    .set_trigger_state = mpu9250IioSetTriggerState,
+};
+
+static void mpu9250IioTriggerPoll(MPU9250_Dev_t *mpu)
+{
+    if(READ_ONCE(mpu->iioTriggerOn))
+        iio_trigger_poll(mpu->iioTrigger);
+}
+
+/** @brief Registers the IIO front-end
+ *  Any trigger can drive the buffer, e.g. an iio-trig-hrtimer instance, and a
+ *  data-ready trigger is also provided when the sensor interrupt is wired.
+ *  @param mpu The sensor
+ */
+static int mpu9250IioStart(MPU9250_Dev_t *mpu)
+{
+    int rv;
+    struct iio_dev *indio_dev;
+
+    indio_dev = devm_iio_device_alloc(mpu->dev, 0);
+
+    if(NULL == indio_dev)
+        return -ENOMEM;
+
+    iio_device_set_drvdata(indio_dev, mpu);
+
+    indio_dev->dev.parent = mpu->dev;
+    indio_dev->name = "mpu9250";
+    indio_dev->info = &g_iioInfo;
+    indio_dev->modes = INDIO_DIRECT_MODE;
+    if(mpu->magPresent)
+    {
+        indio_dev->channels = g_iioMagChannels;
+        indio_dev->num_channels = ARRAY_SIZE(g_iioMagChannels);
+        indio_dev->available_scan_masks = g_iioMagScanMasks;
+    }
+    else
+    {
+        indio_dev->channels = g_iioChannels;
+        indio_dev->num_channels = ARRAY_SIZE(g_iioChannels);
+        indio_dev->available_scan_masks = g_iioScanMasks;
+    }
+
+    /* kfifo backed buffer filled by the trigger handler */
+    rv = iio_triggered_buffer_setup(indio_dev, iio_pollfunc_store_time, mpu9250IioTriggerHandler, &g_iioBufferOps);
+
+    if(0 != rv)
+        return rv;
+
+    if(0 < mpu->irq)
+    {
+        mpu->iioTrigger = devm_iio_trigger_alloc(mpu->dev, "%s-dev%d", indio_dev->name, indio_dev->id);
+
+        if(NULL == mpu->iioTrigger)
+        {
+            rv = -ENOMEM;
+            goto err_buffer;
+        }
+
+        mpu->iioTrigger->dev.parent = mpu->dev;
+        mpu->iioTrigger->ops = &g_iioTriggerOps;
+        iio_trigger_set_drvdata(mpu->iioTrigger, mpu);
+
+        rv = iio_trigger_register(mpu->iioTrigger);
+
+        if(0 != rv)
+            goto err_buffer;
+
+        /* Data-ready is the default trigger */
+        indio_dev->trig = iio_trigger_get(mpu->iioTrigger);
+    }
+
+    rv = iio_device_register(indio_dev);
+
+    if(0 != rv)
+        goto err_trigger;
+
+    mpu->iioDev = indio_dev;
+
+    return 0;
+
+err_trigger:
+    if(NULL != mpu->iioTrigger)
+    {
+        iio_trigger_unregister(mpu->iioTrigger);
+        mpu->iioTrigger = NULL;
+    }
+err_buffer:
+    iio_triggered_buffer_cleanup(indio_dev);
+
+    return rv;
+}
+static void mpu9250IioStop(MPU9250_Dev_t *mpu)
+{
+    if(NULL == mpu->iioDev)
+        return;
+
+    iio_device_unregister(mpu->iioDev);
+
+    if(NULL != mpu->iioTrigger)
+    {
+        iio_trigger_unregister(mpu->iioTrigger);
+        mpu->iioTrigger = NULL;
+    }
+
+    iio_triggered_buffer_cleanup(mpu->iioDev);
+    mpu->iioDev = NULL;
+}
+
+#else
+
+static void mpu9250IioTriggerPoll(MPU9250_Dev_t *mpu)
+{
+}
+static int mpu9250IioStart(MPU9250_Dev_t *mpu)
+{
+    return -ENODEV;
+}
+static void mpu9250IioStop(MPU9250_Dev_t *mpu)
+{
+}
+
+#endif
+
+/*****************************************************************************************/
+
+/* One step of the probe initialization, consecutive registers written in one transaction */
+typedef struct
+{
+    u8                       reg;                                 ///< First register
+    u8                       count;                               ///< Number of registers
+    u8                       values[3];                           ///< Their values
+
+} MPU9250_InitStep_t;
+
+/* Fixed part of the sensor setup, in the order it is applied. The sampling configuration
+ * follows from g_defaultConfig, the calibration from the module parameters.
+ */
+static const MPU9250_InitStep_t g_initTable[] =
+{
+    /* Auxiliary I2C master at 400 kHz, set before the master is enabled */
+    { MPU9250_I2C_MST_CTRL, 1, { MPU9250_I2C_MST_CLK } },
+    /* USER_CTRL, PWR_MGMT_1 and PWR_MGMT_2: I2C master mode, gyro PLL clock, accel and gyro enabled */
+    { MPU9250_USER_CTRL,    3, { MPU9250_I2C_MST_EN, MPU9250_CLOCK_SEL_PLL, MPU9250_SEN_ENABLE } },
+};
+
+/** @brief Reads registers back from the sensor, bypassing the cache, and compares them
+ *  @return 0 when they match or -EIO
+ */
+static int mpu9250InitVerify(MPU9250_Dev_t *mpu, u8 reg, const u8 *expected, u8 count)
+{
+    u8 rx[8];
+
+    if((count != mpu9250ReadRegister(mpu, reg, rx, count)) || (0 != memcmp(expected, rx, count)))
+    {
+        dev_err(mpu->dev, "From Probe: Registers from 0x%02x read back wrong.\n", reg);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/** @brief Applies the probe setup and checks it once against the hardware
+ *  Every step of g_initTable is a single bulk write through the register cache, the
+ *  default sampling configuration another one. The hardware is then read back once per
+ *  step, instead of once per register write.
+ *  @param mpu The sensor
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250InitApply(MPU9250_Dev_t *mpu)
+{
+    u8 values[ARRAY_SIZE(g_initTable)][3];
+    u8 config[5];
+    unsigned int i;
+    int rv;
+
+    for(i = 0; i < ARRAY_SIZE(g_initTable); i++)
+    {
+        /* On SPI USER_CTRL also keeps the I2C slave interface disabled */
+        memcpy(values[i], g_initTable[i].values, g_initTable[i].count);
+
+        if(MPU9250_USER_CTRL == g_initTable[i].reg)
+            values[i][0] |= mpu->bus->userCtrl;
+
+        rv = regmap_bulk_write(mpu->regmap, g_initTable[i].reg, values[i], g_initTable[i].count);
+
+        if(0 != rv)
+            return rv;
+    }
+
+    rv = mpu9250SetConfig(mpu, &g_defaultConfig);
+
+    if(0 != rv)
+        return rv;
+
+    /* Single verification pass, SMPDIV to ACCEL_CONFIG2 are checked against the cache */
+    for(i = 0; i < ARRAY_SIZE(g_initTable); i++)
+    {
+        rv = mpu9250InitVerify(mpu, g_initTable[i].reg, values[i], g_initTable[i].count);
+
+        if(0 != rv)
+            return rv;
+    }
+
+    rv = regmap_bulk_read(mpu->regmap, MPU9250_SMPDIV, config, sizeof(config));
+
+    if(0 != rv)
+        return rv;
+
+    return mpu9250InitVerify(mpu, MPU9250_SMPDIV, config, sizeof(config));
+}
+
+/** @brief Execute when a transport finds a sensor
+ * 
+ *  It initialized the hardware sensor MPU9250. The driver prefers asynchronous probing,
+ *  so a boot with several sensors is not blocked on their setup. The IIO device and the
+ *  character device are created last, once the sensor and its runtime PM are ready, so an
+ *  open() racing with probe finds it usable. The time from here to that point is kept in
+ *  statistics/probe_time.
+ */
+int mpu9250CoreProbe(struct device *dev, struct regmap *regmap, const MPU9250_Bus_t *bus, void *context, int irq)
+{
+    MPU9250_Dev_t *mpu;
+    u64 start = ktime_get_ns();
+    int whoAmI;
+    int rv;
+
+    /* Per sensor state, every other sensor keeps its own */
+    mpu = kzalloc(sizeof(*mpu), GFP_KERNEL);
+
+    if (NULL == mpu)
+        return -ENOMEM;
+
+    /* Open files take their own references, this one is dropped when the sensor is unbound */
+    kref_init(&mpu->ref);
+    init_rwsem(&mpu->removeLock);
+
+    rv = devm_add_action_or_reset(dev, mpu9250Put, mpu);
+
+    if (0 != rv)
+        return rv;
+
+    mpu->counters = alloc_percpu(MPU9250_Counters_t);
+
+    if (NULL == mpu->counters)
+        return -ENOMEM;
+
+    /* Save the bus device and its transport, the register map is already created */
+    mpu->dev = dev;
+    mpu->bus = bus;
+    mpu->busContext = context;
+    mpu->regmap = regmap;
+    dev_set_drvdata(dev, mpu);
+
+    mutex_init(&mpu->busLock);
+    mutex_init(&mpu->womLock);
+    init_waitqueue_head(&mpu->readQueue);
+    atomic_set(&mpu->numberOpens, 0);
+    atomic64_set(&mpu->irqTimestamp, 0);
+    mpu->frameSize = MPU9250_FIFO_FRAME_SIZE;
+    mpu->accelGainMicro[0] = mpu->accelGainMicro[1] = mpu->accelGainMicro[2] = 1000000;
+    mpu->wom = (MPU9250_Wom_t){ 0, 100, 980, 0 };
+    INIT_WORK(&mpu->groupWork, mpu9250GroupWork);
+
+    /* Wake-on-motion is entered at run time, see MPU9250_IOC_SET_WOM */
+    INIT_DELAYED_WORK(&mpu->womWork, mpu9250WomWork);
+
+	/* Check the WHO AM I byte before anything else, expected value is 0x71 (decimal 113) or 0x73 (decimal 115) */
+    whoAmI = mpu9250WhoAmI(mpu);
+
+	if ((113 != whoAmI) && (115 != whoAmI)) 
+    {
+        dev_err(mpu->dev, "From Probe: Who Am I MPU9250 check fail.\n");
+		return -ENODEV;
+	}
+
+    /* Power, clock, I2C master and the default 16G, 2000DPS, 184Hz, 1 kHz configuration */
+    rv = mpu9250InitApply(mpu);
+
+	if (0 > rv) 
+    {
+        dev_err(mpu->dev, "From Probe: Sensor setup fail.\n");
+		return rv;
+	}
+
+    /* Write the persisted offsets, from here on the sensor corrects every sample */
+    rv = mpu9250LoadCalib(mpu);
+
+	if (0 > rv) 
+    {
+        dev_err(mpu->dev, "From Probe: Load calibration fail.\n");
+		return rv;
+	}
+
+    /* Read the AK8963 into every frame, the accel and gyro keep working without it */
+    if (magnetometer && (0 > mpu9250MagStart(mpu)))
+    {
+        dev_warn(mpu->dev, "From Probe: AK8963 magnetometer setup fail, continuing without it.\n");
+    }
+
+    /* Start hardware FIFO streaming */
+    if (streaming)
+    {
+        rv = mpu9250StreamStart(mpu);
+
+        if (0 > rv)
+        {
+            dev_err(mpu->dev, "From Probe: Start FIFO streaming fail.\n");
+            goto err_mag;
+        }
+    }
+
+    /* Enable the data-ready interrupt when the device tree provides one */
+    if (0 < irq)
+    {
+        if (0 > mpu9250IrqStart(mpu, irq))
+        {
+            dev_warn(mpu->dev, "From Probe: Enable data-ready interrupt fail, falling back to polling.\n");
+        }
+        else
+        {
+            mpu->irq = irq;
+        }
+    }
+
+    /* Statistics are optional too, the tracepoints do not depend on them */
+    if (0 != sysfs_create_group(&dev->kobj, &g_statsGroup))
+    {
+        dev_warn(mpu->dev, "From Probe: Create statistics attributes fail.\n");
+    }
+
+    /* Runtime PM is on before any user can reach the sensor, the reference held here keeps it awake until the end of probe.
+     * It sleeps after autosuspend_ms without open files, the delay can be changed in power/autosuspend_delay_ms
+     */
+    pm_runtime_set_active(dev);
+    pm_runtime_get_noresume(dev);
+    pm_runtime_set_autosuspend_delay(dev, autosuspend_ms);
+    pm_runtime_use_autosuspend(dev);
+    pm_runtime_enable(dev);
+
+    /* Register the IIO front-end, the char device keeps working without it */
+    if (0 > mpu9250IioStart(mpu))
+    {
+        dev_warn(mpu->dev, "From Probe: Register IIO device fail.\n");
+    }
+
+    /* The character device of this sensor appears once the sensor is ready */
+    rv = mpu9250CharStart(mpu);
+
+    if (0 > rv)
+    {
+        dev_err(mpu->dev, "From Probe: Create /dev/%s-N fail.\n", DEVICE_NAME);
+        goto err_char;
+    }
+
+    /* Without interrupt the hardware FIFO is drained periodically */
+    if (streaming && (0 >= mpu->irq))
+    {
+        schedule_delayed_work(&mpu->drainWork, msecs_to_jiffies(fifo_poll_ms));
+    }
+
+    /* Ready, grouped reads include this sensor from now on */
+    mutex_lock(&g_devicesLock);
+    list_add_tail(&mpu->node, &g_devices);
+    mutex_unlock(&g_devicesLock);
+
+    /* The autosuspend delay starts now, unless a file is already open */
+    pm_runtime_mark_last_busy(dev);
+    pm_runtime_put_autosuspend(dev);
+
+    mpu->probeTime = ktime_get_ns() - start;
+
+    pr_info("From Probe: /dev/%s-%d on %s ready in %llu us%s%s%s\n", DEVICE_NAME, mpu->index, bus->name, div_u64(mpu->probeTime, NSEC_PER_USEC),
+            mpu->magPresent ? ", magnetometer" : "", streaming ? ", streaming" : "", (0 < mpu->irq) ? ", interrupt" : "");
+
+    return 0;
+
+err_char:
+    mpu9250IioStop(mpu);
+
+    pm_runtime_disable(dev);
+    pm_runtime_dont_use_autosuspend(dev);
+    pm_runtime_set_suspended(dev);
+    pm_runtime_put_noidle(dev);
+
+    sysfs_remove_group(&dev->kobj, &g_statsGroup);
+
+    if (0 < mpu->irq)
+    {
+        mpu9250IrqStop(mpu);
+        mpu->irq = 0;
+    }
+
+    if (streaming)
+    {
+        mpu9250StreamStop(mpu);
+    }
+err_mag:
+    if (mpu->magPresent)
+    {
+        mpu9250MagStop(mpu);
+    }
+
+    return rv;
+}
+
+/** @brief Execute when a transport removes a sensor
+ * 
+ *  It removes the hardware sensor MPU9250
+ */
+void mpu9250CoreRemove(struct device *dev)
+{
+    MPU9250_Dev_t *mpu = dev_get_drvdata(dev);
+    int opens;
+
+    /* Out of grouped reads first */
+    mutex_lock(&g_devicesLock);
+    list_del(&mpu->node);
+    mutex_unlock(&g_devicesLock);
+
+    /* Files still open fail from here on, sleeping readers wake up to see it. The state
+     * itself lives until the last of them is released.
+     */
+    WRITE_ONCE(mpu->gone, true);
+    wake_up_interruptible(&mpu->readQueue);
+
+    /* Wait for the file operations in progress */
+    down_write(&mpu->removeLock);
+    opens = atomic_read(&mpu->numberOpens);
+    up_write(&mpu->removeLock);
+
+    /* Wake the sensor up for good, the cleanup below writes to it */
+    pm_runtime_get_sync(dev);
+    pm_runtime_disable(dev);
+    pm_runtime_dont_use_autosuspend(dev);
+    pm_runtime_put_noidle(dev);
+
+    /* The files still open no longer drop their runtime PM references */
+    while (0 < opens--)
+        pm_runtime_put_noidle(dev);
+
+    sysfs_remove_group(&dev->kobj, &g_statsGroup);
+
+    /* Unregister the IIO front-end */
+    mpu9250IioStop(mpu);
+
+    /* Back to full rate, the interrupt and the FIFO are stopped from there */
+    mpu9250WomStop(mpu);
+
+    /* Disable the data-ready interrupt */
+    if (0 < mpu->irq)
+    {
+        mpu9250IrqStop(mpu);
+        mpu->irq = 0;
+    }
+
+    /* Stop hardware FIFO streaming */
+    if (streaming)
+    {
+        mpu9250StreamStop(mpu);
+    }
+
+    /* Power down the magnetometer */
+    if (mpu->magPresent)
+    {
+        mpu9250MagStop(mpu);
+    }
+
+    /* Remove the character device of this sensor */
+    mpu9250CharStop(mpu);
+
+    pr_info("From Remove: MPU9250 remove success!\n");
+}
+
+module_init(i2cMPU9250char_init);
+module_exit(i2cMPU9250char_exit);
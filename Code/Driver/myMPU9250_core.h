@@ -0,0 +1,68 @@
+#ifndef _myMPU9250_core_H
+#define _myMPU9250_core_H
+
+/* Interface between the bus independent core of the driver, myMPU9250_core.c, and its
+ * transports, myMPU9250_i2c.c and myMPU9250_spi.c. A transport creates the register
+ * map of the sensor on its bus, provides the raw burst reads of the acquisition path
+ * and hands both to mpu9250CoreProbe(). Everything else, the character device, the
+ * FIFO streaming, IIO, runtime PM and the statistics, lives in the core.
+ */
+#include <linux/device.h>
+#include <linux/regmap.h>
+#include <linux/pm.h>
+
+// Types
+
+/* Raw register access of a transport. Configuration writes go through the register map */
+typedef struct
+{
+   const char *             name;                                 ///< Bus name for the probe log
+   u8                       userCtrl;                             ///< Bits kept in every USER_CTRL write
+   int                      (*read)(void *context, u8 subAddress, u8 *rxBuff, u16 count);   ///< Burst read, 0 or a negative error code
+
+} MPU9250_Bus_t;
+
+// Variables
+extern const struct regmap_config   g_mpu9250RegmapConfig;        ///< Register map of the sensor, for every bus
+extern const struct dev_pm_ops      g_mpu9250PmOps;               ///< Runtime PM and system sleep
+extern const struct of_device_id    g_mpu9250OfMatch[];           ///< Device tree compatibles, for every bus
+
+// Public functions
+
+/** @brief Sets up a sensor found by a transport
+ *  @param dev The device of the sensor on its bus, its driver data becomes the sensor
+ *  @param regmap The register map created by the transport
+ *  @param bus The transport
+ *  @param context Passed to the transport read
+ *  @param irq Data-ready interrupt line, 0 or negative when there is none
+ *  @return 0 on success or a negative error code
+ */
+int mpu9250CoreProbe(struct device *dev, struct regmap *regmap, const MPU9250_Bus_t *bus, void *context, int irq);
+
+/** @brief Removes a sensor set up by mpu9250CoreProbe()
+ *  @param dev The device of the sensor on its bus
+ */
+void mpu9250CoreRemove(struct device *dev);
+
+/* Driver registration of every transport, called at module init and exit */
+int mpu9250I2cRegister(void);
+void mpu9250I2cUnregister(void);
+
+#if IS_ENABLED(CONFIG_SPI_MASTER)
+
+int mpu9250SpiRegister(void);
+void mpu9250SpiUnregister(void);
+
+#else
+
+static inline int mpu9250SpiRegister(void)
+{
+   return 0;
+}
+static inline void mpu9250SpiUnregister(void)
+{
+}
+
+#endif
+
+#endif
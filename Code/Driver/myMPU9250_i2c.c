@@ -0,0 +1,118 @@
+/**
+ * @file   myMPU9250_i2c.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  I2C transport of the myMPU9250 LKM.
+ *
+ * Binds the sensor as an I2C client, at 0x68 or 0x69 behind the "mse,myMPU9250"
+ * compatible or the "myMPU9250" client name, and hands it to the core. Configuration
+ * writes go through the I2C register map, burst reads are a single i2c_transfer().
+ */
+#include <linux/module.h>               // Core header for loading LKMs into the kernel
+#include <linux/i2c.h>                  // I2C client driver
+#include <linux/version.h>              // probe() lost its id in 6.3, remove() its result in 6.1
+#include "myMPU9250.h"                  // Registers of the sensor
+#include "myMPU9250_core.h"             // Bus independent core
+
+// Private functions
+
+/** @brief Reads consecutive registers in a single I2C transaction
+ *  The register address write and the data read are two messages joined by a
+ *  repeated start, so no other bus master can interleave between them.
+ *  @param context The I2C client
+ *  @param subAddress The first register to read
+ *  @param rxBuff The buffer to store the registers values
+ *  @param count Number of registers to read
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250I2cRead(void *context, u8 subAddress, u8 *rxBuff, u16 count)
+{
+    struct i2c_client *client = context;
+    int rv;
+    struct i2c_msg msgs[2] =
+    {
+        { .addr = client->addr, .flags = 0,        .len = 1,     .buf = &subAddress },
+        { .addr = client->addr, .flags = I2C_M_RD, .len = count, .buf = rxBuff      },
+    };
+
+    rv = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+
+    if(ARRAY_SIZE(msgs) == rv)
+        return 0;
+
+    return (0 > rv) ? rv : -EIO;
+}
+
+static const MPU9250_Bus_t g_i2cBus =
+{
+    .name = "i2c",
+    .userCtrl = 0,
+    .read = mpu9250I2cRead,
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+static int myMPU9250_i2c_probe(struct i2c_client *client)
+#else
+static int myMPU9250_i2c_probe(struct i2c_client *client, const struct i2c_device_id *id)
+#endif
+{
+    struct regmap *regmap;
+
+    /* Create the cached register map */
+    regmap = devm_regmap_init_i2c(client, &g_mpu9250RegmapConfig);
+
+    if (IS_ERR(regmap))
+    {
+        dev_err(&client->dev, "From Probe: Register map init fail.\n");
+        return PTR_ERR(regmap);
+    }
+
+    return mpu9250CoreProbe(&client->dev, regmap, &g_i2cBus, client, client->irq);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+static void myMPU9250_i2c_remove(struct i2c_client *client)
+{
+    mpu9250CoreRemove(&client->dev);
+}
+#else
+static int myMPU9250_i2c_remove(struct i2c_client *client)
+{
+    mpu9250CoreRemove(&client->dev);
+
+    return 0;
+}
+#endif
+
+static const struct i2c_device_id myMPU9250_i2c_id[] = 
+{
+    { "myMPU9250", 0 },
+    { }
+};
+
+MODULE_DEVICE_TABLE(i2c, myMPU9250_i2c_id);
+
+static struct i2c_driver myMPU9250_i2c_driver = 
+{
+    .driver = 
+    {
+        .name = "myMPU9250",
+        .of_match_table = g_mpu9250OfMatch,
+        .pm = &g_mpu9250PmOps,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+    },
+    .probe = myMPU9250_i2c_probe,
+    .remove = myMPU9250_i2c_remove,
+    .id_table = myMPU9250_i2c_id
+};
+
+// Public functions
+
+int mpu9250I2cRegister(void)
+{
+    return i2c_add_driver(&myMPU9250_i2c_driver);
+}
+
+void mpu9250I2cUnregister(void)
+{
+    i2c_del_driver(&myMPU9250_i2c_driver);
+}
@@ -0,0 +1,218 @@
+/**
+ * @file   myMPU9250_spi.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  SPI transport of the myMPU9250 LKM.
+ *
+ * Binds the sensor as an SPI device, behind the "mse,myMPU9250" compatible or the
+ * "myMPU9250" modalias, and hands it to the core. The address byte of a read carries
+ * MPU9250_I2C_READ_FLAG. Configuration registers are written and read at
+ * MPU9250_SPI_RATE, the sensor, interrupt and FIFO registers are read at up to
+ * MPU9250_SPI_READ_RATE, limited by spi-max-frequency. A full FIFO then takes about
+ * 0.2 ms of bus time instead of 13 ms on I2C. USER_CTRL keeps MPU9250_I2C_IF_DIS set, so
+ * the I2C slave interface of the sensor stays off.
+ */
+#include <linux/module.h>               // Core header for loading LKMs into the kernel
+#include <linux/spi/spi.h>              // SPI device driver
+#include <linux/mutex.h>                // Serializes the use of the bounce buffers
+#include <linux/slab.h>                 // Transport context allocation
+#include <linux/version.h>              // remove() lost its result in 5.18
+#include "myMPU9250.h"                  // Registers of the sensor
+#include "myMPU9250_core.h"             // Bus independent core
+
+// Types
+
+/* Per sensor transport state. SPI controllers may use DMA, so the buffers handed to them
+ * are not on the stack and sit on cache lines of their own.
+ */
+typedef struct
+{
+    struct spi_device *      spi;                                  ///< The sensor on its SPI bus
+    struct mutex             lock;                                 ///< Serializes the use of the buffers
+    u8                       address ____cacheline_aligned;        ///< Register address of a read, with MPU9250_I2C_READ_FLAG
+    u8                       buffer[MPU9250_FIFO_SIZE] ____cacheline_aligned;   ///< Data of a read or a write
+
+} MPU9250_SpiContext_t;
+
+// Private functions
+
+/** @brief Registers read at the fast clock, everything else is limited to 1 MHz */
+static bool mpu9250SpiFastRegister(u8 subAddress)
+{
+    return (MPU9250_INT_STATUS == subAddress) ||
+           ((MPU9250_ACCEL_OUT <= subAddress) && (MPU9250_EXT_SENS_DATA_LAST >= subAddress)) ||
+           ((MPU9250_FIFO_COUNT <= subAddress) && (MPU9250_FIFO_READ >= subAddress));
+}
+
+/** @brief Reads consecutive registers with one chip select
+ *  @param ctx The transport state, locked by the caller
+ *  @param address The register address, with MPU9250_I2C_READ_FLAG
+ *  @param count Number of registers to read into ctx->buffer
+ *  @param speedHz The SPI clock
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SpiTransfer(MPU9250_SpiContext_t *ctx, u8 address, size_t count, u32 speedHz)
+{
+    struct spi_transfer xfers[2] =
+    {
+        { .tx_buf = &ctx->address, .len = 1,     .speed_hz = speedHz },
+        { .rx_buf = ctx->buffer,   .len = count, .speed_hz = speedHz },
+    };
+
+    if(sizeof(ctx->buffer) < count)
+        return -EINVAL;
+
+    ctx->address = address;
+
+    return spi_sync_transfer(ctx->spi, xfers, ARRAY_SIZE(xfers));
+}
+
+/** @brief Burst read of the acquisition path, at the fast clock for sample registers
+ *  @param context The transport state
+ *  @param subAddress The first register to read
+ *  @param rxBuff The buffer to store the registers values
+ *  @param count Number of registers to read
+ *  @return 0 on success or a negative error code
+ */
+static int mpu9250SpiRead(void *context, u8 subAddress, u8 *rxBuff, u16 count)
+{
+    MPU9250_SpiContext_t *ctx = context;
+    u32 speedHz = mpu9250SpiFastRegister(subAddress) ? MPU9250_SPI_READ_RATE : MPU9250_SPI_RATE;
+    int rv;
+
+    mutex_lock(&ctx->lock);
+
+    rv = mpu9250SpiTransfer(ctx, subAddress | MPU9250_I2C_READ_FLAG, count, min(speedHz, ctx->spi->max_speed_hz));
+
+    if(0 == rv)
+        memcpy(rxBuff, ctx->buffer, count);
+
+    mutex_unlock(&ctx->lock);
+
+    return rv;
+}
+
+/** @brief Register map write, the register address followed by the values, at 1 MHz */
+static int mpu9250SpiRegmapWrite(void *context, const void *data, size_t count)
+{
+    MPU9250_SpiContext_t *ctx = context;
+    struct spi_transfer xfer = { .tx_buf = ctx->buffer, .len = count };
+    int rv;
+
+    if(sizeof(ctx->buffer) < count)
+        return -EINVAL;
+
+    mutex_lock(&ctx->lock);
+
+    memcpy(ctx->buffer, data, count);
+    xfer.speed_hz = min_t(u32, MPU9250_SPI_RATE, ctx->spi->max_speed_hz);
+    rv = spi_sync_transfer(ctx->spi, &xfer, 1);
+
+    mutex_unlock(&ctx->lock);
+
+    return rv;
+}
+
+/** @brief Register map read, the register address already carries MPU9250_I2C_READ_FLAG */
+static int mpu9250SpiRegmapRead(void *context, const void *reg, size_t regSize, void *val, size_t valSize)
+{
+    MPU9250_SpiContext_t *ctx = context;
+    int rv;
+
+    mutex_lock(&ctx->lock);
+
+    rv = mpu9250SpiTransfer(ctx, *(const u8 *)reg, valSize, min_t(u32, MPU9250_SPI_RATE, ctx->spi->max_speed_hz));
+
+    if(0 == rv)
+        memcpy(val, ctx->buffer, valSize);
+
+    mutex_unlock(&ctx->lock);
+
+    return rv;
+}
+
+static const struct regmap_bus g_spiRegmapBus =
+{
+    .write = mpu9250SpiRegmapWrite,
+    .read = mpu9250SpiRegmapRead,
+    .read_flag_mask = MPU9250_I2C_READ_FLAG,
+};
+
+static const MPU9250_Bus_t g_spiBus =
+{
+    .name = "spi",
+    .userCtrl = MPU9250_I2C_IF_DIS,
+    .read = mpu9250SpiRead,
+};
+
+static int myMPU9250_spi_probe(struct spi_device *spi)
+{
+    MPU9250_SpiContext_t *ctx;
+    struct regmap *regmap;
+
+    ctx = devm_kzalloc(&spi->dev, sizeof(*ctx), GFP_KERNEL);
+
+    if (NULL == ctx)
+        return -ENOMEM;
+
+    ctx->spi = spi;
+    mutex_init(&ctx->lock);
+
+    /* Create the cached register map, its transfers run at 1 MHz */
+    regmap = devm_regmap_init(&spi->dev, &g_spiRegmapBus, ctx, &g_mpu9250RegmapConfig);
+
+    if (IS_ERR(regmap))
+    {
+        dev_err(&spi->dev, "From Probe: Register map init fail.\n");
+        return PTR_ERR(regmap);
+    }
+
+    return mpu9250CoreProbe(&spi->dev, regmap, &g_spiBus, ctx, spi->irq);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+static void myMPU9250_spi_remove(struct spi_device *spi)
+{
+    mpu9250CoreRemove(&spi->dev);
+}
+#else
+static int myMPU9250_spi_remove(struct spi_device *spi)
+{
+    mpu9250CoreRemove(&spi->dev);
+
+    return 0;
+}
+#endif
+
+static const struct spi_device_id myMPU9250_spi_id[] = 
+{
+    { "myMPU9250", 0 },
+    { }
+};
+
+MODULE_DEVICE_TABLE(spi, myMPU9250_spi_id);
+
+static struct spi_driver myMPU9250_spi_driver = 
+{
+    .driver = 
+    {
+        .name = "myMPU9250",
+        .of_match_table = g_mpu9250OfMatch,
+        .pm = &g_mpu9250PmOps,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+    },
+    .probe = myMPU9250_spi_probe,
+    .remove = myMPU9250_spi_remove,
+    .id_table = myMPU9250_spi_id
+};
+
+// Public functions
+
+int mpu9250SpiRegister(void)
+{
+    return spi_register_driver(&myMPU9250_spi_driver);
+}
+
+void mpu9250SpiUnregister(void)
+{
+    spi_unregister_driver(&myMPU9250_spi_driver);
+}
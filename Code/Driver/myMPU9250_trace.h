@@ -0,0 +1,196 @@
+/* Tracepoints of the myMPU9250 LKM, under events/mympu9250 in tracefs.
+ *
+ * Every stage of the acquisition path has one event: bus reads, FIFO drains and
+ * overflows, data-ready interrupts, reader calls, reader overruns, wake-on-motion
+ * events and wake-ups from suspend. Events that
+ * close a stage carry its duration, so per-stage latency is available from ftrace
+ * or perf without pairing events:
+ *
+ *    # echo 1 > /sys/kernel/tracing/events/mympu9250/enable
+ *    # perf record -e 'mympu9250:*' -a
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mympu9250
+
+#if !defined(_myMPU9250_trace_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _myMPU9250_trace_H
+
+#include <linux/tracepoint.h>
+
+/* Reader call of mpu9250_read */
+#define MPU9250_TRACE_REGISTER    0     // read() of registers
+#define MPU9250_TRACE_STREAM      1     // read() of FIFO frames
+#define MPU9250_TRACE_BATCH       2     // MPU9250_IOC_READ_BATCH
+
+TRACE_EVENT(mpu9250_bus_read,
+
+    TP_PROTO(u8 reg, u16 len, int rv, u64 duration),
+
+    TP_ARGS(reg, len, rv, duration),
+
+    TP_STRUCT__entry(
+        __field(u8,  reg)
+        __field(u16, len)
+        __field(int, rv)
+        __field(u64, duration)
+    ),
+
+    TP_fast_assign(
+        __entry->reg = reg;
+        __entry->len = len;
+        __entry->rv = rv;
+        __entry->duration = duration;
+    ),
+
+    TP_printk("reg=0x%02x len=%u rv=%d duration=%llu ns",
+              __entry->reg, __entry->len, __entry->rv, __entry->duration)
+);
+
+TRACE_EVENT(mpu9250_fifo_drain,
+
+    TP_PROTO(unsigned int frames, int rv, u64 duration),
+
+    TP_ARGS(frames, rv, duration),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, frames)
+        __field(int,          rv)
+        __field(u64,          duration)
+    ),
+
+    TP_fast_assign(
+        __entry->frames = frames;
+        __entry->rv = rv;
+        __entry->duration = duration;
+    ),
+
+    TP_printk("frames=%u rv=%d duration=%llu ns", __entry->frames, __entry->rv, __entry->duration)
+);
+
+TRACE_EVENT(mpu9250_fifo_overflow,
+
+    TP_PROTO(s64 batchEnd),
+
+    TP_ARGS(batchEnd),
+
+    TP_STRUCT__entry(
+        __field(s64, batchEnd)
+    ),
+
+    TP_fast_assign(
+        __entry->batchEnd = batchEnd;
+    ),
+
+    TP_printk("last_frame=%lld", __entry->batchEnd)
+);
+
+TRACE_EVENT(mpu9250_irq,
+
+    TP_PROTO(s64 timestamp),
+
+    TP_ARGS(timestamp),
+
+    TP_STRUCT__entry(
+        __field(s64, timestamp)
+    ),
+
+    TP_fast_assign(
+        __entry->timestamp = timestamp;
+    ),
+
+    TP_printk("timestamp=%lld", __entry->timestamp)
+);
+
+TRACE_EVENT(mpu9250_read,
+
+    TP_PROTO(int call, size_t len, long rv, u64 duration),
+
+    TP_ARGS(call, len, rv, duration),
+
+    TP_STRUCT__entry(
+        __field(int,    call)
+        __field(size_t, len)
+        __field(long,   rv)
+        __field(u64,    duration)
+    ),
+
+    TP_fast_assign(
+        __entry->call = call;
+        __entry->len = len;
+        __entry->rv = rv;
+        __entry->duration = duration;
+    ),
+
+    TP_printk("call=%s len=%zu rv=%ld duration=%llu ns",
+              __print_symbolic(__entry->call,
+                               { MPU9250_TRACE_REGISTER, "register" },
+                               { MPU9250_TRACE_STREAM,   "stream" },
+                               { MPU9250_TRACE_BATCH,    "batch" }),
+              __entry->len, __entry->rv, __entry->duration)
+);
+
+TRACE_EVENT(mpu9250_overrun,
+
+    TP_PROTO(u32 cursor, u32 lost),
+
+    TP_ARGS(cursor, lost),
+
+    TP_STRUCT__entry(
+        __field(u32, cursor)
+        __field(u32, lost)
+    ),
+
+    TP_fast_assign(
+        __entry->cursor = cursor;
+        __entry->lost = lost;
+    ),
+
+    TP_printk("cursor=%u lost=%u", __entry->cursor, __entry->lost)
+);
+
+TRACE_EVENT(mpu9250_motion,
+
+    TP_PROTO(s64 timestamp, bool awake),
+
+    TP_ARGS(timestamp, awake),
+
+    TP_STRUCT__entry(
+        __field(s64,  timestamp)
+        __field(bool, awake)
+    ),
+
+    TP_fast_assign(
+        __entry->timestamp = timestamp;
+        __entry->awake = awake;
+    ),
+
+    TP_printk("timestamp=%lld awake=%d", __entry->timestamp, __entry->awake)
+);
+
+TRACE_EVENT(mpu9250_resume,
+
+    TP_PROTO(u64 latency, bool synced),
+
+    TP_ARGS(latency, synced),
+
+    TP_STRUCT__entry(
+        __field(u64,  latency)
+        __field(bool, synced)
+    ),
+
+    TP_fast_assign(
+        __entry->latency = latency;
+        __entry->synced = synced;
+    ),
+
+    TP_printk("first_sample=%llu ns synced=%d", __entry->latency, __entry->synced)
+);
+
+#endif
+
+/* This header is not in include/trace/events, define_trace.h looks for it here */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE myMPU9250_trace
+#include <trace/define_trace.h>
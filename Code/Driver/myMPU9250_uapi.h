@@ -0,0 +1,244 @@
+#ifndef _myMPU9250_uapi_H
+#define _myMPU9250_uapi_H
+
+/* Types shared between the myMPU9250 LKM and user space programs */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Constants
+
+/* Version of this interface, returned by MPU9250_IOC_GET_VERSION */
+#define MPU9250_UAPI_VERSION          8
+
+/* Shared sample ring exposed through mmap() */
+#define MPU9250_RING_MAGIC            0x3955504D    // "MPU9" in little-endian byte order
+#define MPU9250_RING_VERSION          1
+
+/* MPU9250_Sample_t flags */
+#define MPU9250_SAMPLE_MAG            0x0001        // mag holds the latest AK8963 measurement
+#define MPU9250_SAMPLE_MAG_OVERFLOW   0x0002        // AK8963 magnetic sensor overflow, mag is not valid
+
+/* Low-power accelerometer rates of wake-on-motion, MPU9250_Wom_t lpOdrMilliHz */
+#define MPU9250_WOM_ODR_MIN           240           // 0.24 Hz, one comparison every 4.2 s
+#define MPU9250_WOM_ODR_MAX           500000        // 500 Hz
+
+/* Sensors handled by the driver, /dev/i2cMPU9250-0 to /dev/i2cMPU9250-7 */
+#define MPU9250_GROUP_MAX             8
+
+/* Decimation filters of a reader, MPU9250_Filter_t type */
+#define MPU9250_FILTER_NONE           0             // Every record at the sensor rate
+#define MPU9250_FILTER_BOX            1             // Mean of each block of decimation records, a first order CIC
+#define MPU9250_FILTER_FIR            2             // FIR of taps coefficients evaluated once every decimation records
+#define MPU9250_FILTER_DECIMATION_MAX 1000          // 1 Hz out of 1 kHz
+#define MPU9250_FILTER_TAPS_MAX       64
+
+// Types
+
+/* One sample as produced by the driver, counts are already in CPU byte order */
+typedef struct
+{
+   __s64 timestamp;                   // Acquisition time [ns]
+   __s16 accel[3];                    // Accelerometer counts (x, y, z)
+   __s16 gyro[3];                     // Gyroscope counts (x, y, z)
+   __s16 mag[3];                      // Magnetometer counts (x, y, z)
+   __s16 temp;                        // Temperature counts
+   __u16 flags;                       // MPU9250_SAMPLE_* flags
+   __u16 reserved;
+
+} MPU9250_Sample_t;
+
+/* Header page at offset 0 of the mapping, records start at dataOffset.
+ *
+ * The driver is the single producer. Before overwriting records it advances
+ * 'reserve', after the records are complete it advances 'head' to the same value.
+ * Both are free running counters of records and wrap around at 2^32.
+ *
+ * A reader keeps its own tail and, without any syscall:
+ *   1. h = head (then read barrier), records [tail, h) are complete
+ *   2. copies record (tail % capacity)
+ *   3. read barrier, r = reserve, if (r - tail) > capacity the copy was overwritten
+ *
+ * poll() on the mapped file reports POLLIN while head differs from the tail last
+ * given with MPU9250_IOC_SET_TAIL, so readers only block when they consumed every
+ * record. poll() changes nothing, level-triggered epoll and repeated polls see the
+ * same result until the reader moves its tail.
+ */
+typedef struct
+{
+   __u32 magic;                       // MPU9250_RING_MAGIC
+   __u32 version;                     // MPU9250_RING_VERSION
+   __u32 mapSize;                     // Bytes to mmap(), header page included
+   __u32 dataOffset;                  // Bytes from the start of the mapping to the first record
+   __u32 recordSize;                  // sizeof(MPU9250_Sample_t)
+   __u32 capacity;                    // Records in the ring, always a power of two
+   __u32 head;                        // Records published since streaming started
+   __u32 reserve;                     // Records claimed by the producer, head <= reserve
+
+} MPU9250_Ring_t;
+
+/* Sampling configuration, every field is in physical units.
+ * The output data rate is 1000 / (1 + SMPDIV) Hz, so it is rounded to the nearest
+ * reachable rate (4 to 1000 Hz). Ranges and bandwidths must be one of the listed values.
+ */
+typedef struct
+{
+   __u32 odrHz;                       // Output data rate [Hz]
+   __u32 accelRangeG;                 // Accelerometer full scale: 2, 4, 8 or 16 [g]
+   __u32 gyroRangeDps;                // Gyroscope full scale: 250, 500, 1000 or 2000 [deg/s]
+   __u32 accelBandwidthHz;            // Accelerometer DLPF: 184, 92, 41, 20, 10 or 5 [Hz]
+   __u32 gyroBandwidthHz;             // Gyroscope DLPF: 184, 92, 41, 20, 10 or 5 [Hz]
+
+} MPU9250_Config_t;
+
+/* Factors to convert counts of the current configuration to SI units */
+typedef struct
+{
+   __u32 accelNano;                   // Accelerometer [1e-9 m/s2 / LSB]
+   __u32 gyroNano;                    // Gyroscope [1e-9 rad/s / LSB]
+   __u32 tempSensitivityMilli;        // Temperature sensitivity [1e-3 LSB / C]
+   __s32 tempOffsetMilli;             // Temperature at 0 LSB [1e-3 C]
+   __u32 magPico[3];                  // Magnetometer with fuse ROM adjustment [1e-12 T / LSB], 0 without AK8963
+
+} MPU9250_Scale_t;
+
+/* Layout of the frames returned by read() in streaming mode, or of a burst read from
+ * MPU9250_ACCEL_OUT in register mode. Channels follow the register order and only the
+ * ones in fifoEnable are present: accel (6 bytes), temp (2), gyro x, y and z (2 each)
+ * big-endian, then with MPU9250_FIFO_MAG the AK8963 HXL..HZH little-endian and its ST2.
+ * In streaming mode MPU9250_IOC_SET_LAYOUT selects the channels written to the FIFO,
+ * typed samples then hold zero in the channels left out.
+ */
+typedef struct
+{
+   __u32 fifoEnable;                  // MPU9250_FIFO_* bits of the channels in a frame
+   __u32 frameSize;                   // Bytes per frame, ignored by MPU9250_IOC_SET_LAYOUT
+
+} MPU9250_Layout_t;
+
+/* Calibration applied by the sensor itself, loaded at probe from the module parameters.
+ * The MPU9250 adds the offset registers to every sample, so a bias written there costs
+ * no CPU time in any client. Gyro offsets are in 1000 dps counts (32.8 LSB / deg/s)
+ * and accel offsets in 16 g counts (2048 LSB / g) whatever the configured ranges. The
+ * accel registers hold factory trims: new values must be derived from the current
+ * ones, and bit 0 is kept by the driver. The chip has no gain register, so the accel
+ * scale factors are only stored here for the clients to apply.
+ */
+typedef struct
+{
+   __s16 gyroOffset[3];               // XG_OFFSET_H.. registers
+   __s16 accelOffset[3];              // XA_OFFSET_H.. registers
+   __u32 accelGainMicro[3];           // Accelerometer scale factor of the MPU9250 axes [1e-6]
+
+} MPU9250_Calib_t;
+
+/* Batch read of typed samples, in streaming mode. Uses the same reader cursor as read() */
+typedef struct
+{
+   __u64 samples;                     // In: user pointer to an array of MPU9250_Sample_t
+   __u32 count;                       // In: array length, out: samples stored
+   __u32 overruns;                    // Out: samples this reader lost since its previous batch read
+
+} MPU9250_Batch_t;
+
+/* Acquisition counters, to measure the cost of each access mode. Driver wide counters
+ * start at probe, overruns are those of the file the ioctl is issued on.
+ */
+typedef struct
+{
+   __u64 busTransfers;                // Sensor reads issued on the bus, configuration writes excluded
+   __u64 busBytes;                    // Bytes returned by those reads
+   __u64 samples;                     // Frames drained from the hardware FIFO in streaming mode
+   __u64 fifoOverflows;               // Hardware FIFO overflows, the frames it held were lost
+   __u64 overruns;                    // Samples this reader lost because it was too slow
+
+} MPU9250_Stats_t;
+
+/* Wake-on-motion: the gyro, the magnetometer and FIFO streaming stop and the accel
+ * wakes up at lpOdrMilliHz only to compare each new sample with the previous one. A
+ * change above thresholdMg on any axis is a motion event. Sampling is not available in
+ * this mode, MPU9250_IOC_SET_CONFIG and MPU9250_IOC_SET_LAYOUT fail with EBUSY.
+ * lpOdrMilliHz is rounded to the nearest of 240, 490, 980, 1950, 3910, 7810, 15630,
+ * 31250, 62500, 125000, 250000 and 500000. Worst case wake-up latency is one low-power
+ * period, plus the wom_poll_ms module parameter when no interrupt line is wired.
+ */
+typedef struct
+{
+   __u32 enable;                      // 1 enters wake-on-motion, 0 returns to full rate sampling
+   __u32 thresholdMg;                 // Motion threshold, 4 to 1020 [1e-3 g]
+   __u32 lpOdrMilliHz;                // Comparison rate [1e-3 Hz]
+   __u32 autoWake;                    // 1 returns to full rate sampling on the first motion event
+
+} MPU9250_Wom_t;
+
+/* Motion event, returned by MPU9250_IOC_READ_EVENT. The ioctl sleeps until there is an
+ * event this file did not read, or fails with EAGAIN on a non-blocking file. poll()
+ * reports POLLPRI while there is one. Only the newest event is kept.
+ */
+typedef struct
+{
+   __s64 timestamp;                   // Detection time, same clock as the samples [ns]
+   __u32 seq;                         // Motion events since probe, this one included
+   __u32 missed;                      // Events this file missed since its previous event read
+   __u32 awake;                       // 1 when autoWake already restored full rate sampling
+   __u32 reserved;
+
+} MPU9250_Event_t;
+
+/* Grouped read, one time-aligned sample of every probed sensor whatever the file the
+ * ioctl is issued on. In streaming mode each sample is the ring record nearest to the
+ * reference time, without bus traffic: timestamp 0 takes the newest time every sensor
+ * already reached. In register mode all sensors are read at once, one work per
+ * sensor, so sensors on different I2C controllers are read in parallel, and the
+ * timestamp is ignored. Sensors without a sample yet are left out.
+ */
+typedef struct
+{
+   __s64 timestamp;                   // In: reference time or 0 [ns], out: reference time used
+   __u32 count;                       // Out: samples stored
+   __u32 reserved;
+   __u32 index[MPU9250_GROUP_MAX];    // Out: sensor of each sample, the N of /dev/i2cMPU9250-N
+   MPU9250_Sample_t samples[MPU9250_GROUP_MAX]; // Out: the samples, each with its own timestamp
+
+} MPU9250_Group_t;
+
+/* Decimation stage of the file the ioctl is issued on, in streaming mode. read() and
+ * MPU9250_IOC_READ_BATCH then return one filtered record every decimation records of
+ * the ring, so a reader gets the rate it needs from an oversampled stream with the
+ * anti-aliasing done in the driver. The filters use integer arithmetic on the counts
+ * of every channel. A FIR output is sum(coeff[k] * x[n - k]) / 32768 rounded and
+ * saturated, coeff[0] weights the newest record, so coefficients adding up to 32768
+ * have unity gain. Output timestamps are the center of the block (box) or the record
+ * (taps - 1) / 2 before the newest one, the delay of a symmetric FIR. Records lost by
+ * an overrun restart the filter. Other files and the mapped ring are not affected.
+ */
+typedef struct
+{
+   __u32 type;                        // MPU9250_FILTER_*
+   __u32 decimation;                  // Input records per output record, 1 to MPU9250_FILTER_DECIMATION_MAX
+   __u32 taps;                        // FIR length, 1 to MPU9250_FILTER_TAPS_MAX, ignored by the box filter
+   __u32 rateMilliHz;                 // Out of MPU9250_IOC_GET_FILTER: output rate at the current ODR [1e-3 Hz]
+   __s16 coeff[MPU9250_FILTER_TAPS_MAX]; // FIR coefficients in Q15, the first taps are used
+
+} MPU9250_Filter_t;
+
+/* ioctl commands */
+#define MPU9250_IOC_MAGIC             'M'
+#define MPU9250_IOC_GET_VERSION       _IOR(MPU9250_IOC_MAGIC, 0, __u32)
+#define MPU9250_IOC_GET_CONFIG        _IOR(MPU9250_IOC_MAGIC, 1, MPU9250_Config_t)
+#define MPU9250_IOC_SET_CONFIG        _IOW(MPU9250_IOC_MAGIC, 2, MPU9250_Config_t)
+#define MPU9250_IOC_GET_SCALE         _IOR(MPU9250_IOC_MAGIC, 3, MPU9250_Scale_t)
+#define MPU9250_IOC_READ_BATCH        _IOWR(MPU9250_IOC_MAGIC, 4, MPU9250_Batch_t)
+#define MPU9250_IOC_GET_LAYOUT        _IOR(MPU9250_IOC_MAGIC, 5, MPU9250_Layout_t)
+#define MPU9250_IOC_SET_LAYOUT        _IOW(MPU9250_IOC_MAGIC, 6, MPU9250_Layout_t)
+#define MPU9250_IOC_GET_CALIB         _IOR(MPU9250_IOC_MAGIC, 7, MPU9250_Calib_t)
+#define MPU9250_IOC_SET_CALIB         _IOW(MPU9250_IOC_MAGIC, 8, MPU9250_Calib_t)
+#define MPU9250_IOC_GET_STATS         _IOR(MPU9250_IOC_MAGIC, 9, MPU9250_Stats_t)
+#define MPU9250_IOC_GET_WOM           _IOR(MPU9250_IOC_MAGIC, 10, MPU9250_Wom_t)
+#define MPU9250_IOC_SET_WOM           _IOW(MPU9250_IOC_MAGIC, 11, MPU9250_Wom_t)
+#define MPU9250_IOC_READ_EVENT        _IOR(MPU9250_IOC_MAGIC, 12, MPU9250_Event_t)
+#define MPU9250_IOC_READ_GROUP        _IOWR(MPU9250_IOC_MAGIC, 13, MPU9250_Group_t)
+#define MPU9250_IOC_GET_FILTER        _IOR(MPU9250_IOC_MAGIC, 14, MPU9250_Filter_t)
+#define MPU9250_IOC_SET_FILTER        _IOW(MPU9250_IOC_MAGIC, 15, MPU9250_Filter_t)
+#define MPU9250_IOC_SET_TAIL          _IOW(MPU9250_IOC_MAGIC, 16, __u32)
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * @file   myMPU9250_emu.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Simulated I2C adapter with an emulated MPU9250 at 0x68.
+ *
+ * Loading this module registers a software I2C adapter and instantiates a "myMPU9250"
+ * client on it, so the unmodified myMPU9250 LKM probes against the register model of
+ * myMPU9250_model.c instead of a real sensor. There is no data-ready line, the driver
+ * polls. Unloading the module removes the client before the adapter.
+ *
+ *    insmod myMPU9250sim.ko motion=1 noise=4
+ *    insmod myMPU9250.ko streaming=1
+ */
+#include <linux/init.h>                 // Macros used to mark up functions e.g. __init __exit
+#include <linux/module.h>               // Core header for loading LKMs into the kernel
+#include <linux/kernel.h>               // Contains types, macros, functions for the kernel
+#include <linux/version.h>              // i2c_new_device() was replaced in 5.5
+#include <linux/i2c.h>                  // I2C adapter and client registration
+#include <linux/mutex.h>                // Serializes transfers on the model
+#include <linux/ktime.h>                // Model time
+#include "myMPU9250_model.h"            // Register model of the sensor
+
+#define  ADAPTER_NAME   "myMPU9250sim"  ///< Name of the simulated adapter, see /sys/bus/i2c/devices
+#define  CLIENT_NAME    "myMPU9250"     ///< Matches the i2c_device_id of the myMPU9250 LKM
+#define  CLIENT_ADDRESS 0x68            ///< AD0 low
+
+MODULE_LICENSE("GPL");                                            ///< The license type -- this affects available functionality
+MODULE_AUTHOR("Rodrigo A. Tirapegui");                            ///< The author -- visible when you use modinfo
+MODULE_DESCRIPTION("Emulated MPU9250 on a simulated I2C adapter"); ///< The description -- see modinfo
+MODULE_VERSION("0.1");                                            ///< A version number to inform users
+
+static unsigned short who_am_i = 0x71;                            ///< Identity of the emulated sensor
+module_param(who_am_i, ushort, 0444);
+MODULE_PARM_DESC(who_am_i, "WHO_AM_I of the emulated sensor, 0x71 MPU9250 or 0x73 MPU9255 (default: 0x71)");
+
+static unsigned int motion = MPU9250_MODEL_STILL;                 ///< Simulated motion
+module_param(motion, uint, 0444);
+MODULE_PARM_DESC(motion, "Simulated motion, 0 lying flat or 1 rotating about every axis (default: 0)");
+
+static unsigned int noise = 2;                                    ///< Peak output noise
+module_param(noise, uint, 0444);
+MODULE_PARM_DESC(noise, "Peak noise added to every output in LSB (default: 2)");
+
+static MPU9250_Model_t      g_model;                              ///< The emulated sensor
+static DEFINE_MUTEX(g_modelLock);                                 ///< Serializes transfers on the model
+static u8                   g_pointer = 0;                        ///< Register pointer, kept between messages as on the real bus
+static struct i2c_client *  g_client = NULL;                      ///< The myMPU9250 client on the adapter
+
+// Private functions
+
+static int mpu9250EmuXfer(struct i2c_adapter *adapter, struct i2c_msg *msgs, int num)
+{
+   int i;
+
+   mutex_lock(&g_modelLock);
+
+   mpu9250ModelAdvance(&g_model, ktime_get_ns());
+
+   for (i = 0; i < num; i++)
+   {
+      if (CLIENT_ADDRESS != msgs[i].addr)
+      {
+         mutex_unlock(&g_modelLock);
+         return -ENXIO;
+      }
+
+      if (msgs[i].flags & I2C_M_RD)
+      {
+         mpu9250ModelRead(&g_model, g_pointer, msgs[i].buf, msgs[i].len);
+      }
+      else if (0 < msgs[i].len)
+      {
+         /* First byte is the register pointer, the rest are written from there */
+         g_pointer = msgs[i].buf[0] & (MPU9250_MODEL_REGS - 1);
+         mpu9250ModelWrite(&g_model, g_pointer, &msgs[i].buf[1], msgs[i].len - 1);
+      }
+   }
+
+   mutex_unlock(&g_modelLock);
+
+   return num;
+}
+
+static u32 mpu9250EmuFunctionality(struct i2c_adapter *adapter)
+{
+   return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm mpu9250EmuAlgorithm =
+{
+   .master_xfer   = mpu9250EmuXfer,
+   .functionality = mpu9250EmuFunctionality,
+};
+
+static struct i2c_adapter g_adapter =
+{
+   .owner = THIS_MODULE,
+   .class = I2C_CLASS_HWMON,
+   .algo  = &mpu9250EmuAlgorithm,
+   .name  = ADAPTER_NAME,
+};
+
+// Public functions
+
+static int __init myMPU9250sim_init(void)
+{
+   struct i2c_board_info info = { I2C_BOARD_INFO(CLIENT_NAME, CLIENT_ADDRESS) };
+   int rv;
+
+   if ((0x71 != who_am_i) && (0x73 != who_am_i))
+   {
+      pr_err("From Init: Unsupported WHO_AM_I 0x%02x\n", who_am_i);
+      return -EINVAL;
+   }
+
+   mpu9250ModelInit(&g_model, who_am_i, motion, noise);
+
+   rv = i2c_add_adapter(&g_adapter);
+
+   if(0 > rv)
+   {
+      pr_err("From Init: Add adapter error %d\n", rv);
+      return rv;
+   }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+   g_client = i2c_new_client_device(&g_adapter, &info);
+#else
+   g_client = i2c_new_device(&g_adapter, &info);
+   if (NULL == g_client)
+      g_client = ERR_PTR(-ENODEV);
+#endif
+
+   if (IS_ERR(g_client))
+   {
+      rv = PTR_ERR(g_client);
+      pr_err("From Init: New client error %d\n", rv);
+      i2c_del_adapter(&g_adapter);
+      return rv;
+   }
+
+   pr_info("From Init: Emulated MPU9250 on i2c-%d at 0x%02x\n", g_adapter.nr, CLIENT_ADDRESS);
+
+   return 0;
+}
+
+static void __exit myMPU9250sim_exit(void)
+{
+   i2c_unregister_device(g_client);
+   i2c_del_adapter(&g_adapter);
+
+   pr_info("From Exit: %llu samples, %llu FIFO overflows\n", g_model.samples, g_model.fifoOverflows);
+}
+
+module_init(myMPU9250sim_init);
+module_exit(myMPU9250sim_exit);
@@ -0,0 +1,533 @@
+/**
+ * @file   myMPU9250_model.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Register level model of an MPU9250 with its AK8963.
+ *
+ * See myMPU9250_model.h. Only integer arithmetic is used so the same file builds
+ * in the kernel and in user space; waveforms come from a quarter sine table.
+ */
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/math64.h>
+#else
+#include <string.h>
+#endif
+#include "myMPU9250_model.h"
+
+// Constants
+#define MODEL_CATCHUP       1024                ///< Samples generated at most per advance, the FIFO holds far less
+#define MODEL_TEMP_COUNTS   1335                ///< 25 C, (25 - 21) * 333.87 LSB/C
+#define MODEL_AK8963_INFO   0x9A                ///< Device information byte, any value
+
+/* Bias of the simulated sensor, so calibration has something to remove */
+static const int g_gyroBiasMdps[3] = { 1500, -800, 300 };                  ///< [1e-3 deg/s]
+static const int g_accelBiasMg[3]  = { 20, -15, 30 };                      ///< [1e-3 g]
+
+/* Factory trims of XA_OFFSET_H..ZA_OFFSET_L, bit 0 set as on real parts */
+static const uint8_t g_accelTrim[3][2] = { { 0x0F, 0x21 }, { 0xF2, 0x45 }, { 0x1A, 0x07 } };
+static const uint8_t g_accelTrimRegister[3] = { MPU9250_XA_OFFSET_H, MPU9250_YA_OFFSET_H, MPU9250_ZA_OFFSET_H };
+
+/* Cycle mode wake-up periods indexed by LP_ACCEL_ODR, 0.24 Hz to 500 Hz */
+static const uint32_t g_lpPeriodUs[12] = { 4166667, 2040816, 1020408, 512821, 255754, 128041,
+                                           63980, 32000, 16000, 8000, 4000, 2000 };
+
+/* AK8963 fuse ROM sensitivity adjustment */
+static const uint8_t g_asa[3] = { 0xB0, 0xB2, 0xA6 };
+
+/* sin(x) for x in [0, pi/2], 64 steps, Q15 */
+static const int16_t g_sinQuarter[65] =
+{
+       0,   804,  1608,  2410,  3212,  4011,  4808,  5602,
+    6393,  7179,  7962,  8739,  9512, 10278, 11039, 11793,
+   12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+   18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+   23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+   27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+   30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+   32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+   32767,
+};
+
+// Private functions
+
+/** @brief a % b without a 64 bit division helper in the kernel */
+static uint32_t mpu9250ModelRem(uint64_t a, uint32_t b)
+{
+#ifdef __KERNEL__
+   u32 rem;
+
+   div_u64_rem(a, b, &rem);
+   return rem;
+#else
+   return (uint32_t)(a % b);
+#endif
+}
+
+/** @brief amplitude * sin(2 pi t / period) */
+static int mpu9250ModelSin(uint64_t ms, uint32_t periodMs, int amplitude)
+{
+   unsigned int index = mpu9250ModelRem(ms, periodMs) * 256 / periodMs;
+   unsigned int i = index & 63;
+   int v;
+
+   switch (index >> 6)
+   {
+      case 0:  v =  g_sinQuarter[i];      break;
+      case 1:  v =  g_sinQuarter[64 - i]; break;
+      case 2:  v = -g_sinQuarter[i];      break;
+      default: v = -g_sinQuarter[64 - i]; break;
+   }
+
+   return (amplitude * v) / 32768;
+}
+
+/** @brief Uniform noise in [-noise, noise] */
+static int mpu9250ModelNoise(MPU9250_Model_t *model)
+{
+   if (0 == model->noise)
+      return 0;
+
+   model->seed = model->seed * 1664525u + 1013904223u;
+
+   return (int)((model->seed >> 16) % (2 * model->noise + 1)) - (int)model->noise;
+}
+
+static int16_t mpu9250ModelClamp(int value)
+{
+   return (int16_t)((value > 32767) ? 32767 : ((value < -32768) ? -32768 : value));
+}
+
+static void mpu9250ModelPut16(uint8_t *p, int16_t value)
+{
+   p[0] = (uint16_t)value >> 8;
+   p[1] = (uint16_t)value & 0xFF;
+}
+
+static int16_t mpu9250ModelGet16(const uint8_t *p)
+{
+   return (int16_t)((p[0] << 8) | p[1]);
+}
+
+/** @brief Sample period from SMPDIV, the divider only applies with the DLPF enabled.
+ *  In cycle mode the sensor only wakes up at the low-power rate.
+ */
+static uint64_t mpu9250ModelPeriod(const MPU9250_Model_t *model)
+{
+   unsigned int dlpf = model->regs[MPU9250_CONFIG] & 0x07;
+
+   if (model->regs[MPU9250_PWR_MGMNT_1] & MPU9250_PWR_CYCLE)
+      return 1000ULL * g_lpPeriodUs[(model->regs[MPU9250_LP_ACCEL_ODR] & 0x0F) % 12];
+
+   if ((0 == dlpf) || (7 == dlpf))
+      return 125000;
+
+   return 1000000ULL * (1 + model->regs[MPU9250_SMPDIV]);
+}
+
+static void mpu9250ModelAk8963Reset(MPU9250_Model_t *model)
+{
+   memset(model->akRegs, 0, sizeof(model->akRegs));
+
+   model->akRegs[MPU9250_AK8963_WHO_AM_I] = MPU9250_AK8963_ID;
+   model->akRegs[MPU9250_AK8963_WHO_AM_I + 1] = MODEL_AK8963_INFO;
+   memcpy(&model->akRegs[MPU9250_AK8963_ASA], g_asa, sizeof(g_asa));
+}
+
+static void mpu9250ModelReset(MPU9250_Model_t *model)
+{
+   unsigned int i;
+
+   memset(model->regs, 0, sizeof(model->regs));
+
+   model->regs[MPU9250_WHO_AM_I] = model->whoAmI;
+   model->regs[MPU9250_PWR_MGMNT_1] = MPU9250_CLOCK_SEL_PLL;
+
+   for (i = 0; i < 3; i++)
+   {
+      model->regs[g_accelTrimRegister[i]]     = g_accelTrim[i][0];
+      model->regs[g_accelTrimRegister[i] + 1] = g_accelTrim[i][1];
+   }
+
+   model->fifoHead = 0;
+   model->fifoCount = 0;
+}
+
+/** @brief Writes an AK8963 register as SLV0 does */
+static void mpu9250ModelAk8963Write(MPU9250_Model_t *model, uint8_t reg, uint8_t value)
+{
+   switch (reg)
+   {
+      case MPU9250_AK8963_CNTL2:
+         if (value & MPU9250_AK8963_RESET)
+            mpu9250ModelAk8963Reset(model);
+         break;
+
+      case MPU9250_AK8963_CNTL1:
+         model->akRegs[reg] = value;
+         model->nextMag = model->now;
+         break;
+
+      default:
+         /* WIA, INFO, data, status and fuse ROM are read only */
+         if ((0x0C <= reg) && (MPU9250_AK8963_ASA > reg))
+            model->akRegs[reg] = value;
+         break;
+   }
+}
+
+/** @brief Takes a magnetometer measurement when the AK8963 mode has one due */
+static void mpu9250ModelAk8963Measure(MPU9250_Model_t *model, uint64_t t, uint64_t ms)
+{
+   uint8_t cntl1 = model->akRegs[MPU9250_AK8963_CNTL1];
+   uint64_t period;
+   int field[3];
+   int16_t raw;
+   unsigned int i;
+
+   switch (cntl1 & 0x0F)
+   {
+      case 0x01: period = 0;          break;      // Single measurement
+      case 0x02: period = 125000000;  break;      // Continuous 8 Hz
+      case 0x06: period = 10000000;   break;      // Continuous 100 Hz
+      default:   return;
+   }
+
+   if (t < model->nextMag)
+      return;
+
+   /* Earth field in AK8963 axes [0.1 uT], turning with the heading in the sine motion */
+   if (MPU9250_MODEL_SINE == model->motion)
+   {
+      field[0] = mpu9250ModelSin(ms + 2500, 10000, 250);
+      field[1] = mpu9250ModelSin(ms, 10000, 250);
+   }
+   else
+   {
+      field[0] = 250;
+      field[1] = 0;
+   }
+   field[2] = 400;
+
+   /* 0.15 uT / LSB in 16 bit mode, 0.6 in 14 bit mode, then undo the ASA adjustment */
+   for (i = 0; i < 3; i++)
+   {
+      raw = mpu9250ModelClamp((field[i] * ((cntl1 & 0x10) ? 20 : 5) / 3 + mpu9250ModelNoise(model)) * 256 / (g_asa[i] + 128));
+
+      model->akRegs[MPU9250_AK8963_HXL + 2 * i]     = (uint16_t)raw & 0xFF;
+      model->akRegs[MPU9250_AK8963_HXL + 2 * i + 1] = (uint16_t)raw >> 8;
+   }
+
+   model->akRegs[MPU9250_AK8963_ST1] |= MPU9250_AK8963_ST1_DRDY;
+   model->akRegs[MPU9250_AK8963_ST2] = (cntl1 & 0x10) ? MPU9250_AK8963_ST2_BITM : 0;
+
+   if (0 == period)
+      model->akRegs[MPU9250_AK8963_CNTL1] = cntl1 & 0x10;
+   else
+      model->nextMag = (t - model->nextMag > period) ? t + period : model->nextMag + period;
+}
+
+/** @brief One transaction of the auxiliary I2C master */
+static void mpu9250ModelSlave0(MPU9250_Model_t *model)
+{
+   uint8_t addr = model->regs[MPU9250_I2C_SLV0_ADDR];
+   uint8_t reg = model->regs[MPU9250_I2C_SLV0_REG];
+   unsigned int len = model->regs[MPU9250_I2C_SLV0_CTRL] & 0x0F;
+   unsigned int i;
+
+   if (!(model->regs[MPU9250_USER_CTRL] & MPU9250_I2C_MST_EN) || !(model->regs[MPU9250_I2C_SLV0_CTRL] & MPU9250_I2C_SLV0_EN))
+      return;
+
+   /* Nothing else answers on the auxiliary bus */
+   if (MPU9250_AK8963_I2C_ADDR != (addr & 0x7F))
+      return;
+
+   if (!(addr & MPU9250_I2C_READ_FLAG))
+   {
+      mpu9250ModelAk8963Write(model, reg, model->regs[MPU9250_I2C_SLV0_DO]);
+      return;
+   }
+
+   for (i = 0; i < len; i++)
+      model->regs[MPU9250_EXT_SENS_DATA_00 + i] = (reg + i < MPU9250_MODEL_AK8963_REGS) ? model->akRegs[reg + i] : 0;
+
+   /* Reading ST2 ends the measurement read */
+   if ((reg <= MPU9250_AK8963_ST2) && (reg + len > MPU9250_AK8963_ST2))
+      model->akRegs[MPU9250_AK8963_ST1] &= ~MPU9250_AK8963_ST1_DRDY;
+}
+
+/** @brief Appends the FIFO_EN channels, in register order */
+static void mpu9250ModelFifoPush(MPU9250_Model_t *model)
+{
+   uint8_t enable = model->regs[MPU9250_FIFO_EN];
+   uint8_t frame[6 + 2 + 6 + 15];
+   unsigned int len = 0;
+   unsigned int i;
+
+   if (!(model->regs[MPU9250_USER_CTRL] & MPU9250_USER_FIFO_EN) || (0 == enable))
+      return;
+
+   if (enable & MPU9250_FIFO_ACCEL)
+   {
+      memcpy(frame + len, &model->regs[MPU9250_ACCEL_OUT], 6);
+      len += 6;
+   }
+   if (enable & MPU9250_FIFO_TEMP)
+   {
+      memcpy(frame + len, &model->regs[MPU9250_TEMP_OUT], 2);
+      len += 2;
+   }
+   for (i = 0; i < 3; i++)
+   {
+      if (enable & (MPU9250_FIFO_GYRO_X >> i))
+      {
+         memcpy(frame + len, &model->regs[MPU9250_GYRO_OUT + 2 * i], 2);
+         len += 2;
+      }
+   }
+   if (enable & MPU9250_FIFO_MAG)
+   {
+      memcpy(frame + len, &model->regs[MPU9250_EXT_SENS_DATA_00], model->regs[MPU9250_I2C_SLV0_CTRL] & 0x0F);
+      len += model->regs[MPU9250_I2C_SLV0_CTRL] & 0x0F;
+   }
+
+   if (model->fifoCount + len > MPU9250_FIFO_SIZE)
+   {
+      model->regs[MPU9250_INT_STATUS] |= MPU9250_INT_FIFO_OFLOW;
+      model->fifoOverflows++;
+
+      /* FIFO_MODE keeps the old bytes, otherwise the oldest ones are overwritten */
+      if (model->regs[MPU9250_CONFIG] & MPU9250_CONFIG_FIFO_MODE)
+         return;
+
+      i = model->fifoCount + len - MPU9250_FIFO_SIZE;
+      model->fifoHead = (model->fifoHead + i) % MPU9250_FIFO_SIZE;
+      model->fifoCount -= i;
+   }
+
+   for (i = 0; i < len; i++)
+      model->fifo[(model->fifoHead + model->fifoCount + i) % MPU9250_FIFO_SIZE] = frame[i];
+
+   model->fifoCount += len;
+}
+
+/** @brief Updates every output register for a sample taken at time t */
+static void mpu9250ModelSample(MPU9250_Model_t *model, uint64_t t)
+{
+   uint8_t *regs = model->regs;
+   unsigned int gyroRange = 250 << ((regs[MPU9250_GYRO_CONFIG] >> 3) & 0x03);
+   unsigned int accelRange = 2 << ((regs[MPU9250_ACCEL_CONFIG] >> 3) & 0x03);
+   uint8_t disabled = regs[MPU9250_PWR_MGMNT_2];
+   uint64_t ms;
+   int gyroMdps[3], accelMg[3];
+   int counts, trim, delta;
+   unsigned int i;
+
+#ifdef __KERNEL__
+   ms = div_u64(t, 1000000);
+#else
+   ms = t / 1000000;
+#endif
+
+   /* Motion, then what the sensor makes of it */
+   if (MPU9250_MODEL_SINE == model->motion)
+   {
+      gyroMdps[0] = mpu9250ModelSin(ms, 2000, 90000);
+      gyroMdps[1] = mpu9250ModelSin(ms, 3000, 45000);
+      gyroMdps[2] = mpu9250ModelSin(ms, 5000, 180000);
+      accelMg[0]  = mpu9250ModelSin(ms, 1500, 200);
+      accelMg[1]  = mpu9250ModelSin(ms, 2500, 200);
+   }
+   else
+   {
+      gyroMdps[0] = gyroMdps[1] = gyroMdps[2] = 0;
+      accelMg[0] = accelMg[1] = 0;
+   }
+   accelMg[2] = 1000;
+
+   for (i = 0; i < 3; i++)
+   {
+      /* 32768 / (range * 1000) LSB per milli unit, written as 4096 / (range * 125) to stay in 32 bits */
+      counts = (gyroMdps[i] + g_gyroBiasMdps[i]) * 4096 / (int)(gyroRange * 125) +
+               mpu9250ModelGet16(&regs[MPU9250_XG_OFFSET_H + 2 * i]) * 1000 / (int)gyroRange;
+      mpu9250ModelPut16(&regs[MPU9250_GYRO_OUT + 2 * i],
+                        (disabled & (0x04 >> i)) ? 0 : mpu9250ModelClamp(counts + mpu9250ModelNoise(model)));
+
+      /* Accel offsets are in 16 g counts and relative to the factory trims */
+      trim = (mpu9250ModelGet16(&regs[g_accelTrimRegister[i]]) & ~1) - (mpu9250ModelGet16(g_accelTrim[i]) & ~1);
+      counts = (accelMg[i] + g_accelBiasMg[i]) * 4096 / (int)(accelRange * 125) + trim * 16 / (int)accelRange;
+      mpu9250ModelPut16(&regs[MPU9250_ACCEL_OUT + 2 * i],
+                        (disabled & (0x20 >> i)) ? 0 : mpu9250ModelClamp(counts + mpu9250ModelNoise(model)));
+   }
+
+   /* Motion comparator, against the previous sample in compare mode */
+   if (model->womRefValid &&
+       ((MPU9250_ACCEL_INTEL_EN | MPU9250_ACCEL_INTEL_MODE) ==
+        (regs[MPU9250_MOT_DETECT_CTRL] & (MPU9250_ACCEL_INTEL_EN | MPU9250_ACCEL_INTEL_MODE))))
+   {
+      for (i = 0; i < 3; i++)
+      {
+         delta = accelMg[i] - model->womRefMg[i];
+
+         if ((delta > 4 * regs[MPU9250_WOM_THR]) || (-delta > 4 * regs[MPU9250_WOM_THR]))
+            regs[MPU9250_INT_STATUS] |= MPU9250_INT_WOM;
+      }
+   }
+
+   memcpy(model->womRefMg, accelMg, sizeof(model->womRefMg));
+   model->womRefValid = 1;
+
+   mpu9250ModelPut16(&regs[MPU9250_TEMP_OUT], MODEL_TEMP_COUNTS + mpu9250ModelNoise(model));
+
+   mpu9250ModelAk8963Measure(model, t, ms);
+   mpu9250ModelSlave0(model);
+   mpu9250ModelFifoPush(model);
+
+   regs[MPU9250_INT_STATUS] |= MPU9250_INT_RAW_RDY_EN;
+   model->samples++;
+}
+
+static void mpu9250ModelWriteRegister(MPU9250_Model_t *model, uint8_t reg, uint8_t value)
+{
+   switch (reg)
+   {
+      case MPU9250_WHO_AM_I:
+      case MPU9250_INT_STATUS:
+      case MPU9250_FIFO_COUNT:
+      case MPU9250_FIFO_COUNT + 1:
+         return;
+
+      case MPU9250_FIFO_READ:
+         if (MPU9250_FIFO_SIZE > model->fifoCount)
+         {
+            model->fifo[(model->fifoHead + model->fifoCount) % MPU9250_FIFO_SIZE] = value;
+            model->fifoCount++;
+         }
+         return;
+
+      case MPU9250_PWR_MGMNT_1:
+         if (value & MPU9250_PWR_RESET)
+         {
+            mpu9250ModelReset(model);
+            return;
+         }
+         break;
+
+      case MPU9250_MOT_DETECT_CTRL:
+         /* The first sample after enabling the comparator only sets its reference */
+         model->womRefValid = 0;
+         break;
+
+      case MPU9250_USER_CTRL:
+         /* Reset bits clear themselves */
+         if (value & MPU9250_USER_FIFO_RST)
+         {
+            model->fifoHead = 0;
+            model->fifoCount = 0;
+         }
+         value &= ~(MPU9250_USER_FIFO_RST | 0x03);
+         break;
+
+      default:
+         if ((MPU9250_ACCEL_OUT <= reg) && (MPU9250_EXT_SENS_DATA_LAST >= reg))
+            return;
+         break;
+   }
+
+   model->regs[reg] = value;
+}
+
+static uint8_t mpu9250ModelReadRegister(MPU9250_Model_t *model, uint8_t reg)
+{
+   uint8_t value;
+
+   switch (reg)
+   {
+      case MPU9250_FIFO_READ:
+         /* An empty FIFO reads as the last byte, 0xFF is as good */
+         if (0 == model->fifoCount)
+            return 0xFF;
+
+         value = model->fifo[model->fifoHead];
+         model->fifoHead = (model->fifoHead + 1) % MPU9250_FIFO_SIZE;
+         model->fifoCount--;
+         return value;
+
+      case MPU9250_INT_STATUS:
+         /* Cleared by reading it */
+         value = model->regs[reg];
+         model->regs[reg] = 0;
+         return value;
+
+      case MPU9250_FIFO_COUNT:
+         return (model->fifoCount >> 8) & 0x1F;
+
+      case MPU9250_FIFO_COUNT + 1:
+         return model->fifoCount & 0xFF;
+
+      default:
+         return model->regs[reg];
+   }
+}
+
+// Public functions
+
+void mpu9250ModelInit(MPU9250_Model_t *model, uint8_t whoAmI, unsigned int motion, unsigned int noise)
+{
+   memset(model, 0, sizeof(*model));
+
+   model->whoAmI = whoAmI;
+   model->motion = motion;
+   model->noise = noise;
+   model->seed = 1;
+
+   mpu9250ModelReset(model);
+   mpu9250ModelAk8963Reset(model);
+}
+
+void mpu9250ModelAdvance(MPU9250_Model_t *model, uint64_t now)
+{
+   unsigned int n = 0;
+
+   if (now < model->now)
+      return;
+
+   model->now = now;
+
+   /* Sampling starts with the first transaction */
+   if (0 == model->nextSample)
+   {
+      model->nextSample = now + mpu9250ModelPeriod(model);
+      return;
+   }
+
+   while (model->nextSample <= now)
+   {
+      /* After a long gap only the last samples can still be in the FIFO */
+      if (MODEL_CATCHUP < ++n)
+      {
+         model->nextSample = now + mpu9250ModelPeriod(model);
+         break;
+      }
+
+      if (!(model->regs[MPU9250_PWR_MGMNT_1] & MPU9250_PWR_SLEEP))
+         mpu9250ModelSample(model, model->nextSample);
+
+      model->nextSample += mpu9250ModelPeriod(model);
+   }
+}
+
+void mpu9250ModelWrite(MPU9250_Model_t *model, uint8_t reg, const uint8_t *data, unsigned int count)
+{
+   unsigned int i;
+
+   for (i = 0; i < count; i++)
+      mpu9250ModelWriteRegister(model, (MPU9250_FIFO_READ == reg) ? reg : ((reg + i) & (MPU9250_MODEL_REGS - 1)), data[i]);
+}
+
+void mpu9250ModelRead(MPU9250_Model_t *model, uint8_t reg, uint8_t *data, unsigned int count)
+{
+   unsigned int i;
+
+   for (i = 0; i < count; i++)
+      data[i] = mpu9250ModelReadRegister(model, (MPU9250_FIFO_READ == reg) ? reg : ((reg + i) & (MPU9250_MODEL_REGS - 1)));
+}
@@ -0,0 +1,101 @@
+#ifndef _myMPU9250_model_H
+#define _myMPU9250_model_H
+
+/* Register level model of an MPU9250 with its AK8963, for tests without hardware.
+ *
+ * The same code runs inside the myMPU9250sim kernel module, behind a simulated I2C
+ * adapter the myMPU9250 LKM binds to, and linked into user space programs. It has
+ * no clock of its own: the caller advances it to the current time before every bus
+ * transaction, and the samples due since the previous call are generated then.
+ *
+ * Modelled behaviour:
+ *  - WHO_AM_I 0x71 (or 0x73), register reset through PWR_MGMT_1 and sleep mode
+ *  - sample period from SMPDIV and the DLPF setting, RAW_DATA_RDY in INT_STATUS,
+ *    cleared by reading it
+ *  - accel, temperature and gyro outputs in the configured ranges, with a sensor
+ *    bias and the gyro and accel offset registers (factory trims included)
+ *  - FIFO of 512 bytes filled with the FIFO_EN channels, FIFO_COUNT, FIFO_R_W burst
+ *    reads, FIFO_RST, FIFO_OFLOW and the CONFIG FIFO_MODE stop or overwrite policy
+ *  - SLV0 of the auxiliary master run once per sample: reads into EXT_SENS_DATA
+ *    and writes of SLV0_DO
+ *  - AK8963 WIA, CNTL1 modes (8 and 100 Hz, fuse ROM), CNTL2 soft reset, ASA, ST1
+ *    DRDY and ST2 with the 16 bit flag
+ *  - wake-on-motion: cycle mode at the LP_ACCEL_ODR rate, and the MOT_DETECT_CTRL
+ *    comparator setting WOM_INT when the accel moved more than WOM_THR since the
+ *    previous sample
+ */
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+#include "myMPU9250.h"
+
+// Constants
+
+/* Motion of the simulated sensor */
+#define MPU9250_MODEL_STILL           0             // Lying flat, gravity on +z
+#define MPU9250_MODEL_SINE            1             // Rotating back and forth about every axis
+
+/* Register file sizes, MPU9250 0x00 to 0x7F and AK8963 0x00 (WIA) to 0x12 (ASAZ) */
+#define MPU9250_MODEL_REGS            0x80
+#define MPU9250_MODEL_AK8963_REGS     0x13
+
+// Types
+typedef struct
+{
+   uint8_t regs[MPU9250_MODEL_REGS];                // MPU9250 registers
+   uint8_t akRegs[MPU9250_MODEL_AK8963_REGS];       // AK8963 registers
+
+   uint8_t fifo[MPU9250_FIFO_SIZE];                 // FIFO ring
+   unsigned int fifoHead;                           // Oldest byte
+   unsigned int fifoCount;                          // Bytes queued
+
+   uint8_t whoAmI;                                  // 0x71 MPU9250, 0x73 MPU9255
+   unsigned int motion;                             // MPU9250_MODEL_*
+   unsigned int noise;                              // Peak noise added to every output [LSB]
+   uint32_t seed;                                   // Noise generator state
+
+   uint64_t now;                                    // Model time [ns]
+   uint64_t nextSample;                             // Time of the next sample, 0 until the first advance [ns]
+   uint64_t nextMag;                                // Time of the next AK8963 measurement [ns]
+   uint64_t samples;                                // Samples generated
+   uint64_t fifoOverflows;                          // Frames that did not fit in the FIFO
+   int womRefMg[3];                                 // Accel of the previous sample, reference of the motion comparator [1e-3 g]
+   unsigned int womRefValid;                        // womRefMg was taken since MOT_DETECT_CTRL was written
+
+} MPU9250_Model_t;
+
+// Public functions
+
+/** @brief Powers the model up, every register at its reset value
+ *  @param model The model
+ *  @param whoAmI WHO_AM_I value, 0x71 or 0x73
+ *  @param motion MPU9250_MODEL_STILL or MPU9250_MODEL_SINE
+ *  @param noise Peak noise added to every output [LSB]
+ */
+void mpu9250ModelInit(MPU9250_Model_t *model, uint8_t whoAmI, unsigned int motion, unsigned int noise);
+
+/** @brief Generates the samples due up to a time
+ *  @param model The model
+ *  @param now Current time, monotonic [ns]
+ */
+void mpu9250ModelAdvance(MPU9250_Model_t *model, uint64_t now);
+
+/** @brief Bus write of consecutive registers, FIFO_R_W does not auto-increment
+ *  @param model The model
+ *  @param reg First register
+ *  @param data The values
+ *  @param count Number of registers
+ */
+void mpu9250ModelWrite(MPU9250_Model_t *model, uint8_t reg, const uint8_t *data, unsigned int count);
+
+/** @brief Bus read of consecutive registers, FIFO_R_W does not auto-increment
+ *  @param model The model
+ *  @param reg First register
+ *  @param data The values read
+ *  @param count Number of registers
+ */
+void mpu9250ModelRead(MPU9250_Model_t *model, uint8_t reg, uint8_t *data, unsigned int count);
+
+#endif
@@ -0,0 +1,307 @@
+/**
+ * @file   myMPU9250_broker.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Sample rings in POSIX shared memory.
+ *
+ * See myMPU9250_broker.h. The producer claims records by advancing reserve before
+ * writing them and publishes them by advancing head, a consumer validates a copy by
+ * reading reserve after it, the same protocol as the driver mapped ring.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "myMPU9250_broker.h"
+
+// Constants
+#define CAPACITY_MIN        64                  ///< Smallest ring, in records
+#define CAPACITY_MAX        (1u << 24)          ///< Largest ring, in records
+
+// Private functions
+
+static long mpu9250BrokerFutex(uint32_t *word, int op, uint32_t val, const struct timespec *timeout)
+{
+   return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+/** @brief Bumps the futex word and wakes every consumer sleeping on it */
+static void mpu9250BrokerWake(MPU9250_BrokerRing_t *ring)
+{
+   __atomic_add_fetch(&ring->futex, 1, __ATOMIC_RELEASE);
+   mpu9250BrokerFutex(&ring->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+// Public functions
+
+int mpu9250BrokerCreate(MPU9250_Broker_t *b, unsigned int sensor, unsigned int capacity, const MPU9250_Config_t *config,
+                        const MPU9250_Scale_t *scale, const MPU9250_Calib_t *calib)
+{
+   MPU9250_BrokerRing_t *ring;
+   uint32_t dataOffset, size;
+   char name[32];
+   void *map;
+   int fd;
+
+   if ((MPU9250_GROUP_MAX <= sensor) || (CAPACITY_MAX < capacity))
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   capacity = (CAPACITY_MIN > capacity) ? CAPACITY_MIN : capacity;
+
+   while (capacity & (capacity - 1))
+      capacity = (capacity | (capacity - 1)) + 1;
+
+   dataOffset = (sizeof(MPU9250_BrokerRing_t) + 63) & ~63u;
+   size = dataOffset + capacity * sizeof(MPU9250_Sample_t);
+
+   /* A ring left by a broker that did not stop cleanly is replaced, its consumers keep
+    * the old mapping and see it stopped
+    */
+   snprintf(name, sizeof(name), MPU9250_BROKER_NAME, sensor);
+   shm_unlink(name);
+
+   fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+   if (0 > fd)
+      return -1;
+
+   if (0 != ftruncate(fd, size))
+   {
+      close(fd);
+      shm_unlink(name);
+      return -1;
+   }
+
+   map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+
+   if (MAP_FAILED == map)
+   {
+      shm_unlink(name);
+      return -1;
+   }
+
+   /* ftruncate() zeroed the memory, magic goes last so a consumer never sees half a header */
+   ring = map;
+   ring->version = MPU9250_BROKER_VERSION;
+   ring->size = size;
+   ring->dataOffset = dataOffset;
+   ring->capacity = capacity;
+   ring->sensor = sensor;
+   ring->producer = getpid();
+   ring->config = *config;
+   ring->scale = *scale;
+
+   if (calib)
+      ring->calib = *calib;
+
+   __atomic_store_n(&ring->magic, MPU9250_BROKER_MAGIC, __ATOMIC_RELEASE);
+
+   memset(b, 0, sizeof(*b));
+   b->ring = ring;
+   b->records = (MPU9250_Sample_t *)((char *)map + dataOffset);
+   b->owner = 1;
+
+   return 0;
+}
+
+MPU9250_Sample_t *mpu9250BrokerClaim(MPU9250_Broker_t *b, unsigned int *count)
+{
+   MPU9250_BrokerRing_t *ring = b->ring;
+   uint64_t head = ring->head;
+   uint32_t pos = head & (ring->capacity - 1);
+
+   if (*count > ring->capacity - pos)
+      *count = ring->capacity - pos;
+
+   /* Sequentially consistent, so the claim is visible before any of the records change */
+   __atomic_store_n(&ring->reserve, head + *count, __ATOMIC_SEQ_CST);
+
+   return &b->records[pos];
+}
+
+void mpu9250BrokerPublish(MPU9250_Broker_t *b, unsigned int count)
+{
+   MPU9250_BrokerRing_t *ring = b->ring;
+   uint64_t head = ring->head + count;
+
+   /* Claimed records left unfilled were not touched, consumers need not drop their copies */
+   __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+   __atomic_store_n(&ring->reserve, head, __ATOMIC_RELEASE);
+
+   if (0 != count)
+      mpu9250BrokerWake(ring);
+}
+
+void mpu9250BrokerDestroy(MPU9250_Broker_t *b)
+{
+   MPU9250_BrokerRing_t *ring = b->ring;
+   char name[32];
+
+   if (!ring)
+      return;
+
+   __atomic_store_n(&ring->producer, 0, __ATOMIC_RELEASE);
+   mpu9250BrokerWake(ring);
+
+   snprintf(name, sizeof(name), MPU9250_BROKER_NAME, ring->sensor);
+   shm_unlink(name);
+
+   munmap(ring, ring->size);
+   b->ring = NULL;
+}
+
+int mpu9250BrokerAttach(MPU9250_Broker_t *b, unsigned int sensor)
+{
+   MPU9250_BrokerRing_t *ring;
+   struct stat st;
+   char name[32];
+   void *map;
+   int fd;
+
+   snprintf(name, sizeof(name), MPU9250_BROKER_NAME, sensor);
+
+   fd = shm_open(name, O_RDONLY, 0);
+
+   if (0 > fd)
+      return -1;
+
+   if (0 != fstat(fd, &st))
+   {
+      close(fd);
+      return -1;
+   }
+
+   /* The broker is still sizing it */
+   if ((size_t)st.st_size < sizeof(MPU9250_BrokerRing_t))
+   {
+      close(fd);
+      errno = EAGAIN;
+      return -1;
+   }
+
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+
+   if (MAP_FAILED == map)
+      return -1;
+
+   ring = map;
+
+   if ((MPU9250_BROKER_MAGIC != __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE)) ||
+       (MPU9250_BROKER_VERSION != ring->version) || ((size_t)st.st_size < ring->size))
+   {
+      fd = (0 == ring->magic) ? EAGAIN : EPROTO;
+      munmap(map, st.st_size);
+      errno = fd;
+      return -1;
+   }
+
+   memset(b, 0, sizeof(*b));
+   b->ring = ring;
+   b->records = (MPU9250_Sample_t *)((char *)map + ring->dataOffset);
+   b->seq = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+   return 0;
+}
+
+unsigned int mpu9250BrokerRead(MPU9250_Broker_t *b, MPU9250_Sample_t *samples, unsigned int count)
+{
+   const MPU9250_BrokerRing_t *ring = b->ring;
+   uint32_t mask = ring->capacity - 1;
+   uint64_t head, reserve, lost;
+   unsigned int n, first;
+
+   head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+   /* Skip what the producer already overwrote */
+   if (head - b->seq > ring->capacity)
+   {
+      b->overruns += head - b->seq - ring->capacity;
+      b->seq = head - ring->capacity;
+   }
+
+   n = (head - b->seq < count) ? (unsigned int)(head - b->seq) : count;
+
+   if (0 == n)
+      return 0;
+
+   /* At most two pieces, before and after the end of the ring */
+   first = ring->capacity - (b->seq & mask);
+   first = (first < n) ? first : n;
+
+   memcpy(samples, &b->records[b->seq & mask], first * sizeof(MPU9250_Sample_t));
+   memcpy(&samples[first], b->records, (n - first) * sizeof(MPU9250_Sample_t));
+
+   /* Drop the oldest copies if the producer claimed their records meanwhile */
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   reserve = __atomic_load_n(&ring->reserve, __ATOMIC_RELAXED);
+
+   if (reserve - b->seq > ring->capacity)
+   {
+      lost = reserve - b->seq - ring->capacity;
+      lost = (lost < n) ? lost : n;
+
+      memmove(samples, &samples[lost], (n - lost) * sizeof(MPU9250_Sample_t));
+      b->overruns += lost;
+      b->seq += lost;
+      n -= lost;
+   }
+
+   b->seq += n;
+
+   return n;
+}
+
+int mpu9250BrokerWait(MPU9250_Broker_t *b, int timeoutMs)
+{
+   MPU9250_BrokerRing_t *ring = b->ring;
+   struct timespec ts = { .tv_sec = timeoutMs / 1000, .tv_nsec = (timeoutMs % 1000) * 1000000L };
+   uint32_t word;
+   pid_t producer;
+
+   while (1)
+   {
+      /* Read the word before head, a publication in between changes the word and the wait returns at once */
+      word = __atomic_load_n(&ring->futex, __ATOMIC_ACQUIRE);
+
+      if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != b->seq)
+         return 0;
+
+      producer = __atomic_load_n(&ring->producer, __ATOMIC_ACQUIRE);
+
+      if (0 == producer)
+      {
+         errno = EPIPE;
+         return -1;
+      }
+
+      if ((0 == mpu9250BrokerFutex(&ring->futex, FUTEX_WAIT, word, (0 > timeoutMs) ? NULL : &ts)) || (EAGAIN == errno))
+         continue;
+
+      /* A broker killed before it could mark the ring stops publishing for good */
+      if ((ETIMEDOUT == errno) && (0 != kill(producer, 0)) && (ESRCH == errno))
+         errno = EPIPE;
+
+      return -1;
+   }
+}
+
+void mpu9250BrokerDetach(MPU9250_Broker_t *b)
+{
+   if (!b->ring)
+      return;
+
+   munmap(b->ring, b->ring->size);
+   b->ring = NULL;
+}
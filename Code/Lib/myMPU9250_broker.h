@@ -0,0 +1,151 @@
+#ifndef _myMPU9250_broker_H
+#define _myMPU9250_broker_H
+
+/* Sample rings in POSIX shared memory, published by the myMPU9250 broker daemon.
+ *
+ * The broker is the only process that opens /dev/i2cMPU9250-N. It acquires every
+ * sensor at full rate and publishes its samples in /dev/shm/myMPU9250-N, a ring with
+ * the protocol of the driver mapped ring (MPU9250_Ring_t) and 64 bit sequence
+ * numbers that never wrap in practice. Any number of local consumers attach
+ * read-only and keep their own sequence number, so reading costs no syscall, no lock
+ * and no I2C transfer, and a consumer can neither block the producer nor corrupt the
+ * ring. A slow consumer finds out how many samples it lost.
+ *
+ * A consumer with nothing to read sleeps on a futex word of the ring, the broker
+ * wakes every sleeper once per published batch:
+ *
+ *    mpu9250BrokerAttach(&c, 0);
+ *    while (run)
+ *    {
+ *       n = mpu9250BrokerRead(&c, samples, 64);
+ *       if (0 == n) mpu9250BrokerWait(&c, 1000);
+ *    }
+ *    mpu9250BrokerDetach(&c);
+ *
+ * Link with -lrt on C libraries that keep shm_open() there.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "myMPU9250_uapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Constants
+
+#define MPU9250_BROKER_NAME           "/myMPU9250-%u"   // shm_open() name of sensor N
+#define MPU9250_BROKER_MAGIC          0x4B52424D    // "MBRK" in little-endian byte order
+#define MPU9250_BROKER_VERSION        1
+
+/* Records of a ring when the broker is not told otherwise, 4 s at 1 kHz */
+#define MPU9250_BROKER_CAPACITY       4096
+
+// Types
+
+/* Start of the shared memory, records follow at dataOffset. Producer counters sit on
+ * their own cache line so consumers polling them do not share a line with anything
+ * the producer writes less often.
+ */
+typedef struct
+{
+   uint32_t magic;                    // MPU9250_BROKER_MAGIC
+   uint32_t version;                  // MPU9250_BROKER_VERSION
+   uint32_t size;                     // Bytes of the shared memory
+   uint32_t dataOffset;               // Bytes from the start to the first record
+   uint32_t capacity;                 // Records, a power of two
+   uint32_t sensor;                   // The N of /dev/i2cMPU9250-N
+   int32_t producer;                  // Process id of the broker, 0 once it stopped
+   uint32_t reserved;
+   MPU9250_Config_t config;           // Sampling setup of the sensor when the broker started
+   MPU9250_Scale_t scale;
+   MPU9250_Calib_t calib;
+
+   uint64_t head __attribute__((aligned(64)));   // Records published
+   uint64_t reserve;                  // Records claimed by the producer, head <= reserve
+   uint32_t futex;                    // Bumped on every publication, consumers wait on it
+
+} MPU9250_BrokerRing_t;
+
+/* A mapping of one ring, by the broker or by a consumer */
+typedef struct
+{
+   MPU9250_BrokerRing_t *ring;
+   MPU9250_Sample_t *records;
+   uint64_t seq;                      // Consumer: next record to read
+   uint64_t overruns;                 // Consumer: records lost because it was too slow
+   int owner;                         // The broker created the ring
+
+} MPU9250_Broker_t;
+
+// Public functions
+
+/** @brief Creates the ring of a sensor, replacing a stale one
+ *  @param b The ring, owned by the caller
+ *  @param sensor The N of /dev/i2cMPU9250-N
+ *  @param capacity Records, rounded up to a power of two
+ *  @param config Sampling setup published to consumers
+ *  @param scale Scale factors published to consumers
+ *  @param calib Calibration published to consumers, NULL when unknown
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250BrokerCreate(MPU9250_Broker_t *b, unsigned int sensor, unsigned int capacity, const MPU9250_Config_t *config,
+                        const MPU9250_Scale_t *scale, const MPU9250_Calib_t *calib);
+
+/** @brief Space for the next records, contiguous up to the end of the ring
+ *  The records are claimed, consumers treat a copy of them as lost until they are
+ *  published. MPU9250_IOC_READ_BATCH can fill them directly.
+ *  @param b The ring, owned by the caller
+ *  @param count Records wanted, updated with the records available
+ *  @return The first record
+ */
+MPU9250_Sample_t *mpu9250BrokerClaim(MPU9250_Broker_t *b, unsigned int *count);
+
+/** @brief Publishes records filled after mpu9250BrokerClaim() and wakes the consumers
+ *  Call it after every claim, with 0 when nothing was filled.
+ *  @param b The ring, owned by the caller
+ *  @param count Records filled, no more than claimed
+ */
+void mpu9250BrokerPublish(MPU9250_Broker_t *b, unsigned int count);
+
+/** @brief Marks the ring as stopped, wakes the consumers and removes its name
+ *  Consumers still attached keep their mapping.
+ *  @param b The ring, owned by the caller
+ */
+void mpu9250BrokerDestroy(MPU9250_Broker_t *b);
+
+/** @brief Maps the ring of a sensor read-only, positioned at the newest record
+ *  @param b The mapping
+ *  @param sensor The N of /dev/i2cMPU9250-N
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250BrokerAttach(MPU9250_Broker_t *b, unsigned int sensor);
+
+/** @brief Copies the records not read yet, without any syscall
+ *  Records the producer overwrote before or during the copy are skipped and added
+ *  to overruns.
+ *  @param b The mapping
+ *  @param samples The samples
+ *  @param count Maximum number of samples
+ *  @return Samples stored
+ */
+unsigned int mpu9250BrokerRead(MPU9250_Broker_t *b, MPU9250_Sample_t *samples, unsigned int count);
+
+/** @brief Sleeps until the producer publishes records not read yet
+ *  @param b The mapping
+ *  @param timeoutMs Longest sleep, negative to wait forever
+ *  @return 0 when there are records to read, -1 with errno ETIMEDOUT, EINTR or
+ *          EPIPE when the broker stopped
+ */
+int mpu9250BrokerWait(MPU9250_Broker_t *b, int timeoutMs);
+
+/** @brief Unmaps the ring
+ *  @param b The mapping
+ */
+void mpu9250BrokerDetach(MPU9250_Broker_t *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
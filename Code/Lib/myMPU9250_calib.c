@@ -0,0 +1,281 @@
+/**
+ * @file   myMPU9250_calib.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Online calibration of the MPU9250 accelerometer and gyroscope.
+ *
+ * See myMPU9250_calib.h. Statistics are kept in counts of the current configuration
+ * and only converted to the fixed units of the offset registers at the end.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "myMPU9250_calib.h"
+
+// Constants
+#define STILL_GYRO_RAD      0.01f               ///< Largest gyro standard deviation of a still window [rad/s]
+#define STILL_ACCEL_MS2     0.1f                ///< Largest accel standard deviation of a still window [m/s2]
+#define STILL_GRAVITY       0.05f               ///< Largest relative deviation of a still accel norm from 1 g
+#define GRAVITY_MS2         9.807f              ///< Standard gravity [m/s2]
+
+// Private functions
+
+/** @brief Welford update with one sample */
+static void mpu9250CalibPush(MPU9250_CalibStats_t *stats, const double *x)
+{
+   double delta;
+   unsigned int i;
+
+   stats->n++;
+
+   for (i = 0; i < 6; i++)
+   {
+      delta = x[i] - stats->mean[i];
+      stats->mean[i] += delta / stats->n;
+      stats->m2[i] += delta * (x[i] - stats->mean[i]);
+   }
+}
+
+/** @brief Merges the statistics of b into a (Chan et al.) */
+static void mpu9250CalibMerge(MPU9250_CalibStats_t *a, const MPU9250_CalibStats_t *b)
+{
+   double delta;
+   unsigned int n = a->n + b->n;
+   unsigned int i;
+
+   if (0 == b->n)
+      return;
+
+   for (i = 0; i < 6; i++)
+   {
+      delta = b->mean[i] - a->mean[i];
+      a->mean[i] += delta * b->n / n;
+      a->m2[i] += b->m2[i] + delta * delta * ((double)a->n * b->n / n);
+   }
+
+   a->n = n;
+}
+
+/** @brief Tests the window just filled and files it by face when it is still */
+static void mpu9250CalibWindow(MPU9250_Calibrator_t *cal)
+{
+   const MPU9250_CalibStats_t *w = &cal->current;
+   double norm = sqrt(w->mean[0] * w->mean[0] + w->mean[1] * w->mean[1] + w->mean[2] * w->mean[2]);
+   unsigned int i, axis = 0;
+
+   for (i = 0; i < 3; i++)
+   {
+      if (w->m2[i] / w->n > (double)cal->accelNoise * cal->accelNoise)
+         return;
+
+      if (w->m2[3 + i] / w->n > (double)cal->gyroNoise * cal->gyroNoise)
+         return;
+
+      if (fabs(w->mean[i]) > fabs(w->mean[axis]))
+         axis = i;
+   }
+
+   if (fabs(norm - cal->countsPerG) > cal->gravityTolerance)
+      return;
+
+   mpu9250CalibMerge(&cal->still, w);
+   mpu9250CalibMerge(&cal->face[2 * axis + (0 > w->mean[axis])], w);
+   cal->stillWindows++;
+}
+
+/** @brief Clamps to the range of a 16 bit register */
+static int16_t mpu9250CalibClamp(long value)
+{
+   return (int16_t)((value > INT16_MAX) ? INT16_MAX : ((value < INT16_MIN) ? INT16_MIN : value));
+}
+
+// Public functions
+
+void mpu9250CalibInit(MPU9250_Calibrator_t *cal, const MPU9250_ConvParams_t *params, unsigned int window)
+{
+   memset(cal, 0, sizeof(*cal));
+
+   cal->window           = (0 != window) ? window : MPU9250_CALIB_WINDOW;
+   cal->gyroNoise        = STILL_GYRO_RAD / params->gyroScale;
+   cal->accelNoise       = STILL_ACCEL_MS2 / params->accelScale;
+   cal->countsPerG       = GRAVITY_MS2 / params->accelScale;
+   cal->gravityTolerance = STILL_GRAVITY * cal->countsPerG;
+}
+
+unsigned int mpu9250CalibAdd(MPU9250_Calibrator_t *cal, const MPU9250_Sample_t *samples, unsigned int count)
+{
+   double x[6];
+   unsigned int i, j;
+
+   for (i = 0; i < count; i++)
+   {
+      for (j = 0; j < 3; j++)
+      {
+         x[j]     = samples[i].accel[j];
+         x[3 + j] = samples[i].gyro[j];
+      }
+
+      mpu9250CalibPush(&cal->current, x);
+
+      if (cal->current.n == cal->window)
+      {
+         mpu9250CalibWindow(cal);
+         memset(&cal->current, 0, sizeof(cal->current));
+      }
+   }
+
+   return cal->stillWindows;
+}
+
+unsigned int mpu9250CalibFaces(const MPU9250_Calibrator_t *cal)
+{
+   unsigned int faces = 0;
+   unsigned int i;
+
+   for (i = 0; i < MPU9250_CALIB_FACES; i++)
+      faces |= (0 != cal->face[i].n) << i;
+
+   return faces;
+}
+
+int mpu9250CalibResult(const MPU9250_Calibrator_t *cal, const MPU9250_Config_t *config,
+                       const MPU9250_Calib_t *current, MPU9250_Calib_t *next)
+{
+   const MPU9250_CalibStats_t *up, *down;
+   double bias, gain, expected, sum;
+   unsigned int i, f, n;
+
+   if (0 == cal->still.n)
+      return -1;
+
+   *next = *current;
+
+   for (i = 0; i < 3; i++)
+   {
+      /* Counts of the configured range to 1000 dps register counts, the sensor adds the register */
+      bias = cal->still.mean[3 + i];
+      next->gyroOffset[i] = mpu9250CalibClamp(current->gyroOffset[i] - lround(bias * config->gyroRangeDps / 1000.0));
+
+      up = &cal->face[2 * i];
+      down = &cal->face[2 * i + 1];
+      gain = current->accelGainMicro[i] * 1e-6;
+
+      if ((0 != up->n) && (0 != down->n))
+      {
+         /* Gravity cancels out between opposite faces, its difference is the scale */
+         bias = (up->mean[i] + down->mean[i]) / 2.0;
+         gain = 2.0 * cal->countsPerG / (up->mean[i] - down->mean[i]);
+         next->accelGainMicro[i] = (uint32_t)lround(gain * 1e6);
+      }
+      else
+      {
+         /* Expected gravity with the current scale factor, or zero on the faces of other axes */
+         sum = 0.0;
+         n = 0;
+
+         for (f = 0; f < MPU9250_CALIB_FACES; f++)
+         {
+            expected = (f / 2 != i) ? 0.0 : ((f & 1) ? -1.0 : 1.0) * cal->countsPerG / gain;
+            sum += (cal->face[f].mean[i] - expected) * cal->face[f].n;
+            n += cal->face[f].n;
+         }
+
+         bias = sum / n;
+      }
+
+      /* Counts of the configured range to 16 g register counts, an even step keeps bit 0 */
+      next->accelOffset[i] = mpu9250CalibClamp(current->accelOffset[i] - 2 * lround(bias * config->accelRangeG / 32.0));
+   }
+
+   return 0;
+}
+
+void mpu9250CalibParams(const MPU9250_Calib_t *calib, MPU9250_ConvParams_t *params)
+{
+   unsigned int i, j;
+
+   /* Body axis i reads MPU9250 axis j */
+   for (i = 0; i < 3; i++)
+   {
+      for (j = 0; j < 3; j++)
+      {
+         if (0 != params->rotation[i][j])
+            params->accelGain[i] = calib->accelGainMicro[j] * 1e-6f;
+      }
+   }
+}
+
+int mpu9250CalibDevice(int fd, char *name, size_t size)
+{
+   char link[64], target[256];
+   const char *base;
+   struct stat st;
+   ssize_t length;
+
+   if (0 != fstat(fd, &st))
+      return -1;
+
+   if (!S_ISCHR(st.st_mode))
+   {
+      errno = ENOTTY;
+      return -1;
+   }
+
+   /* The character device is created under the bus device of its sensor */
+   snprintf(link, sizeof(link), "/sys/dev/char/%u:%u/device", major(st.st_rdev), minor(st.st_rdev));
+   length = readlink(link, target, sizeof(target) - 1);
+
+   if (0 > length)
+      return -1;
+
+   target[length] = '\0';
+   base = strrchr(target, '/');
+   base = (NULL != base) ? base + 1 : target;
+
+   if (strlen(base) >= size)
+   {
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+
+   strcpy(name, base);
+
+   return 0;
+}
+
+int mpu9250CalibSave(const char *path, const MPU9250_CalibEntry_t *entries, unsigned int count)
+{
+   const MPU9250_Calib_t *calib;
+   FILE *file = fopen(path, "w");
+   unsigned int i;
+   int rv;
+
+   if (NULL == file)
+      return -1;
+
+   rv = fprintf(file, "# Written by mpu9250CalibSave()\n");
+
+   /* One calib entry per sensor: device, gyro offsets, accel offsets and scale factors */
+   if ((0 <= rv) && (0 < count))
+      rv = fprintf(file, "options myMPU9250 calib=");
+
+   for (i = 0; (0 <= rv) && (i < count); i++)
+   {
+      calib = &entries[i].calib;
+      rv = fprintf(file, "%s%s:%d:%d:%d:%d:%d:%d:%u:%u:%u", i ? "," : "", entries[i].device,
+                   calib->gyroOffset[0], calib->gyroOffset[1], calib->gyroOffset[2],
+                   calib->accelOffset[0], calib->accelOffset[1], calib->accelOffset[2],
+                   calib->accelGainMicro[0], calib->accelGainMicro[1], calib->accelGainMicro[2]);
+   }
+
+   if ((0 <= rv) && (0 < count))
+      rv = fprintf(file, "\n");
+
+   if (0 != fclose(file))
+      rv = -1;
+
+   return (0 > rv) ? -1 : 0;
+}
@@ -0,0 +1,143 @@
+#ifndef _myMPU9250_calib_H
+#define _myMPU9250_calib_H
+
+/* Online calibration of the MPU9250 accelerometer and gyroscope.
+ *
+ * Samples are split in windows whose mean and variance are kept with Welford's
+ * algorithm. A window is still when both sensors are quiet and the accelerometer
+ * sees 1 g, and still windows are merged by the face pointing up. The gyro bias is
+ * the mean of every still sample; the accel bias and scale factor of an axis come
+ * from its two faces, or the bias alone from the faces seen so far.
+ *
+ * The result is expressed as MPU9250_Calib_t, the biases are written into the
+ * sensor offset registers with MPU9250_IOC_SET_CALIB and persisted as module
+ * parameters, so no client pays for the correction per sample. The saved entries
+ * are keyed by the bus device of each sensor, not by its /dev number:
+ *
+ *    mpu9250CalibInit(&cal, &params, 0);
+ *    while (!done) { ioctl(fd, MPU9250_IOC_READ_BATCH, &batch); mpu9250CalibAdd(&cal, samples, batch.count); }
+ *    mpu9250CalibResult(&cal, &config, &current, &next);
+ *    ioctl(fd, MPU9250_IOC_SET_CALIB, &next);
+ *    entries[0].calib = next; mpu9250CalibDevice(fd, entries[0].device, sizeof(entries[0].device));
+ *    mpu9250CalibSave("/etc/modprobe.d/myMPU9250.conf", entries, 1);
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "myMPU9250_uapi.h"
+#include "myMPU9250_conv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Constants
+
+/* Faces of the sensor, the axis and direction pointing up */
+#define MPU9250_CALIB_FACES           6             // +x, -x, +y, -y, +z, -z
+
+/* Samples per stillness window when none is given, 0.25 s at 1 kHz */
+#define MPU9250_CALIB_WINDOW          250
+
+/* Longest bus device name kept, e.g. 2-0068 or spi1.0 */
+#define MPU9250_CALIB_DEVICE_MAX      32
+
+// Types
+
+/* Running mean and sum of squared deviations of accel x, y, z and gyro x, y, z [LSB] */
+typedef struct
+{
+   unsigned int n;
+   double mean[6];
+   double m2[6];
+
+} MPU9250_CalibStats_t;
+
+typedef struct
+{
+   unsigned int window;               // Samples per stillness test
+   float gyroNoise;                   // Largest standard deviation of a still gyro [LSB]
+   float accelNoise;                  // Largest standard deviation of a still accel [LSB]
+   float countsPerG;                  // Nominal accel counts of 1 g
+   float gravityTolerance;            // Largest deviation of a still accel norm from 1 g [LSB]
+
+   MPU9250_CalibStats_t current;      // Window being filled
+   MPU9250_CalibStats_t still;        // Every still window
+   MPU9250_CalibStats_t face[MPU9250_CALIB_FACES];   // Still windows by face up
+   unsigned int stillWindows;
+
+} MPU9250_Calibrator_t;
+
+/* Saved calibration of one sensor */
+typedef struct
+{
+   char device[MPU9250_CALIB_DEVICE_MAX];   // Name of its I2C client or SPI device, see mpu9250CalibDevice()
+   MPU9250_Calib_t calib;
+
+} MPU9250_CalibEntry_t;
+
+// Public functions
+
+/** @brief Starts a calibration with thresholds for the current configuration
+ *  Still means gyro noise below 0.01 rad/s, accel noise below 0.1 m/s2 and an
+ *  accel norm within 5 % of 1 g.
+ *  @param cal The calibrator
+ *  @param params Scales of the current configuration, see mpu9250ConvDefaults()
+ *  @param window Samples per stillness test, 0 for MPU9250_CALIB_WINDOW
+ */
+void mpu9250CalibInit(MPU9250_Calibrator_t *cal, const MPU9250_ConvParams_t *params, unsigned int window);
+
+/** @brief Feeds samples as returned by MPU9250_IOC_READ_BATCH or the shared ring
+ *  @param cal The calibrator
+ *  @param samples The samples
+ *  @param count Number of samples
+ *  @return Still windows seen so far
+ */
+unsigned int mpu9250CalibAdd(MPU9250_Calibrator_t *cal, const MPU9250_Sample_t *samples, unsigned int count);
+
+/** @brief Faces seen still so far
+ *  @return One bit per face, bit 0 is +x up
+ */
+unsigned int mpu9250CalibFaces(const MPU9250_Calibrator_t *cal);
+
+/** @brief Folds the estimates into the calibration the samples were taken with
+ *  Accel scale factors are only updated for axes seen still with both faces up.
+ *  @param cal The calibrator
+ *  @param config Configuration the samples were taken with
+ *  @param current Calibration the samples were taken with, from MPU9250_IOC_GET_CALIB
+ *  @param next The calibration to write with MPU9250_IOC_SET_CALIB
+ *  @return 0 on success or -1 if no still window was seen
+ */
+int mpu9250CalibResult(const MPU9250_Calibrator_t *cal, const MPU9250_Config_t *config,
+                       const MPU9250_Calib_t *current, MPU9250_Calib_t *next);
+
+/** @brief Copies the accel scale factors of a calibration to the conversion parameters
+ *  The offsets need no conversion, the sensor already applies them.
+ *  @param calib Calibration from MPU9250_IOC_GET_CALIB
+ *  @param params The parameters, rotation must already be set
+ */
+void mpu9250CalibParams(const MPU9250_Calib_t *calib, MPU9250_ConvParams_t *params);
+
+/** @brief Names the bus device of an open sensor, the key of its saved calibration
+ *  It is the target of /sys/dev/char/<major>:<minor>/device, which stays the same
+ *  whatever number the sensor gets under /dev.
+ *  @param fd The device file descriptor
+ *  @param name Receives the name, e.g. 2-0068
+ *  @param size Size of name
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250CalibDevice(int fd, char *name, size_t size);
+
+/** @brief Persists the calibration of each sensor as module parameters, loaded at every probe
+ *  The file is rewritten, so pass every sensor whose calibration must be kept.
+ *  @param path A modprobe.d file, e.g. /etc/modprobe.d/myMPU9250.conf
+ *  @param entries One entry per sensor
+ *  @param count Number of entries
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250CalibSave(const char *path, const MPU9250_CalibEntry_t *entries, unsigned int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
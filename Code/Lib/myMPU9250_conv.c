@@ -0,0 +1,382 @@
+/**
+ * @file   myMPU9250_conv.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Batch conversion of myMPU9250 frames and samples to SI units.
+ *
+ * See myMPU9250_conv.h. Build with -mfpu=neon on the BeagleBone (or any ARM with
+ * NEON) and with SSE2 on x86, otherwise the portable loops are used.
+ */
+#include <math.h>
+#include <string.h>
+#include "myMPU9250.h"
+#include "myMPU9250_conv.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MPU9250_CONV_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MPU9250_CONV_SSE
+#endif
+
+// Constants
+#define MIN(a,b) ((a < b) ? (a) : (b))  ///< Macro to get the minimum between two numbers
+
+/* Unpacked channels, in frame order */
+#define CH_ACCEL    0
+#define CH_TEMP     3
+#define CH_GYRO     4
+#define CH_MAG      7
+
+// Types
+typedef int16_t MPU9250_ConvBlock_t[MPU9250_CONV_AXES][MPU9250_CONV_BLOCK];
+
+// Private functions
+
+/** @brief out = c0 * in0 + c1 * in1 + c2 * in2 + offset, for n samples */
+static void mpu9250ConvAxis(const int16_t *in0, const int16_t *in1, const int16_t *in2,
+                            const float *c, float offset, float *out, unsigned int n)
+{
+   unsigned int i = 0;
+
+#if defined(MPU9250_CONV_NEON)
+   float32x4_t acc;
+
+   for (; i + 4 <= n; i += 4)
+   {
+      acc = vdupq_n_f32(offset);
+      acc = vmlaq_n_f32(acc, vcvtq_f32_s32(vmovl_s16(vld1_s16(in0 + i))), c[0]);
+      acc = vmlaq_n_f32(acc, vcvtq_f32_s32(vmovl_s16(vld1_s16(in1 + i))), c[1]);
+      acc = vmlaq_n_f32(acc, vcvtq_f32_s32(vmovl_s16(vld1_s16(in2 + i))), c[2]);
+      vst1q_f32(out + i, acc);
+   }
+#elif defined(MPU9250_CONV_SSE)
+   const __m128 c0 = _mm_set1_ps(c[0]);
+   const __m128 c1 = _mm_set1_ps(c[1]);
+   const __m128 c2 = _mm_set1_ps(c[2]);
+   const __m128 off = _mm_set1_ps(offset);
+   __m128i v;
+   __m128 acc;
+
+   for (; i + 4 <= n; i += 4)
+   {
+      /* Sign extend: duplicate every 16 bit lane and shift the copy down arithmetically */
+      v = _mm_loadl_epi64((const __m128i *)(in0 + i));
+      acc = _mm_add_ps(off, _mm_mul_ps(c0, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16))));
+      v = _mm_loadl_epi64((const __m128i *)(in1 + i));
+      acc = _mm_add_ps(acc, _mm_mul_ps(c1, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16))));
+      v = _mm_loadl_epi64((const __m128i *)(in2 + i));
+      acc = _mm_add_ps(acc, _mm_mul_ps(c2, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16))));
+      _mm_storeu_ps(out + i, acc);
+   }
+#endif
+
+   for (; i < n; i++)
+      out[i] = c[0] * in0[i] + c[1] * in1[i] + c[2] * in2[i] + offset;
+}
+
+/** @brief out = (c0 * in0 + c1 * in1 + c2 * in2 + offset) >> shift, for n samples
+ *  Coefficients are scaled by mpu9250ConvSetAxis() so the sum never overflows 32 bits.
+ */
+static void mpu9250ConvAxisFixed(const int16_t *in0, const int16_t *in1, const int16_t *in2,
+                                 const int16_t *c, int32_t offset, int32_t shift, int32_t *out, unsigned int n)
+{
+   unsigned int i = 0;
+
+#if defined(MPU9250_CONV_NEON)
+   const int32x4_t off = vdupq_n_s32(offset);
+   const int32x4_t sh = vdupq_n_s32(-shift);
+   int32x4_t acc;
+
+   for (; i + 4 <= n; i += 4)
+   {
+      acc = vmull_n_s16(vld1_s16(in0 + i), c[0]);
+      acc = vmlal_n_s16(acc, vld1_s16(in1 + i), c[1]);
+      acc = vmlal_n_s16(acc, vld1_s16(in2 + i), c[2]);
+      acc = vshlq_s32(vaddq_s32(acc, off), sh);
+      vst1q_s32(out + i, acc);
+   }
+#elif defined(MPU9250_CONV_SSE)
+   /* pmaddwd multiplies interleaved (in0, in1) pairs by (c0, c1) and adds each pair */
+   const __m128i c01 = _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)c[1] << 16) | (uint16_t)c[0]));
+   const __m128i c2 = _mm_set1_epi32((uint16_t)c[2]);
+   const __m128i off = _mm_set1_epi32(offset);
+   const __m128i sh = _mm_cvtsi32_si128(shift);
+   const __m128i zero = _mm_setzero_si128();
+   __m128i acc;
+
+   for (; i + 4 <= n; i += 4)
+   {
+      acc = _mm_madd_epi16(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(in0 + i)),
+                                              _mm_loadl_epi64((const __m128i *)(in1 + i))), c01);
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(in2 + i)), zero), c2));
+      acc = _mm_sra_epi32(_mm_add_epi32(acc, off), sh);
+      _mm_storeu_si128((__m128i *)(out + i), acc);
+   }
+#endif
+
+   for (; i < n; i++)
+      out[i] = (c[0] * in0[i] + c[1] * in1[i] + c[2] * in2[i] + offset) >> shift;
+}
+
+static void mpu9250ConvUnpackFrames(const MPU9250_Conv_t *conv, const uint8_t *frames, unsigned int n, MPU9250_ConvBlock_t raw)
+{
+   unsigned int i, ch;
+
+   for (i = 0; i < n; i++, frames += conv->frameSize)
+   {
+      /* Accel, temperature and gyro are big-endian, the AK8963 little-endian */
+      for (ch = 0; ch < CH_MAG; ch++)
+         raw[ch][i] = mpu9250ConvBe16(frames + 2 * ch);
+
+      if (MPU9250_FIFO_FRAME_SIZE < conv->frameSize)
+      {
+         for (ch = CH_MAG; ch < CH_MAG + 3; ch++)
+            raw[ch][i] = mpu9250ConvLe16(frames + 2 * ch);
+      }
+   }
+}
+
+static void mpu9250ConvUnpackSamples(const MPU9250_Sample_t *samples, unsigned int n, MPU9250_ConvBlock_t raw)
+{
+   unsigned int i, axis;
+
+   for (i = 0; i < n; i++)
+   {
+      for (axis = 0; axis < 3; axis++)
+      {
+         raw[CH_ACCEL + axis][i] = samples[i].accel[axis];
+         raw[CH_GYRO + axis][i]  = samples[i].gyro[axis];
+         raw[CH_MAG + axis][i]   = samples[i].mag[axis];
+      }
+
+      raw[CH_TEMP][i] = samples[i].temp;
+   }
+}
+
+/* Output array of every axis, in coefficient order */
+static void mpu9250ConvTargets(void *const *accel, void *const *gyro, void *const *mag, void *temp,
+                               int withMag, void *dst[MPU9250_CONV_AXES])
+{
+   unsigned int axis;
+
+   for (axis = 0; axis < 3; axis++)
+   {
+      dst[MPU9250_CONV_ACCEL + axis] = accel[axis];
+      dst[MPU9250_CONV_GYRO + axis]  = gyro[axis];
+      dst[MPU9250_CONV_MAG + axis]   = withMag ? mag[axis] : NULL;
+   }
+
+   dst[MPU9250_CONV_TEMP] = temp;
+}
+
+static void mpu9250ConvBlock(const MPU9250_Conv_t *conv, MPU9250_ConvBlock_t raw, unsigned int n, void *dst[MPU9250_CONV_AXES], unsigned int first, int fixed)
+{
+   unsigned int axis;
+   const unsigned char *in;
+
+   for (axis = 0; axis < MPU9250_CONV_AXES; axis++)
+   {
+      if (NULL == dst[axis])
+         continue;
+
+      in = conv->input[axis];
+
+      if (fixed)
+         mpu9250ConvAxisFixed(raw[in[0]], raw[in[1]], raw[in[2]], conv->fixCoef[axis], conv->fixOffset[axis],
+                              conv->fixShift[axis], (int32_t *)dst[axis] + first, n);
+      else
+         mpu9250ConvAxis(raw[in[0]], raw[in[1]], raw[in[2]], conv->coef[axis], conv->offset[axis],
+                         (float *)dst[axis] + first, n);
+   }
+}
+
+static void mpu9250ConvRun(const MPU9250_Conv_t *conv, const void *src, int frames, unsigned int count, void *dst[MPU9250_CONV_AXES], int fixed)
+{
+   MPU9250_ConvBlock_t raw __attribute__((aligned(16)));
+   unsigned int done, n;
+
+   for (done = 0; done < count; done += n)
+   {
+      n = MIN(count - done, MPU9250_CONV_BLOCK);
+
+      if (frames)
+         mpu9250ConvUnpackFrames(conv, (const uint8_t *)src + done * conv->frameSize, n, raw);
+      else
+         mpu9250ConvUnpackSamples((const MPU9250_Sample_t *)src + done, n, raw);
+
+      mpu9250ConvBlock(conv, raw, n, dst, done, fixed);
+   }
+}
+
+/** @brief Sets one output axis as a combination of three unpacked channels */
+static void mpu9250ConvSetAxis(MPU9250_Conv_t *conv, unsigned int axis, unsigned int channel, const float *coef, float offset)
+{
+   float max = 0.0f;
+   float limit;
+   float q;
+   int32_t shift = 0;
+   unsigned int used = 0;
+   unsigned int j;
+
+   for (j = 0; j < 3; j++)
+   {
+      conv->input[axis][j] = channel + j;
+      conv->coef[axis][j] = coef[j];
+
+      if (0.0f != coef[j])
+         used++;
+
+      if (max < fabsf(coef[j]))
+         max = fabsf(coef[j]);
+   }
+
+   conv->offset[axis] = offset;
+
+   /* The sum of the products must stay below 2^30, so the coefficients share 15 bits
+    * among the inputs actually used. Take the largest shift within that, for the most
+    * precision: a single input keeps the conversion error below one LSB.
+    */
+   limit = 32767.0f / (used ? used : 1);
+
+   while ((15 > shift) && (0.0f < max) && (limit >= ldexpf(max, MPU9250_CONV_Q + shift + 1)))
+      shift++;
+
+   for (j = 0; j < 3; j++)
+   {
+      /* Scales of 0.5 unit / LSB or more do not fit at Q16, no sensor range gets there */
+      q = ldexpf(coef[j], MPU9250_CONV_Q + shift);
+      conv->fixCoef[axis][j] = (int16_t)lrintf(fmaxf(-32767.0f, fminf(32767.0f, q)));
+   }
+
+   conv->fixOffset[axis] = (int32_t)lrintf(ldexpf(offset, MPU9250_CONV_Q + shift)) + (shift ? (1 << (shift - 1)) : 0);
+   conv->fixShift[axis] = shift;
+}
+
+// Public functions
+void mpu9250ConvDefaults(MPU9250_ConvParams_t *params, const MPU9250_Scale_t *scale, const signed char rotation[3][3])
+{
+   /* AK8963 x and y are swapped and z is inverted against the MPU9250 axes */
+   static const signed char akToMpu[3][3] = { { 0, 1, 0 }, { 1, 0, 0 }, { 0, 0, -1 } };
+   unsigned int i, j, k;
+
+   memset(params, 0, sizeof(*params));
+
+   params->accelScale = 9.807f * (16.0f / 32767.5f);
+   params->gyroScale  = 2000.0f / 32767.5f * (3.14159265359f / 180.0f);
+   params->tempScale  = 1.0f / 333.87f;
+   params->tempOffset = 21.0f;
+
+   for (i = 0; i < 3; i++)
+   {
+      params->magScale[i] = 4912.0f / 32760.0f;
+      params->accelGain[i] = 1.0f;
+   }
+
+   if (NULL != scale)
+   {
+      params->accelScale = scale->accelNano * 1e-9f;
+      params->gyroScale  = scale->gyroNano * 1e-9f;
+      params->tempScale  = 1000.0f / scale->tempSensitivityMilli;
+      params->tempOffset = scale->tempOffsetMilli / 1000.0f;
+
+      for (i = 0; i < 3; i++)
+      {
+         if (0 != scale->magPico[i])
+            params->magScale[i] = scale->magPico[i] * 1e-6f;
+      }
+   }
+
+   for (i = 0; i < 3; i++)
+   {
+      for (j = 0; j < 3; j++)
+      {
+         params->rotation[i][j] = (NULL != rotation) ? rotation[i][j] : (i == j);
+      }
+   }
+
+   for (i = 0; i < 3; i++)
+   {
+      for (j = 0; j < 3; j++)
+      {
+         params->magRotation[i][j] = 0;
+
+         for (k = 0; k < 3; k++)
+            params->magRotation[i][j] += params->rotation[i][k] * akToMpu[k][j];
+      }
+   }
+}
+
+int mpu9250ConvInit(MPU9250_Conv_t *conv, const MPU9250_ConvParams_t *params, unsigned int frameSize)
+{
+   float coef[3];
+   unsigned int i, j;
+
+   if ((MPU9250_FIFO_FRAME_SIZE != frameSize) && (MPU9250_FIFO_FRAME_SIZE + MPU9250_FIFO_MAG_SIZE != frameSize))
+      return -1;
+
+   memset(conv, 0, sizeof(*conv));
+   conv->frameSize = frameSize;
+
+   for (i = 0; i < 3; i++)
+   {
+      /* ((R * counts) * scale - bias) * gain */
+      for (j = 0; j < 3; j++)
+         coef[j] = params->rotation[i][j] * params->accelScale * params->accelGain[i];
+
+      mpu9250ConvSetAxis(conv, MPU9250_CONV_ACCEL + i, CH_ACCEL, coef, -params->accelBias[i] * params->accelGain[i]);
+
+      for (j = 0; j < 3; j++)
+         coef[j] = params->rotation[i][j] * params->gyroScale;
+
+      mpu9250ConvSetAxis(conv, MPU9250_CONV_GYRO + i, CH_GYRO, coef, -params->gyroBias[i]);
+
+      /* The fuse ROM adjustment is per AK8963 axis, so it is applied before the rotation */
+      for (j = 0; j < 3; j++)
+         coef[j] = params->magRotation[i][j] * params->magScale[j];
+
+      mpu9250ConvSetAxis(conv, MPU9250_CONV_MAG + i, CH_MAG, coef, -params->magBias[i]);
+   }
+
+   /* Temperature only uses its own channel, the other two coefficients are zero */
+   coef[0] = params->tempScale;
+   coef[1] = coef[2] = 0.0f;
+   mpu9250ConvSetAxis(conv, MPU9250_CONV_TEMP, CH_TEMP, coef, params->tempOffset);
+   conv->input[MPU9250_CONV_TEMP][1] = conv->input[MPU9250_CONV_TEMP][2] = CH_TEMP;
+
+   return 0;
+}
+
+void mpu9250ConvFrames(const MPU9250_Conv_t *conv, const void *frames, unsigned int count, const MPU9250_ConvFloat_t *out)
+{
+   void *dst[MPU9250_CONV_AXES];
+
+   mpu9250ConvTargets((void *const *)out->accel, (void *const *)out->gyro, (void *const *)out->mag, out->temp,
+                      MPU9250_FIFO_FRAME_SIZE < conv->frameSize, dst);
+   mpu9250ConvRun(conv, frames, 1, count, dst, 0);
+}
+
+void mpu9250ConvFramesFixed(const MPU9250_Conv_t *conv, const void *frames, unsigned int count, const MPU9250_ConvFixed_t *out)
+{
+   void *dst[MPU9250_CONV_AXES];
+
+   mpu9250ConvTargets((void *const *)out->accel, (void *const *)out->gyro, (void *const *)out->mag, out->temp,
+                      MPU9250_FIFO_FRAME_SIZE < conv->frameSize, dst);
+   mpu9250ConvRun(conv, frames, 1, count, dst, 1);
+}
+
+void mpu9250ConvSamples(const MPU9250_Conv_t *conv, const MPU9250_Sample_t *samples, unsigned int count, const MPU9250_ConvFloat_t *out)
+{
+   void *dst[MPU9250_CONV_AXES];
+
+   mpu9250ConvTargets((void *const *)out->accel, (void *const *)out->gyro, (void *const *)out->mag, out->temp, 1, dst);
+   mpu9250ConvRun(conv, samples, 0, count, dst, 0);
+}
+
+void mpu9250ConvSamplesFixed(const MPU9250_Conv_t *conv, const MPU9250_Sample_t *samples, unsigned int count, const MPU9250_ConvFixed_t *out)
+{
+   void *dst[MPU9250_CONV_AXES];
+
+   mpu9250ConvTargets((void *const *)out->accel, (void *const *)out->gyro, (void *const *)out->mag, out->temp, 1, dst);
+   mpu9250ConvRun(conv, samples, 0, count, dst, 1);
+}
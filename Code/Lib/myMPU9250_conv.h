@@ -0,0 +1,147 @@
+#ifndef _myMPU9250_conv_H
+#define _myMPU9250_conv_H
+
+/* Batch conversion of myMPU9250 frames and samples to SI units.
+ *
+ * Frames are converted in blocks: counts are first unpacked (byte swap and sign
+ * extension) into a structure of arrays, then every output axis is computed for
+ * the whole block as a linear combination of three input axes plus an offset.
+ * Orientation, scale, bias and scale factor are folded into those coefficients
+ * once, so a sample costs three multiply-adds per axis, done with NEON or SSE
+ * four samples at a time when the compiler targets them.
+ *
+ * The float path writes float arrays, the fixed-point path writes Q16.16 arrays.
+ */
+#include <stdint.h>
+#include "myMPU9250_uapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Constants
+
+/* Output axes, also the index of each axis coefficients */
+#define MPU9250_CONV_ACCEL            0             // Accelerometer x, y, z [m/s2]
+#define MPU9250_CONV_GYRO             3             // Gyroscope x, y, z [rad/s]
+#define MPU9250_CONV_MAG              6             // Magnetometer x, y, z [uT]
+#define MPU9250_CONV_TEMP             9             // Temperature [C]
+#define MPU9250_CONV_AXES             10
+
+/* Samples unpacked and converted per block, multiple of the vector width */
+#define MPU9250_CONV_BLOCK            64
+
+/* Fractional bits of the fixed-point outputs */
+#define MPU9250_CONV_Q                16
+
+// Types
+
+/* Calibration of a sensor, in the units of the outputs.
+ * Accel and gyro are computed as ((rotation * counts) * scale - bias) * gain, the
+ * magnetometer as (magRotation * (counts * magScale)) - magBias.
+ */
+typedef struct
+{
+   float accelScale;                  // [m/s2 / LSB]
+   float gyroScale;                   // [rad/s / LSB]
+   float magScale[3];                 // [uT / LSB] of the AK8963 axes, fuse ROM adjustment included
+   float tempScale;                   // [C / LSB]
+   float tempOffset;                  // Temperature at 0 LSB [C]
+
+   signed char rotation[3][3];        // Body axes from MPU9250 axes, one row per body axis
+   signed char magRotation[3][3];     // Body axes from AK8963 axes
+
+   float accelBias[3];
+   float accelGain[3];
+   float gyroBias[3];
+   float magBias[3];                  // Hard iron offset
+
+} MPU9250_ConvParams_t;
+
+/* Folded coefficients, built by mpu9250ConvInit() */
+typedef struct
+{
+   unsigned int frameSize;            // Bytes per frame, 14 or 21 with the magnetometer
+
+   unsigned char input[MPU9250_CONV_AXES][3];   // Unpacked channels combined by each output axis
+   float coef[MPU9250_CONV_AXES][3];
+   float offset[MPU9250_CONV_AXES];
+
+   int16_t fixCoef[MPU9250_CONV_AXES][3];       // coef in Q(16 + fixShift)
+   int32_t fixOffset[MPU9250_CONV_AXES];        // offset in Q(16 + fixShift), rounding included
+   int32_t fixShift[MPU9250_CONV_AXES];
+
+} MPU9250_Conv_t;
+
+/* Structure of arrays outputs, NULL arrays are not computed */
+typedef struct
+{
+   float *accel[3];
+   float *gyro[3];
+   float *mag[3];
+   float *temp;
+
+} MPU9250_ConvFloat_t;
+
+typedef struct
+{
+   int32_t *accel[3];
+   int32_t *gyro[3];
+   int32_t *mag[3];
+   int32_t *temp;
+
+} MPU9250_ConvFixed_t;
+
+// Public functions
+
+/** @brief Big-endian count as stored by the MPU9250 */
+static inline int16_t mpu9250ConvBe16(const uint8_t *p)
+{
+   return (int16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+/** @brief Little-endian count as stored by the AK8963 */
+static inline int16_t mpu9250ConvLe16(const uint8_t *p)
+{
+   return (int16_t)(((uint16_t)p[1] << 8) | p[0]);
+}
+
+/** @brief Fills a calibration with the driver scales, no bias and the given orientation
+ *  @param params The calibration to fill
+ *  @param scale Scales from MPU9250_IOC_GET_SCALE, or NULL for the 16 g and 2000 dps defaults
+ *  @param rotation Body axes from MPU9250 axes, or NULL for identity
+ */
+void mpu9250ConvDefaults(MPU9250_ConvParams_t *params, const MPU9250_Scale_t *scale, const signed char rotation[3][3]);
+
+/** @brief Folds a calibration into per axis coefficients
+ *  @param conv The converter to initialize
+ *  @param params The calibration
+ *  @param frameSize Bytes per frame from MPU9250_IOC_GET_LAYOUT
+ *  @return 0 on success or -1 if the frame size is not supported
+ */
+int mpu9250ConvInit(MPU9250_Conv_t *conv, const MPU9250_ConvParams_t *params, unsigned int frameSize);
+
+/** @brief Converts raw frames as returned by read() or a burst from MPU9250_ACCEL_OUT
+ *  The magnetometer outputs are only written when frames hold it.
+ *  @param conv The converter
+ *  @param frames The frames
+ *  @param count Number of frames
+ *  @param out The output arrays, count elements each
+ */
+void mpu9250ConvFrames(const MPU9250_Conv_t *conv, const void *frames, unsigned int count, const MPU9250_ConvFloat_t *out);
+void mpu9250ConvFramesFixed(const MPU9250_Conv_t *conv, const void *frames, unsigned int count, const MPU9250_ConvFixed_t *out);
+
+/** @brief Converts typed samples as returned by MPU9250_IOC_READ_BATCH or the shared ring
+ *  @param conv The converter
+ *  @param samples The samples
+ *  @param count Number of samples
+ *  @param out The output arrays, count elements each
+ */
+void mpu9250ConvSamples(const MPU9250_Conv_t *conv, const MPU9250_Sample_t *samples, unsigned int count, const MPU9250_ConvFloat_t *out);
+void mpu9250ConvSamplesFixed(const MPU9250_Conv_t *conv, const MPU9250_Sample_t *samples, unsigned int count, const MPU9250_ConvFixed_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
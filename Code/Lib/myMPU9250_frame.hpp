@@ -0,0 +1,243 @@
+#ifndef _myMPU9250_frame_HPP
+#define _myMPU9250_frame_HPP
+
+/* Frame parsers for every FIFO channel set of the myMPU9250 LKM, C++17.
+ *
+ * The channels in a frame are the MPU9250_FIFO_* bits of MPU9250_Layout_t, see
+ * myMPU9250_uapi.h. Frame<Enable> computes offsets and stride at compile time, so
+ * the unpacker of a layout is straight-line code with no per sample branch or
+ * offset lookup. FrameParser picks the unpacker of the layout reported by the
+ * driver at run time, from a table holding one instance per channel set.
+ *
+ *    MPU9250_Layout_t layout;
+ *    ioctl(fd, MPU9250_IOC_GET_LAYOUT, &layout);
+ *    mpu9250::FrameParser parser(layout);
+ *    n = read(fd, buffer, sizeof(buffer));
+ *    parser.unpack(buffer, n / parser.frameSize(), samples);
+ *
+ * The typed samples can then be converted with mpu9250ConvSamples().
+ */
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "myMPU9250.h"
+#include "myMPU9250_uapi.h"
+
+namespace mpu9250
+{
+
+// Constants
+
+/* Channels of a frame, in FIFO order */
+constexpr unsigned kAccel = MPU9250_FIFO_ACCEL;
+constexpr unsigned kTemp  = MPU9250_FIFO_TEMP;
+constexpr unsigned kGyroX = MPU9250_FIFO_GYRO_X;
+constexpr unsigned kGyroY = MPU9250_FIFO_GYRO_Y;
+constexpr unsigned kGyroZ = MPU9250_FIFO_GYRO_Z;
+constexpr unsigned kMag   = MPU9250_FIFO_MAG;
+
+constexpr unsigned kChannels = kAccel | kTemp | kGyroX | kGyroY | kGyroZ | kMag;
+
+// Types
+
+/* Offsets and stride of the frames of one channel set */
+template <unsigned Enable>
+struct Frame
+{
+   static_assert((0 != Enable) && (0 == (Enable & ~kChannels)), "not a FIFO channel set");
+
+   static constexpr bool hasAccel = Enable & kAccel;
+   static constexpr bool hasTemp  = Enable & kTemp;
+   static constexpr bool hasGyroX = Enable & kGyroX;
+   static constexpr bool hasGyroY = Enable & kGyroY;
+   static constexpr bool hasGyroZ = Enable & kGyroZ;
+   static constexpr bool hasMag   = Enable & kMag;
+
+   static constexpr std::size_t accel = 0;
+   static constexpr std::size_t temp  = accel + (hasAccel ? 6 : 0);
+   static constexpr std::size_t gyroX = temp  + (hasTemp  ? 2 : 0);
+   static constexpr std::size_t gyroY = gyroX + (hasGyroX ? 2 : 0);
+   static constexpr std::size_t gyroZ = gyroY + (hasGyroY ? 2 : 0);
+   static constexpr std::size_t mag   = gyroZ + (hasGyroZ ? 2 : 0);
+   static constexpr std::size_t size  = mag   + (hasMag ? MPU9250_FIFO_MAG_SIZE : 0);
+};
+
+// Private functions
+namespace detail
+{
+
+/* Big-endian MPU9250 and little-endian AK8963 counts */
+inline std::int16_t be16(const std::uint8_t *p) { return static_cast<std::int16_t>((p[0] << 8) | p[1]); }
+inline std::int16_t le16(const std::uint8_t *p) { return static_cast<std::int16_t>((p[1] << 8) | p[0]); }
+
+/* Set index bits in FIFO order, used to enumerate every channel set */
+constexpr unsigned kOrder[] = { kAccel, kTemp, kGyroX, kGyroY, kGyroZ, kMag };
+constexpr std::size_t kSets = std::size_t(1) << (sizeof(kOrder) / sizeof(kOrder[0]));
+
+constexpr unsigned enableOf(std::size_t index)
+{
+   unsigned enable = 0;
+
+   for (std::size_t i = 0; i < sizeof(kOrder) / sizeof(kOrder[0]); i++)
+      enable |= (index & (std::size_t(1) << i)) ? kOrder[i] : 0;
+
+   return enable;
+}
+
+inline std::size_t indexOf(unsigned enable)
+{
+   std::size_t index = 0;
+
+   for (std::size_t i = 0; i < sizeof(kOrder) / sizeof(kOrder[0]); i++)
+      index |= (enable & kOrder[i]) ? (std::size_t(1) << i) : 0;
+
+   return index;
+}
+
+} // namespace detail
+
+// Public functions
+
+/** @brief Unpacks one frame of a channel set, the channels left out are zero
+ *  @param frame The frame, Frame<Enable>::size bytes
+ *  @param sample The sample to fill, the timestamp is left untouched
+ */
+template <unsigned Enable>
+inline void unpackFrame(const std::uint8_t *frame, MPU9250_Sample_t &sample)
+{
+   using F = Frame<Enable>;
+
+   sample.accel[0] = F::hasAccel ? detail::be16(frame + F::accel)     : 0;
+   sample.accel[1] = F::hasAccel ? detail::be16(frame + F::accel + 2) : 0;
+   sample.accel[2] = F::hasAccel ? detail::be16(frame + F::accel + 4) : 0;
+   sample.temp     = F::hasTemp  ? detail::be16(frame + F::temp)      : 0;
+   sample.gyro[0]  = F::hasGyroX ? detail::be16(frame + F::gyroX)     : 0;
+   sample.gyro[1]  = F::hasGyroY ? detail::be16(frame + F::gyroY)     : 0;
+   sample.gyro[2]  = F::hasGyroZ ? detail::be16(frame + F::gyroZ)     : 0;
+   sample.mag[0]   = F::hasMag   ? detail::le16(frame + F::mag)       : 0;
+   sample.mag[1]   = F::hasMag   ? detail::le16(frame + F::mag + 2)   : 0;
+   sample.mag[2]   = F::hasMag   ? detail::le16(frame + F::mag + 4)   : 0;
+
+   if constexpr (F::hasMag)
+   {
+      /* Branch free overflow flag from ST2 */
+      sample.flags = MPU9250_SAMPLE_MAG | (((frame[F::mag + 6] & MPU9250_AK8963_ST2_HOFL) != 0) * MPU9250_SAMPLE_MAG_OVERFLOW);
+   }
+   else
+   {
+      sample.flags = 0;
+   }
+}
+
+/** @brief Unpacks consecutive frames of a channel set
+ *  @param frames The frames, Frame<Enable>::size bytes each
+ *  @param count Number of frames
+ *  @param samples The samples to fill, count elements
+ *  @return Number of frames unpacked
+ */
+template <unsigned Enable>
+inline std::size_t unpackFrames(const void *frames, std::size_t count, MPU9250_Sample_t *samples)
+{
+   const std::uint8_t *frame = static_cast<const std::uint8_t *>(frames);
+
+   for (std::size_t i = 0; i < count; i++, frame += Frame<Enable>::size)
+      unpackFrame<Enable>(frame, samples[i]);
+
+   return count;
+}
+
+/* Unpacker of a channel set chosen at run time */
+using Unpacker = std::size_t (*)(const void *frames, std::size_t count, MPU9250_Sample_t *samples);
+
+namespace detail
+{
+
+template <std::size_t Index>
+constexpr Unpacker unpackerOf()
+{
+   if constexpr (0 == enableOf(Index))
+      return nullptr;
+   else
+      return &unpackFrames<enableOf(Index)>;
+}
+
+template <std::size_t... Index>
+constexpr std::array<Unpacker, sizeof...(Index)> unpackers(std::index_sequence<Index...>)
+{
+   return {{ unpackerOf<Index>()... }};
+}
+
+/* One unpacker per channel set, built at compile time */
+inline constexpr std::array<Unpacker, kSets> kUnpackers = unpackers(std::make_index_sequence<kSets>());
+
+template <std::size_t Index>
+constexpr std::uint8_t sizeOf()
+{
+   if constexpr (0 == enableOf(Index))
+      return 0;
+   else
+      return Frame<enableOf(Index)>::size;
+}
+
+template <std::size_t... Index>
+constexpr std::array<std::uint8_t, sizeof...(Index)> sizes(std::index_sequence<Index...>)
+{
+   return {{ sizeOf<Index>()... }};
+}
+
+inline constexpr std::array<std::uint8_t, kSets> kSizes = sizes(std::make_index_sequence<kSets>());
+
+} // namespace detail
+
+/** @brief Unpacker of a channel set, nullptr if it is not one */
+inline Unpacker unpackerFor(unsigned fifoEnable)
+{
+   if (0 != (fifoEnable & ~kChannels))
+      return nullptr;
+
+   return detail::kUnpackers[detail::indexOf(fifoEnable)];
+}
+
+/** @brief Bytes per frame of a channel set, 0 if it is not one */
+inline std::size_t frameSizeFor(unsigned fifoEnable)
+{
+   if (0 != (fifoEnable & ~kChannels))
+      return 0;
+
+   return detail::kSizes[detail::indexOf(fifoEnable)];
+}
+
+/* Parser of the layout reported by MPU9250_IOC_GET_LAYOUT */
+class FrameParser
+{
+public:
+   explicit FrameParser(const MPU9250_Layout_t &layout)
+      : m_unpack(unpackerFor(layout.fifoEnable)),
+        m_frameSize(frameSizeFor(layout.fifoEnable))
+   {
+      /* A layout this header does not know is rejected rather than misparsed */
+      if (m_frameSize != layout.frameSize)
+      {
+         m_unpack = nullptr;
+         m_frameSize = 0;
+      }
+   }
+
+   bool valid() const { return nullptr != m_unpack; }
+   std::size_t frameSize() const { return m_frameSize; }
+
+   /** @brief Unpacks consecutive frames, 0 if the layout is not valid */
+   std::size_t unpack(const void *frames, std::size_t count, MPU9250_Sample_t *samples) const
+   {
+      return valid() ? m_unpack(frames, count, samples) : 0;
+   }
+
+private:
+   Unpacker m_unpack;
+   std::size_t m_frameSize;
+};
+
+} // namespace mpu9250
+
+#endif
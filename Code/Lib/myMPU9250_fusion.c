@@ -0,0 +1,450 @@
+/**
+ * @file   myMPU9250_fusion.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Streaming orientation fusion (Madgwick and Mahony filters).
+ *
+ * See myMPU9250_fusion.h. A filter step is a serial chain on the quaternion, so one
+ * sensor cannot be split across vector lanes: the NEON and SSE builds instead run
+ * four sensors per step in mpu9250FusionUpdate4(). The step bodies are written once
+ * in myMPU9250_fusion_impl.h and instantiated for float and for four float vectors.
+ */
+#include <math.h>
+#include <string.h>
+#include "myMPU9250_fusion.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MPU9250_FUSION_NEON
+#elif defined(__SSE2__)
+#include <xmmintrin.h>
+#define MPU9250_FUSION_SSE
+#endif
+
+// Constants
+#define FIX_ONE     (1 << MPU9250_FUSION_Q)      ///< 1.0 in the fixed-point state
+
+// Types
+
+/* Four lanes, GCC and clang lower the arithmetic to NEON, SSE or scalar code */
+typedef float MPU9250_Float4_t __attribute__((vector_size(16)));
+
+// Private functions
+
+/** @brief Four lane 1 / sqrt(x), estimate refined with Newton steps to float precision */
+static inline MPU9250_Float4_t mpu9250FusionRsqrt4(MPU9250_Float4_t x)
+{
+#if defined(MPU9250_FUSION_NEON)
+   float32x4_t v = (float32x4_t)x;
+   float32x4_t y = vrsqrteq_f32(v);
+
+   y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(v, y), y));
+   y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(v, y), y));
+
+   return (MPU9250_Float4_t)y;
+#elif defined(MPU9250_FUSION_SSE)
+   MPU9250_Float4_t y = (MPU9250_Float4_t)_mm_rsqrt_ps((__m128)x);
+
+   return y * (1.5f - 0.5f * x * y * y);
+#else
+   MPU9250_Float4_t y;
+
+   y[0] = 1.0f / sqrtf(x[0]);
+   y[1] = 1.0f / sqrtf(x[1]);
+   y[2] = 1.0f / sqrtf(x[2]);
+   y[3] = 1.0f / sqrtf(x[3]);
+
+   return y;
+#endif
+}
+
+/* One sensor per call */
+#define FUSION_T             float
+#define FUSION_RSQRT(x)      (1.0f / sqrtf(x))
+#define FUSION_FN(name)      name
+#include "myMPU9250_fusion_impl.h"
+#undef FUSION_T
+#undef FUSION_RSQRT
+#undef FUSION_FN
+
+/* Four sensors per call */
+#define FUSION_T             MPU9250_Float4_t
+#define FUSION_RSQRT(x)      mpu9250FusionRsqrt4(x)
+#define FUSION_FN(name)      name##4
+#include "myMPU9250_fusion_impl.h"
+#undef FUSION_T
+#undef FUSION_RSQRT
+#undef FUSION_FN
+
+/** @brief Sample i of an optional input array */
+static inline float mpu9250FusionAt(const float *in, unsigned int i)
+{
+   return (NULL != in) ? in[i] : 0.0f;
+}
+
+/** @brief Fixed-point product, both operands and the result in Q24 */
+static inline int32_t mpu9250FusionMul(int32_t a, int32_t b)
+{
+   return (int32_t)(((int64_t)a * b) >> MPU9250_FUSION_Q);
+}
+
+/** @brief 1 / sqrt(x / 2^frac) in Q24, 0 for a zero x
+ *  x is reduced to m * 2^(2e) with m in [0.25, 1), then 1 / sqrt(m) is refined in Q30
+ *  with Newton steps from a linear estimate, good to 1e-9 after four of them.
+ */
+static int32_t mpu9250FusionRsqrtFixed(uint64_t x, int frac)
+{
+   int64_t m, y, y2;
+   int t, e, shift, i;
+
+   if (0 == x)
+      return 0;
+
+   /* x = m * 2^t with m in Q30 and an even exponent t + 30 - frac */
+   t = (63 - __builtin_clzll(x)) - 29;
+   if ((t + 30 - frac) & 1)
+      t++;
+
+   m = (t >= 0) ? (int64_t)(x >> t) : (int64_t)(x << -t);
+   e = (t + 30 - frac) / 2;
+
+   /* 7/3 - 4/3 m is exact at both ends of the interval */
+   y = ((7LL << 30) - 4 * m) / 3;
+
+   for (i = 0; i < 4; i++)
+   {
+      y2 = (y * y) >> 30;
+      y = (y * ((3LL << 30) - ((m * y2) >> 30))) >> 31;
+   }
+
+   /* Q30 to Q24, scaled by 2^-e */
+   shift = 30 - MPU9250_FUSION_Q + e;
+   if (shift >= 0)
+      return (int32_t)(y >> shift);
+
+   return (y > (INT32_MAX >> -shift)) ? INT32_MAX : (int32_t)(y << -shift);
+}
+
+/** @brief Normalises a Q16.16 vector to Q24 in place, returns 0 for a zero vector */
+static inline int mpu9250FusionUnitFixed(int32_t *x, int32_t *y, int32_t *z)
+{
+   uint64_t n = (uint64_t)((int64_t)*x * *x) + (uint64_t)((int64_t)*y * *y) + (uint64_t)((int64_t)*z * *z);
+   int32_t r = mpu9250FusionRsqrtFixed(n, 2 * MPU9250_CONV_Q);
+
+   /* Q16 * Q24 = Q40, back to Q24 */
+   *x = (int32_t)(((int64_t)*x * r) >> MPU9250_CONV_Q);
+   *y = (int32_t)(((int64_t)*y * r) >> MPU9250_CONV_Q);
+   *z = (int32_t)(((int64_t)*z * r) >> MPU9250_CONV_Q);
+
+   return (0 != n);
+}
+
+/** @brief Q24 square root of a sum of Q24 squares given in Q48 */
+static inline int32_t mpu9250FusionSqrtFixed(uint64_t n)
+{
+   return mpu9250FusionMul((int32_t)(n >> MPU9250_FUSION_Q), mpu9250FusionRsqrtFixed(n, 2 * MPU9250_FUSION_Q));
+}
+
+/** @brief Normalises the quaternion after integration */
+static inline void mpu9250FusionNormaliseFixed(int32_t q[4])
+{
+   uint64_t n = (uint64_t)((int64_t)q[0] * q[0]) + (uint64_t)((int64_t)q[1] * q[1]) +
+                (uint64_t)((int64_t)q[2] * q[2]) + (uint64_t)((int64_t)q[3] * q[3]);
+   int32_t r = mpu9250FusionRsqrtFixed(n, 2 * MPU9250_FUSION_Q);
+
+   q[0] = mpu9250FusionMul(q[0], r);
+   q[1] = mpu9250FusionMul(q[1], r);
+   q[2] = mpu9250FusionMul(q[2], r);
+   q[3] = mpu9250FusionMul(q[3], r);
+}
+
+/** @brief Earth field reference of a unit Q24 magnetometer sample, see mpu9250FusionMadgwickStep() */
+static inline void mpu9250FusionFieldFixed(const int32_t q[4], int32_t mx, int32_t my, int32_t mz, int32_t *bx, int32_t *bz)
+{
+   const int32_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+   int32_t hx, hy;
+
+   hx = mpu9250FusionMul(mx, FIX_ONE - 2 * (mpu9250FusionMul(q2, q2) + mpu9250FusionMul(q3, q3))) +
+        mpu9250FusionMul(my, 2 * (mpu9250FusionMul(q1, q2) - mpu9250FusionMul(q0, q3))) +
+        mpu9250FusionMul(mz, 2 * (mpu9250FusionMul(q1, q3) + mpu9250FusionMul(q0, q2)));
+   hy = mpu9250FusionMul(mx, 2 * (mpu9250FusionMul(q1, q2) + mpu9250FusionMul(q0, q3))) +
+        mpu9250FusionMul(my, FIX_ONE - 2 * (mpu9250FusionMul(q1, q1) + mpu9250FusionMul(q3, q3))) +
+        mpu9250FusionMul(mz, 2 * (mpu9250FusionMul(q2, q3) - mpu9250FusionMul(q0, q1)));
+   *bz = mpu9250FusionMul(mx, 2 * (mpu9250FusionMul(q1, q3) - mpu9250FusionMul(q0, q2))) +
+         mpu9250FusionMul(my, 2 * (mpu9250FusionMul(q2, q3) + mpu9250FusionMul(q0, q1))) +
+         mpu9250FusionMul(mz, FIX_ONE - 2 * (mpu9250FusionMul(q1, q1) + mpu9250FusionMul(q2, q2)));
+   *bx = mpu9250FusionSqrtFixed((uint64_t)((int64_t)hx * hx) + (uint64_t)((int64_t)hy * hy));
+}
+
+/** @brief Fixed-point mpu9250FusionMadgwickStep(), gyro in Q24 and unit vectors in Q24
+ *  Every term stays below 64 in magnitude, well inside the Q24 range.
+ */
+static void mpu9250FusionMadgwickFixed(MPU9250_FusionFixed_t *fusion, int32_t gx, int32_t gy, int32_t gz,
+                                       int32_t ax, int32_t ay, int32_t az, int gravity,
+                                       int32_t mx, int32_t my, int32_t mz)
+{
+   int32_t *q = fusion->q;
+   const int32_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+   int32_t qd0, qd1, qd2, qd3;
+   int32_t bx, bz, r;
+   int32_t f0, f1, f2, f3, f4, f5;
+   int32_t s0, s1, s2, s3;
+   int32_t q1q1, q2q2, q3q3;
+   uint64_t n;
+
+   qd0 = (-mpu9250FusionMul(q1, gx) - mpu9250FusionMul(q2, gy) - mpu9250FusionMul(q3, gz)) / 2;
+   qd1 = ( mpu9250FusionMul(q0, gx) + mpu9250FusionMul(q2, gz) - mpu9250FusionMul(q3, gy)) / 2;
+   qd2 = ( mpu9250FusionMul(q0, gy) - mpu9250FusionMul(q1, gz) + mpu9250FusionMul(q3, gx)) / 2;
+   qd3 = ( mpu9250FusionMul(q0, gz) + mpu9250FusionMul(q1, gy) - mpu9250FusionMul(q2, gx)) / 2;
+
+   mpu9250FusionFieldFixed(q, mx, my, mz, &bx, &bz);
+
+   q1q1 = mpu9250FusionMul(q1, q1);
+   q2q2 = mpu9250FusionMul(q2, q2);
+   q3q3 = mpu9250FusionMul(q3, q3);
+
+   if (gravity)
+   {
+      f0 = 2 * (mpu9250FusionMul(q1, q3) - mpu9250FusionMul(q0, q2)) - ax;
+      f1 = 2 * (mpu9250FusionMul(q0, q1) + mpu9250FusionMul(q2, q3)) - ay;
+      f2 = FIX_ONE - 2 * (q1q1 + q2q2) - az;
+   }
+   else
+   {
+      f0 = f1 = f2 = 0;
+   }
+
+   f3 = mpu9250FusionMul(2 * bx, FIX_ONE / 2 - q2q2 - q3q3) +
+        mpu9250FusionMul(2 * bz, mpu9250FusionMul(q1, q3) - mpu9250FusionMul(q0, q2)) - mx;
+   f4 = mpu9250FusionMul(2 * bx, mpu9250FusionMul(q1, q2) - mpu9250FusionMul(q0, q3)) +
+        mpu9250FusionMul(2 * bz, mpu9250FusionMul(q0, q1) + mpu9250FusionMul(q2, q3)) - my;
+   f5 = mpu9250FusionMul(2 * bx, mpu9250FusionMul(q0, q2) + mpu9250FusionMul(q1, q3)) +
+        mpu9250FusionMul(2 * bz, FIX_ONE / 2 - q1q1 - q2q2) - mz;
+
+   s0 = mpu9250FusionMul(-2 * q2, f0) + mpu9250FusionMul(2 * q1, f1) +
+        mpu9250FusionMul(-2 * mpu9250FusionMul(bz, q2), f3) +
+        mpu9250FusionMul(2 * (mpu9250FusionMul(bz, q1) - mpu9250FusionMul(bx, q3)), f4) +
+        mpu9250FusionMul(2 * mpu9250FusionMul(bx, q2), f5);
+   s1 = mpu9250FusionMul(2 * q3, f0) + mpu9250FusionMul(2 * q0, f1) - mpu9250FusionMul(4 * q1, f2) +
+        mpu9250FusionMul(2 * mpu9250FusionMul(bz, q3), f3) +
+        mpu9250FusionMul(2 * (mpu9250FusionMul(bx, q2) + mpu9250FusionMul(bz, q0)), f4) +
+        mpu9250FusionMul(2 * mpu9250FusionMul(bx, q3) - 4 * mpu9250FusionMul(bz, q1), f5);
+   s2 = mpu9250FusionMul(-2 * q0, f0) + mpu9250FusionMul(2 * q3, f1) - mpu9250FusionMul(4 * q2, f2) -
+        mpu9250FusionMul(4 * mpu9250FusionMul(bx, q2) + 2 * mpu9250FusionMul(bz, q0), f3) +
+        mpu9250FusionMul(2 * (mpu9250FusionMul(bx, q1) + mpu9250FusionMul(bz, q3)), f4) +
+        mpu9250FusionMul(2 * mpu9250FusionMul(bx, q0) - 4 * mpu9250FusionMul(bz, q2), f5);
+   s3 = mpu9250FusionMul(2 * q1, f0) + mpu9250FusionMul(2 * q2, f1) +
+        mpu9250FusionMul(2 * mpu9250FusionMul(bz, q1) - 4 * mpu9250FusionMul(bx, q3), f3) +
+        mpu9250FusionMul(2 * (mpu9250FusionMul(bz, q2) - mpu9250FusionMul(bx, q0)), f4) +
+        mpu9250FusionMul(2 * mpu9250FusionMul(bx, q1), f5);
+
+   n = (uint64_t)((int64_t)s0 * s0) + (uint64_t)((int64_t)s1 * s1) +
+       (uint64_t)((int64_t)s2 * s2) + (uint64_t)((int64_t)s3 * s3);
+   r = mpu9250FusionMul(fusion->beta, mpu9250FusionRsqrtFixed(n, 2 * MPU9250_FUSION_Q));
+
+   qd0 -= mpu9250FusionMul(r, s0);
+   qd1 -= mpu9250FusionMul(r, s1);
+   qd2 -= mpu9250FusionMul(r, s2);
+   qd3 -= mpu9250FusionMul(r, s3);
+
+   /* dt is Q30 to keep the integration step exact at high rates */
+   q[0] = q0 + (int32_t)(((int64_t)qd0 * fusion->dt) >> 30);
+   q[1] = q1 + (int32_t)(((int64_t)qd1 * fusion->dt) >> 30);
+   q[2] = q2 + (int32_t)(((int64_t)qd2 * fusion->dt) >> 30);
+   q[3] = q3 + (int32_t)(((int64_t)qd3 * fusion->dt) >> 30);
+
+   mpu9250FusionNormaliseFixed(q);
+}
+
+/** @brief Fixed-point mpu9250FusionMahonyStep(), gyro in Q24 and unit vectors in Q24 */
+static void mpu9250FusionMahonyFixed(MPU9250_FusionFixed_t *fusion, int32_t gx, int32_t gy, int32_t gz,
+                                     int32_t ax, int32_t ay, int32_t az,
+                                     int32_t mx, int32_t my, int32_t mz)
+{
+   int32_t *q = fusion->q;
+   const int32_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+   int32_t bx, bz;
+   int32_t vx, vy, vz, wx, wy, wz;
+   int32_t ex, ey, ez;
+
+   mpu9250FusionFieldFixed(q, mx, my, mz, &bx, &bz);
+
+   vx = mpu9250FusionMul(q1, q3) - mpu9250FusionMul(q0, q2);
+   vy = mpu9250FusionMul(q0, q1) + mpu9250FusionMul(q2, q3);
+   vz = mpu9250FusionMul(q0, q0) - FIX_ONE / 2 + mpu9250FusionMul(q3, q3);
+
+   /* Half of the expected field, b is the full reference here */
+   bx /= 2;
+   bz /= 2;
+   wx = mpu9250FusionMul(bx, FIX_ONE - 2 * (mpu9250FusionMul(q2, q2) + mpu9250FusionMul(q3, q3))) +
+        mpu9250FusionMul(bz, 2 * (mpu9250FusionMul(q1, q3) - mpu9250FusionMul(q0, q2)));
+   wy = mpu9250FusionMul(bx, 2 * (mpu9250FusionMul(q1, q2) - mpu9250FusionMul(q0, q3))) +
+        mpu9250FusionMul(bz, 2 * (mpu9250FusionMul(q0, q1) + mpu9250FusionMul(q2, q3)));
+   wz = mpu9250FusionMul(bx, 2 * (mpu9250FusionMul(q0, q2) + mpu9250FusionMul(q1, q3))) +
+        mpu9250FusionMul(bz, FIX_ONE - 2 * (mpu9250FusionMul(q1, q1) + mpu9250FusionMul(q2, q2)));
+
+   ex = (mpu9250FusionMul(ay, vz) - mpu9250FusionMul(az, vy)) + (mpu9250FusionMul(my, wz) - mpu9250FusionMul(mz, wy));
+   ey = (mpu9250FusionMul(az, vx) - mpu9250FusionMul(ax, vz)) + (mpu9250FusionMul(mz, wx) - mpu9250FusionMul(mx, wz));
+   ez = (mpu9250FusionMul(ax, vy) - mpu9250FusionMul(ay, vx)) + (mpu9250FusionMul(mx, wy) - mpu9250FusionMul(my, wx));
+
+   if (0 != fusion->ki)
+   {
+      fusion->integral[0] += (int32_t)(((int64_t)mpu9250FusionMul(2 * fusion->ki, ex) * fusion->dt) >> 30);
+      fusion->integral[1] += (int32_t)(((int64_t)mpu9250FusionMul(2 * fusion->ki, ey) * fusion->dt) >> 30);
+      fusion->integral[2] += (int32_t)(((int64_t)mpu9250FusionMul(2 * fusion->ki, ez) * fusion->dt) >> 30);
+   }
+
+   gx += fusion->integral[0] + mpu9250FusionMul(2 * fusion->kp, ex);
+   gy += fusion->integral[1] + mpu9250FusionMul(2 * fusion->kp, ey);
+   gz += fusion->integral[2] + mpu9250FusionMul(2 * fusion->kp, ez);
+
+   /* g * dt / 2, the period is Q30 */
+   gx = (int32_t)(((int64_t)gx * fusion->dt) >> 31);
+   gy = (int32_t)(((int64_t)gy * fusion->dt) >> 31);
+   gz = (int32_t)(((int64_t)gz * fusion->dt) >> 31);
+
+   q[0] = q0 - mpu9250FusionMul(q1, gx) - mpu9250FusionMul(q2, gy) - mpu9250FusionMul(q3, gz);
+   q[1] = q1 + mpu9250FusionMul(q0, gx) + mpu9250FusionMul(q2, gz) - mpu9250FusionMul(q3, gy);
+   q[2] = q2 + mpu9250FusionMul(q0, gy) - mpu9250FusionMul(q1, gz) + mpu9250FusionMul(q3, gx);
+   q[3] = q3 + mpu9250FusionMul(q0, gz) + mpu9250FusionMul(q1, gy) - mpu9250FusionMul(q2, gx);
+
+   mpu9250FusionNormaliseFixed(q);
+}
+
+// Public functions
+
+void mpu9250FusionInit(MPU9250_Fusion_t *fusion, MPU9250_FusionAlgorithm_t algorithm, float sampleRateHz)
+{
+   memset(fusion, 0, sizeof(*fusion));
+
+   fusion->algorithm = algorithm;
+   fusion->dt = 1.0f / sampleRateHz;
+   fusion->beta = 0.1f;
+   fusion->kp = 0.5f;
+   fusion->ki = 0.0f;
+   fusion->q[0] = 1.0f;
+}
+
+void mpu9250FusionFixedInit(MPU9250_FusionFixed_t *fusion, MPU9250_FusionAlgorithm_t algorithm, float sampleRateHz)
+{
+   memset(fusion, 0, sizeof(*fusion));
+
+   fusion->algorithm = algorithm;
+   fusion->dt = (int32_t)lrintf((float)(1 << 30) / sampleRateHz);
+   fusion->beta = (int32_t)lrintf(0.1f * FIX_ONE);
+   fusion->kp = (int32_t)lrintf(0.5f * FIX_ONE);
+   fusion->ki = 0;
+   fusion->q[0] = FIX_ONE;
+}
+
+void mpu9250FusionUpdate(MPU9250_Fusion_t *fusion, const MPU9250_ConvFloat_t *in, unsigned int count, float *const *quat)
+{
+   const float *const *g = (const float *const *)in->gyro;
+   const float *const *a = (const float *const *)in->accel;
+   const float *const *m = (const float *const *)in->mag;
+   unsigned int i;
+
+   for (i = 0; i < count; i++)
+   {
+      if (MPU9250_FUSION_MAHONY == fusion->algorithm)
+      {
+         mpu9250FusionMahonyStep(fusion->q, fusion->integral, g[0][i], g[1][i], g[2][i], a[0][i], a[1][i], a[2][i],
+                                 mpu9250FusionAt(m[0], i), mpu9250FusionAt(m[1], i), mpu9250FusionAt(m[2], i),
+                                 fusion->kp, fusion->ki, fusion->dt);
+      }
+      else
+      {
+         mpu9250FusionMadgwickStep(fusion->q, g[0][i], g[1][i], g[2][i], a[0][i], a[1][i], a[2][i],
+                                   mpu9250FusionAt(m[0], i), mpu9250FusionAt(m[1], i), mpu9250FusionAt(m[2], i),
+                                   fusion->beta, fusion->dt);
+      }
+
+      if (NULL != quat)
+      {
+         quat[0][i] = fusion->q[0];
+         quat[1][i] = fusion->q[1];
+         quat[2][i] = fusion->q[2];
+         quat[3][i] = fusion->q[3];
+      }
+   }
+}
+
+void mpu9250FusionUpdate4(MPU9250_Fusion_t *const fusion[4], const MPU9250_ConvFloat_t *const in[4], unsigned int count)
+{
+   const MPU9250_Fusion_t *f = fusion[0];
+   MPU9250_Float4_t q[4], integral[3], v[9];
+   unsigned int i, j, k;
+
+   /* Sensors to lanes */
+   for (j = 0; j < 4; j++)
+   {
+      for (k = 0; k < 4; k++)
+         q[k][j] = fusion[j]->q[k];
+      for (k = 0; k < 3; k++)
+         integral[k][j] = fusion[j]->integral[k];
+   }
+
+   for (i = 0; i < count; i++)
+   {
+      for (j = 0; j < 4; j++)
+      {
+         for (k = 0; k < 3; k++)
+         {
+            v[k][j]     = in[j]->gyro[k][i];
+            v[3 + k][j] = in[j]->accel[k][i];
+            v[6 + k][j] = mpu9250FusionAt(in[j]->mag[k], i);
+         }
+      }
+
+      if (MPU9250_FUSION_MAHONY == f->algorithm)
+         mpu9250FusionMahonyStep4(q, integral, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], f->kp, f->ki, f->dt);
+      else
+         mpu9250FusionMadgwickStep4(q, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], f->beta, f->dt);
+   }
+
+   for (j = 0; j < 4; j++)
+   {
+      for (k = 0; k < 4; k++)
+         fusion[j]->q[k] = q[k][j];
+      for (k = 0; k < 3; k++)
+         fusion[j]->integral[k] = integral[k][j];
+   }
+}
+
+void mpu9250FusionFixedUpdate(MPU9250_FusionFixed_t *fusion, const MPU9250_ConvFixed_t *in, unsigned int count, int32_t *const *quat)
+{
+   const int shift = MPU9250_FUSION_Q - MPU9250_CONV_Q;
+   int32_t gx, gy, gz, ax, ay, az, mx, my, mz;
+   unsigned int i;
+   int gravity;
+
+   for (i = 0; i < count; i++)
+   {
+      /* Gyro to Q24, accel and mag to unit vectors in Q24 */
+      gx = in->gyro[0][i] * (1 << shift);
+      gy = in->gyro[1][i] * (1 << shift);
+      gz = in->gyro[2][i] * (1 << shift);
+
+      ax = in->accel[0][i];
+      ay = in->accel[1][i];
+      az = in->accel[2][i];
+      gravity = mpu9250FusionUnitFixed(&ax, &ay, &az);
+
+      mx = (NULL != in->mag[0]) ? in->mag[0][i] : 0;
+      my = (NULL != in->mag[1]) ? in->mag[1][i] : 0;
+      mz = (NULL != in->mag[2]) ? in->mag[2][i] : 0;
+      mpu9250FusionUnitFixed(&mx, &my, &mz);
+
+      if (MPU9250_FUSION_MAHONY == fusion->algorithm)
+         mpu9250FusionMahonyFixed(fusion, gx, gy, gz, ax, ay, az, mx, my, mz);
+      else
+         mpu9250FusionMadgwickFixed(fusion, gx, gy, gz, ax, ay, az, gravity, mx, my, mz);
+
+      if (NULL != quat)
+      {
+         quat[0][i] = fusion->q[0];
+         quat[1][i] = fusion->q[1];
+         quat[2][i] = fusion->q[2];
+         quat[3][i] = fusion->q[3];
+      }
+   }
+}
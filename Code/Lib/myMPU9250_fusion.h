@@ -0,0 +1,92 @@
+#ifndef _myMPU9250_fusion_H
+#define _myMPU9250_fusion_H
+
+/* Streaming orientation fusion (Madgwick and Mahony filters).
+ *
+ * Consumes the structure of arrays batches of myMPU9250_conv.h and keeps one
+ * quaternion per sensor, rotating body axes into the earth frame (w, x, y, z).
+ * The magnetometer is optional: without it, or with a zero sample, the filters
+ * fall back to 6 axes. Zero vectors never need a branch, so the same code runs
+ * on scalars and on four sensors at once, one per NEON or SSE lane.
+ *
+ * The fixed-point backend consumes the Q16.16 outputs of mpu9250ConvFramesFixed()
+ * and works in Q24, for cores without a fast FPU or when bit exact results
+ * across platforms matter.
+ */
+#include <stdint.h>
+#include "myMPU9250_conv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Constants
+
+/* Fractional bits of the fixed-point state */
+#define MPU9250_FUSION_Q              24
+
+// Types
+typedef enum
+{
+   MPU9250_FUSION_MADGWICK = 0,       // Gradient descent, one gain
+   MPU9250_FUSION_MAHONY,             // Complementary filter with PI feedback
+
+} MPU9250_FusionAlgorithm_t;
+
+typedef struct
+{
+   MPU9250_FusionAlgorithm_t algorithm;
+   float dt;                          // Sample period [s]
+   float beta;                        // Madgwick gain
+   float kp;                          // Mahony proportional gain
+   float ki;                          // Mahony integral gain, 0 disables the gyro bias estimation
+   float q[4];                        // Orientation quaternion
+   float integral[3];                 // Mahony integral feedback [rad/s]
+
+} MPU9250_Fusion_t;
+
+typedef struct
+{
+   MPU9250_FusionAlgorithm_t algorithm;
+   int32_t dt;                        // Sample period, Q30 [s]
+   int32_t beta;                      // Gains, Q24
+   int32_t kp;
+   int32_t ki;
+   int32_t q[4];                      // Orientation quaternion, Q24
+   int32_t integral[3];               // Mahony integral feedback, Q24 [rad/s]
+
+} MPU9250_FusionFixed_t;
+
+// Public functions
+
+/** @brief Starts a filter at the identity orientation with the usual gains
+ *  Madgwick beta is 0.1, Mahony kp is 0.5 and ki is 0. Gains can be changed afterwards.
+ *  @param fusion The filter
+ *  @param algorithm Madgwick or Mahony
+ *  @param sampleRateHz Output data rate of the samples, see MPU9250_Config_t
+ */
+void mpu9250FusionInit(MPU9250_Fusion_t *fusion, MPU9250_FusionAlgorithm_t algorithm, float sampleRateHz);
+void mpu9250FusionFixedInit(MPU9250_FusionFixed_t *fusion, MPU9250_FusionAlgorithm_t algorithm, float sampleRateHz);
+
+/** @brief Feeds a batch of converted samples of one sensor
+ *  @param fusion The filter
+ *  @param in Accel [m/s2] and gyro [rad/s] arrays, mag [uT] arrays or NULL for 6 axes
+ *  @param count Number of samples
+ *  @param quat Arrays that receive w, x, y and z after every sample, or NULL
+ */
+void mpu9250FusionUpdate(MPU9250_Fusion_t *fusion, const MPU9250_ConvFloat_t *in, unsigned int count, float *const *quat);
+void mpu9250FusionFixedUpdate(MPU9250_FusionFixed_t *fusion, const MPU9250_ConvFixed_t *in, unsigned int count, int32_t *const *quat);
+
+/** @brief Feeds a batch of converted samples of four sensors in lockstep, one per vector lane
+ *  Every filter must use the same algorithm, sample period and gains.
+ *  @param fusion The four filters
+ *  @param in The samples of each sensor, count each
+ *  @param count Number of samples per sensor
+ */
+void mpu9250FusionUpdate4(MPU9250_Fusion_t *const fusion[4], const MPU9250_ConvFloat_t *const in[4], unsigned int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
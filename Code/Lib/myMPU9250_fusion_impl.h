@@ -0,0 +1,135 @@
+/* Filter steps shared by the scalar and the four lane backends of myMPU9250_fusion.c.
+ * The includer defines FUSION_T (float or a four float vector), FUSION_RSQRT() and
+ * FUSION_FN() to name the instance.
+ *
+ * Zero vectors are handled without branches: normalising x as x * rsqrt(|x|^2 + tiny)
+ * keeps them zero, and a zero magnetometer makes every magnetic term vanish.
+ */
+
+/* Keeps rsqrt finite for zero vectors, far below any squared sensor norm */
+#define FUSION_TINY   1e-30f
+
+/** @brief One Madgwick step, the gradient is J^T f of the gravity and magnetic objectives */
+static inline void FUSION_FN(mpu9250FusionMadgwickStep)(FUSION_T q[4], FUSION_T gx, FUSION_T gy, FUSION_T gz,
+                                                        FUSION_T ax, FUSION_T ay, FUSION_T az,
+                                                        FUSION_T mx, FUSION_T my, FUSION_T mz, float beta, float dt)
+{
+   FUSION_T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+   FUSION_T qd0, qd1, qd2, qd3;
+   FUSION_T n, r, w;
+   FUSION_T hx, hy, bx, bz;
+   FUSION_T f0, f1, f2, f3, f4, f5;
+   FUSION_T s0, s1, s2, s3;
+
+   /* Rate of change from the gyroscope, q * (0, g) / 2 */
+   qd0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+   qd1 = 0.5f * ( q0 * gx + q2 * gz - q3 * gy);
+   qd2 = 0.5f * ( q0 * gy - q1 * gz + q3 * gx);
+   qd3 = 0.5f * ( q0 * gz + q1 * gy - q2 * gx);
+
+   /* Unit accel, w is 0 for a zero vector so gravity does not pull towards it */
+   n = ax * ax + ay * ay + az * az;
+   r = FUSION_RSQRT(n + FUSION_TINY);
+   w = n * r * r;
+   ax *= r; ay *= r; az *= r;
+
+   n = mx * mx + my * my + mz * mz;
+   r = FUSION_RSQRT(n + FUSION_TINY);
+   mx *= r; my *= r; mz *= r;
+
+   /* Earth field h = q m q*, its reference b has no east component */
+   hx = mx * (1.0f - 2.0f * (q2 * q2 + q3 * q3)) + my * 2.0f * (q1 * q2 - q0 * q3) + mz * 2.0f * (q1 * q3 + q0 * q2);
+   hy = mx * 2.0f * (q1 * q2 + q0 * q3) + my * (1.0f - 2.0f * (q1 * q1 + q3 * q3)) + mz * 2.0f * (q2 * q3 - q0 * q1);
+   bz = mx * 2.0f * (q1 * q3 - q0 * q2) + my * 2.0f * (q2 * q3 + q0 * q1) + mz * (1.0f - 2.0f * (q1 * q1 + q2 * q2));
+   n = hx * hx + hy * hy;
+   bx = n * FUSION_RSQRT(n + FUSION_TINY);
+
+   /* Objectives: expected minus measured direction, in the sensor frame */
+   f0 = w * (2.0f * (q1 * q3 - q0 * q2) - ax);
+   f1 = w * (2.0f * (q0 * q1 + q2 * q3) - ay);
+   f2 = w * (1.0f - 2.0f * (q1 * q1 + q2 * q2) - az);
+   f3 = 2.0f * bx * (0.5f - q2 * q2 - q3 * q3) + 2.0f * bz * (q1 * q3 - q0 * q2) - mx;
+   f4 = 2.0f * bx * (q1 * q2 - q0 * q3) + 2.0f * bz * (q0 * q1 + q2 * q3) - my;
+   f5 = 2.0f * bx * (q0 * q2 + q1 * q3) + 2.0f * bz * (0.5f - q1 * q1 - q2 * q2) - mz;
+
+   /* Gradient J^T f */
+   s0 = -2.0f * q2 * f0 + 2.0f * q1 * f1
+        - 2.0f * bz * q2 * f3 + 2.0f * (bz * q1 - bx * q3) * f4 + 2.0f * bx * q2 * f5;
+   s1 =  2.0f * q3 * f0 + 2.0f * q0 * f1 - 4.0f * q1 * f2
+        + 2.0f * bz * q3 * f3 + 2.0f * (bx * q2 + bz * q0) * f4 + (2.0f * bx * q3 - 4.0f * bz * q1) * f5;
+   s2 = -2.0f * q0 * f0 + 2.0f * q3 * f1 - 4.0f * q2 * f2
+        - (4.0f * bx * q2 + 2.0f * bz * q0) * f3 + 2.0f * (bx * q1 + bz * q3) * f4 + (2.0f * bx * q0 - 4.0f * bz * q2) * f5;
+   s3 =  2.0f * q1 * f0 + 2.0f * q2 * f1
+        + (2.0f * bz * q1 - 4.0f * bx * q3) * f3 + 2.0f * (bz * q2 - bx * q0) * f4 + 2.0f * bx * q1 * f5;
+
+   /* Step of length beta against the gradient */
+   r = beta * FUSION_RSQRT(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3 + FUSION_TINY);
+   qd0 -= r * s0; qd1 -= r * s1; qd2 -= r * s2; qd3 -= r * s3;
+
+   q0 += qd0 * dt; q1 += qd1 * dt; q2 += qd2 * dt; q3 += qd3 * dt;
+
+   r = FUSION_RSQRT(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+   q[0] = q0 * r; q[1] = q1 * r; q[2] = q2 * r; q[3] = q3 * r;
+}
+
+/** @brief One Mahony step, the feedback is the cross product of measured and expected directions */
+static inline void FUSION_FN(mpu9250FusionMahonyStep)(FUSION_T q[4], FUSION_T integral[3], FUSION_T gx, FUSION_T gy, FUSION_T gz,
+                                                      FUSION_T ax, FUSION_T ay, FUSION_T az,
+                                                      FUSION_T mx, FUSION_T my, FUSION_T mz, float kp, float ki, float dt)
+{
+   FUSION_T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+   FUSION_T n, r;
+   FUSION_T hx, hy, bx, bz;
+   FUSION_T vx, vy, vz, wx, wy, wz;
+   FUSION_T ex, ey, ez;
+
+   /* Unit vectors, a zero vector gives no feedback */
+   r = FUSION_RSQRT(ax * ax + ay * ay + az * az + FUSION_TINY);
+   ax *= r; ay *= r; az *= r;
+
+   r = FUSION_RSQRT(mx * mx + my * my + mz * mz + FUSION_TINY);
+   mx *= r; my *= r; mz *= r;
+
+   /* Half of the expected gravity direction */
+   vx = q1 * q3 - q0 * q2;
+   vy = q0 * q1 + q2 * q3;
+   vz = q0 * q0 - 0.5f + q3 * q3;
+
+   /* Earth field reference and half of its expected direction */
+   hx = 2.0f * (mx * (0.5f - q2 * q2 - q3 * q3) + my * (q1 * q2 - q0 * q3) + mz * (q1 * q3 + q0 * q2));
+   hy = 2.0f * (mx * (q1 * q2 + q0 * q3) + my * (0.5f - q1 * q1 - q3 * q3) + mz * (q2 * q3 - q0 * q1));
+   bz = 2.0f * (mx * (q1 * q3 - q0 * q2) + my * (q2 * q3 + q0 * q1) + mz * (0.5f - q1 * q1 - q2 * q2));
+   n = hx * hx + hy * hy;
+   bx = n * FUSION_RSQRT(n + FUSION_TINY);
+
+   wx = bx * (0.5f - q2 * q2 - q3 * q3) + bz * (q1 * q3 - q0 * q2);
+   wy = bx * (q1 * q2 - q0 * q3) + bz * (q0 * q1 + q2 * q3);
+   wz = bx * (q0 * q2 + q1 * q3) + bz * (0.5f - q1 * q1 - q2 * q2);
+
+   /* Half of the error, measured x expected */
+   ex = (ay * vz - az * vy) + (my * wz - mz * wy);
+   ey = (az * vx - ax * vz) + (mz * wx - mx * wz);
+   ez = (ax * vy - ay * vx) + (mx * wy - my * wx);
+
+   /* Integral feedback tracks the gyro bias, it stays zero when ki is zero */
+   integral[0] += (2.0f * ki * dt) * ex;
+   integral[1] += (2.0f * ki * dt) * ey;
+   integral[2] += (2.0f * ki * dt) * ez;
+
+   gx += integral[0] + (2.0f * kp) * ex;
+   gy += integral[1] + (2.0f * kp) * ey;
+   gz += integral[2] + (2.0f * kp) * ez;
+
+   /* Integrate q * (0, g) / 2 */
+   gx *= 0.5f * dt; gy *= 0.5f * dt; gz *= 0.5f * dt;
+
+   q0 += -q[1] * gx - q[2] * gy - q[3] * gz;
+   q1 +=  q[0] * gx + q[2] * gz - q[3] * gy;
+   q2 +=  q[0] * gy - q[1] * gz + q[3] * gx;
+   q3 +=  q[0] * gz + q[1] * gy - q[2] * gx;
+
+   r = FUSION_RSQRT(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+   q[0] = q0 * r; q[1] = q1 * r; q[2] = q2 * r; q[3] = q3 * r;
+}
+
+#undef FUSION_TINY
@@ -0,0 +1,698 @@
+/**
+ * @file   myMPU9250_rec.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Binary recordings of MPU9250 samples.
+ *
+ * See myMPU9250_rec.h. Chunk headers may start at any byte of the file, so they are
+ * copied out of the mapping instead of being accessed in place.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "myMPU9250_rec.h"
+
+// Constants
+#define SAMPLE_BYTES_MAX    48                  ///< Largest encoded sample: 10 + 10 * 3 + 3 bytes, or a raw sample
+
+// Private functions
+
+static uint64_t mpu9250RecZigzag(int64_t v)
+{
+   return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t mpu9250RecUnzigzag(uint64_t v)
+{
+   return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint8_t *mpu9250RecPutVarint(uint8_t *p, uint64_t v)
+{
+   while (0x80 <= v)
+   {
+      *p++ = (uint8_t)v | 0x80;
+      v >>= 7;
+   }
+
+   *p++ = (uint8_t)v;
+
+   return p;
+}
+
+/** @brief Decodes a varint, NULL when it runs past the end of the payload */
+static const uint8_t *mpu9250RecGetVarint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+   unsigned int shift;
+
+   *v = 0;
+
+   for (shift = 0; (p < end) && (64 > shift); shift += 7)
+   {
+      *v |= (uint64_t)(*p & 0x7F) << shift;
+
+      if (0 == (*p++ & 0x80))
+         return p;
+   }
+
+   return NULL;
+}
+
+static void mpu9250RecChannels(const MPU9250_Sample_t *sample, int16_t *ch)
+{
+   memcpy(&ch[0], sample->accel, sizeof(sample->accel));
+   memcpy(&ch[3], sample->gyro, sizeof(sample->gyro));
+   memcpy(&ch[6], sample->mag, sizeof(sample->mag));
+   ch[9] = sample->temp;
+}
+
+static void mpu9250RecFromChannels(MPU9250_Sample_t *sample, const int16_t *ch)
+{
+   memcpy(sample->accel, &ch[0], sizeof(sample->accel));
+   memcpy(sample->gyro, &ch[3], sizeof(sample->gyro));
+   memcpy(sample->mag, &ch[6], sizeof(sample->mag));
+   sample->temp = ch[9];
+}
+
+static void mpu9250RecDeltaReset(MPU9250_RecDelta_t *delta, int64_t first)
+{
+   memset(delta, 0, sizeof(*delta));
+   delta->timestamp = first;
+}
+
+/** @brief Encodes one sample against the previous one of its chunk
+ *  @return The end of the encoded sample
+ */
+static uint8_t *mpu9250RecEncode(MPU9250_RecDelta_t *delta, const MPU9250_Sample_t *sample, uint8_t *p)
+{
+   int16_t ch[MPU9250_REC_CHANNELS];
+   int64_t period = sample->timestamp - delta->timestamp;
+   unsigned int i;
+
+   /* Second difference of the timestamp, 0 at a perfectly steady rate */
+   p = mpu9250RecPutVarint(p, mpu9250RecZigzag(period - delta->period));
+   delta->period = period;
+   delta->timestamp = sample->timestamp;
+
+   mpu9250RecChannels(sample, ch);
+
+   for (i = 0; i < MPU9250_REC_CHANNELS; i++)
+   {
+      p = mpu9250RecPutVarint(p, mpu9250RecZigzag((int32_t)ch[i] - delta->channel[i]));
+      delta->channel[i] = ch[i];
+   }
+
+   return mpu9250RecPutVarint(p, sample->flags);
+}
+
+/** @brief Decodes one sample, the inverse of mpu9250RecEncode()
+ *  @return The end of the encoded sample, NULL on a damaged payload
+ */
+static const uint8_t *mpu9250RecDecode(MPU9250_RecDelta_t *delta, const uint8_t *p, const uint8_t *end, MPU9250_Sample_t *sample)
+{
+   int16_t ch[MPU9250_REC_CHANNELS];
+   uint64_t v;
+   unsigned int i;
+
+   p = mpu9250RecGetVarint(p, end, &v);
+
+   if (NULL == p)
+      return NULL;
+
+   delta->period += mpu9250RecUnzigzag(v);
+   delta->timestamp += delta->period;
+
+   for (i = 0; i < MPU9250_REC_CHANNELS; i++)
+   {
+      p = mpu9250RecGetVarint(p, end, &v);
+
+      if (NULL == p)
+         return NULL;
+
+      ch[i] = (int16_t)(delta->channel[i] + mpu9250RecUnzigzag(v));
+      delta->channel[i] = ch[i];
+   }
+
+   p = mpu9250RecGetVarint(p, end, &v);
+
+   if (NULL == p)
+      return NULL;
+
+   memset(sample, 0, sizeof(*sample));
+   sample->timestamp = delta->timestamp;
+   sample->flags = (uint16_t)v;
+   mpu9250RecFromChannels(sample, ch);
+
+   return p;
+}
+
+/** @brief Writes every byte, retrying short writes */
+static int mpu9250RecWriteAll(int fd, const void *buf, size_t len)
+{
+   const uint8_t *p = buf;
+   ssize_t n;
+
+   while (0 < len)
+   {
+      n = write(fd, p, len);
+
+      if (0 > n)
+      {
+         if (EINTR == errno)
+            continue;
+
+         return -1;
+      }
+
+      p += n;
+      len -= n;
+   }
+
+   return 0;
+}
+
+static int mpu9250RecFlushBlock(MPU9250_RecWriter_t *w)
+{
+   if (0 != mpu9250RecWriteAll(w->fd, w->block, w->blockUsed))
+      return -1;
+
+   w->offset += w->blockUsed;
+   w->blockUsed = 0;
+
+   return 0;
+}
+
+/** @brief Moves the chunk being filled of a sensor to the write block and indexes it */
+static int mpu9250RecCloseChunk(MPU9250_RecWriter_t *w, unsigned int sensor)
+{
+   MPU9250_RecChunk_t *chunk = &w->open[sensor].chunk;
+   size_t need = sizeof(*chunk) + chunk->size;
+   MPU9250_RecIndex_t *index;
+
+   if (0 == chunk->count)
+      return 0;
+
+   if (w->indexCount == w->indexSize)
+   {
+      index = realloc(w->index, (w->indexSize ? 2 * w->indexSize : 256) * sizeof(*index));
+
+      if (NULL == index)
+         return -1;
+
+      w->index = index;
+      w->indexSize = w->indexSize ? 2 * w->indexSize : 256;
+   }
+
+   if ((MPU9250_REC_BLOCK < w->blockUsed + need) && (0 != mpu9250RecFlushBlock(w)))
+      return -1;
+
+   index = &w->index[w->indexCount++];
+   index->offset = w->offset + w->blockUsed;
+   index->first = chunk->first;
+   index->last = chunk->last;
+   index->sensor = sensor;
+   index->count = chunk->count;
+
+   memcpy(w->block + w->blockUsed, chunk, sizeof(*chunk));
+   memcpy(w->block + w->blockUsed + sizeof(*chunk), w->open[sensor].payload, chunk->size);
+   w->blockUsed += need;
+   w->bytes += need;
+
+   chunk->count = 0;
+   chunk->size = 0;
+
+   return 0;
+}
+
+/** @brief Loads the next chunk of a sensor into its cursor
+ *  @return 1 when a chunk was loaded, 0 at the end of the sensor or -1 on a damaged chunk
+ */
+static int mpu9250RecNextChunk(MPU9250_RecReader_t *r, unsigned int sensor)
+{
+   const MPU9250_RecIndex_t *index;
+   MPU9250_RecChunk_t *chunk = &r->cursor[sensor].chunk;
+
+   if (r->cursor[sensor].next >= r->cursor[sensor].chunkCount)
+      return 0;
+
+   index = &r->index[r->cursor[sensor].chunks[r->cursor[sensor].next++]];
+
+   if (index->offset + sizeof(*chunk) > r->size)
+      return -1;
+
+   memcpy(chunk, r->map + index->offset, sizeof(*chunk));
+
+   if ((MPU9250_REC_CHUNK_MAGIC != chunk->magic) || (sensor != chunk->sensor) ||
+       (MPU9250_REC_CODEC_DELTA < chunk->codec) ||
+       (index->offset + sizeof(*chunk) + chunk->size > r->size))
+   {
+      return -1;
+   }
+
+   r->cursor[sensor].pos = r->map + index->offset + sizeof(*chunk);
+   r->cursor[sensor].end = r->cursor[sensor].pos + chunk->size;
+   r->cursor[sensor].left = chunk->count;
+   mpu9250RecDeltaReset(&r->cursor[sensor].delta, chunk->first);
+
+   return 1;
+}
+
+/** @brief Decodes the next sample of the chunk being decoded of a sensor */
+static int mpu9250RecNextSample(MPU9250_RecReader_t *r, unsigned int sensor, MPU9250_Sample_t *sample)
+{
+   MPU9250_RecCursor_t *c = &r->cursor[sensor];
+
+   if (MPU9250_REC_CODEC_RAW == c->chunk.codec)
+   {
+      if (sizeof(*sample) > (size_t)(c->end - c->pos))
+         return -1;
+
+      memcpy(sample, c->pos, sizeof(*sample));
+      c->pos += sizeof(*sample);
+   }
+   else
+   {
+      c->pos = mpu9250RecDecode(&c->delta, c->pos, c->end, sample);
+
+      if (NULL == c->pos)
+         return -1;
+   }
+
+   c->left--;
+
+   return 0;
+}
+
+/** @brief Rebuilds the index of a recording that was not closed from its chunk headers */
+static int mpu9250RecScan(MPU9250_RecReader_t *r)
+{
+   MPU9250_RecChunk_t chunk;
+   MPU9250_RecIndex_t *index;
+   unsigned int size = 0;
+   uint64_t offset = sizeof(MPU9250_RecHeader_t);
+
+   while (offset + sizeof(chunk) <= r->size)
+   {
+      memcpy(&chunk, r->map + offset, sizeof(chunk));
+
+      /* The last chunk may be incomplete */
+      if ((MPU9250_REC_CHUNK_MAGIC != chunk.magic) || (MPU9250_GROUP_MAX <= chunk.sensor) ||
+          (offset + sizeof(chunk) + chunk.size > r->size))
+      {
+         break;
+      }
+
+      if (r->indexCount == size)
+      {
+         size = size ? 2 * size : 256;
+         index = realloc(r->index, size * sizeof(*index));
+
+         if (NULL == index)
+            return -1;
+
+         r->index = index;
+      }
+
+      index = &r->index[r->indexCount++];
+      index->offset = offset;
+      index->first = chunk.first;
+      index->last = chunk.last;
+      index->sensor = chunk.sensor;
+      index->count = chunk.count;
+
+      offset += sizeof(chunk) + chunk.size;
+   }
+
+   return 0;
+}
+
+// Public functions
+
+int mpu9250RecCreate(MPU9250_RecWriter_t *w, const char *path, unsigned int codec)
+{
+   memset(w, 0, sizeof(*w));
+
+   if (MPU9250_REC_CODEC_DELTA < codec)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   w->block = malloc(MPU9250_REC_BLOCK);
+
+   if (NULL == w->block)
+      return -1;
+
+   w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+   if (0 > w->fd)
+   {
+      free(w->block);
+      return -1;
+   }
+
+   w->codec = codec;
+   w->header.magic = MPU9250_REC_MAGIC;
+   w->header.version = MPU9250_REC_VERSION;
+
+   /* Rewritten at close with the index offset */
+   memcpy(w->block, &w->header, sizeof(w->header));
+   w->blockUsed = sizeof(w->header);
+   w->bytes = sizeof(w->header);
+
+   return 0;
+}
+
+int mpu9250RecSensor(MPU9250_RecWriter_t *w, unsigned int sensor, const MPU9250_Config_t *config,
+                     const MPU9250_Scale_t *scale, const MPU9250_Calib_t *calib)
+{
+   MPU9250_RecSensor_t *desc;
+
+   if ((MPU9250_GROUP_MAX <= sensor) || (NULL != w->open[sensor].payload))
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   w->open[sensor].payload = malloc(MPU9250_REC_CHUNK_BYTES);
+
+   if (NULL == w->open[sensor].payload)
+      return -1;
+
+   desc = &w->header.sensor[sensor];
+   memset(desc, 0, sizeof(*desc));
+   desc->config = *config;
+   desc->scale = *scale;
+
+   if (NULL != calib)
+      desc->calib = *calib;
+
+   w->header.sensors |= 1u << sensor;
+
+   /* A recording cut short still describes its sensors */
+   if (0 == w->offset)
+      memcpy(w->block, &w->header, sizeof(w->header));
+   else if ((ssize_t)sizeof(w->header) != pwrite(w->fd, &w->header, sizeof(w->header), 0))
+      return -1;
+
+   return 0;
+}
+
+int mpu9250RecWrite(MPU9250_RecWriter_t *w, unsigned int sensor, const MPU9250_Sample_t *samples, unsigned int count)
+{
+   MPU9250_RecChunk_t *chunk;
+   uint8_t *p;
+   unsigned int i;
+
+   if ((MPU9250_GROUP_MAX <= sensor) || (NULL == w->open[sensor].payload))
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   chunk = &w->open[sensor].chunk;
+
+   for (i = 0; i < count; i++)
+   {
+      if ((MPU9250_REC_CHUNK_BYTES - chunk->size < SAMPLE_BYTES_MAX) && (0 != mpu9250RecCloseChunk(w, sensor)))
+         return -1;
+
+      if (0 == chunk->count)
+      {
+         chunk->magic = MPU9250_REC_CHUNK_MAGIC;
+         chunk->sensor = sensor;
+         chunk->codec = w->codec;
+         chunk->first = samples[i].timestamp;
+         mpu9250RecDeltaReset(&w->open[sensor].delta, chunk->first);
+      }
+
+      p = w->open[sensor].payload + chunk->size;
+
+      if (MPU9250_REC_CODEC_RAW == w->codec)
+      {
+         memcpy(p, &samples[i], sizeof(samples[i]));
+         p += sizeof(samples[i]);
+      }
+      else
+      {
+         p = mpu9250RecEncode(&w->open[sensor].delta, &samples[i], p);
+      }
+
+      chunk->size = p - w->open[sensor].payload;
+      chunk->last = samples[i].timestamp;
+      chunk->count++;
+   }
+
+   w->samples += count;
+
+   return 0;
+}
+
+int mpu9250RecClose(MPU9250_RecWriter_t *w)
+{
+   unsigned int i;
+   int rv = 0;
+
+   for (i = 0; i < MPU9250_GROUP_MAX; i++)
+   {
+      if ((NULL != w->open[i].payload) && (0 != mpu9250RecCloseChunk(w, i)))
+         rv = -1;
+   }
+
+   if ((0 == rv) && (0 != mpu9250RecFlushBlock(w)))
+      rv = -1;
+
+   /* The index follows the last chunk, the header points to it */
+   if (0 == rv)
+   {
+      w->header.indexOffset = w->offset;
+      w->header.indexCount = w->indexCount;
+
+      if ((0 != mpu9250RecWriteAll(w->fd, w->index, w->indexCount * sizeof(*w->index))) ||
+          ((ssize_t)sizeof(w->header) != pwrite(w->fd, &w->header, sizeof(w->header), 0)))
+      {
+         rv = -1;
+      }
+
+      w->bytes += w->indexCount * sizeof(*w->index);
+   }
+
+   if ((0 != close(w->fd)) && (0 == rv))
+      rv = -1;
+
+   for (i = 0; i < MPU9250_GROUP_MAX; i++)
+      free(w->open[i].payload);
+
+   free(w->index);
+   free(w->block);
+
+   return rv;
+}
+
+int mpu9250RecOpen(MPU9250_RecReader_t *r, const char *path)
+{
+   struct stat st;
+   unsigned int i, s;
+   int fd;
+
+   memset(r, 0, sizeof(*r));
+
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+
+   if (0 > fd)
+      return -1;
+
+   if ((0 != fstat(fd, &st)) || (sizeof(r->header) > (size_t)st.st_size))
+   {
+      close(fd);
+      errno = EINVAL;
+      return -1;
+   }
+
+   r->size = st.st_size;
+   r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+
+   if (MAP_FAILED == r->map)
+      return -1;
+
+   /* Replays read the chunks of every sensor roughly in file order */
+   madvise((void *)r->map, r->size, MADV_SEQUENTIAL);
+
+   memcpy(&r->header, r->map, sizeof(r->header));
+
+   if ((MPU9250_REC_MAGIC != r->header.magic) || (MPU9250_REC_VERSION != r->header.version))
+   {
+      mpu9250RecRelease(r);
+      errno = EINVAL;
+      return -1;
+   }
+
+   if ((0 != r->header.indexOffset) &&
+       (r->header.indexOffset + (uint64_t)r->header.indexCount * sizeof(*r->index) <= r->size))
+   {
+      r->indexCount = r->header.indexCount;
+      r->index = malloc(r->indexCount * sizeof(*r->index) + 1);
+
+      if (NULL != r->index)
+         memcpy(r->index, r->map + r->header.indexOffset, r->indexCount * sizeof(*r->index));
+   }
+   else if (0 != mpu9250RecScan(r))
+   {
+      mpu9250RecRelease(r);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   if ((NULL == r->index) && (0 != r->indexCount))
+   {
+      mpu9250RecRelease(r);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   /* Chunks of a sensor are written in time order, split the index by sensor */
+   for (i = 0; i < r->indexCount; i++)
+   {
+      if (MPU9250_GROUP_MAX > r->index[i].sensor)
+         r->cursor[r->index[i].sensor].chunkCount++;
+   }
+
+   for (s = 0; s < MPU9250_GROUP_MAX; s++)
+   {
+      r->cursor[s].chunks = malloc(r->cursor[s].chunkCount * sizeof(unsigned int) + 1);
+
+      if (NULL == r->cursor[s].chunks)
+      {
+         mpu9250RecRelease(r);
+         errno = ENOMEM;
+         return -1;
+      }
+
+      r->cursor[s].chunkCount = 0;
+   }
+
+   for (i = 0; i < r->indexCount; i++)
+   {
+      s = r->index[i].sensor;
+
+      if (MPU9250_GROUP_MAX > s)
+         r->cursor[s].chunks[r->cursor[s].chunkCount++] = i;
+   }
+
+   return 0;
+}
+
+uint64_t mpu9250RecSpan(const MPU9250_RecReader_t *r, int64_t *first, int64_t *last)
+{
+   uint64_t samples = 0;
+   unsigned int i;
+
+   *first = 0;
+   *last = 0;
+
+   for (i = 0; i < r->indexCount; i++)
+   {
+      if ((0 == samples) || (r->index[i].first < *first))
+         *first = r->index[i].first;
+
+      if ((0 == samples) || (r->index[i].last > *last))
+         *last = r->index[i].last;
+
+      samples += r->index[i].count;
+   }
+
+   return samples;
+}
+
+void mpu9250RecSeek(MPU9250_RecReader_t *r, int64_t timestamp)
+{
+   MPU9250_RecCursor_t saved;
+   MPU9250_Sample_t sample;
+   unsigned int lo, hi, mid, s;
+
+   for (s = 0; s < MPU9250_GROUP_MAX; s++)
+   {
+      /* First chunk that ends at or after the time */
+      lo = 0;
+      hi = r->cursor[s].chunkCount;
+
+      while (lo < hi)
+      {
+         mid = lo + (hi - lo) / 2;
+
+         if (r->index[r->cursor[s].chunks[mid]].last < timestamp)
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+
+      r->cursor[s].next = lo;
+      r->cursor[s].left = 0;
+
+      if (1 != mpu9250RecNextChunk(r, s))
+         continue;
+
+      /* Skip the older samples of that chunk, keep the cursor on the first newer one */
+      while (0 < r->cursor[s].left)
+      {
+         saved = r->cursor[s];
+
+         if ((0 != mpu9250RecNextSample(r, s, &sample)) || (sample.timestamp >= timestamp))
+         {
+            r->cursor[s] = saved;
+            break;
+         }
+      }
+   }
+}
+
+int mpu9250RecRead(MPU9250_RecReader_t *r, unsigned int sensor, MPU9250_Sample_t *samples, unsigned int count)
+{
+   unsigned int stored = 0;
+   int rv;
+
+   if (MPU9250_GROUP_MAX <= sensor)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   while (stored < count)
+   {
+      if (0 == r->cursor[sensor].left)
+      {
+         rv = mpu9250RecNextChunk(r, sensor);
+
+         if (1 != rv)
+            return (0 == rv) ? (int)stored : -1;
+
+         continue;
+      }
+
+      if (0 != mpu9250RecNextSample(r, sensor, &samples[stored]))
+         return -1;
+
+      stored++;
+   }
+
+   return stored;
+}
+
+void mpu9250RecRelease(MPU9250_RecReader_t *r)
+{
+   unsigned int i;
+
+   for (i = 0; i < MPU9250_GROUP_MAX; i++)
+      free(r->cursor[i].chunks);
+
+   free(r->index);
+
+   if ((NULL != r->map) && (MAP_FAILED != r->map))
+      munmap((void *)r->map, r->size);
+
+   memset(r, 0, sizeof(*r));
+}
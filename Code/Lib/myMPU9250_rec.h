@@ -0,0 +1,251 @@
+#ifndef _myMPU9250_rec_H
+#define _myMPU9250_rec_H
+
+/* Binary recordings of MPU9250 samples.
+ *
+ * A recording is a header, a sequence of chunks and a time index. Every chunk holds
+ * consecutive samples of one sensor and describes itself, so the writer only appends
+ * and a reader seeks without decoding what comes before:
+ *
+ *    header | chunk | chunk | ... | index | (header rewritten with the index offset)
+ *
+ * MPU9250_REC_CODEC_DELTA stores every sample as zigzag varints: the second difference
+ * of the timestamp, which takes one or two bytes at a steady rate, the difference of
+ * every channel with the previous sample and the flags. A sensor at rest costs about
+ * 13 bytes per sample, against 32 of MPU9250_Sample_t and about 100 of the text the
+ * test program prints. MPU9250_REC_CODEC_RAW stores MPU9250_Sample_t as is, for the
+ * lowest CPU cost.
+ *
+ * The writer fills chunks in memory and hands them to write() in blocks of
+ * MPU9250_REC_BLOCK bytes, so the storage only sees large sequential writes. The
+ * reader maps the file and finds the chunk of a time with a binary search on the
+ * index of each sensor. A recording that was not closed has no index, the reader
+ * then rebuilds it from the chunk headers:
+ *
+ *    mpu9250RecCreate(&w, "run.rec", MPU9250_REC_CODEC_DELTA);
+ *    mpu9250RecSensor(&w, 0, &config, &scale, &calib);
+ *    while (run) { ioctl(fd, MPU9250_IOC_READ_BATCH, &batch); mpu9250RecWrite(&w, 0, samples, batch.count); }
+ *    mpu9250RecClose(&w);
+ *
+ *    mpu9250RecOpen(&r, "run.rec");
+ *    mpu9250RecSeek(&r, timestamp);
+ *    while (0 < (n = mpu9250RecRead(&r, 0, samples, 32))) ...
+ *    mpu9250RecRelease(&r);
+ *
+ * Integers are stored in the byte order of the host, the BeagleBone and x86 are both
+ * little-endian.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "myMPU9250_uapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Constants
+
+#define MPU9250_REC_MAGIC             0x5245394D    // "M9ER" in little-endian byte order
+#define MPU9250_REC_CHUNK_MAGIC       0x4B4E4843    // "CHNK"
+#define MPU9250_REC_VERSION           1
+
+/* Sample encodings of a chunk */
+#define MPU9250_REC_CODEC_RAW         0             // MPU9250_Sample_t as is
+#define MPU9250_REC_CODEC_DELTA       1             // Zigzag varints of differences
+
+/* Payload of a chunk, a chunk is closed before a sample could overflow it */
+#define MPU9250_REC_CHUNK_BYTES       65536
+
+/* Channels of a sample: accel x, y, z, gyro x, y, z, mag x, y, z and temp */
+#define MPU9250_REC_CHANNELS          10
+
+/* Bytes handed to each write() */
+#define MPU9250_REC_BLOCK             (1 << 20)
+
+// Types
+
+/* Sampling setup of a recorded sensor, enough to convert its samples offline */
+typedef struct
+{
+   MPU9250_Config_t config;           // From MPU9250_IOC_GET_CONFIG
+   MPU9250_Scale_t scale;             // From MPU9250_IOC_GET_SCALE
+   MPU9250_Calib_t calib;             // From MPU9250_IOC_GET_CALIB
+
+} MPU9250_RecSensor_t;
+
+/* File header */
+typedef struct
+{
+   uint32_t magic;                    // MPU9250_REC_MAGIC
+   uint32_t version;                  // MPU9250_REC_VERSION
+   uint32_t sensors;                  // Bit i set when sensor[i] is valid, i is the N of /dev/i2cMPU9250-N
+   uint32_t indexCount;               // Entries of the index
+   uint64_t indexOffset;              // File offset of the index, 0 until the recording is closed
+   MPU9250_RecSensor_t sensor[MPU9250_GROUP_MAX];
+
+} MPU9250_RecHeader_t;
+
+/* Chunk header, the payload follows */
+typedef struct
+{
+   uint32_t magic;                    // MPU9250_REC_CHUNK_MAGIC
+   uint16_t sensor;                   // Sensor of every sample of the chunk
+   uint16_t codec;                    // MPU9250_REC_CODEC_*
+   uint32_t count;                    // Samples
+   uint32_t size;                     // Payload bytes
+   int64_t first;                     // Timestamp of the first sample [ns]
+   int64_t last;                      // Timestamp of the last sample [ns]
+
+} MPU9250_RecChunk_t;
+
+/* Index entry, one per chunk in file order */
+typedef struct
+{
+   uint64_t offset;                   // File offset of the chunk header
+   int64_t first;                     // Timestamp of the first sample [ns]
+   int64_t last;                      // Timestamp of the last sample [ns]
+   uint32_t sensor;
+   uint32_t count;
+
+} MPU9250_RecIndex_t;
+
+/* Delta coder state of one sensor */
+typedef struct
+{
+   int64_t timestamp;                 // Previous timestamp [ns]
+   int64_t period;                    // Previous timestamp difference [ns]
+   int16_t channel[MPU9250_REC_CHANNELS];   // Previous counts
+
+} MPU9250_RecDelta_t;
+
+typedef struct
+{
+   int fd;
+   unsigned int codec;
+   MPU9250_RecHeader_t header;
+
+   uint8_t *block;                    // Bytes not written yet
+   size_t blockUsed;
+   uint64_t offset;                   // File offset of the block
+
+   MPU9250_RecIndex_t *index;
+   unsigned int indexCount;
+   unsigned int indexSize;
+
+   struct
+   {
+      MPU9250_RecChunk_t chunk;
+      MPU9250_RecDelta_t delta;
+      uint8_t *payload;               // MPU9250_REC_CHUNK_BYTES
+   } open[MPU9250_GROUP_MAX];         // Chunk being filled of every sensor
+
+   uint64_t samples;                  // Samples written
+   uint64_t bytes;                    // Bytes of the recording so far
+
+} MPU9250_RecWriter_t;
+
+/* Decoding position of one sensor */
+typedef struct
+{
+   unsigned int *chunks;              // Index entries of this sensor, in time order
+   unsigned int chunkCount;
+   unsigned int next;                 // Next of those chunks to decode
+   MPU9250_RecChunk_t chunk;          // Header of the chunk being decoded
+   const uint8_t *pos;                // Next sample in its payload
+   const uint8_t *end;                // End of its payload
+   unsigned int left;                 // Samples left in it, 0 when none is being decoded
+   MPU9250_RecDelta_t delta;
+
+} MPU9250_RecCursor_t;
+
+typedef struct
+{
+   const uint8_t *map;
+   size_t size;
+   MPU9250_RecHeader_t header;
+
+   MPU9250_RecIndex_t *index;         // Chunks of every sensor, in file order
+   unsigned int indexCount;
+
+   MPU9250_RecCursor_t cursor[MPU9250_GROUP_MAX];
+
+} MPU9250_RecReader_t;
+
+// Public functions
+
+/** @brief Creates a recording, replacing the file
+ *  @param w The writer
+ *  @param path The file
+ *  @param codec MPU9250_REC_CODEC_DELTA or MPU9250_REC_CODEC_RAW
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250RecCreate(MPU9250_RecWriter_t *w, const char *path, unsigned int codec);
+
+/** @brief Describes a sensor, before its first sample
+ *  @param w The writer
+ *  @param sensor The N of /dev/i2cMPU9250-N
+ *  @param config Its sampling configuration
+ *  @param scale Its scale factors
+ *  @param calib Its calibration, NULL when unknown
+ *  @return 0 on success or -1 if the sensor is out of range
+ */
+int mpu9250RecSensor(MPU9250_RecWriter_t *w, unsigned int sensor, const MPU9250_Config_t *config,
+                     const MPU9250_Scale_t *scale, const MPU9250_Calib_t *calib);
+
+/** @brief Appends samples of a sensor, as returned by MPU9250_IOC_READ_BATCH
+ *  Samples are only buffered, write() is called once per MPU9250_REC_BLOCK bytes.
+ *  @param w The writer
+ *  @param sensor The sensor, described by mpu9250RecSensor()
+ *  @param samples The samples, in time order
+ *  @param count Number of samples
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250RecWrite(MPU9250_RecWriter_t *w, unsigned int sensor, const MPU9250_Sample_t *samples, unsigned int count);
+
+/** @brief Writes the pending chunks, the index and the final header, then closes the file
+ *  @param w The writer
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250RecClose(MPU9250_RecWriter_t *w);
+
+/** @brief Maps a recording and loads its index
+ *  @param r The reader, positioned at the start of every sensor
+ *  @param path The file
+ *  @return 0 on success or -1 on error, see errno
+ */
+int mpu9250RecOpen(MPU9250_RecReader_t *r, const char *path);
+
+/** @brief Time span of a recording
+ *  @param r The reader
+ *  @param first First timestamp of any sensor [ns]
+ *  @param last Last timestamp of any sensor [ns]
+ *  @return Samples in the recording
+ */
+uint64_t mpu9250RecSpan(const MPU9250_RecReader_t *r, int64_t *first, int64_t *last);
+
+/** @brief Positions every sensor at its first sample not older than a time
+ *  A binary search on the index finds the chunk, only that chunk is decoded.
+ *  @param r The reader
+ *  @param timestamp The time [ns]
+ */
+void mpu9250RecSeek(MPU9250_RecReader_t *r, int64_t timestamp);
+
+/** @brief Decodes the next samples of a sensor
+ *  @param r The reader
+ *  @param sensor The sensor
+ *  @param samples The samples
+ *  @param count Maximum number of samples
+ *  @return Samples stored, 0 at the end of the sensor or -1 on a damaged chunk
+ */
+int mpu9250RecRead(MPU9250_RecReader_t *r, unsigned int sensor, MPU9250_Sample_t *samples, unsigned int count);
+
+/** @brief Unmaps the recording
+ *  @param r The reader
+ */
+void mpu9250RecRelease(MPU9250_RecReader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,960 @@
+/**
+ * @file   benchMyMPU9250.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  End-to-end acquisition benchmark of the myMPU9250.c LKM.
+ *
+ * Reads the device for a fixed time with every access mode and prints one JSON
+ * object per mode: sustained samples/s, samples lost, syscalls, bus transfers and
+ * process CPU time per sample, and the p50, p99 and p99.9 latency of a log-linear
+ * histogram. With timestamped samples (batch, mmap and iio) the latency is the age
+ * of each sample when the benchmark gets it, otherwise it is the time the read call
+ * takes once data is ready. The resume mode lets the sensor fall asleep before every
+ * sample and measures open() to first sample, the cost an intermittent reader pays.
+ *
+ * Register modes need the LKM loaded with streaming=0, FIFO modes with streaming=1,
+ * iio needs a trigger, e.g. the data-ready one or an iio-trig-hrtimer instance.
+ * Modes the running configuration does not support are reported as unavailable.
+ * The simulated device of Code/Emulator runs the same code without the board.
+ * Run it as "./benchio [-d device] [-t seconds] [-H] [mode...]", the modes are
+ * single, burst, stream, batch, mmap, iio and resume, all of them by default; -H adds the
+ * whole histogram to the output.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include "myMPU9250.h"
+#include "myMPU9250_uapi.h"
+
+// Constants
+#define DEVICE_UNDER_TEST   "/dev/i2cMPU9250-0" ///< Device under test
+#define MODULE_PARAMETERS   "/sys/module/myMPU9250/parameters"  ///< Configuration of the loaded LKM
+#define IIO_DEVICES         "/sys/bus/iio/devices"              ///< IIO devices, the LKM registers "mpu9250"
+#define IIO_NAME            "mpu9250"           ///< Name of the IIO front-end
+#define SECONDS_DEFAULT     5.0                 ///< Time per mode
+#define POLL_TIMEOUT_MS     1000                ///< A mode stops when no data arrives in time
+#define AUTOSUSPEND_MS      2000                ///< Autosuspend delay when the LKM does not tell
+#define SLEEP_MARGIN_MS     200                 ///< Extra idle time so the sensor is surely asleep
+#define BATCH_LENGTH        64                  ///< Samples or frames per read call
+#define FRAME_SIZE_MAX      (MPU9250_FIFO_FRAME_SIZE + MPU9250_FIFO_MAG_SIZE)  ///< Largest frame of any layout
+#define SCAN_SIZE_MAX       32                  ///< Largest IIO scan, channels and timestamp
+#define HIST_SUB_BITS       4                   ///< 16 buckets per power of two, 6 % resolution
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// Types
+
+/* Log-linear histogram of latencies [ns] */
+typedef struct
+{
+   uint64_t count[HIST_BUCKETS];
+   uint64_t n;
+   uint64_t max;
+
+} Histogram_t;
+
+/* Outcome of one mode */
+typedef struct
+{
+   uint64_t samples;                  // Samples read
+   uint64_t syscalls;                 // Calls into the driver, poll() included
+   int64_t dropped;                   // Samples lost, -1 when the mode cannot tell
+   const char *latencyKind;           // What the latency measures, the read call time when NULL
+   double seconds;                    // Wall time
+   double cpuSeconds;                 // User and system time of this process
+   int hasStats;                      // before and after are valid
+   MPU9250_Stats_t before;
+   MPU9250_Stats_t after;
+   Histogram_t latency;
+   const char *error;                 // Why the mode is unavailable, NULL when it ran
+
+} BenchResult_t;
+
+typedef void (*BenchMode_t)(BenchResult_t *r);
+
+// Variables
+static const char *         g_device = DEVICE_UNDER_TEST;       ///< Character device
+static double               g_seconds = SECONDS_DEFAULT;        ///< Time per mode
+static int                  g_printHistogram = 0;               ///< Print every histogram bucket
+static clockid_t            g_sampleClock = CLOCK_MONOTONIC;    ///< Clock of the sample timestamps
+static int                  g_streaming = -1;                   ///< LKM streaming parameter, -1 unknown
+static BenchResult_t        g_result;                           ///< Result of the mode running
+
+// Private functions
+
+/** @brief Time on a clock [ns] */
+static int64_t now_ns(clockid_t clock)
+{
+   struct timespec ts;
+
+   clock_gettime(clock, &ts);
+   return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @brief User and system time of this process [s] */
+static double cpu_seconds(void)
+{
+   struct rusage ru;
+
+   getrusage(RUSAGE_SELF, &ru);
+
+   return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+}
+
+static unsigned int hist_index(uint64_t v)
+{
+   unsigned int e;
+
+   if (HIST_SUB > v)
+      return (unsigned int)v;
+
+   e = 63 - __builtin_clzll(v);
+
+   return (e - HIST_SUB_BITS + 1) * HIST_SUB + (unsigned int)((v >> (e - HIST_SUB_BITS)) - HIST_SUB);
+}
+
+/** @brief Smallest value of a bucket */
+static uint64_t hist_lower(unsigned int i)
+{
+   if (HIST_SUB > i)
+      return i;
+
+   return (uint64_t)(HIST_SUB + i % HIST_SUB) << (i / HIST_SUB - 1);
+}
+
+static void hist_add(Histogram_t *h, int64_t v)
+{
+   /* A timestamp slightly ahead of this clock reads as no age at all */
+   uint64_t u = (0 > v) ? 0 : (uint64_t)v;
+
+   h->count[hist_index(u)]++;
+   h->n++;
+
+   if (u > h->max)
+      h->max = u;
+}
+
+/** @brief Upper bound of the bucket holding a percentile [ns] */
+static uint64_t hist_percentile(const Histogram_t *h, double p)
+{
+   uint64_t target = (uint64_t)(p * h->n + 0.999999);
+   uint64_t sum = 0;
+   uint64_t upper;
+   unsigned int i;
+
+   for (i = 0; i < HIST_BUCKETS; i++)
+   {
+      sum += h->count[i];
+
+      if ((0 < h->count[i]) && (sum >= target))
+      {
+         upper = (i + 1 < HIST_BUCKETS) ? hist_lower(i + 1) - 1 : h->max;
+         return (upper < h->max) ? upper : h->max;
+      }
+   }
+
+   return h->max;
+}
+
+/** @brief Reads a small sysfs attribute
+ *  @return Bytes read without the trailing newline, or -1
+ */
+static int read_attribute(const char *path, char *value, size_t size)
+{
+   int fd = open(path, O_RDONLY);
+   ssize_t n;
+
+   if (0 > fd)
+      return -1;
+
+   n = read(fd, value, size - 1);
+   close(fd);
+
+   if (0 > n)
+      return -1;
+
+   while ((0 < n) && ('\n' == value[n - 1]))
+      n--;
+
+   value[n] = '\0';
+
+   return (int)n;
+}
+
+static int write_attribute(const char *path, const char *value)
+{
+   int fd = open(path, O_WRONLY);
+   ssize_t n;
+
+   if (0 > fd)
+      return -1;
+
+   n = write(fd, value, strlen(value));
+   close(fd);
+
+   return ((ssize_t)strlen(value) == n) ? 0 : -1;
+}
+
+/** @brief Learns the streaming mode and the timestamp clock of the loaded LKM */
+static void load_parameters(void)
+{
+   char value[16];
+
+   if (0 < read_attribute(MODULE_PARAMETERS "/streaming", value, sizeof(value)))
+      g_streaming = ('Y' == value[0]) || ('1' == value[0]);
+
+   if (0 < read_attribute(MODULE_PARAMETERS "/timestamp_clock", value, sizeof(value)))
+      g_sampleClock = (clockid_t)atoi(value);
+}
+
+/** @brief Opens the device and takes the counters at the start of a mode
+ *  @return The file descriptor or -1, with r->error set
+ */
+static int bench_open(BenchResult_t *r, int flags)
+{
+   int fd = open(g_device, flags);
+
+   if (0 > fd)
+   {
+      r->error = "cannot open the device";
+      return -1;
+   }
+
+   r->hasStats = (0 == ioctl(fd, MPU9250_IOC_GET_STATS, &r->before));
+
+   return fd;
+}
+
+static void bench_start(BenchResult_t *r)
+{
+   r->seconds = -now_ns(CLOCK_MONOTONIC) * 1e-9;
+   r->cpuSeconds = -cpu_seconds();
+}
+
+static int bench_running(const BenchResult_t *r)
+{
+   return (r->seconds + now_ns(CLOCK_MONOTONIC) * 1e-9) < g_seconds;
+}
+
+static void bench_stop(BenchResult_t *r, int fd)
+{
+   r->seconds += now_ns(CLOCK_MONOTONIC) * 1e-9;
+   r->cpuSeconds += cpu_seconds();
+
+   if (r->hasStats)
+      r->hasStats = (0 == ioctl(fd, MPU9250_IOC_GET_STATS, &r->after));
+}
+
+/** @brief Frame layout of the current configuration */
+static unsigned int frame_layout(int fd, unsigned int *fifoEnable)
+{
+   MPU9250_Layout_t layout;
+
+   if (0 != ioctl(fd, MPU9250_IOC_GET_LAYOUT, &layout))
+   {
+      layout.fifoEnable = MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO;
+      layout.frameSize = MPU9250_FIFO_FRAME_SIZE;
+   }
+
+   if (NULL != fifoEnable)
+      *fifoEnable = layout.fifoEnable;
+
+   return layout.frameSize;
+}
+
+/** @brief One pread() per sensor block, each on its own descriptor
+ *  With the data-ready interrupt every descriptor waits for a sample newer than the
+ *  one it read last, as independent readers of each sensor would.
+ */
+static void bench_single(BenchResult_t *r)
+{
+   static const struct { unsigned char reg; unsigned char len; } blocks[] =
+   {
+      { MPU9250_ACCEL_OUT, 6 },
+      { MPU9250_TEMP_OUT, 2 },
+      { MPU9250_GYRO_OUT, 6 },
+      { MPU9250_EXT_SENS_DATA_00, MPU9250_FIFO_MAG_SIZE },
+   };
+   int fd[4] = { -1, -1, -1, -1 };
+   unsigned int fifoEnable, count, i;
+   unsigned char rx[FRAME_SIZE_MAX];
+   int64_t t;
+
+   if (1 == g_streaming)
+   {
+      r->error = "register modes need streaming=0";
+      return;
+   }
+
+   fd[0] = bench_open(r, O_RDONLY);
+
+   if (0 > fd[0])
+      return;
+
+   frame_layout(fd[0], &fifoEnable);
+   count = (fifoEnable & MPU9250_FIFO_MAG) ? 4 : 3;
+
+   for (i = 1; i < count; i++)
+      fd[i] = open(g_device, O_RDONLY);
+
+   bench_start(r);
+
+   while (bench_running(r))
+   {
+      for (i = 0; i < count; i++)
+      {
+         t = now_ns(CLOCK_MONOTONIC);
+
+         if (blocks[i].len != pread(fd[i], rx, blocks[i].len, blocks[i].reg))
+         {
+            r->error = "read failed";
+            break;
+         }
+
+         hist_add(&r->latency, now_ns(CLOCK_MONOTONIC) - t);
+         r->syscalls++;
+      }
+
+      if (NULL != r->error)
+         break;
+
+      r->samples++;
+   }
+
+   bench_stop(r, fd[0]);
+
+   for (i = 0; i < count; i++)
+      close(fd[i]);
+}
+
+/** @brief One pread() of the whole frame from ACCEL_OUT, a single bus transaction */
+static void bench_burst(BenchResult_t *r)
+{
+   unsigned char rx[FRAME_SIZE_MAX];
+   unsigned int frameSize;
+   int64_t t;
+   int fd;
+
+   if (1 == g_streaming)
+   {
+      r->error = "register modes need streaming=0";
+      return;
+   }
+
+   fd = bench_open(r, O_RDONLY);
+
+   if (0 > fd)
+      return;
+
+   frameSize = frame_layout(fd, NULL);
+
+   bench_start(r);
+
+   while (bench_running(r))
+   {
+      t = now_ns(CLOCK_MONOTONIC);
+
+      if ((ssize_t)frameSize != pread(fd, rx, frameSize, MPU9250_ACCEL_OUT))
+      {
+         r->error = "read failed";
+         break;
+      }
+
+      hist_add(&r->latency, now_ns(CLOCK_MONOTONIC) - t);
+      r->syscalls++;
+      r->samples++;
+   }
+
+   bench_stop(r, fd);
+   close(fd);
+}
+
+/** @brief poll() then read() of FIFO frames */
+static void bench_stream(BenchResult_t *r)
+{
+   unsigned char rx[BATCH_LENGTH * FRAME_SIZE_MAX];
+   unsigned int frameSize;
+   struct pollfd pfd;
+   ssize_t n;
+   int64_t t;
+   int fd;
+
+   if (0 == g_streaming)
+   {
+      r->error = "FIFO modes need streaming=1";
+      return;
+   }
+
+   fd = bench_open(r, O_RDONLY | O_NONBLOCK);
+
+   if (0 > fd)
+      return;
+
+   frameSize = frame_layout(fd, NULL);
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+
+   bench_start(r);
+
+   while (bench_running(r))
+   {
+      r->syscalls++;
+
+      if (0 >= poll(&pfd, 1, POLL_TIMEOUT_MS))
+      {
+         r->error = "no data";
+         break;
+      }
+
+      t = now_ns(CLOCK_MONOTONIC);
+      n = read(fd, rx, BATCH_LENGTH * frameSize);
+      r->syscalls++;
+
+      if (0 > n)
+      {
+         if (EAGAIN == errno)
+            continue;
+
+         r->error = "read failed";
+         break;
+      }
+
+      hist_add(&r->latency, now_ns(CLOCK_MONOTONIC) - t);
+      r->samples += n / frameSize;
+   }
+
+   bench_stop(r, fd);
+   close(fd);
+
+   /* Frames carry no loss information, the reader overruns do */
+   if (r->hasStats)
+      r->dropped = r->after.overruns - r->before.overruns;
+}
+
+/** @brief Blocking MPU9250_IOC_READ_BATCH of typed samples */
+static void bench_batch(BenchResult_t *r)
+{
+   MPU9250_Sample_t samples[BATCH_LENGTH];
+   MPU9250_Batch_t batch;
+   unsigned int i;
+   int64_t t;
+   int fd;
+
+   if (0 == g_streaming)
+   {
+      r->error = "FIFO modes need streaming=1";
+      return;
+   }
+
+   fd = bench_open(r, O_RDONLY);
+
+   if (0 > fd)
+      return;
+
+   r->latencyKind = "sample_age";
+   r->dropped = 0;
+
+   bench_start(r);
+
+   while (bench_running(r))
+   {
+      batch.samples = (unsigned long)samples;
+      batch.count = BATCH_LENGTH;
+
+      if (0 != ioctl(fd, MPU9250_IOC_READ_BATCH, &batch))
+      {
+         r->error = "batch read failed";
+         break;
+      }
+
+      t = now_ns(g_sampleClock);
+      r->syscalls++;
+
+      for (i = 0; i < batch.count; i++)
+         hist_add(&r->latency, t - samples[i].timestamp);
+
+      r->samples += batch.count;
+      r->dropped += batch.overruns;
+   }
+
+   bench_stop(r, fd);
+   close(fd);
+}
+
+/** @brief Shared sample ring, one poll() and one tail update per wake-up and no copy through the kernel */
+static void bench_mmap(BenchResult_t *r)
+{
+   const MPU9250_Sample_t *records;
+   MPU9250_Ring_t *ring;
+   MPU9250_Sample_t sample;
+   struct pollfd pfd;
+   unsigned int tail, head, size;
+   int64_t t;
+   int fd;
+
+   if (0 == g_streaming)
+   {
+      r->error = "FIFO modes need streaming=1";
+      return;
+   }
+
+   fd = bench_open(r, O_RDONLY);
+
+   if (0 > fd)
+      return;
+
+   /* Map the header page first to learn the ring size */
+   ring = mmap(NULL, sizeof(MPU9250_Ring_t), PROT_READ, MAP_SHARED, fd, 0);
+
+   if (MAP_FAILED == ring)
+   {
+      r->error = "mmap failed";
+      close(fd);
+      return;
+   }
+
+   size = ring->mapSize;
+   munmap(ring, sizeof(MPU9250_Ring_t));
+   ring = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+   if ((MAP_FAILED == ring) || (MPU9250_RING_MAGIC != ring->magic) || (MPU9250_RING_VERSION != ring->version))
+   {
+      r->error = "unexpected ring";
+      close(fd);
+      return;
+   }
+
+   records = (const MPU9250_Sample_t *)((const char *)ring + ring->dataOffset);
+   tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+   ioctl(fd, MPU9250_IOC_SET_TAIL, &tail);
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+   r->latencyKind = "sample_age";
+   r->dropped = 0;
+
+   bench_start(r);
+
+   while (bench_running(r))
+   {
+      r->syscalls++;
+
+      if (0 >= poll(&pfd, 1, POLL_TIMEOUT_MS))
+      {
+         r->error = "no data";
+         break;
+      }
+
+      head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+      t = now_ns(g_sampleClock);
+
+      if (head - tail > ring->capacity)
+      {
+         r->dropped += head - tail - ring->capacity;
+         tail = head - ring->capacity;
+      }
+
+      for (; tail != head; tail++)
+      {
+         sample = records[tail & (ring->capacity - 1)];
+
+         /* The copy was overwritten meanwhile */
+         if (__atomic_load_n(&ring->reserve, __ATOMIC_ACQUIRE) - tail > ring->capacity)
+         {
+            r->dropped++;
+            continue;
+         }
+
+         hist_add(&r->latency, t - sample.timestamp);
+         r->samples++;
+      }
+
+      /* poll() stays readable until the driver learns the new tail */
+      r->syscalls++;
+      ioctl(fd, MPU9250_IOC_SET_TAIL, &tail);
+   }
+
+   bench_stop(r, fd);
+   munmap(ring, size);
+   close(fd);
+}
+
+/** @brief Finds the IIO front-end
+ *  @param path Set to its sysfs directory
+ *  @return The IIO device number or -1
+ */
+static int iio_find(char *path, size_t size)
+{
+   DIR *dir = opendir(IIO_DEVICES);
+   struct dirent *entry;
+   char name[64];
+   int id = -1;
+
+   if (NULL == dir)
+      return -1;
+
+   while ((0 > id) && (NULL != (entry = readdir(dir))))
+   {
+      if (0 != strncmp(entry->d_name, "iio:device", 10))
+         continue;
+
+      snprintf(path, size, IIO_DEVICES "/%s/name", entry->d_name);
+
+      if ((0 < read_attribute(path, name, sizeof(name))) && (0 == strcmp(name, IIO_NAME)))
+      {
+         snprintf(path, size, IIO_DEVICES "/%s", entry->d_name);
+         id = atoi(entry->d_name + 10);
+      }
+   }
+
+   closedir(dir);
+
+   return id;
+}
+
+/** @brief Enables every scan element
+ *  @return Bytes per scan, 16 bit channels then the 8 byte aligned timestamp, or -1
+ */
+static int iio_enable_scan(const char *device)
+{
+   char path[640];
+   DIR *dir;
+   struct dirent *entry;
+   int channels = 0;
+
+   snprintf(path, sizeof(path), "%s/scan_elements", device);
+   dir = opendir(path);
+
+   if (NULL == dir)
+      return -1;
+
+   while (NULL != (entry = readdir(dir)))
+   {
+      size_t len = strlen(entry->d_name);
+
+      if ((3 > len) || (0 != strcmp(entry->d_name + len - 3, "_en")))
+         continue;
+
+      snprintf(path, sizeof(path), "%s/scan_elements/%s", device, entry->d_name);
+
+      if (0 != write_attribute(path, "1"))
+         channels = -1000;
+
+      if (NULL == strstr(entry->d_name, "timestamp"))
+         channels++;
+   }
+
+   closedir(dir);
+
+   return (0 > channels) ? -1 : ((2 * channels + 7) & ~7) + 8;
+}
+
+/** @brief IIO buffer of /dev/iio:deviceN, timestamps taken on the monotonic clock */
+static void bench_iio(BenchResult_t *r)
+{
+   unsigned char rx[BATCH_LENGTH * SCAN_SIZE_MAX];
+   char device[512], path[640], node[32], value[64];
+   int64_t timestamp, t;
+   struct pollfd pfd;
+   int id, scanSize, fd, stats;
+   ssize_t n, i;
+
+   id = iio_find(device, sizeof(device));
+
+   if (0 > id)
+   {
+      r->error = "no IIO device";
+      return;
+   }
+
+   snprintf(path, sizeof(path), "%s/trigger/current_trigger", device);
+
+   if (0 >= read_attribute(path, value, sizeof(value)))
+   {
+      r->error = "no IIO trigger selected";
+      return;
+   }
+
+   snprintf(path, sizeof(path), "%s/current_timestamp_clock", device);
+   write_attribute(path, "monotonic\n");
+
+   scanSize = iio_enable_scan(device);
+
+   if ((0 > scanSize) || (SCAN_SIZE_MAX < scanSize))
+   {
+      r->error = "cannot enable the scan elements";
+      return;
+   }
+
+   snprintf(path, sizeof(path), "%s/buffer/enable", device);
+
+   if (0 != write_attribute(path, "1"))
+   {
+      r->error = "cannot enable the IIO buffer";
+      return;
+   }
+
+   snprintf(node, sizeof(node), "/dev/iio:device%d", id);
+   fd = open(node, O_RDONLY | O_NONBLOCK);
+
+   if (0 > fd)
+   {
+      r->error = "cannot open the IIO device";
+      write_attribute(path, "0");
+      return;
+   }
+
+   /* Bus counters come from the character device */
+   stats = bench_open(r, O_RDONLY);
+   r->error = NULL;
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+   r->latencyKind = "sample_age";
+
+   bench_start(r);
+
+   while (bench_running(r))
+   {
+      r->syscalls++;
+
+      if (0 >= poll(&pfd, 1, POLL_TIMEOUT_MS))
+      {
+         r->error = "no data";
+         break;
+      }
+
+      n = read(fd, rx, sizeof(rx));
+      t = now_ns(CLOCK_MONOTONIC);
+      r->syscalls++;
+
+      if (0 > n)
+      {
+         if (EAGAIN == errno)
+            continue;
+
+         r->error = "read failed";
+         break;
+      }
+
+      for (i = 0; i + scanSize <= n; i += scanSize)
+      {
+         memcpy(&timestamp, rx + i + scanSize - 8, sizeof(timestamp));
+         hist_add(&r->latency, t - timestamp);
+         r->samples++;
+      }
+   }
+
+   bench_stop(r, stats);
+
+   close(fd);
+   write_attribute(path, "0");
+
+   if (0 <= stats)
+      close(stats);
+}
+
+/** @brief Open to first sample of an intermittent reader
+ *  Before every sample the device stays closed for longer than the autosuspend delay,
+ *  so each open() wakes the sensor up. Wall time includes those idle periods.
+ */
+static void bench_resume(BenchResult_t *r)
+{
+   unsigned char rx[BATCH_LENGTH * FRAME_SIZE_MAX];
+   unsigned int frameSize;
+   struct pollfd pfd;
+   char value[16];
+   int delayMs = AUTOSUSPEND_MS;
+   ssize_t n;
+   int64_t t;
+   int fd;
+
+   if (0 < read_attribute(MODULE_PARAMETERS "/autosuspend_ms", value, sizeof(value)))
+      delayMs = atoi(value);
+
+   if (0 > delayMs)
+   {
+      r->error = "autosuspend disabled";
+      return;
+   }
+
+   fd = bench_open(r, O_RDONLY);
+
+   if (0 > fd)
+      return;
+
+   frameSize = frame_layout(fd, NULL);
+   close(fd);
+
+   r->latencyKind = "open_to_sample";
+
+   bench_start(r);
+
+   do
+   {
+      usleep((delayMs + SLEEP_MARGIN_MS) * 1000);
+
+      t = now_ns(CLOCK_MONOTONIC);
+      fd = open(g_device, O_RDONLY);
+      r->syscalls++;
+
+      if (0 > fd)
+      {
+         r->error = "cannot open the device";
+         break;
+      }
+
+      /* A register read right after open() already returns a sample taken after the wake-up */
+      if (1 == g_streaming)
+      {
+         pfd.fd = fd;
+         pfd.events = POLLIN;
+         n = (0 < poll(&pfd, 1, POLL_TIMEOUT_MS)) ? read(fd, rx, BATCH_LENGTH * frameSize) : -1;
+         r->syscalls += 2;
+      }
+      else
+      {
+         n = pread(fd, rx, frameSize, MPU9250_ACCEL_OUT);
+         r->syscalls++;
+      }
+
+      if (0 >= n)
+      {
+         r->error = "no data";
+         close(fd);
+         break;
+      }
+
+      hist_add(&r->latency, now_ns(CLOCK_MONOTONIC) - t);
+      r->samples++;
+      close(fd);
+
+   } while (bench_running(r));
+
+   /* Counters after the last wake-up, this open does not sleep first */
+   fd = open(g_device, O_RDONLY);
+   bench_stop(r, fd);
+
+   if (0 <= fd)
+      close(fd);
+}
+
+/** @brief Prints a result as one JSON object */
+static void print_result(const char *mode, const BenchResult_t *r)
+{
+   const double n = (0 < r->samples) ? (double)r->samples : 1.0;
+   unsigned int i;
+   int first = 1;
+
+   printf("{\"mode\":\"%s\",\"available\":%s", mode, (0 == r->samples) ? "false" : "true");
+
+   if (0 == r->samples)
+   {
+      printf(",\"error\":\"%s\"}\n", (NULL != r->error) ? r->error : "no samples");
+      return;
+   }
+
+   printf(",\"seconds\":%.3f,\"samples\":%llu,\"samples_per_s\":%.1f",
+          r->seconds, (unsigned long long)r->samples, r->samples / r->seconds);
+
+   if (0 <= r->dropped)
+      printf(",\"dropped\":%lld", (long long)r->dropped);
+   else
+      printf(",\"dropped\":null");
+
+   printf(",\"syscalls_per_sample\":%.3f,\"cpu_us_per_sample\":%.3f", r->syscalls / n, r->cpuSeconds * 1e6 / n);
+
+   if (r->hasStats)
+   {
+      printf(",\"bus_per_sample\":%.3f,\"bus_bytes_per_sample\":%.1f,\"fifo_overflows\":%llu",
+             (r->after.busTransfers - r->before.busTransfers) / n, (r->after.busBytes - r->before.busBytes) / n,
+             (unsigned long long)(r->after.fifoOverflows - r->before.fifoOverflows));
+   }
+   else
+   {
+      printf(",\"bus_per_sample\":null,\"bus_bytes_per_sample\":null,\"fifo_overflows\":null");
+   }
+
+   printf(",\"latency\":\"%s\",\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+          (NULL != r->latencyKind) ? r->latencyKind : "read_call",
+          hist_percentile(&r->latency, 0.5) * 1e-3, hist_percentile(&r->latency, 0.99) * 1e-3,
+          hist_percentile(&r->latency, 0.999) * 1e-3, r->latency.max * 1e-3);
+
+   if (g_printHistogram)
+   {
+      /* Non empty buckets as [lower bound, count] */
+      printf(",\"histogram_us\":[");
+
+      for (i = 0; i < HIST_BUCKETS; i++)
+      {
+         if (0 == r->latency.count[i])
+            continue;
+
+         printf("%s[%.3f,%llu]", first ? "" : ",", hist_lower(i) * 1e-3, (unsigned long long)r->latency.count[i]);
+         first = 0;
+      }
+
+      printf("]");
+   }
+
+   printf(",\"error\":%s%s%s}\n", (NULL != r->error) ? "\"" : "", (NULL != r->error) ? r->error : "null", (NULL != r->error) ? "\"" : "");
+}
+
+int main(int argc, char *argv[])
+{
+   static const struct { const char *name; BenchMode_t run; } modes[] =
+   {
+      { "single", bench_single },
+      { "burst",  bench_burst },
+      { "stream", bench_stream },
+      { "batch",  bench_batch },
+      { "mmap",   bench_mmap },
+      { "iio",    bench_iio },
+      { "resume", bench_resume },
+   };
+   unsigned int i;
+   int opt, selected, all;
+
+   while (-1 != (opt = getopt(argc, argv, "d:t:H")))
+   {
+      switch (opt)
+      {
+         case 'd': g_device = optarg; break;
+         case 't': g_seconds = atof(optarg); break;
+         case 'H': g_printHistogram = 1; break;
+         default:
+            fprintf(stderr, "Usage: %s [-d device] [-t seconds] [-H] [single|burst|stream|batch|mmap|iio|resume...]\n", argv[0]);
+            return EINVAL;
+      }
+   }
+
+   load_parameters();
+   all = (optind >= argc);
+
+   for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+   {
+      selected = all;
+
+      for (opt = optind; opt < argc; opt++)
+         selected |= (0 == strcmp(argv[opt], modes[i].name));
+
+      if (!selected)
+         continue;
+
+      memset(&g_result, 0, sizeof(g_result));
+      g_result.dropped = -1;
+
+      modes[i].run(&g_result);
+      print_result(modes[i].name, &g_result);
+      fflush(stdout);
+   }
+
+   return 0;
+}
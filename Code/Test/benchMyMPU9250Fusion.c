@@ -0,0 +1,170 @@
+/**
+ * @file   benchMyMPU9250Fusion.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Cost per sample of the orientation fusion backends of myMPU9250_fusion.c.
+ *
+ * Runs every backend over the same synthetic motion (a slow rotation with sensor
+ * noise, 1 kHz) and prints the time per sample and the final attitude. No device
+ * is needed, so it can be run on the BeagleBone and on the build host alike.
+ * Run it as "./bench [samples]".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "myMPU9250_fusion.h"
+
+// Constants
+#define SAMPLE_RATE_HZ      1000.0f             ///< Rate of the synthetic samples
+#define SAMPLES_DEFAULT     100000              ///< Samples per backend
+#define BATCH_LENGTH        256                 ///< Samples per update call, as a reader would get them
+#define ROUNDS              3                   ///< Best of, against scheduling noise
+
+// Variables
+static float     g_in[9][BATCH_LENGTH];         ///< gyro, accel and mag [rad/s, m/s2, uT]
+static int32_t   g_inFixed[9][BATCH_LENGTH];    ///< Same in Q16.16
+static uint32_t  g_seed = 1;                    ///< Noise generator state
+
+// Private functions
+/** @brief Uniform noise in [-1, 1), deterministic across runs */
+static float noise(void)
+{
+   g_seed = g_seed * 1664525u + 1013904223u;
+   return (float)(int32_t)g_seed / 2147483648.0f;
+}
+
+/** @brief Fills a batch with a rotation about z and a slower one about x, seen from the sensor
+ *  @param first Index of the first sample of the batch
+ */
+static void make_batch(unsigned int first)
+{
+   static const float field[3] = { 20.0f, 0.0f, -40.0f };     ///< Earth field [uT]
+   const float wz = 0.5f, wx = 0.2f;                          ///< Rotation rates [rad/s]
+   float t, cz, sz, cx, sx, e[3];
+   unsigned int i, k;
+
+   for (i = 0; i < BATCH_LENGTH; i++)
+   {
+      t = (first + i) / SAMPLE_RATE_HZ;
+      cz = cosf(wz * t); sz = sinf(wz * t);
+      cx = cosf(wx * t); sx = sinf(wx * t);
+
+      g_in[0][i] = wx + 0.01f * noise();
+      g_in[1][i] = 0.01f * noise();
+      g_in[2][i] = wz + 0.01f * noise();
+
+      /* Earth vectors into the sensor frame, transpose of Rz * Rx */
+      g_in[3][i] = 9.81f * (sx * sz) + 0.05f * noise();
+      g_in[4][i] = 9.81f * (sx * cz) + 0.05f * noise();
+      g_in[5][i] = 9.81f * cx + 0.05f * noise();
+
+      e[0] = cz * field[0] + sz * field[1];
+      e[1] = -sz * field[0] + cz * field[1];
+      e[2] = field[2];
+      g_in[6][i] = e[0] + 0.3f * noise();
+      g_in[7][i] = cx * e[1] + sx * e[2] + 0.3f * noise();
+      g_in[8][i] = -sx * e[1] + cx * e[2] + 0.3f * noise();
+
+      for (k = 0; k < 9; k++)
+         g_inFixed[k][i] = (int32_t)lrintf(g_in[k][i] * (1 << MPU9250_CONV_Q));
+   }
+}
+
+/** @brief Monotonic time [ns] */
+static double now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** @brief Runs one backend and prints its cost
+ *  @param name Backend name
+ *  @param algorithm Madgwick or Mahony
+ *  @param backend 0 float, 1 four lanes, 2 fixed point
+ *  @param mag Nonzero for 9 axes
+ *  @param samples Samples per sensor
+ */
+static void bench(const char *name, MPU9250_FusionAlgorithm_t algorithm, int backend, int mag, unsigned int samples)
+{
+   MPU9250_ConvFloat_t in = {
+                              .gyro  = { g_in[0], g_in[1], g_in[2] },
+                              .accel = { g_in[3], g_in[4], g_in[5] },
+                              .mag   = { mag ? g_in[6] : NULL, mag ? g_in[7] : NULL, mag ? g_in[8] : NULL },
+                            };
+   MPU9250_ConvFixed_t inFixed = {
+                                   .gyro  = { g_inFixed[0], g_inFixed[1], g_inFixed[2] },
+                                   .accel = { g_inFixed[3], g_inFixed[4], g_inFixed[5] },
+                                   .mag   = { mag ? g_inFixed[6] : NULL, mag ? g_inFixed[7] : NULL, mag ? g_inFixed[8] : NULL },
+                                 };
+   const MPU9250_ConvFloat_t *in4[4] = { &in, &in, &in, &in };
+   MPU9250_Fusion_t fusion[4], *fusion4[4] = { &fusion[0], &fusion[1], &fusion[2], &fusion[3] };
+   MPU9250_FusionFixed_t fusionFixed;
+   double t, best = 0.0;
+   float q[4];
+   unsigned int i, round, lanes = (1 == backend) ? 4 : 1;
+
+   for (round = 0; round < ROUNDS; round++)
+   {
+      for (i = 0; i < 4; i++)
+         mpu9250FusionInit(&fusion[i], algorithm, SAMPLE_RATE_HZ);
+      mpu9250FusionFixedInit(&fusionFixed, algorithm, SAMPLE_RATE_HZ);
+
+      g_seed = 1;
+      t = 0.0;
+
+      /* Batches are generated outside of the timed section */
+      for (i = 0; i < samples; i += BATCH_LENGTH)
+      {
+         make_batch(i);
+         t -= now_ns();
+
+         if (0 == backend)
+            mpu9250FusionUpdate(&fusion[0], &in, BATCH_LENGTH, NULL);
+         else if (1 == backend)
+            mpu9250FusionUpdate4(fusion4, in4, BATCH_LENGTH);
+         else
+            mpu9250FusionFixedUpdate(&fusionFixed, &inFixed, BATCH_LENGTH, NULL);
+
+         t += now_ns();
+      }
+
+      if ((0 == round) || (t < best))
+         best = t;
+   }
+
+   for (i = 0; i < 4; i++)
+      q[i] = (2 == backend) ? fusionFixed.q[i] / (float)(1 << MPU9250_FUSION_Q) : fusion[0].q[i];
+
+   printf("%-9s %-8s %s axes %8.1f ns/sample   q = % .4f % .4f % .4f % .4f\n",
+          name, (MPU9250_FUSION_MAHONY == algorithm) ? "mahony" : "madgwick", mag ? "9" : "6",
+          best / ((double)(samples / BATCH_LENGTH) * BATCH_LENGTH * lanes), q[0], q[1], q[2], q[3]);
+}
+
+int main(int argc, char *argv[])
+{
+   static const char *const names[] = { "float", "float x4", "fixed" };
+   unsigned int samples = SAMPLES_DEFAULT;
+   int algorithm, backend, mag;
+
+   if (argc > 1)
+      samples = strtoul(argv[1], NULL, 0);
+
+   if (samples < BATCH_LENGTH)
+      samples = BATCH_LENGTH;
+
+   printf("Fusing %u samples per backend at %.0f Hz, float x4 is per sensor\n", samples, SAMPLE_RATE_HZ);
+
+   for (backend = 0; backend < 3; backend++)
+   {
+      for (algorithm = MPU9250_FUSION_MADGWICK; algorithm <= MPU9250_FUSION_MAHONY; algorithm++)
+      {
+         for (mag = 0; mag <= 1; mag++)
+            bench(names[backend], (MPU9250_FusionAlgorithm_t)algorithm, backend, mag, samples);
+      }
+   }
+
+   return 0;
+}
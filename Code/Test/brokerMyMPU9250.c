@@ -0,0 +1,255 @@
+/**
+ * @file   brokerMyMPU9250.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Publishes the samples of every MPU9250 in shared memory for local consumers.
+ *
+ * Opens every /dev/i2cMPU9250-N present, or the devices given with -d, and publishes
+ * their samples in the shared memory rings of myMPU9250_broker.h until SIGINT or
+ * SIGTERM arrives. MPU9250_IOC_READ_BATCH stores the samples straight into the ring,
+ * so the broker makes no copy and the sensors see a single reader however many
+ * consumers attach. Samples come from the driver ring, so the LKM must be loaded with
+ * streaming=1. -n sets the records of every shared ring, 4096 by default. Every
+ * 10 s, and at the end, the samples published and lost by every sensor are printed.
+ * Run it as "./broker [-n records] [-d device]...", consumers as "./test broker [sensor]".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "myMPU9250_uapi.h"
+#include "myMPU9250_broker.h"
+
+// Constants
+#define DEVICE_PATTERN      "/dev/i2cMPU9250-%u"    ///< Character device of sensor N
+#define POLL_TIMEOUT_MS     1000                ///< Period of the stop check when no sensor delivers
+#define REPORT_PERIOD_S     10.0                ///< Time between printed statistics
+
+// Types
+
+/* A published sensor */
+typedef struct
+{
+   int fd;
+   unsigned int index;                // The N of /dev/i2cMPU9250-N
+   MPU9250_Broker_t ring;
+   uint64_t samples;
+   uint64_t overruns;
+
+} Published_t;
+
+// Variables
+static volatile sig_atomic_t g_stop = 0;                        ///< Set by SIGINT and SIGTERM
+static Published_t          g_sensors[MPU9250_GROUP_MAX];       ///< Sensors being published
+static unsigned int         g_count = 0;                        ///< Number of them
+
+// Private functions
+
+static void on_signal(int sig)
+{
+   (void)sig;
+   g_stop = 1;
+}
+
+/** @brief Time on the monotonic clock [s] */
+static double now_s(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** @brief Opens a sensor and creates its shared ring
+ *  @return 0 on success or -1 if it is not a streaming myMPU9250 device
+ */
+static int add_sensor(const char *path, unsigned int index, unsigned int capacity)
+{
+   Published_t *s = &g_sensors[g_count];
+   MPU9250_Config_t config;
+   MPU9250_Scale_t scale;
+   MPU9250_Calib_t calib;
+   unsigned int version;
+   int fd;
+
+   fd = open(path, O_RDONLY | O_NONBLOCK);
+
+   if (0 > fd)
+      return -1;
+
+   if ((0 != ioctl(fd, MPU9250_IOC_GET_VERSION, &version)) || (MPU9250_UAPI_VERSION != version) ||
+       (0 != ioctl(fd, MPU9250_IOC_GET_CONFIG, &config)) || (0 != ioctl(fd, MPU9250_IOC_GET_SCALE, &scale)))
+   {
+      fprintf(stderr, "From Broker: %s is not a myMPU9250 device of this version\n", path);
+      close(fd);
+      return -1;
+   }
+
+   if (0 != mpu9250BrokerCreate(&s->ring, index, capacity, &config, &scale,
+                                (0 == ioctl(fd, MPU9250_IOC_GET_CALIB, &calib)) ? &calib : NULL))
+   {
+      perror("From Broker: Failed to create the shared ring");
+      close(fd);
+      return -1;
+   }
+
+   s->fd = fd;
+   s->index = index;
+   g_count++;
+
+   printf("From Broker: %s at %u Hz in " MPU9250_BROKER_NAME ", %u records\n", path, config.odrHz, index,
+          s->ring.ring->capacity);
+
+   return 0;
+}
+
+/** @brief Moves every sample available on a sensor into its shared ring */
+static int drain_sensor(Published_t *s)
+{
+   MPU9250_Batch_t batch;
+   unsigned int count;
+
+   while (1)
+   {
+      /* The driver writes the claimed records in place, up to the end of the ring */
+      count = s->ring.ring->capacity / 4;
+      batch.samples = (uintptr_t)mpu9250BrokerClaim(&s->ring, &count);
+      batch.count = count;
+
+      if (0 != ioctl(s->fd, MPU9250_IOC_READ_BATCH, &batch))
+      {
+         mpu9250BrokerPublish(&s->ring, 0);
+         return (EAGAIN == errno) ? 0 : -1;
+      }
+
+      mpu9250BrokerPublish(&s->ring, batch.count);
+
+      s->samples += batch.count;
+      s->overruns += batch.overruns;
+
+      /* A short batch emptied the driver ring */
+      if (count > batch.count)
+         return 0;
+   }
+}
+
+static void report(void)
+{
+   unsigned int i;
+
+   for (i = 0; i < g_count; i++)
+   {
+      printf("From Broker: sensor %u, %llu samples published, %llu lost\n", g_sensors[i].index,
+             (unsigned long long)g_sensors[i].samples, (unsigned long long)g_sensors[i].overruns);
+   }
+}
+
+// Public functions
+int main(int argc, char *argv[])
+{
+   struct pollfd pfd[MPU9250_GROUP_MAX];
+   const char *devices[MPU9250_GROUP_MAX];
+   unsigned int capacity = MPU9250_BROKER_CAPACITY;
+   unsigned int ndevices = 0;
+   unsigned int i, n;
+   double reported;
+   char path[64];
+   int opt, ready, rv = 0;
+
+   while (-1 != (opt = getopt(argc, argv, "n:d:")))
+   {
+      switch (opt)
+      {
+         case 'n': capacity = strtoul(optarg, NULL, 0); break;
+         case 'd':
+            if (MPU9250_GROUP_MAX > ndevices)
+               devices[ndevices++] = optarg;
+            break;
+         default:
+            optind = argc + 1;
+            break;
+      }
+   }
+
+   if (optind != argc)
+   {
+      fprintf(stderr, "Usage: %s [-n records] [-d device]...\n", argv[0]);
+      return EINVAL;
+   }
+
+   /* Without -d every sensor present is published, under its own number */
+   for (i = 0; i < (ndevices ? ndevices : MPU9250_GROUP_MAX); i++)
+   {
+      if (0 == ndevices)
+      {
+         snprintf(path, sizeof(path), DEVICE_PATTERN, i);
+         add_sensor(path, i, capacity);
+      }
+      else if (1 != sscanf(devices[i], DEVICE_PATTERN, &n) || (0 != add_sensor(devices[i], n, capacity)))
+      {
+         fprintf(stderr, "From Broker: Skipping %s\n", devices[i]);
+      }
+   }
+
+   if (0 == g_count)
+   {
+      fprintf(stderr, "From Broker: No sensor to publish, is the LKM loaded with streaming=1?\n");
+      return ENODEV;
+   }
+
+   signal(SIGINT, on_signal);
+   signal(SIGTERM, on_signal);
+
+   for (i = 0; i < g_count; i++)
+   {
+      pfd[i].fd = g_sensors[i].fd;
+      pfd[i].events = POLLIN;
+   }
+
+   reported = now_s();
+
+   while (!g_stop)
+   {
+      ready = poll(pfd, g_count, POLL_TIMEOUT_MS);
+
+      if ((0 > ready) && (EINTR != errno))
+      {
+         perror("From Broker: Failed to wait for samples");
+         rv = errno;
+         break;
+      }
+
+      for (i = 0; (0 < ready) && (i < g_count); i++)
+      {
+         if ((pfd[i].revents & POLLIN) && (0 != drain_sensor(&g_sensors[i])))
+         {
+            perror("From Broker: Failed to read samples");
+            g_stop = 1;
+            rv = errno;
+         }
+      }
+
+      if (now_s() - reported >= REPORT_PERIOD_S)
+      {
+         report();
+         reported = now_s();
+      }
+   }
+
+   /* Attached consumers see the rings stopped and return from their wait */
+   report();
+
+   for (i = 0; i < g_count; i++)
+   {
+      mpu9250BrokerDestroy(&g_sensors[i].ring);
+      close(g_sensors[i].fd);
+   }
+
+   return rv;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file   frameMyMPU9250.cpp
+ * @author Rodrigo A. Tirapegui
+ * @brief  Checks the compile-time frame parsers of myMPU9250_frame.hpp.
+ *
+ * For every FIFO channel set MPU9250_IOC_GET_LAYOUT can return, random samples are
+ * packed into frames by a plain reference encoder that walks the channels in FIFO
+ * order, then unpacked through FrameParser and compared field by field. Layouts the
+ * header does not know, and sizes that do not match, must be rejected. Runs without
+ * the LKM or the sensor, build it with "make check" in Code/Lib or with
+ * "g++ -std=c++17 -O2 -I../Driver -I../Lib -o frame frameMyMPU9250.cpp".
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include "myMPU9250_frame.hpp"
+
+// Constants
+#define FRAMES              64                  ///< Frames packed per channel set
+#define SEED                0x4D505539u         ///< Fixed so a failure can be reproduced
+
+// Variables
+static unsigned int g_failures = 0;             ///< Checks that failed
+static std::uint32_t g_random = SEED;           ///< State of the sample generator
+
+// Private functions
+
+static std::int16_t random16(void)
+{
+   /* xorshift32, the full 16 bit range including the extremes */
+   g_random ^= g_random << 13;
+   g_random ^= g_random >> 17;
+   g_random ^= g_random << 5;
+
+   return static_cast<std::int16_t>(g_random >> 16);
+}
+
+static void check(bool ok, const char *what, unsigned fifoEnable, unsigned frame)
+{
+   if (!ok)
+   {
+      if (10 > g_failures)
+         printf("From FrameTest: layout 0x%02x frame %u: %s\n", fifoEnable, frame, what);
+
+      g_failures++;
+   }
+}
+
+static void putBe16(std::vector<std::uint8_t> &out, std::int16_t v)
+{
+   out.push_back(static_cast<std::uint8_t>(static_cast<std::uint16_t>(v) >> 8));
+   out.push_back(static_cast<std::uint8_t>(v));
+}
+
+static void putLe16(std::vector<std::uint8_t> &out, std::int16_t v)
+{
+   out.push_back(static_cast<std::uint8_t>(v));
+   out.push_back(static_cast<std::uint8_t>(static_cast<std::uint16_t>(v) >> 8));
+}
+
+/** @brief Appends the frame of a sample as the MPU9250 writes it to its FIFO
+ *  The sample channels left out of the set are cleared, they are what unpacking must return.
+ */
+static void encode(unsigned fifoEnable, MPU9250_Sample_t &s, std::vector<std::uint8_t> &out)
+{
+   unsigned i;
+
+   if (fifoEnable & MPU9250_FIFO_ACCEL)
+      for (i = 0; i < 3; i++) putBe16(out, s.accel[i]);
+   else
+      memset(s.accel, 0, sizeof(s.accel));
+
+   if (fifoEnable & MPU9250_FIFO_TEMP) putBe16(out, s.temp); else s.temp = 0;
+   if (fifoEnable & MPU9250_FIFO_GYRO_X) putBe16(out, s.gyro[0]); else s.gyro[0] = 0;
+   if (fifoEnable & MPU9250_FIFO_GYRO_Y) putBe16(out, s.gyro[1]); else s.gyro[1] = 0;
+   if (fifoEnable & MPU9250_FIFO_GYRO_Z) putBe16(out, s.gyro[2]); else s.gyro[2] = 0;
+
+   if (fifoEnable & MPU9250_FIFO_MAG)
+   {
+      /* HXL..HZH little-endian then ST2, with the overflow bit in some frames */
+      for (i = 0; i < 3; i++) putLe16(out, s.mag[i]);
+
+      out.push_back((s.flags & MPU9250_SAMPLE_MAG_OVERFLOW) ? MPU9250_AK8963_ST2_HOFL | 0x10 : 0x10);
+   }
+   else
+   {
+      memset(s.mag, 0, sizeof(s.mag));
+      s.flags = 0;
+   }
+}
+
+/** @brief Packs and unpacks random frames of one channel set */
+static void checkLayout(unsigned fifoEnable, std::size_t frameSize)
+{
+   MPU9250_Sample_t expected[FRAMES], samples[FRAMES];
+   std::vector<std::uint8_t> frames;
+   MPU9250_Layout_t layout;
+   unsigned i, j;
+
+   for (i = 0; i < FRAMES; i++)
+   {
+      memset(&expected[i], 0, sizeof(expected[i]));
+
+      for (j = 0; j < 3; j++)
+      {
+         expected[i].accel[j] = random16();
+         expected[i].gyro[j] = random16();
+         expected[i].mag[j] = random16();
+      }
+
+      expected[i].temp = random16();
+      expected[i].flags = MPU9250_SAMPLE_MAG | ((i % 3) ? 0 : MPU9250_SAMPLE_MAG_OVERFLOW);
+      expected[i].timestamp = 1000000 * (std::int64_t)i;
+
+      encode(fifoEnable, expected[i], frames);
+   }
+
+   check(frames.size() == frameSize * FRAMES, "reference size differs", fifoEnable, 0);
+
+   layout.fifoEnable = fifoEnable;
+   layout.frameSize = frames.size() / FRAMES;
+
+   mpu9250::FrameParser parser(layout);
+
+   check(parser.valid(), "layout rejected", fifoEnable, 0);
+   check(parser.frameSize() == layout.frameSize, "frame size differs", fifoEnable, 0);
+
+   if (!parser.valid())
+      return;
+
+   /* The parser leaves the timestamps alone */
+   for (i = 0; i < FRAMES; i++)
+   {
+      memset(&samples[i], 0x5A, sizeof(samples[i]));
+      samples[i].timestamp = expected[i].timestamp;
+   }
+
+   check(FRAMES == parser.unpack(frames.data(), FRAMES, samples), "short unpack", fifoEnable, 0);
+
+   for (i = 0; i < FRAMES; i++)
+   {
+      check(0 == memcmp(samples[i].accel, expected[i].accel, sizeof(samples[i].accel)), "accel differs", fifoEnable, i);
+      check(0 == memcmp(samples[i].gyro, expected[i].gyro, sizeof(samples[i].gyro)), "gyro differs", fifoEnable, i);
+      check(0 == memcmp(samples[i].mag, expected[i].mag, sizeof(samples[i].mag)), "mag differs", fifoEnable, i);
+      check(samples[i].temp == expected[i].temp, "temp differs", fifoEnable, i);
+      check(samples[i].flags == expected[i].flags, "flags differ", fifoEnable, i);
+      check(samples[i].timestamp == expected[i].timestamp, "timestamp changed", fifoEnable, i);
+   }
+}
+
+// Public functions
+int main(void)
+{
+   static const struct
+   {
+      unsigned fifoEnable;
+      std::size_t frameSize;
+      const char *name;
+   } layouts[] =
+   {
+      { MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO, MPU9250_FIFO_FRAME_SIZE, "accel, temp and gyro" },
+      { MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO | MPU9250_FIFO_MAG,
+        MPU9250_FIFO_FRAME_SIZE + MPU9250_FIFO_MAG_SIZE, "accel, temp, gyro and mag" },
+      { MPU9250_FIFO_GYRO, 6, "gyro" },
+      { MPU9250_FIFO_ACCEL | MPU9250_FIFO_GYRO_Y, 8, "accel and gyro y" },
+      { MPU9250_FIFO_GYRO_X | MPU9250_FIFO_GYRO_Z | MPU9250_FIFO_MAG, 4 + MPU9250_FIFO_MAG_SIZE, "gyro x, gyro z and mag" },
+      { MPU9250_FIFO_ACCEL | MPU9250_FIFO_MAG, 6 + MPU9250_FIFO_MAG_SIZE, "accel and mag" },
+   };
+   MPU9250_Layout_t layout;
+   unsigned i, enable, sets = 0;
+   std::size_t size;
+
+   /* The layouts the driver reports most often, with their documented sizes */
+   for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++)
+   {
+      printf("From FrameTest: %s, %zu bytes\n", layouts[i].name, layouts[i].frameSize);
+      checkLayout(layouts[i].fifoEnable, layouts[i].frameSize);
+   }
+
+   /* Every other channel set, sized by the reference encoder */
+   for (enable = 1; enable <= mpu9250::kChannels; enable++)
+   {
+      if (0 != (enable & ~mpu9250::kChannels))
+         continue;
+
+      size = 2 * __builtin_popcount(enable & (MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO)) +
+             ((enable & MPU9250_FIFO_ACCEL) ? 6 : 0) + ((enable & MPU9250_FIFO_MAG) ? MPU9250_FIFO_MAG_SIZE : 0);
+
+      checkLayout(enable, size);
+      sets++;
+   }
+
+   printf("From FrameTest: %u channel sets\n", sets);
+
+   /* Layouts the header cannot parse are rejected, not misparsed */
+   layout.fifoEnable = 0;
+   layout.frameSize = 0;
+   check(!mpu9250::FrameParser(layout).valid(), "empty layout accepted", layout.fifoEnable, 0);
+
+   layout.fifoEnable = MPU9250_FIFO_ACCEL | 0x04;
+   layout.frameSize = 6;
+   check(!mpu9250::FrameParser(layout).valid(), "unknown channel accepted", layout.fifoEnable, 0);
+
+   layout.fifoEnable = MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO;
+   layout.frameSize = MPU9250_FIFO_FRAME_SIZE + 1;
+   check(!mpu9250::FrameParser(layout).valid(), "wrong frame size accepted", layout.fifoEnable, 0);
+
+   printf("From FrameTest: %s, %u failures\n", g_failures ? "FAIL" : "PASS", g_failures);
+
+   return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+/**
+ * @file   modelMyMPU9250.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Checks the user space build of the MPU9250 register model.
+ *
+ * Drives myMPU9250_model.c through mpu9250ModelWrite(), mpu9250ModelRead() and
+ * mpu9250ModelAdvance() the way the LKM drives the real sensor, and checks what the
+ * model answers: WHO_AM_I, the sample period set by SMPDIV and the DLPF, output
+ * scaling, FIFO_COUNT, the FIFO overflow in its two modes, and the AK8963 reached
+ * through SLV0 of the auxiliary master. No kernel build is needed, run it with
+ * "make check" in Code/Emulator or build it with
+ * "gcc -O2 -I../Driver -I../Emulator -o model modelMyMPU9250.c ../Emulator/myMPU9250_model.c".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "myMPU9250_model.h"
+
+// Constants
+#define MS                  1000000ULL          ///< One millisecond [ns]
+#define T0                  (1000 * MS)         ///< Time of the first transaction
+
+// Variables
+static unsigned int g_checks = 0;               ///< Checks run
+static unsigned int g_failures = 0;             ///< Checks that failed
+
+// Private functions
+
+/** @brief Counts a check, the values are evaluated once since reading some registers clears them */
+static void checkEqual(const char *what, long long got, long long expected)
+{
+   g_checks++;
+
+   if (got != expected)
+   {
+      printf("From ModelTest: %s: got %lld, expected %lld\n", what, got, expected);
+      g_failures++;
+   }
+}
+
+static void writeRegister(MPU9250_Model_t *m, uint8_t reg, uint8_t value)
+{
+   mpu9250ModelWrite(m, reg, &value, 1);
+}
+
+static uint8_t readRegister(MPU9250_Model_t *m, uint8_t reg)
+{
+   uint8_t value;
+
+   mpu9250ModelRead(m, reg, &value, 1);
+   return value;
+}
+
+static int16_t be16(const uint8_t *p)
+{
+   return (int16_t)((p[0] << 8) | p[1]);
+}
+
+static unsigned int fifoCount(MPU9250_Model_t *m)
+{
+   uint8_t count[2];
+
+   mpu9250ModelRead(m, MPU9250_FIFO_COUNT, count, 2);
+   return ((count[0] << 8) | count[1]) & MPU9250_FIFO_COUNT_MASK;
+}
+
+/** @brief A still, noiseless sensor sampling at 1 kHz with the 184 Hz DLPF, 2 g and 250 dps */
+static void setup(MPU9250_Model_t *m)
+{
+   mpu9250ModelInit(m, 0x71, MPU9250_MODEL_STILL, 0);
+   writeRegister(m, MPU9250_CONFIG, MPU9250_GYRO_DLPF_184);
+   writeRegister(m, MPU9250_ACCEL_CONFIG2, MPU9250_ACCEL_DLPF_184);
+   writeRegister(m, MPU9250_SMPDIV, 0);
+
+   /* The first advance starts sampling */
+   mpu9250ModelAdvance(m, T0);
+}
+
+static void testWhoAmI(void)
+{
+   MPU9250_Model_t m;
+
+   mpu9250ModelInit(&m, 0x71, MPU9250_MODEL_STILL, 0);
+   checkEqual("WHO_AM_I of the MPU9250", readRegister(&m, MPU9250_WHO_AM_I), 0x71);
+
+   /* Read only, and kept across a register reset */
+   writeRegister(&m, MPU9250_WHO_AM_I, 0x00);
+   writeRegister(&m, MPU9250_PWR_MGMNT_1, MPU9250_PWR_RESET);
+   checkEqual("WHO_AM_I after a write and a reset", readRegister(&m, MPU9250_WHO_AM_I), 0x71);
+   checkEqual("PWR_MGMT_1 after a reset", readRegister(&m, MPU9250_PWR_MGMNT_1), MPU9250_CLOCK_SEL_PLL);
+
+   mpu9250ModelInit(&m, 0x73, MPU9250_MODEL_STILL, 0);
+   checkEqual("WHO_AM_I of the MPU9255", readRegister(&m, MPU9250_WHO_AM_I), 0x73);
+}
+
+static void testSampleRate(void)
+{
+   MPU9250_Model_t m;
+
+   /* 1000 / (1 + SMPDIV) Hz with the DLPF on */
+   setup(&m);
+   writeRegister(&m, MPU9250_SMPDIV, 9);
+   mpu9250ModelAdvance(&m, T0 + 10 * MS);
+   m.samples = 0;
+   mpu9250ModelAdvance(&m, T0 + 1010 * MS);
+   checkEqual("samples in 1 s at SMPDIV 9", m.samples, 100);
+
+   /* RAW_DATA_RDY is set by a sample and cleared by reading INT_STATUS */
+   checkEqual("RAW_DATA_RDY after samples", readRegister(&m, MPU9250_INT_STATUS) & MPU9250_INT_RAW_RDY, MPU9250_INT_RAW_RDY);
+   checkEqual("INT_STATUS after reading it", readRegister(&m, MPU9250_INT_STATUS), 0);
+   /* Samples keep the 1 ms phase of the first one, the next is due at 1011 ms */
+   mpu9250ModelAdvance(&m, T0 + 1010 * MS + MS / 2);
+   checkEqual("RAW_DATA_RDY before the next sample", readRegister(&m, MPU9250_INT_STATUS), 0);
+   mpu9250ModelAdvance(&m, T0 + 1011 * MS);
+   checkEqual("RAW_DATA_RDY at the next sample", readRegister(&m, MPU9250_INT_STATUS), MPU9250_INT_RAW_RDY);
+
+   /* SMPDIV is ignored with the DLPF bypassed, the sensor runs at 8 kHz */
+   setup(&m);
+   writeRegister(&m, MPU9250_SMPDIV, 9);
+   writeRegister(&m, MPU9250_CONFIG, 0);
+   mpu9250ModelAdvance(&m, T0 + 1 * MS);
+   m.samples = 0;
+   mpu9250ModelAdvance(&m, T0 + 11 * MS);
+   checkEqual("samples in 10 ms with the DLPF bypassed", m.samples, 80);
+
+   /* Nothing is sampled in sleep mode */
+   setup(&m);
+   writeRegister(&m, MPU9250_PWR_MGMNT_1, MPU9250_PWR_SLEEP | MPU9250_CLOCK_SEL_PLL);
+   mpu9250ModelAdvance(&m, T0 + 100 * MS);
+   checkEqual("samples in sleep mode", m.samples, 0);
+}
+
+static void testOutputs(void)
+{
+   MPU9250_Model_t m;
+   uint8_t frame[MPU9250_FIFO_FRAME_SIZE];
+
+   setup(&m);
+   mpu9250ModelAdvance(&m, T0 + 5 * MS);
+   mpu9250ModelRead(&m, MPU9250_ACCEL_OUT, frame, sizeof(frame));
+
+   /* 1 g plus the 30 mg bias on z at 16384 LSB / g, 25 C, 1.5 dps of gyro x bias at 131 LSB / dps */
+   checkEqual("accel z at 2 g", be16(frame + 4), (1000 + 30) * 4096 / 250);
+   checkEqual("temperature", be16(frame + 6), 1335);
+   checkEqual("gyro x at 250 dps", be16(frame + 8), 1500 * 4096 / 31250);
+
+   /* The same acceleration at 16 g */
+   writeRegister(&m, MPU9250_ACCEL_CONFIG, MPU9250_ACCEL_FS_SEL_16G);
+   mpu9250ModelAdvance(&m, T0 + 6 * MS);
+   mpu9250ModelRead(&m, MPU9250_ACCEL_OUT, frame, sizeof(frame));
+   checkEqual("accel z at 16 g", be16(frame + 4), (1000 + 30) * 4096 / 2000);
+
+   /* Disabled axes read zero */
+   writeRegister(&m, MPU9250_PWR_MGMNT_2, MPU9250_DIS_GYRO);
+   mpu9250ModelAdvance(&m, T0 + 7 * MS);
+   mpu9250ModelRead(&m, MPU9250_ACCEL_OUT, frame, sizeof(frame));
+   checkEqual("gyro x disabled", be16(frame + 8), 0);
+}
+
+static void testFifo(void)
+{
+   MPU9250_Model_t m;
+   uint8_t frames[10 * MPU9250_FIFO_FRAME_SIZE];
+   unsigned int i;
+
+   setup(&m);
+   writeRegister(&m, MPU9250_FIFO_EN, MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO);
+   writeRegister(&m, MPU9250_USER_CTRL, MPU9250_USER_FIFO_EN | MPU9250_USER_FIFO_RST);
+   checkEqual("FIFO_COUNT after FIFO_RST", fifoCount(&m), 0);
+   checkEqual("USER_CTRL reset bit clears itself", readRegister(&m, MPU9250_USER_CTRL), MPU9250_USER_FIFO_EN);
+
+   /* One 14 byte frame per sample */
+   mpu9250ModelAdvance(&m, T0 + 10 * MS);
+   checkEqual("FIFO_COUNT after 10 samples", fifoCount(&m), 10 * MPU9250_FIFO_FRAME_SIZE);
+
+   /* FIFO_R_W does not auto-increment, a burst drains consecutive bytes */
+   mpu9250ModelRead(&m, MPU9250_FIFO_READ, frames, sizeof(frames));
+   checkEqual("FIFO_COUNT after a burst read", fifoCount(&m), 0);
+
+   for (i = 0; i < 10; i++)
+   {
+      checkEqual("accel z of a FIFO frame", be16(frames + i * MPU9250_FIFO_FRAME_SIZE + 4), (1000 + 30) * 4096 / 250);
+      checkEqual("temperature of a FIFO frame", be16(frames + i * MPU9250_FIFO_FRAME_SIZE + 6), 1335);
+   }
+
+   /* Overwrite mode keeps the newest 512 bytes */
+   mpu9250ModelAdvance(&m, T0 + 110 * MS);
+   checkEqual("FIFO_COUNT after an overflow", fifoCount(&m), MPU9250_FIFO_SIZE);
+   checkEqual("FIFO_OFLOW after an overflow", readRegister(&m, MPU9250_INT_STATUS) & MPU9250_INT_FIFO_OFLOW, MPU9250_INT_FIFO_OFLOW);
+   checkEqual("frames lost", m.fifoOverflows, 100 - MPU9250_FIFO_SIZE / MPU9250_FIFO_FRAME_SIZE);
+
+   /* FIFO_MODE stops at the last whole frame that fits */
+   writeRegister(&m, MPU9250_CONFIG, MPU9250_CONFIG_FIFO_MODE | MPU9250_GYRO_DLPF_184);
+   writeRegister(&m, MPU9250_USER_CTRL, MPU9250_USER_FIFO_EN | MPU9250_USER_FIFO_RST);
+   mpu9250ModelAdvance(&m, T0 + 210 * MS);
+   checkEqual("FIFO_COUNT in FIFO_MODE", fifoCount(&m), (MPU9250_FIFO_SIZE / MPU9250_FIFO_FRAME_SIZE) * MPU9250_FIFO_FRAME_SIZE);
+
+   /* Partial channel sets */
+   writeRegister(&m, MPU9250_CONFIG, MPU9250_GYRO_DLPF_184);
+   writeRegister(&m, MPU9250_FIFO_EN, MPU9250_FIFO_GYRO_X | MPU9250_FIFO_GYRO_Z);
+   writeRegister(&m, MPU9250_USER_CTRL, MPU9250_USER_FIFO_EN | MPU9250_USER_FIFO_RST);
+   mpu9250ModelAdvance(&m, T0 + 215 * MS);
+   checkEqual("FIFO_COUNT of gyro x and z frames", fifoCount(&m), 5 * 4);
+
+   /* Nothing is queued with the FIFO disabled */
+   writeRegister(&m, MPU9250_USER_CTRL, MPU9250_USER_FIFO_RST);
+   mpu9250ModelAdvance(&m, T0 + 220 * MS);
+   checkEqual("FIFO_COUNT with the FIFO disabled", fifoCount(&m), 0);
+}
+
+/** @brief Runs one SLV0 transaction, it happens once per sample */
+static void slave0(MPU9250_Model_t *m, uint64_t *now, uint8_t addr, uint8_t reg, uint8_t length, uint8_t data)
+{
+   writeRegister(m, MPU9250_I2C_SLV0_ADDR, addr);
+   writeRegister(m, MPU9250_I2C_SLV0_REG, reg);
+   writeRegister(m, MPU9250_I2C_SLV0_DO, data);
+   writeRegister(m, MPU9250_I2C_SLV0_CTRL, MPU9250_I2C_SLV0_EN | length);
+
+   *now += MS;
+   mpu9250ModelAdvance(m, *now);
+}
+
+static void testAk8963(void)
+{
+   MPU9250_Model_t m;
+   uint8_t data[MPU9250_FIFO_MAG_SIZE];
+   uint8_t frame[MPU9250_FIFO_FRAME_SIZE + MPU9250_FIFO_MAG_SIZE];
+   uint64_t now = T0;
+   int16_t raw;
+
+   setup(&m);
+
+   /* The auxiliary master only runs with I2C_MST_EN */
+   slave0(&m, &now, MPU9250_AK8963_I2C_ADDR | MPU9250_I2C_READ_FLAG, MPU9250_AK8963_WHO_AM_I, 1, 0);
+   checkEqual("EXT_SENS_DATA without I2C_MST_EN", readRegister(&m, MPU9250_EXT_SENS_DATA_00), 0);
+
+   writeRegister(&m, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN);
+   slave0(&m, &now, MPU9250_AK8963_I2C_ADDR | MPU9250_I2C_READ_FLAG, MPU9250_AK8963_WHO_AM_I, 1, 0);
+   checkEqual("AK8963 WIA through SLV0", readRegister(&m, MPU9250_EXT_SENS_DATA_00), MPU9250_AK8963_ID);
+
+   /* Fuse ROM, as the driver reads it at probe */
+   slave0(&m, &now, MPU9250_AK8963_I2C_ADDR, MPU9250_AK8963_CNTL1, 1, MPU9250_AK8963_FUSE_ROM);
+   slave0(&m, &now, MPU9250_AK8963_I2C_ADDR | MPU9250_I2C_READ_FLAG, MPU9250_AK8963_ASA, 3, 0);
+   mpu9250ModelRead(&m, MPU9250_EXT_SENS_DATA_00, data, 3);
+   checkEqual("AK8963 ASAX", data[0], 0xB0);
+
+   /* Continuous 100 Hz in 16 bit mode, then HXL..HZH and ST2 every sample */
+   slave0(&m, &now, MPU9250_AK8963_I2C_ADDR, MPU9250_AK8963_CNTL1, 1, MPU9250_AK8963_CNT_MEAS2);
+   checkEqual("AK8963 CNTL1 written through SLV0", m.akRegs[MPU9250_AK8963_CNTL1], MPU9250_AK8963_CNT_MEAS2);
+
+   slave0(&m, &now, MPU9250_AK8963_I2C_ADDR | MPU9250_I2C_READ_FLAG, MPU9250_AK8963_HXL, MPU9250_FIFO_MAG_SIZE, 0);
+   mpu9250ModelRead(&m, MPU9250_EXT_SENS_DATA_00, data, sizeof(data));
+
+   /* 400 (0.1 uT) on z at 0.15 uT / LSB, before the ASA adjustment */
+   raw = (int16_t)((data[5] << 8) | data[4]);
+   checkEqual("AK8963 z field", raw, (400 * 20 / 3) * 256 / (0xA6 + 128));
+   checkEqual("AK8963 ST2 in 16 bit mode", data[6], MPU9250_AK8963_ST2_BITM);
+   checkEqual("AK8963 DRDY cleared by reading ST2", m.akRegs[MPU9250_AK8963_ST1] & MPU9250_AK8963_ST1_DRDY, 0);
+
+   /* EXT_SENS_DATA goes to the FIFO after the gyro */
+   writeRegister(&m, MPU9250_FIFO_EN, MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO | MPU9250_FIFO_MAG);
+   writeRegister(&m, MPU9250_USER_CTRL, MPU9250_I2C_MST_EN | MPU9250_USER_FIFO_EN | MPU9250_USER_FIFO_RST);
+   now += 3 * MS;
+   mpu9250ModelAdvance(&m, now);
+   checkEqual("FIFO_COUNT of frames with the magnetometer", fifoCount(&m), 3 * sizeof(frame));
+
+   mpu9250ModelRead(&m, MPU9250_FIFO_READ, frame, sizeof(frame));
+   checkEqual("AK8963 z field in a FIFO frame", (int16_t)((frame[MPU9250_FIFO_FRAME_SIZE + 5] << 8) | frame[MPU9250_FIFO_FRAME_SIZE + 4]), raw);
+
+   /* A soft reset powers the AK8963 down */
+   slave0(&m, &now, MPU9250_AK8963_I2C_ADDR, MPU9250_AK8963_CNTL2, 1, MPU9250_AK8963_RESET);
+   checkEqual("AK8963 CNTL1 after a soft reset", m.akRegs[MPU9250_AK8963_CNTL1], MPU9250_AK8963_PWR_DOWN);
+}
+
+// Public functions
+int main(void)
+{
+   testWhoAmI();
+   testSampleRate();
+   testOutputs();
+   testFifo();
+   testAk8963();
+
+   printf("From ModelTest: %s, %u checks, %u failures\n", g_failures ? "FAIL" : "PASS", g_checks, g_failures);
+
+   return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
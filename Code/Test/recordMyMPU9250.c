@@ -0,0 +1,246 @@
+/**
+ * @file   recordMyMPU9250.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Records the samples of every MPU9250 into a binary recording.
+ *
+ * Opens every /dev/i2cMPU9250-N present, or the devices given with -d, and stores
+ * their samples with the sampling setup of each sensor in the format of
+ * myMPU9250_rec.h until the time given with -t elapses or SIGINT arrives. Samples
+ * come from MPU9250_IOC_READ_BATCH, so the LKM must be loaded with streaming=1.
+ * -r stores raw samples instead of delta coded ones. At the end the size per sample
+ * and the samples lost by every sensor are printed.
+ * Run it as "./record [-t seconds] [-r] [-d device]... file.rec".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "myMPU9250_uapi.h"
+#include "myMPU9250_rec.h"
+
+// Constants
+#define DEVICE_PATTERN      "/dev/i2cMPU9250-%u"    ///< Character device of sensor N
+#define POLL_TIMEOUT_MS     1000                ///< Recording stops when no sensor delivers in time
+#define BATCH_LENGTH        256                 ///< Samples per batch read
+
+// Types
+
+/* A recorded sensor */
+typedef struct
+{
+   int fd;
+   unsigned int index;                // The N of /dev/i2cMPU9250-N
+   uint64_t samples;
+   uint64_t overruns;
+
+} Recorded_t;
+
+// Variables
+static volatile sig_atomic_t g_stop = 0;                        ///< Set by SIGINT
+static Recorded_t           g_sensors[MPU9250_GROUP_MAX];       ///< Sensors being recorded
+static unsigned int         g_count = 0;                        ///< Number of them
+
+// Private functions
+
+static void on_signal(int sig)
+{
+   (void)sig;
+   g_stop = 1;
+}
+
+/** @brief Time on the monotonic clock [s] */
+static double now_s(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** @brief Opens a sensor and describes it in the recording
+ *  @return 0 on success or -1 if it is not a streaming myMPU9250 device
+ */
+static int add_sensor(MPU9250_RecWriter_t *w, const char *path, unsigned int index)
+{
+   MPU9250_Config_t config;
+   MPU9250_Scale_t scale;
+   MPU9250_Calib_t calib;
+   unsigned int version;
+   int fd;
+
+   fd = open(path, O_RDONLY | O_NONBLOCK);
+
+   if (0 > fd)
+      return -1;
+
+   if ((0 != ioctl(fd, MPU9250_IOC_GET_VERSION, &version)) || (MPU9250_UAPI_VERSION != version) ||
+       (0 != ioctl(fd, MPU9250_IOC_GET_CONFIG, &config)) || (0 != ioctl(fd, MPU9250_IOC_GET_SCALE, &scale)) ||
+       (0 != mpu9250RecSensor(w, index, &config, &scale, (0 == ioctl(fd, MPU9250_IOC_GET_CALIB, &calib)) ? &calib : NULL)))
+   {
+      fprintf(stderr, "From Record: %s is not a myMPU9250 device of this version\n", path);
+      close(fd);
+      return -1;
+   }
+
+   g_sensors[g_count].fd = fd;
+   g_sensors[g_count].index = index;
+   g_count++;
+
+   printf("From Record: %s at %u Hz\n", path, config.odrHz);
+
+   return 0;
+}
+
+/** @brief Moves every sample available on a sensor into the recording */
+static int drain_sensor(MPU9250_RecWriter_t *w, Recorded_t *s)
+{
+   static MPU9250_Sample_t samples[BATCH_LENGTH];
+   MPU9250_Batch_t batch;
+
+   while (1)
+   {
+      batch.samples = (uintptr_t)samples;
+      batch.count = BATCH_LENGTH;
+
+      if (0 != ioctl(s->fd, MPU9250_IOC_READ_BATCH, &batch))
+         return (EAGAIN == errno) ? 0 : -1;
+
+      s->samples += batch.count;
+      s->overruns += batch.overruns;
+
+      if (0 != mpu9250RecWrite(w, s->index, samples, batch.count))
+         return -1;
+
+      /* A short batch emptied the ring */
+      if (BATCH_LENGTH > batch.count)
+         return 0;
+   }
+}
+
+// Public functions
+int main(int argc, char *argv[])
+{
+   MPU9250_RecWriter_t w;
+   struct pollfd pfd[MPU9250_GROUP_MAX];
+   const char *devices[MPU9250_GROUP_MAX];
+   unsigned int codec = MPU9250_REC_CODEC_DELTA;
+   unsigned int ndevices = 0;
+   unsigned int i, n;
+   double seconds = 0.0;
+   double start, elapsed;
+   uint64_t samples = 0;
+   char path[64];
+   int opt, ready, rv = 0;
+
+   while (-1 != (opt = getopt(argc, argv, "t:rd:")))
+   {
+      switch (opt)
+      {
+         case 't': seconds = atof(optarg); break;
+         case 'r': codec = MPU9250_REC_CODEC_RAW; break;
+         case 'd':
+            if (MPU9250_GROUP_MAX > ndevices)
+               devices[ndevices++] = optarg;
+            break;
+         default:
+            optind = argc;
+            break;
+      }
+   }
+
+   if (optind + 1 != argc)
+   {
+      fprintf(stderr, "Usage: %s [-t seconds] [-r] [-d device]... file.rec\n", argv[0]);
+      return EINVAL;
+   }
+
+   if (0 != mpu9250RecCreate(&w, argv[optind], codec))
+   {
+      perror("From Record: Failed to create the recording");
+      return errno;
+   }
+
+   /* Without -d every sensor present is recorded, under its own number */
+   for (i = 0; i < (ndevices ? ndevices : MPU9250_GROUP_MAX); i++)
+   {
+      if (0 == ndevices)
+      {
+         snprintf(path, sizeof(path), DEVICE_PATTERN, i);
+         add_sensor(&w, path, i);
+      }
+      else if (1 != sscanf(devices[i], DEVICE_PATTERN, &n) || (0 != add_sensor(&w, devices[i], n)))
+      {
+         fprintf(stderr, "From Record: Skipping %s\n", devices[i]);
+      }
+   }
+
+   if (0 == g_count)
+   {
+      fprintf(stderr, "From Record: No sensor to record, is the LKM loaded with streaming=1?\n");
+      mpu9250RecClose(&w);
+      return ENODEV;
+   }
+
+   signal(SIGINT, on_signal);
+   signal(SIGTERM, on_signal);
+
+   for (i = 0; i < g_count; i++)
+   {
+      pfd[i].fd = g_sensors[i].fd;
+      pfd[i].events = POLLIN;
+   }
+
+   start = now_s();
+
+   while (!g_stop && ((0.0 >= seconds) || (now_s() - start < seconds)))
+   {
+      ready = poll(pfd, g_count, POLL_TIMEOUT_MS);
+
+      if (0 >= ready)
+      {
+         if ((0 > ready) && (EINTR == errno))
+            continue;
+
+         fprintf(stderr, "From Record: No samples, stopping\n");
+         break;
+      }
+
+      for (i = 0; i < g_count; i++)
+      {
+         if ((pfd[i].revents & POLLIN) && (0 != drain_sensor(&w, &g_sensors[i])))
+         {
+            perror("From Record: Failed to record");
+            g_stop = 1;
+            rv = errno;
+         }
+      }
+   }
+
+   elapsed = now_s() - start;
+
+   if (0 != mpu9250RecClose(&w))
+   {
+      perror("From Record: Failed to close the recording");
+      rv = errno;
+   }
+
+   for (i = 0; i < g_count; i++)
+   {
+      printf("From Record: sensor %u, %llu samples, %llu lost\n", g_sensors[i].index,
+             (unsigned long long)g_sensors[i].samples, (unsigned long long)g_sensors[i].overruns);
+      samples += g_sensors[i].samples;
+      close(g_sensors[i].fd);
+   }
+
+   printf("From Record: %.1f s, %llu bytes, %.2f bytes/sample, %.0f samples/s\n", elapsed,
+          (unsigned long long)w.bytes, samples ? (double)w.bytes / samples : 0.0, samples / elapsed);
+
+   return rv;
+}
@@ -0,0 +1,234 @@
+/**
+ * @file   replayMyMPU9250.c
+ * @author Rodrigo A. Tirapegui
+ * @brief  Replays a binary recording through the conversion library.
+ *
+ * Decodes the recording written by recordMyMPU9250.c, merges the samples of every
+ * sensor in time order and converts them with the scale and calibration each sensor
+ * had while recording, exactly as a live client of MPU9250_IOC_READ_BATCH would. The
+ * samples are delivered at the recorded pace, or as fast as possible with -f, from
+ * the time given with -s on, found with a binary search on the recording index.
+ * Once per recorded second the latest converted sample of every sensor is printed,
+ * at the end the replay throughput.
+ * Run it as "./replay [-f] [-s seconds] file.rec".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "myMPU9250.h"
+#include "myMPU9250_uapi.h"
+#include "myMPU9250_conv.h"
+#include "myMPU9250_calib.h"
+#include "myMPU9250_rec.h"
+
+// Constants
+#define BATCH_LENGTH        64                  ///< Samples decoded per sensor at once
+#define PRINT_PERIOD_NS     1000000000LL        ///< Recorded time between printed samples
+
+// Types
+
+/* Replay state of a recorded sensor */
+typedef struct
+{
+   MPU9250_Conv_t conv;
+   MPU9250_Sample_t samples[BATCH_LENGTH];
+   unsigned int count;                // Decoded samples
+   unsigned int next;                 // Next of them to deliver
+   int64_t printed;                   // Timestamp of the last printed sample
+   uint64_t delivered;
+
+} Replayed_t;
+
+// Variables
+static Replayed_t           g_sensors[MPU9250_GROUP_MAX];       ///< Every sensor of the recording
+
+// Private functions
+
+/** @brief Time on the monotonic clock [ns] */
+static int64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @brief Sleeps until a time of the monotonic clock [ns] */
+static void sleep_until(int64_t t)
+{
+   struct timespec ts = { .tv_sec = t / 1000000000, .tv_nsec = t % 1000000000 };
+
+   while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+      ;
+}
+
+/** @brief Decodes more samples of a sensor when it delivered all of them
+ *  @return 1 when the sensor has a sample to deliver, 0 at its end or -1 on error
+ */
+static int refill(MPU9250_RecReader_t *r, unsigned int sensor)
+{
+   Replayed_t *s = &g_sensors[sensor];
+   int n;
+
+   if (s->next < s->count)
+      return 1;
+
+   n = mpu9250RecRead(r, sensor, s->samples, BATCH_LENGTH);
+
+   s->count = (0 < n) ? n : 0;
+   s->next = 0;
+
+   return (0 < n) ? 1 : n;
+}
+
+/** @brief Converts and prints samples, the same work a live client does per batch */
+static void deliver(unsigned int sensor, unsigned int count)
+{
+   Replayed_t *s = &g_sensors[sensor];
+   const MPU9250_Sample_t *samples = &s->samples[s->next];
+   float ax[BATCH_LENGTH], ay[BATCH_LENGTH], az[BATCH_LENGTH];
+   float gx[BATCH_LENGTH], gy[BATCH_LENGTH], gz[BATCH_LENGTH];
+   MPU9250_ConvFloat_t out = { .accel = { ax, ay, az }, .gyro = { gx, gy, gz } };
+   unsigned int last = count - 1;
+
+   mpu9250ConvSamples(&s->conv, samples, count, &out);
+
+   if (samples[last].timestamp - s->printed >= PRINT_PERIOD_NS)
+   {
+      printf("From Replay: [sensor %u, %lld ns] Acelerometro = (%f, %f, %f) [m/s2] Giroscopo = (%f, %f, %f) [rad/s]\n",
+             sensor, (long long)samples[last].timestamp, ax[last], ay[last], az[last], gx[last], gy[last], gz[last]);
+      s->printed = samples[last].timestamp;
+   }
+
+   s->next += count;
+   s->delivered += count;
+}
+
+// Public functions
+int main(int argc, char *argv[])
+{
+   MPU9250_RecReader_t r;
+   MPU9250_ConvParams_t params;
+   int64_t first, last, start, t0 = 0, wall0 = 0, limit;
+   double offset = 0.0;
+   int fast = 0;
+   unsigned int i, sensor, n;
+   uint64_t total = 0;
+   int opt, rv = 0;
+
+   while (-1 != (opt = getopt(argc, argv, "fs:")))
+   {
+      switch (opt)
+      {
+         case 'f': fast = 1; break;
+         case 's': offset = atof(optarg); break;
+         default:
+            optind = argc;
+            break;
+      }
+   }
+
+   if (optind + 1 != argc)
+   {
+      fprintf(stderr, "Usage: %s [-f] [-s seconds] file.rec\n", argv[0]);
+      return EINVAL;
+   }
+
+   if (0 != mpu9250RecOpen(&r, argv[optind]))
+   {
+      perror("From Replay: Failed to open the recording");
+      return errno;
+   }
+
+   printf("From Replay: %llu samples", (unsigned long long)mpu9250RecSpan(&r, &first, &last));
+   printf(" over %.3f s%s\n", (last - first) * 1e-9, r.header.indexOffset ? "" : ", index rebuilt");
+
+   for (i = 0; i < MPU9250_GROUP_MAX; i++)
+   {
+      if (!(r.header.sensors & (1u << i)))
+         continue;
+
+      /* Scale and calibration of the sensor at recording time, MPU9250 axes */
+      mpu9250ConvDefaults(&params, &r.header.sensor[i].scale, NULL);
+      mpu9250CalibParams(&r.header.sensor[i].calib, &params);
+      mpu9250ConvInit(&g_sensors[i].conv, &params, MPU9250_FIFO_FRAME_SIZE);
+      g_sensors[i].printed = INT64_MIN / 2;
+
+      printf("From Replay: sensor %u at %u Hz, +-%u g, +-%u dps\n", i, r.header.sensor[i].config.odrHz,
+             r.header.sensor[i].config.accelRangeG, r.header.sensor[i].config.gyroRangeDps);
+   }
+
+   mpu9250RecSeek(&r, first + (int64_t)(offset * 1e9));
+   start = now_ns();
+
+   while (1)
+   {
+      /* The sensor with the oldest pending sample goes next */
+      sensor = MPU9250_GROUP_MAX;
+
+      for (i = 0; i < MPU9250_GROUP_MAX; i++)
+      {
+         if (!(r.header.sensors & (1u << i)))
+            continue;
+
+         opt = refill(&r, i);
+
+         if (0 > opt)
+         {
+            fprintf(stderr, "From Replay: Damaged chunk of sensor %u\n", i);
+            rv = EIO;
+         }
+
+         if ((1 == opt) && ((MPU9250_GROUP_MAX == sensor) ||
+             (g_sensors[i].samples[g_sensors[i].next].timestamp < g_sensors[sensor].samples[g_sensors[sensor].next].timestamp)))
+         {
+            sensor = i;
+         }
+      }
+
+      if (MPU9250_GROUP_MAX == sensor)
+         break;
+
+      /* Its samples up to the next pending sample of any other sensor go at once */
+      limit = INT64_MAX;
+
+      for (i = 0; i < MPU9250_GROUP_MAX; i++)
+      {
+         if ((i != sensor) && (g_sensors[i].next < g_sensors[i].count) &&
+             (g_sensors[i].samples[g_sensors[i].next].timestamp < limit))
+         {
+            limit = g_sensors[i].samples[g_sensors[i].next].timestamp;
+         }
+      }
+
+      for (n = 1; (g_sensors[sensor].next + n < g_sensors[sensor].count) &&
+                  (g_sensors[sensor].samples[g_sensors[sensor].next + n].timestamp <= limit); n++)
+         ;
+
+      if (!fast)
+      {
+         /* Recorded time maps to wall time from the first delivered sample */
+         if (0 == total)
+         {
+            t0 = g_sensors[sensor].samples[g_sensors[sensor].next].timestamp;
+            wall0 = now_ns();
+         }
+
+         sleep_until(wall0 + (g_sensors[sensor].samples[g_sensors[sensor].next + n - 1].timestamp - t0));
+      }
+
+      deliver(sensor, n);
+      total += n;
+   }
+
+   printf("From Replay: %llu samples in %.3f s, %.0f samples/s\n", (unsigned long long)total,
+          (now_ns() - start) * 1e-9, total / ((now_ns() - start) * 1e-9));
+
+   mpu9250RecRelease(&r);
+
+   return rv;
+}
@@ -6,79 +6,195 @@
  * @brief  A Linux user space program that communicates with the myMPU9250.c LKM. 
  *         It passes a string to the LKM and reads the response from the LKM. 
  * 
- * For this example to work the device must be called /dev/i2cMPU9250.
+ * For this example to work the device must be called /dev/i2cMPU9250-0, the first sensor.
+ * Run it as "./test stream" to read FIFO frames when the LKM is loaded with streaming=1,
+ * as "./test batch" to read typed samples with the batch ioctl, as "./test mmap"
+ * to read the shared sample ring without copies, or as "./test group" to read one
+ * time-aligned sample of every sensor. "./test filter [Hz]" lets the driver low-pass
+ * filter and decimate the stream down to the given rate. "./test broker [sensor]" reads
+ * the shared memory ring of the broker daemon instead of the device. "./test calibrate [file]" estimates the
+ * sensor offsets while the board rests on one or more faces, writes them into the
+ * sensor and persists the calibration of every sensor as module parameters.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <math.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 #include "myMPU9250.h"
+#include "myMPU9250_uapi.h"
+#include "myMPU9250_conv.h"
+#include "myMPU9250_calib.h"
+#include "myMPU9250_broker.h"
 
 // Constants
-#define DEVICE_UNDER_TEST   "/dev/i2cMPU9250"   ///< Device under test
+#define DEVICE_UNDER_TEST   "/dev/i2cMPU9250-0" ///< Device under test
+#define DEVICE_PATTERN      "/dev/i2cMPU9250-%u" ///< Character device of sensor N
 #define BUFFER_LENGTH       256                 ///< The buffer length
+#define FRAME_SIZE_MIN      2                   ///< Smallest FIFO frame, the temperature or a single gyro axis
+#define POLL_TIMEOUT_MS     1000                ///< Time to wait for streamed frames
+#define BATCH_LENGTH        32                  ///< Samples per batch read
+#define CALIB_WINDOWS       40                  ///< Still windows to average, 10 s at 1 kHz
+#define GROUP_PERIOD_US     100000              ///< Time between grouped reads
+#define FILTER_RATE_HZ      100                 ///< Default output rate of the decimation test
+#define CALIB_FILE          "/etc/modprobe.d/myMPU9250.conf"  ///< Calibration loaded at every probe
 
-// Types
-typedef struct 
+// Variables
+static char                 g_rxData[BUFFER_LENGTH];            ///< The receive buffer from the LKM
+static const signed char    g_rotation[3][3] = {                ///< Body axes from MPU9250 axes
+                                                 { 0, 1, 0 },
+                                                 { 1, 0, 0 },
+                                                 { 0, 0, -1 },
+                                               };
+static MPU9250_Conv_t       g_conv;                             ///< Converter of the current driver configuration
+
+// Private functions
+/** @brief Loads the scale factors and frame layout of the current driver configuration
+ *  The 16 g and 2000 dps defaults are kept when the driver does not support the query.
+ *  Typed samples convert with any layout, raw frames only with the 14 and 21 byte ones;
+ *  for other channel sets the converter is set up for 14 byte register reads.
+ *  @param fd The device file descriptor
+ *  @return 0 on success or -1 if raw frames of the current layout cannot be converted
+ */
+static int load_scale(int fd)
 {
-   /* Data counts */
-   short _axcounts, _aycounts, _azcounts;
-   short _gxcounts, _gycounts, _gzcounts;
-   short _tcounts;
+   unsigned int version;
+   MPU9250_Scale_t scale;
+   MPU9250_Layout_t layout = { MPU9250_FIFO_ACCEL | MPU9250_FIFO_TEMP | MPU9250_FIFO_GYRO, MPU9250_FIFO_FRAME_SIZE };
+   MPU9250_Calib_t calib;
+   MPU9250_ConvParams_t params;
+   const MPU9250_Scale_t *driverScale = NULL;
+   const MPU9250_Calib_t *driverCalib = NULL;
+   unsigned int frameSize = MPU9250_FIFO_FRAME_SIZE;
+
+   if ((0 == ioctl(fd, MPU9250_IOC_GET_VERSION, &version)) && (MPU9250_UAPI_VERSION == version))
+   {
+      if (0 == ioctl(fd, MPU9250_IOC_GET_SCALE, &scale))
+         driverScale = &scale;
 
-   /* Data buffer */
-   float _ax, _ay, _az;
-   float _gx, _gy, _gz;
-   float _t;
+      if (0 == ioctl(fd, MPU9250_IOC_GET_LAYOUT, &layout))
+         frameSize = layout.frameSize;
 
-   /* Gyro bias estimation */
-   float _gxb, _gyb, _gzb;
+      if (0 == ioctl(fd, MPU9250_IOC_GET_CALIB, &calib))
+         driverCalib = &calib;
+   }
 
-   /* Accel bias and scale factor estimation */
-   float _axb, _ayb, _azb;
-   float _axs, _ays, _azs;
+   /* Biases are removed by the sensor itself, only the accel scale factors are applied here */
+   mpu9250ConvDefaults(&params, driverScale, g_rotation);
 
-   /* Scale factors */
-   float _accelScale;
-   float _gyroScale;
-   float _tempScale;
-   float _tempOffset;
+   if (NULL != driverCalib)
+      mpu9250CalibParams(driverCalib, &params);
 
-   /* Transformation matrix */
-   short tX[3];
-   short tY[3];
-   short tZ[3];
+   if (0 == mpu9250ConvInit(&g_conv, &params, frameSize))
+      return 0;
 
-   /* Track success of interacting with sensor */
-   char _status;
+   printf("From TestApp: Frames of %u bytes (channels 0x%02x) cannot be converted, try \"./test batch\"\n", frameSize, layout.fifoEnable);
 
-} MPU9250_Control_t;
+   mpu9250ConvInit(&g_conv, &params, MPU9250_FIFO_FRAME_SIZE);
 
-// Variables
-static char                         g_txData[BUFFER_LENGTH];    ///< The transmit buffer to the LKM
-static char                         g_rxData[BUFFER_LENGTH];    ///< The receive buffer from the LKM
-static MPU9250_Control_t   g_MPU9250Control =  {                   
-                                                ._tempScale = 333.87f,
-                                                ._tempOffset = 21.0f,
-                                                ._axs = 1.0f,
-                                                ._ays = 1.0f,
-                                                ._azs = 1.0f,
-                                                ._accelScale = 9.807f * (16.0f / 32767.5f),
-                                                ._gyroScale = 2000.0f / 32767.5f * (3.14159265359f/180.0f),
-                                                .tX[0] = 0,
-                                                .tX[1] = 1,
-                                                .tX[2] = 0,
-                                                .tY[0] = 1,
-                                                .tY[1] = 0,
-                                                .tY[2] = 0,
-                                                .tZ[0] = 0,
-                                                .tZ[1] = 0,
-                                                .tZ[2] = -1,
-                                                };             ///< Control data structure of hardware sensor MPU9250
+   return -1;
+}
+
+/** @brief Converts and prints accel, temperature, gyro and magnetometer frames as read from MPU9250_ACCEL_OUT
+ *  @param frames The pointer to the frames, the magnetometer is only present in 21 bytes frames
+ *  @param count Number of frames
+ */
+static void print_frames(const char *frames, unsigned int count)
+{
+   float v[MPU9250_CONV_AXES][BUFFER_LENGTH / FRAME_SIZE_MIN];
+   MPU9250_ConvFloat_t out = {
+                               .accel = { v[MPU9250_CONV_ACCEL], v[MPU9250_CONV_ACCEL + 1], v[MPU9250_CONV_ACCEL + 2] },
+                               .gyro  = { v[MPU9250_CONV_GYRO],  v[MPU9250_CONV_GYRO + 1],  v[MPU9250_CONV_GYRO + 2] },
+                               .mag   = { v[MPU9250_CONV_MAG],   v[MPU9250_CONV_MAG + 1],   v[MPU9250_CONV_MAG + 2] },
+                               .temp  = v[MPU9250_CONV_TEMP],
+                             };
+   unsigned int i;
+
+   /* Convert the whole batch at once */
+   mpu9250ConvFrames(&g_conv, frames, count, &out);
+
+   for (i = 0; i < count; i++)
+   {
+      printf("From TestApp: Giroscopo = (%f, %f, %f) [rad/s]\r\n", out.gyro[0][i], out.gyro[1][i], out.gyro[2][i]);
+
+      printf("From TestApp: Acelerometro = (%f, %f, %f) [m/s2]\r\n", out.accel[0][i], out.accel[1][i], out.accel[2][i]);
+
+      if (MPU9250_FIFO_FRAME_SIZE < g_conv.frameSize)
+      {
+         printf("From TestApp: Magnetometro = (%f, %f, %f) [uT]%s\r\n", out.mag[0][i], out.mag[1][i], out.mag[2][i],
+                (frames[i * g_conv.frameSize + 20] & MPU9250_AK8963_ST2_HOFL) ? " overflow" : "");
+      }
+
+      printf("From TestApp: Temperatura = %f [C]\r\n\r\n", out.temp[i]);
+   }
+}
+
+static int stream_test(void)
+{
+   int ret, fd;
+   struct pollfd pfd;
+
+   printf("From TestApp: Starting device streaming test..\n");
+
+   /* Open the device with read access, frames come from the driver ring buffer */
+   fd = open(DEVICE_UNDER_TEST, O_RDONLY | O_NONBLOCK);
+
+   if (0 > fd)
+   {
+      printf("From TestApp: Failed to open the device %s\n", DEVICE_UNDER_TEST);
+      
+      return errno;
+   }
+
+   /* The frames are decoded here, so their layout must be one the converter knows */
+   if (0 != load_scale(fd))
+   {
+      close(fd);
+
+      return EINVAL;
+   }
+
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+
+   /* Repeat until no frame arrives in time */
+   while(1)
+   {
+      /* Sleep until the driver has complete frames */
+      ret = poll(&pfd, 1, POLL_TIMEOUT_MS);
+
+      if(0 >= ret)
+      {
+         printf("From TestApp: No frames from the device %s\n", DEVICE_UNDER_TEST);
+         break;
+      }
+
+      /* Read as many whole frames as fit in the buffer */
+      ret = read(fd, g_rxData, sizeof(g_rxData));
+
+      if(0 > ret)
+      {
+         if(EAGAIN == errno)
+            continue;
+
+         printf("From TestApp: Failed to read the message from the device.\n");
+
+         return errno;
+      }
+
+      print_frames(g_rxData, ret / g_conv.frameSize);
+   }
+
+   close(fd);
+
+   return 0;
+}
 
-// Private functions
 static int unit_test(void)
 {
    int ret, fd, c;
@@ -94,6 +210,9 @@ static int unit_test(void)
       
       return errno;
    }
+
+   /* Scale factors of the configuration the driver is running with, registers are read as 14 byte frames with any FIFO layout */
+   load_scale(fd);
    
    /* Repeat forever */
    while(1)
@@ -108,21 +227,8 @@ static int unit_test(void)
 
       printf("From TestApp: Reading from the device %s\n", DEVICE_UNDER_TEST);
 
-      /* Fill txBuffer with MPU9250 register */
-      g_txData[0] = MPU9250_ACCEL_OUT;
-
-      /* Send the data to the LKM */
-      ret = write(fd, g_txData, 1); 
-
-      if(0 > ret)
-      {
-         printf("From TestApp: Failed to write the message to the device.\n");
-         
-         return errno;
-      }
-
-      /* Read the response from the LKM */
-      ret = read(fd, g_rxData, 15);
+      /* Read the accel, temperature, gyro and magnetometer registers in one syscall and one bus transaction */
+      ret = pread(fd, g_rxData, g_conv.frameSize, MPU9250_ACCEL_OUT);
       
       if(0 > ret)
       {
@@ -132,33 +238,7 @@ static int unit_test(void)
       }
 
       /* Parse response from LKM */
-      g_MPU9250Control._axcounts = (((short)g_rxData[0]) << 8)  | g_rxData[1];
-      g_MPU9250Control._aycounts = (((short)g_rxData[2]) << 8)  | g_rxData[3];
-      g_MPU9250Control._azcounts = (((short)g_rxData[4]) << 8)  | g_rxData[5];
-      g_MPU9250Control._tcounts  = (((short)g_rxData[6]) << 8)  | g_rxData[7];
-      g_MPU9250Control._gxcounts = (((short)g_rxData[8]) << 8)  | g_rxData[9];
-      g_MPU9250Control._gycounts = (((short)g_rxData[10]) << 8) | g_rxData[11];
-      g_MPU9250Control._gzcounts = (((short)g_rxData[12]) << 8) | g_rxData[13];
-
-      /* Transform and convert to float values */
-	  g_MPU9250Control._ax = (((float)(g_MPU9250Control.tX[0]*g_MPU9250Control._axcounts + g_MPU9250Control.tX[1]*g_MPU9250Control._aycounts + g_MPU9250Control.tX[2]*g_MPU9250Control._azcounts) * g_MPU9250Control._accelScale) - g_MPU9250Control._axb)*g_MPU9250Control._axs;
-	  g_MPU9250Control._ay = (((float)(g_MPU9250Control.tY[0]*g_MPU9250Control._axcounts + g_MPU9250Control.tY[1]*g_MPU9250Control._aycounts + g_MPU9250Control.tY[2]*g_MPU9250Control._azcounts) * g_MPU9250Control._accelScale) - g_MPU9250Control._ayb)*g_MPU9250Control._ays;
-	  g_MPU9250Control._az = (((float)(g_MPU9250Control.tZ[0]*g_MPU9250Control._axcounts + g_MPU9250Control.tZ[1]*g_MPU9250Control._aycounts + g_MPU9250Control.tZ[2]*g_MPU9250Control._azcounts) * g_MPU9250Control._accelScale) - g_MPU9250Control._azb)*g_MPU9250Control._azs;
-	  g_MPU9250Control._gx = ((float) (g_MPU9250Control.tX[0]*g_MPU9250Control._gxcounts + g_MPU9250Control.tX[1]*g_MPU9250Control._gycounts + g_MPU9250Control.tX[2]*g_MPU9250Control._gzcounts) * g_MPU9250Control._gyroScale) -  g_MPU9250Control._gxb;
-	  g_MPU9250Control._gy = ((float) (g_MPU9250Control.tY[0]*g_MPU9250Control._gxcounts + g_MPU9250Control.tY[1]*g_MPU9250Control._gycounts + g_MPU9250Control.tY[2]*g_MPU9250Control._gzcounts) * g_MPU9250Control._gyroScale) -  g_MPU9250Control._gyb;
-	  g_MPU9250Control._gz = ((float) (g_MPU9250Control.tZ[0]*g_MPU9250Control._gxcounts + g_MPU9250Control.tZ[1]*g_MPU9250Control._gycounts + g_MPU9250Control.tZ[2]*g_MPU9250Control._gzcounts) * g_MPU9250Control._gyroScale) -  g_MPU9250Control._gzb;
-	  g_MPU9250Control._t = ((((float) g_MPU9250Control._tcounts) - g_MPU9250Control._tempOffset)/ g_MPU9250Control._tempScale) + g_MPU9250Control._tempOffset;
-
-      /* Print results */
-      printf("From TestApp: Giroscopo = (%f, %f, %f) [rad/s]\r\n", g_MPU9250Control._gx,
-                                                                   g_MPU9250Control._gy,
-                                                                   g_MPU9250Control._gz );
-
-	  printf("From TestApp: Acelerometro = (%f, %f, %f) [m/s2]\r\n", g_MPU9250Control._ax,
-                                                                     g_MPU9250Control._ay,
-                                                                     g_MPU9250Control._az );
-
-	  printf("From TestApp: Temperatura = %f [C]\r\n\r\n", g_MPU9250Control._t);
+      print_frames(g_rxData, 1);
    }
 
    /* Close the device with read/write access */
@@ -176,8 +256,516 @@ static int unit_test(void)
    return 0;
 }
 
+static int batch_test(void)
+{
+   int ret, fd;
+   unsigned int i;
+   MPU9250_Sample_t samples[BATCH_LENGTH];
+   MPU9250_Batch_t batch;
+   float ax[BATCH_LENGTH], ay[BATCH_LENGTH], az[BATCH_LENGTH];
+   MPU9250_ConvFloat_t out = { .accel = { ax, ay, az } };
+
+   printf("From TestApp: Starting device batch test..\n");
+
+   fd = open(DEVICE_UNDER_TEST, O_RDONLY);
+
+   if (0 > fd)
+   {
+      printf("From TestApp: Failed to open the device %s\n", DEVICE_UNDER_TEST);
+      
+      return errno;
+   }
+
+   load_scale(fd);
+
+   /* Repeat forever, every call blocks until samples are available */
+   while(1)
+   {
+      batch.samples = (unsigned long)samples;
+      batch.count = BATCH_LENGTH;
+
+      ret = ioctl(fd, MPU9250_IOC_READ_BATCH, &batch);
+
+      if(0 > ret)
+      {
+         printf("From TestApp: Failed to read a batch from the device.\n");
+         break;
+      }
+
+      if(0 != batch.overruns)
+         printf("From TestApp: Lost %u samples\n", batch.overruns);
+
+      /* Only the accelerometer is converted, the other outputs are NULL */
+      mpu9250ConvSamples(&g_conv, samples, batch.count, &out);
+
+      for(i = 0; i < batch.count; i++)
+      {
+         printf("From TestApp: [%lld ns] Acelerometro = (%f, %f, %f) [m/s2]\n",
+                (long long)samples[i].timestamp, ax[i], ay[i], az[i]);
+      }
+   }
+
+   close(fd);
+
+   return errno;
+}
+
+static int group_test(void)
+{
+   int ret, fd;
+   unsigned int i;
+   MPU9250_Group_t group;
+
+   printf("From TestApp: Starting device group test..\n");
+
+   fd = open(DEVICE_UNDER_TEST, O_RDONLY);
+
+   if (0 > fd)
+   {
+      printf("From TestApp: Failed to open the device %s\n", DEVICE_UNDER_TEST);
+      
+      return errno;
+   }
+
+   /* Repeat forever, any sensor file returns the samples of all of them */
+   while(1)
+   {
+      memset(&group, 0, sizeof(group));
+
+      ret = ioctl(fd, MPU9250_IOC_READ_GROUP, &group);
+
+      if(0 > ret)
+      {
+         printf("From TestApp: Failed to read a group from the device.\n");
+         break;
+      }
+
+      /* The skew is how far each sample is from the common reference time */
+      for(i = 0; i < group.count; i++)
+      {
+         printf("From TestApp: [sensor %u, %+lld ns] Acelerometro = (%d, %d, %d)\n",
+                group.index[i], (long long)(group.samples[i].timestamp - group.timestamp),
+                group.samples[i].accel[0], group.samples[i].accel[1], group.samples[i].accel[2]);
+      }
+
+      usleep(GROUP_PERIOD_US);
+   }
+
+   close(fd);
+
+   return errno;
+}
+
+/** @brief Designs a low-pass FIR for the decimation stage of the driver
+ *  Hamming windowed sinc with its cutoff at 80 % of the output Nyquist frequency, the
+ *  coefficients are quantized to Q15 and the rounding error goes to the center tap so
+ *  the DC gain is exactly one.
+ *  @param filter The filter settings, decimation must be set
+ */
+static void design_fir(MPU9250_Filter_t *filter)
+{
+   unsigned int taps = 4 * filter->decimation + 1;
+   double fc = 0.4 / filter->decimation;
+   double h, x;
+   int sum = 0;
+   unsigned int k;
+
+   if (MPU9250_FILTER_TAPS_MAX <= taps)
+      taps = MPU9250_FILTER_TAPS_MAX - 1;
+
+   filter->type = MPU9250_FILTER_FIR;
+   filter->taps = taps;
+
+   for (k = 0; k < taps; k++)
+   {
+      x = (double)k - (taps - 1) / 2.0;
+      h = (0.0 == x) ? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x);
+      h *= 0.54 - 0.46 * cos(2.0 * M_PI * k / ((1 < taps) ? taps - 1 : 1));
+
+      filter->coeff[k] = (short)lround(h * 32768.0);
+      sum += filter->coeff[k];
+   }
+
+   filter->coeff[(taps - 1) / 2] += 32768 - sum;
+}
+
+static int filter_test(unsigned int rateHz)
+{
+   int ret, fd;
+   unsigned int i;
+   MPU9250_Sample_t samples[BATCH_LENGTH];
+   MPU9250_Batch_t batch;
+   MPU9250_Config_t config;
+   MPU9250_Filter_t filter;
+
+   printf("From TestApp: Starting device filter test..\n");
+
+   fd = open(DEVICE_UNDER_TEST, O_RDONLY);
+
+   if (0 > fd)
+   {
+      printf("From TestApp: Failed to open the device %s\n", DEVICE_UNDER_TEST);
+      
+      return errno;
+   }
+
+   if ((0 == rateHz) || (0 > ioctl(fd, MPU9250_IOC_GET_CONFIG, &config)))
+   {
+      printf("From TestApp: Failed to get the sampling configuration.\n");
+      close(fd);
+      return EINVAL;
+   }
+
+   memset(&filter, 0, sizeof(filter));
+   filter.decimation = (config.odrHz + rateHz / 2) / rateHz;
+
+   if (1 > filter.decimation)
+      filter.decimation = 1;
+
+   design_fir(&filter);
+
+   if ((0 > ioctl(fd, MPU9250_IOC_SET_FILTER, &filter)) || (0 > ioctl(fd, MPU9250_IOC_GET_FILTER, &filter)))
+   {
+      printf("From TestApp: Failed to set the filter, is the LKM loaded with streaming=1?\n");
+      close(fd);
+      return errno;
+   }
+
+   printf("From TestApp: %u Hz decimated by %u with %u taps, %.3f Hz out\n",
+          config.odrHz, filter.decimation, filter.taps, filter.rateMilliHz / 1000.0);
+
+   /* Repeat forever, every call blocks until filtered samples are available */
+   while(1)
+   {
+      batch.samples = (unsigned long)samples;
+      batch.count = BATCH_LENGTH;
+
+      ret = ioctl(fd, MPU9250_IOC_READ_BATCH, &batch);
+
+      if(0 > ret)
+      {
+         printf("From TestApp: Failed to read a batch from the device.\n");
+         break;
+      }
+
+      if(0 != batch.overruns)
+         printf("From TestApp: Lost %u input samples, the filter restarted\n", batch.overruns);
+
+      for(i = 0; i < batch.count; i++)
+      {
+         printf("From TestApp: [%lld ns] Acelerometro = (%d, %d, %d)\n", (long long)samples[i].timestamp,
+                samples[i].accel[0], samples[i].accel[1], samples[i].accel[2]);
+      }
+   }
+
+   close(fd);
+
+   return errno;
+}
+
+static int mmap_test(void)
+{
+   int fd;
+   unsigned int tail, head, n;
+   struct pollfd pfd;
+   MPU9250_Ring_t *ring;
+   const MPU9250_Sample_t *records;
+   MPU9250_Sample_t sample;
+
+   printf("From TestApp: Starting device mmap test..\n");
+
+   fd = open(DEVICE_UNDER_TEST, O_RDONLY);
+
+   if (0 > fd)
+   {
+      printf("From TestApp: Failed to open the device %s\n", DEVICE_UNDER_TEST);
+      
+      return errno;
+   }
+
+   /* Map the header page first to learn the ring size */
+   ring = mmap(NULL, sizeof(MPU9250_Ring_t), PROT_READ, MAP_SHARED, fd, 0);
+
+   if (MAP_FAILED == ring)
+   {
+      printf("From TestApp: Failed to map the device %s, is streaming enabled?\n", DEVICE_UNDER_TEST);
+      close(fd);
+
+      return errno;
+   }
+
+   n = ring->mapSize;
+   munmap(ring, sizeof(MPU9250_Ring_t));
+
+   ring = mmap(NULL, n, PROT_READ, MAP_SHARED, fd, 0);
+
+   if ((MAP_FAILED == ring) || (MPU9250_RING_MAGIC != ring->magic) || (MPU9250_RING_VERSION != ring->version))
+   {
+      printf("From TestApp: Unexpected ring in the device %s\n", DEVICE_UNDER_TEST);
+      close(fd);
+
+      return EINVAL;
+   }
+
+   records = (const MPU9250_Sample_t *)((const char *)ring + ring->dataOffset);
+   tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+   ioctl(fd, MPU9250_IOC_SET_TAIL, &tail);
+
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+
+   /* Repeat until no record arrives in time */
+   while(0 < poll(&pfd, 1, POLL_TIMEOUT_MS))
+   {
+      head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+      /* Skip what the producer already overwrote */
+      if (head - tail > ring->capacity)
+      {
+         printf("From TestApp: Lost %u records\n", head - tail - ring->capacity);
+         tail = head - ring->capacity;
+      }
+
+      for (; tail != head; tail++)
+      {
+         sample = records[tail & (ring->capacity - 1)];
+
+         /* Check the copy was not overwritten meanwhile */
+         if (__atomic_load_n(&ring->reserve, __ATOMIC_ACQUIRE) - tail > ring->capacity)
+            continue;
+
+         printf("From TestApp: [%lld ns] Acelerometro = (%d, %d, %d) Giroscopo = (%d, %d, %d)",
+                (long long)sample.timestamp,
+                sample.accel[0], sample.accel[1], sample.accel[2],
+                sample.gyro[0], sample.gyro[1], sample.gyro[2]);
+
+         if (sample.flags & MPU9250_SAMPLE_MAG)
+            printf(" Magnetometro = (%d, %d, %d)", sample.mag[0], sample.mag[1], sample.mag[2]);
+
+         printf("\n");
+      }
+
+      /* poll() blocks again once the driver knows every record was consumed */
+      ioctl(fd, MPU9250_IOC_SET_TAIL, &tail);
+   }
+
+   munmap(ring, n);
+   close(fd);
+
+   return 0;
+}
+
+static int broker_test(unsigned int sensor)
+{
+   unsigned int i, n;
+   uint64_t overruns = 0;
+   MPU9250_Broker_t c;
+   MPU9250_ConvParams_t params;
+   MPU9250_Sample_t samples[BATCH_LENGTH];
+   float ax[BATCH_LENGTH], ay[BATCH_LENGTH], az[BATCH_LENGTH];
+   MPU9250_ConvFloat_t out = { .accel = { ax, ay, az } };
+
+   printf("From TestApp: Starting broker test..\n");
+
+   if (0 != mpu9250BrokerAttach(&c, sensor))
+   {
+      printf("From TestApp: Failed to attach to sensor %u, is the broker running?\n", sensor);
+
+      return errno;
+   }
+
+   /* The broker publishes the scale and calibration the sensor had when it started */
+   mpu9250ConvDefaults(&params, &c.ring->scale, g_rotation);
+   /* A zero gain means the broker could not read the calibration */
+   if (0 != c.ring->calib.accelGainMicro[0])
+      mpu9250CalibParams(&c.ring->calib, &params);
+
+   mpu9250ConvInit(&g_conv, &params, MPU9250_FIFO_FRAME_SIZE);
+
+   /* Repeat until the broker stops, reads cost no syscall */
+   while(1)
+   {
+      n = mpu9250BrokerRead(&c, samples, BATCH_LENGTH);
+
+      if(0 == n)
+      {
+         if(0 != mpu9250BrokerWait(&c, POLL_TIMEOUT_MS))
+         {
+            printf("From TestApp: No samples from the broker, %s\n", strerror(errno));
+            break;
+         }
+
+         continue;
+      }
+
+      if(overruns != c.overruns)
+      {
+         printf("From TestApp: Lost %llu samples\n", (unsigned long long)(c.overruns - overruns));
+         overruns = c.overruns;
+      }
+
+      mpu9250ConvSamples(&g_conv, samples, n, &out);
+
+      for(i = 0; i < n; i++)
+      {
+         printf("From TestApp: [%lld ns] Acelerometro = (%f, %f, %f) [m/s2]\n",
+                (long long)samples[i].timestamp, ax[i], ay[i], az[i]);
+      }
+   }
+
+   mpu9250BrokerDetach(&c);
+
+   return errno;
+}
+
+/** @brief Saves the calibration every sensor holds now, one entry per bus device
+ *  The file is rewritten, the sensors not calibrated this time keep theirs.
+ *  @param path The modprobe.d file
+ *  @return 0 on success or -1 on error
+ */
+static int calib_save(const char *path)
+{
+   MPU9250_CalibEntry_t entries[MPU9250_GROUP_MAX];
+   char node[32];
+   unsigned int i, count = 0;
+   int fd;
+
+   for (i = 0; i < MPU9250_GROUP_MAX; i++)
+   {
+      snprintf(node, sizeof(node), DEVICE_PATTERN, i);
+      fd = open(node, O_RDONLY);
+
+      if (0 > fd)
+         continue;
+
+      if ((0 == ioctl(fd, MPU9250_IOC_GET_CALIB, &entries[count].calib)) &&
+          (0 == mpu9250CalibDevice(fd, entries[count].device, sizeof(entries[count].device))))
+      {
+         printf("From TestApp: Saving the calibration of %s, bus device %s\n", node, entries[count].device);
+         count++;
+      }
+
+      close(fd);
+   }
+
+   return mpu9250CalibSave(path, entries, count);
+}
+
+static int calib_test(const char *path)
+{
+   int ret, fd;
+   unsigned int still = 0, faces = 0;
+   unsigned int version;
+   MPU9250_Sample_t samples[BATCH_LENGTH];
+   MPU9250_Batch_t batch;
+   MPU9250_Scale_t scale;
+   MPU9250_Config_t config;
+   MPU9250_Calib_t current, next;
+   MPU9250_ConvParams_t params;
+   MPU9250_Calibrator_t cal;
+
+   printf("From TestApp: Starting device calibration, keep the board still and turn it to other faces to estimate the accel scale..\n");
+
+   /* Writing the offsets needs write access */
+   fd = open(DEVICE_UNDER_TEST, O_RDWR);
+
+   if (0 > fd)
+   {
+      printf("From TestApp: Failed to open the device %s\n", DEVICE_UNDER_TEST);
+      
+      return errno;
+   }
+
+   if ((0 != ioctl(fd, MPU9250_IOC_GET_VERSION, &version)) || (MPU9250_UAPI_VERSION != version) ||
+       (0 != ioctl(fd, MPU9250_IOC_GET_SCALE, &scale)) || (0 != ioctl(fd, MPU9250_IOC_GET_CONFIG, &config)) ||
+       (0 != ioctl(fd, MPU9250_IOC_GET_CALIB, &current)))
+   {
+      printf("From TestApp: The device %s does not support calibration\n", DEVICE_UNDER_TEST);
+      close(fd);
+
+      return EINVAL;
+   }
+
+   mpu9250ConvDefaults(&params, &scale, NULL);
+   mpu9250CalibInit(&cal, &params, config.odrHz / 4);
+
+   /* Every call blocks until samples are available */
+   while(CALIB_WINDOWS > still)
+   {
+      batch.samples = (unsigned long)samples;
+      batch.count = BATCH_LENGTH;
+
+      ret = ioctl(fd, MPU9250_IOC_READ_BATCH, &batch);
+
+      if(0 > ret)
+      {
+         printf("From TestApp: Failed to read a batch from the device, is streaming enabled?\n");
+         close(fd);
+
+         return errno;
+      }
+
+      still = mpu9250CalibAdd(&cal, samples, batch.count);
+
+      if (faces != mpu9250CalibFaces(&cal))
+      {
+         faces = mpu9250CalibFaces(&cal);
+         printf("From TestApp: Faces seen still 0x%02x\n", faces);
+      }
+   }
+
+   mpu9250CalibResult(&cal, &config, &current, &next);
+
+   printf("From TestApp: Gyro offsets (%d, %d, %d) -> (%d, %d, %d)\n",
+          current.gyroOffset[0], current.gyroOffset[1], current.gyroOffset[2],
+          next.gyroOffset[0], next.gyroOffset[1], next.gyroOffset[2]);
+   printf("From TestApp: Accel offsets (%d, %d, %d) -> (%d, %d, %d), scale factors (%u, %u, %u) [1e-6]\n",
+          current.accelOffset[0], current.accelOffset[1], current.accelOffset[2],
+          next.accelOffset[0], next.accelOffset[1], next.accelOffset[2],
+          next.accelGainMicro[0], next.accelGainMicro[1], next.accelGainMicro[2]);
+
+   /* From now on the sensor corrects every sample */
+   if (0 != ioctl(fd, MPU9250_IOC_SET_CALIB, &next))
+   {
+      printf("From TestApp: Failed to write the calibration to the device %s\n", DEVICE_UNDER_TEST);
+      close(fd);
+
+      return errno;
+   }
+
+   if (0 != calib_save(path))
+      printf("From TestApp: Failed to save the calibration to %s\n", path);
+   else
+      printf("From TestApp: Calibration saved to %s\n", path);
+
+   close(fd);
+
+   return 0;
+}
+
 // Public functions
-int main(void)
+int main(int argc, char *argv[])
 {
+   if ((1 < argc) && (0 == strcmp(argv[1], "stream")))
+      return stream_test();
+
+   if ((1 < argc) && (0 == strcmp(argv[1], "batch")))
+      return batch_test();
+
+   if ((1 < argc) && (0 == strcmp(argv[1], "mmap")))
+      return mmap_test();
+
+   if ((1 < argc) && (0 == strcmp(argv[1], "group")))
+      return group_test();
+
+   if ((1 < argc) && (0 == strcmp(argv[1], "filter")))
+      return filter_test((2 < argc) ? (unsigned int)atoi(argv[2]) : FILTER_RATE_HZ);
+
+   if ((1 < argc) && (0 == strcmp(argv[1], "broker")))
+      return broker_test((2 < argc) ? (unsigned int)atoi(argv[2]) : 0);
+
+   if ((1 < argc) && (0 == strcmp(argv[1], "calibrate")))
+      return calib_test((2 < argc) ? argv[2] : CALIB_FILE);
+
    return unit_test();
 }